@@ -0,0 +1,409 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include "config.h"
+#include "dataset.h"
+#include "util.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// thread counts of one invocation
+#define MAX_RUNS    32
+
+typedef enum {
+    MODE_LATENCY,
+    MODE_THROUGHPUT,
+    MODE_COLD
+} Mode;
+
+static const char *ModeNames[] = { "latency", "throughput", "cold" };
+
+typedef struct {
+    const Backend *backend;
+    const char *model_file;
+    const uint8_t *pixels;
+    int count, height, width;
+    int batch, warmup, reps;
+    FILE *json;
+} Bench;
+
+typedef struct {
+    const Bench *bench;
+    void *model;
+    pthread_barrier_t *barrier;
+    int index, threads;
+    // images per call, 1 or the batch
+    int unit;
+    int64_t *latencies;
+    int calls;
+    int *preds;
+    int64_t start, end;
+} Thread;
+
+static int CompareNs(const void *a, const void *b)
+{
+    const int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int ReadAll(const int fd, void *data, const size_t size)
+{
+    // a pipe hands over large writes in pieces
+    for (size_t done = 0; done < size; )
+    {
+        const ssize_t got = read(fd, (char *)data + done, size - done);
+        if (got <= 0)
+            return 0;
+        done += got;
+    }
+    return 1;
+}
+
+static int WriteAll(const int fd, const void *data, const size_t size)
+{
+    for (size_t done = 0; done < size; )
+    {
+        const ssize_t put = write(fd, (const char *)data + done, size - done);
+        if (put <= 0)
+            return 0;
+        done += put;
+    }
+    return 1;
+}
+
+static void Report(
+    const Bench *bench, const Mode mode, const int threads, const int unit,
+    int64_t *samples, const int count, const double images_per_s, const long peak_rss
+)
+{
+    qsort(samples, count, sizeof(int64_t), CompareNs);
+    double mean = 0.0;
+    for (int i = 0; i < count; ++i)
+        mean += samples[i];
+    mean = count > 0 ? mean / count / 1e3 : 0.0;
+    const double p50 = count > 0 ? samples[(count - 1) * 50 / 100] / 1e3 : 0.0;
+    const double p90 = count > 0 ? samples[(count - 1) * 90 / 100] / 1e3 : 0.0;
+    const double p99 = count > 0 ? samples[(count - 1) * 99 / 100] / 1e3 : 0.0;
+    printf(
+        "%s %s, threads %d, batch %d: p50 %.1f us, p90 %.1f us, p99 %.1f us, %.0f images/s, peak RSS %ld KiB\n",
+        bench->backend->name, ModeNames[mode], threads, unit, p50, p90, p99, images_per_s, peak_rss
+    );
+    if (bench->json == NULL)
+        return;
+    fprintf(
+        bench->json,
+        "{\"backend\": \"%s\", \"mode\": \"%s\", \"threads\": %d, \"batch\": %d, "
+        "\"warmup\": %d, \"reps\": %d, \"images\": %d, \"samples\": %d, "
+        "\"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, \"mean_us\": %.3f, "
+        "\"images_per_s\": %.1f, \"peak_rss_kib\": %ld}\n",
+        bench->backend->name, ModeNames[mode], threads, unit,
+        mode == MODE_COLD ? 0 : bench->warmup, bench->reps, bench->count, count,
+        p50, p90, p99, mean, images_per_s, peak_rss
+    );
+    fflush(bench->json);
+}
+
+static void Pass(Thread *thread, void *ctx, int64_t *latencies)
+{
+    // calls of unit images are dealt round robin to the threads
+    const Bench *bench = thread->bench;
+    const size_t in_size = (size_t)bench->height * bench->width;
+    const int calls = (bench->count + thread->unit - 1) / thread->unit;
+    int n = 0;
+    for (int call = thread->index; call < calls; call += thread->threads)
+    {
+        const int image_i = call * thread->unit;
+        const int count = bench->count - image_i < thread->unit ? bench->count - image_i : thread->unit;
+        const int64_t start = NowNs();
+        bench->backend->run(ctx, &bench->pixels[image_i * in_size], count, &thread->preds[image_i]);
+        if (latencies != NULL)
+            latencies[n++] = NowNs() - start;
+    }
+}
+
+static void *ThreadMain(void *arg)
+{
+    // the context is created by the thread that runs it
+    Thread *thread = arg;
+    const Bench *bench = thread->bench;
+    void *ctx = bench->backend->create(thread->model);
+    pthread_barrier_wait(thread->barrier);
+    for (int i = 0; ctx != NULL && i < bench->warmup; ++i)
+        Pass(thread, ctx, NULL);
+    pthread_barrier_wait(thread->barrier);
+    thread->start = NowNs();
+    for (int i = 0; ctx != NULL && i < bench->reps; ++i)
+        Pass(thread, ctx, &thread->latencies[i * thread->calls]);
+    thread->end = NowNs();
+    if (ctx != NULL)
+        bench->backend->destroy(ctx);
+    else
+        thread->calls = -1;
+    return NULL;
+}
+
+static int Measure(const Bench *bench, const Mode mode, const int threads, const int fd)
+{
+    // runs in the child of RunWarm(), writes the number of samples, the
+    // images/s and the samples to fd
+    const int unit = mode == MODE_LATENCY ? 1 : bench->batch;
+    void *model = bench->backend->load(bench->model_file, bench->height, bench->width, unit);
+    if (model == NULL)
+    {
+        printf("Failed to load model\n");
+        return 0;
+    }
+    const int calls = (bench->count + unit - 1) / unit;
+    const int per_thread = (calls + threads - 1) / threads;
+    Thread *list = calloc(threads, sizeof(Thread));
+    int64_t *latencies = malloc((size_t)threads * per_thread * bench->reps * sizeof(int64_t));
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    int *preds = malloc(bench->count * sizeof(int));
+    if (list == NULL || latencies == NULL || ids == NULL || preds == NULL)
+    {
+        printf("Failed to allocate samples\n");
+        exit(1);
+    }
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, threads);
+    int ok = 1;
+    int started = 0;
+    for (int t = 0; ok && t < threads; ++t)
+    {
+        Thread *thread = &list[t];
+        thread->bench = bench;
+        thread->model = model;
+        thread->barrier = &barrier;
+        thread->index = t;
+        thread->threads = threads;
+        thread->unit = unit;
+        thread->calls = (calls - t + threads - 1) / threads;
+        thread->latencies = &latencies[(size_t)t * per_thread * bench->reps];
+        thread->preds = preds;
+        ok = pthread_create(&ids[t], NULL, ThreadMain, thread) == 0;
+        started += ok;
+    }
+    // a thread that could not start would leave the others at the barrier
+    if (started < threads)
+    {
+        printf("Failed to start threads\n");
+        exit(1);
+    }
+    for (int t = 0; t < started; ++t)
+        pthread_join(ids[t], NULL);
+    pthread_barrier_destroy(&barrier);
+
+    int64_t start = INT64_MAX, end = 0;
+    int samples = 0;
+    for (int t = 0; ok && t < threads; ++t)
+    {
+        if (list[t].calls < 0)
+        {
+            printf("Failed to create context\n");
+            ok = 0;
+            break;
+        }
+        start = list[t].start < start ? list[t].start : start;
+        end = list[t].end > end ? list[t].end : end;
+        // packed to the front for the percentiles
+        memmove(&latencies[samples], list[t].latencies, (size_t)list[t].calls * bench->reps * sizeof(int64_t));
+        samples += list[t].calls * bench->reps;
+    }
+    if (ok)
+    {
+        const double images_per_s = (double)bench->count * bench->reps / ((end - start) / 1e9);
+        ok = WriteAll(fd, &samples, sizeof(samples)) && WriteAll(fd, &images_per_s, sizeof(images_per_s)) &&
+            WriteAll(fd, latencies, (size_t)samples * sizeof(int64_t));
+    }
+    free(preds);
+    free(ids);
+    free(latencies);
+    free(list);
+    bench->backend->release(model);
+    return ok;
+}
+
+static int RunWarm(const Bench *bench, const Mode mode, const int threads)
+{
+    // every configuration runs in a fresh child, as RunCold() does, so that
+    // its peak RSS is its own and not the largest of the runs before it
+    fflush(NULL);
+    int fds[2];
+    if (pipe(fds) != 0)
+        return 0;
+    const pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return 0;
+    }
+    if (pid == 0)
+    {
+        close(fds[0]);
+        const int ok = Measure(bench, mode, threads, fds[1]);
+        fflush(stdout);
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    int samples = 0;
+    double images_per_s = 0.0;
+    int64_t *latencies = NULL;
+    int got = ReadAll(fds[0], &samples, sizeof(samples)) && ReadAll(fds[0], &images_per_s, sizeof(images_per_s)) &&
+        samples >= 0 && (latencies = malloc(((size_t)samples + 1) * sizeof(int64_t))) != NULL &&
+        ReadAll(fds[0], latencies, (size_t)samples * sizeof(int64_t));
+    close(fds[0]);
+    int status;
+    struct rusage usage;
+    got = wait4(pid, &status, 0, &usage) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0 && got;
+    if (got)
+        Report(bench, mode, threads, mode == MODE_LATENCY ? 1 : bench->batch, latencies, samples, images_per_s, usage.ru_maxrss);
+    free(latencies);
+    return got;
+}
+
+static int RunCold(const Bench *bench)
+{
+    // a fresh process per repetition, so that nothing of the previous load
+    // but the page cache is left
+    int64_t *samples = malloc(bench->reps * sizeof(int64_t));
+    long peak_rss = 0;
+    int64_t total = 0;
+    fflush(NULL);
+    int ok = samples != NULL;
+    for (int i = 0; ok && i < bench->reps; ++i)
+    {
+        int fds[2];
+        if (pipe(fds) != 0)
+            break;
+        const pid_t pid = fork();
+        if (pid < 0)
+        {
+            close(fds[0]);
+            close(fds[1]);
+            break;
+        }
+        if (pid == 0)
+        {
+            close(fds[0]);
+            const int64_t start = NowNs();
+            int64_t elapsed = -1;
+            int pred;
+            void *model = bench->backend->load(bench->model_file, bench->height, bench->width, 1);
+            void *ctx = model != NULL ? bench->backend->create(model) : NULL;
+            if (ctx != NULL)
+            {
+                bench->backend->run(ctx, bench->pixels, 1, &pred);
+                elapsed = NowNs() - start;
+            }
+            if (write(fds[1], &elapsed, sizeof(elapsed)) != sizeof(elapsed))
+                _exit(1);
+            _exit(0);
+        }
+        close(fds[1]);
+        int64_t elapsed = -1;
+        const int got = read(fds[0], &elapsed, sizeof(elapsed)) == sizeof(elapsed);
+        close(fds[0]);
+        int status;
+        struct rusage usage;
+        wait4(pid, &status, 0, &usage);
+        if (!got || elapsed < 0)
+        {
+            printf("Failed to load model\n");
+            ok = 0;
+            break;
+        }
+        samples[i] = elapsed;
+        total += elapsed;
+        peak_rss = usage.ru_maxrss > peak_rss ? usage.ru_maxrss : peak_rss;
+        // one image per process start, load included
+        if (i == bench->reps - 1)
+            Report(bench, MODE_COLD, 1, 1, samples, bench->reps, bench->reps / (total / 1e9), peak_rss);
+    }
+    free(samples);
+    return ok;
+}
+
+int BenchMain(int argc, char *argv[], const Backend *backend)
+{
+    // get settings
+    if (argc < 3)
+    {
+        printf("Usage: %s model input [latency|throughput|cold|all] [threads,...] [batch] [warmup] [reps] [json]\n", argv[0]);
+        return 0;
+    }
+    const char *modes = argc >= 4 ? argv[3] : "all";
+    const int all = strcmp(modes, "all") == 0;
+    if (!all && strcmp(modes, "latency") != 0 && strcmp(modes, "throughput") != 0 && strcmp(modes, "cold") != 0)
+    {
+        printf("Unknown mode: %s\n", modes);
+        return 1;
+    }
+    int thread_list[MAX_RUNS] = { 1, };
+    int runs = 1;
+    if (argc >= 5)
+    {
+        runs = 0;
+        for (const char *p = argv[4]; *p != '\0' && runs < MAX_RUNS; )
+        {
+            thread_list[runs] = atoi(p);
+            if (thread_list[runs] <= 0)
+            {
+                printf("Bad thread list: %s\n", argv[4]);
+                return 1;
+            }
+            ++runs;
+            p = strchr(p, ',');
+            p = p != NULL ? p + 1 : "";
+        }
+    }
+    Bench bench = { backend, argv[1], NULL, 0, 0, 0, BATCH_SIZE, 2, 5, NULL };
+    if (argc >= 6 && atoi(argv[5]) > 0)
+        bench.batch = atoi(argv[5]);
+    if (argc >= 7 && atoi(argv[6]) >= 0)
+        bench.warmup = atoi(argv[6]);
+    if (argc >= 8 && atoi(argv[7]) > 0)
+        bench.reps = atoi(argv[7]);
+    if (argc >= 9 && (bench.json = fopen(argv[8], "a")) == NULL)
+    {
+        printf("Failed to open %s\n", argv[8]);
+        return 1;
+    }
+
+    // packed datasets carry their dims, text ones are IMG_HEIGHT x IMG_WIDTH
+    DatasetFile dataset = { 0, };
+    if (LoadDataset(argv[2], IMG_HEIGHT, IMG_WIDTH, &dataset) == 0)
+    {
+        printf("Failed to load data\n");
+        return 1;
+    }
+    bench.pixels = dataset.pixels;
+    bench.count = dataset.count;
+    bench.height = dataset.height;
+    bench.width = dataset.width;
+    printf("Backend: %s\n", backend->name);
+    printf("Images: %d of %dx%d\n", bench.count, bench.height, bench.width);
+    printf("Batch: %d, warmup: %d, reps: %d\n", bench.batch, bench.warmup, bench.reps);
+
+    // cold start first, while this process has loaded nothing
+    int ok = 1;
+    if (ok && (all || strcmp(modes, "cold") == 0))
+        ok = RunCold(&bench);
+    for (int mode = MODE_LATENCY; ok && mode <= MODE_THROUGHPUT; ++mode)
+    {
+        if (!all && strcmp(modes, ModeNames[mode]) != 0)
+            continue;
+        for (int r = 0; ok && r < runs; ++r)
+            ok = RunWarm(&bench, (Mode)mode, thread_list[r]);
+    }
+
+    if (bench.json != NULL)
+        fclose(bench.json);
+    FreeDatasetFile(&dataset);
+    return ok ? 0 : 1;
+}
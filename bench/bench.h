@@ -0,0 +1,45 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Benchmark harness shared by the backends. Every backend is its own
+// executable, so that peak RSS and cold start are measured per backend, and
+// runs the same modes over the same uint8 images through this interface,
+// each mode and thread count in a forked child with its own peak RSS:
+//   latency     every thread runs its images one at a time, percentiles are
+//               per image
+//   throughput  every thread runs batches of images, percentiles are per
+//               batch
+//   cold        a forked child loads the model and runs one image, timed
+//               from before the load, once per repetition
+// The backends get one context per thread and run single-threaded inside,
+// the harness owns the threads.
+typedef struct {
+    const char *name;
+    // model shared by the threads, NULL on failure
+    void *(*load)(const char *filename, const int in_h, const int in_w, const int max_batch);
+    void (*release)(void *model);
+    // state of one thread
+    void *(*create)(void *model);
+    void (*destroy)(void *ctx);
+    // classes of count images of in_h x in_w pixels stored back to back
+    void (*run)(void *ctx, const uint8_t *images, const int count, int *preds);
+} Backend;
+
+// usage: name model input [latency|throughput|cold|all] [threads,...] [batch]
+//        [warmup] [reps] [json]
+// prints a summary per mode and thread count and appends one JSON object
+// per line to json, returns the exit code
+int BenchMain(int argc, char *argv[], const Backend *backend);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // BENCH_H_
@@ -0,0 +1,60 @@
+// cnn_const keeps its fixed network in one file, it is built in here
+// without its main()
+#define CNN_CONST_NO_MAIN
+#include "../cnn_const.c"
+#include "bench.h"
+
+static void *Load(const char *filename, const int in_h, const int in_w, const int max_batch)
+{
+    // the weights live in the globals of cnn_const.c
+    if (in_h != IMG_HEIGHT || in_w != IMG_WIDTH || max_batch > MAX_BATCH ||
+        LoadArray(filename, ModelParam, MODEL_SIZE) == 0)
+    {
+        return NULL;
+    }
+    PackModel();
+    return ModelParam;
+}
+
+static void Release(void *model)
+{
+    (void)model;
+}
+
+static void *Create(void *model)
+{
+    (void)model;
+    Workspace *ws = malloc(sizeof(Workspace));
+    if (ws != NULL && AllocWorkspace(ws) == 0)
+    {
+        FreeWorkspace(ws);
+        free(ws);
+        return NULL;
+    }
+    return ws;
+}
+
+static void Destroy(void *ctx)
+{
+    FreeWorkspace(ctx);
+    free(ctx);
+}
+
+static void Run(void *ctx, const uint8_t *images, const int count, int *preds)
+{
+    // normalized like cnn_const's main()
+    Workspace *ws = ctx;
+    for (int j = 0; j < count * IMG_SIZE; ++j)
+        ws->image[j] = images[j] / 255.0f;
+    ws->image[count * IMG_SIZE] = 1.0f;
+    if (count == 1)
+        Reco(ws->image, preds, ws->blob, ws->col);
+    else
+        RecoBatch(ws->image, preds, count, ws->blob, ws->col);
+}
+
+int main(int argc, char *argv[])
+{
+    const Backend backend = { "cnn_const", Load, Release, Create, Destroy, Run };
+    return BenchMain(argc, argv, &backend);
+}
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "net.h"
+#include "bench.h"
+
+// the net is shared, every image gets its own extractor as in cnn_ncnn
+struct NcnnModel {
+    ncnn::Net net;
+    int in_h, in_w;
+};
+
+struct NcnnContext {
+    NcnnModel *model;
+    std::vector<float> image;
+};
+
+static void *Load(const char *filename, const int in_h, const int in_w, const int max_batch)
+{
+    NcnnModel *model = new NcnnModel;
+    model->in_h = in_h;
+    model->in_w = in_w;
+    // one thread inside, the harness owns the threads
+    model->net.opt.num_threads = 1;
+    if (model->net.load_param((std::string(filename) + ".param").c_str()) ||
+        model->net.load_model((std::string(filename) + ".bin").c_str()))
+    {
+        delete model;
+        return NULL;
+    }
+    (void)max_batch;
+    return model;
+}
+
+static void Release(void *model)
+{
+    delete static_cast<NcnnModel *>(model);
+}
+
+static void *Create(void *model)
+{
+    NcnnContext *ctx = new NcnnContext;
+    ctx->model = static_cast<NcnnModel *>(model);
+    ctx->image.resize((size_t)ctx->model->in_h * ctx->model->in_w);
+    return ctx;
+}
+
+static void Destroy(void *ctx)
+{
+    delete static_cast<NcnnContext *>(ctx);
+}
+
+static void Run(void *ctx_ptr, const uint8_t *images, const int count, int *preds)
+{
+    // ncnn runs one image per extractor, a batch is a loop
+    NcnnContext *ctx = static_cast<NcnnContext *>(ctx_ptr);
+    const int in_h = ctx->model->in_h, in_w = ctx->model->in_w;
+    const size_t in_size = (size_t)in_h * in_w;
+    for (int i = 0; i < count; ++i)
+    {
+        // norm
+        for (size_t j = 0; j < in_size; ++j)
+            ctx->image[j] = images[i * in_size + j] / 255.0f;
+
+        ncnn::Mat in(in_w, in_h, ctx->image.data());
+        ncnn::Mat out;
+        // inference
+        ncnn::Extractor ex = ctx->model->net.create_extractor();
+        ex.input("conv2d_2_input", in);
+        ex.extract("dense_3", out);
+        // argmax
+        int pred = 0;
+        for (int j = 1; j < out.w; ++j)
+        {
+            if (out[j] > out[pred])
+                pred = j;
+        }
+        preds[i] = pred;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const Backend backend = { "ncnn", Load, Release, Create, Destroy, Run };
+    return BenchMain(argc, argv, &backend);
+}
@@ -0,0 +1,116 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <onnxruntime_cxx_api.h>
+#include "bench.h"
+
+// the session is shared, Run() is thread-safe, each thread keeps its own
+// input buffer
+struct OrtModel {
+    Ort::Env env{OrtLoggingLevel::ORT_LOGGING_LEVEL_WARNING, "TINY-CNN"};
+    Ort::Session session{nullptr};
+    Ort::MemoryInfo memory_info{nullptr};
+    std::vector<std::string> input_names, output_names;
+    std::vector<const char *> input_names_ptr, output_names_ptr;
+    int in_h, in_w;
+};
+
+struct OrtContext {
+    OrtModel *model;
+    std::vector<float> inputs;
+};
+
+static void *Load(const char *filename, const int in_h, const int in_w, const int max_batch)
+{
+    OrtModel *model = new OrtModel;
+    model->in_h = in_h;
+    model->in_w = in_w;
+    try
+    {
+        // one thread inside, the harness owns the threads
+        Ort::SessionOptions session_options;
+        session_options.SetIntraOpNumThreads(1);
+        session_options.SetInterOpNumThreads(1);
+        session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_EXTENDED);
+        model->session = Ort::Session(model->env, filename, session_options);
+        model->memory_info = Ort::MemoryInfo::CreateCpu(
+            OrtAllocatorType::OrtArenaAllocator, OrtMemType::OrtMemTypeDefault
+        );
+        Ort::AllocatorWithDefaultOptions allocator;
+        auto in_count = model->session.GetInputCount(), out_count = model->session.GetOutputCount();
+        for (size_t i = 0; i < in_count; ++i)
+            model->input_names.emplace_back(model->session.GetInputNameAllocated(i, allocator).get());
+        for (size_t i = 0; i < out_count; ++i)
+            model->output_names.emplace_back(model->session.GetOutputNameAllocated(i, allocator).get());
+    }
+    catch (const Ort::Exception &e)
+    {
+        std::fprintf(stderr, "Failed to load model: %s\n", e.what());
+        delete model;
+        return nullptr;
+    }
+    for (const auto &name : model->input_names)
+        model->input_names_ptr.emplace_back(name.c_str());
+    for (const auto &name : model->output_names)
+        model->output_names_ptr.emplace_back(name.c_str());
+    (void)max_batch;
+    return model;
+}
+
+static void Release(void *model)
+{
+    delete static_cast<OrtModel *>(model);
+}
+
+static void *Create(void *model)
+{
+    return new OrtContext{static_cast<OrtModel *>(model), {}};
+}
+
+static void Destroy(void *ctx)
+{
+    delete static_cast<OrtContext *>(ctx);
+}
+
+static void Run(void *ctx_ptr, const uint8_t *images, const int count, int *preds)
+{
+    OrtContext *ctx = static_cast<OrtContext *>(ctx_ptr);
+    OrtModel *model = ctx->model;
+    const size_t size = (size_t)count * model->in_h * model->in_w;
+    // norm
+    ctx->inputs.resize(size);
+    for (size_t i = 0; i < size; ++i)
+        ctx->inputs[i] = images[i] / 255.0f;
+    std::vector<int64_t> in_shape = {count, model->in_h, model->in_w, 1};
+    Ort::Value input_tensors = Ort::Value::CreateTensor<float>(
+        model->memory_info, ctx->inputs.data(), size, in_shape.data(), in_shape.size());
+    std::vector<Ort::Value> output_tensors = model->session.Run(
+        Ort::RunOptions{nullptr},
+        model->input_names_ptr.data(),
+        &input_tensors,
+        model->input_names_ptr.size(),
+        model->output_names_ptr.data(),
+        model->output_names_ptr.size()
+    );
+    // argmax over the last dim
+    const Ort::Value &out = output_tensors.front();
+    const int classes = (int)out.GetTensorTypeAndShapeInfo().GetShape().back();
+    const float *data = out.GetTensorData<float>();
+    for (int i = 0; i < count; ++i)
+    {
+        const float *ptr = &data[i * classes];
+        int pred = 0;
+        for (int j = 1; j < classes; ++j)
+        {
+            if (ptr[j] > ptr[pred])
+                pred = j;
+        }
+        preds[i] = pred;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const Backend backend = { "ort", Load, Release, Create, Destroy, Run };
+    return BenchMain(argc, argv, &backend);
+}
@@ -0,0 +1,40 @@
+#include "bench.h"
+#include "tinycnn.h"
+
+static void *Load(const char *filename, const int in_h, const int in_w, const int max_batch)
+{
+    tcnn_options options = tcnn_default_options();
+    options.in_h = in_h;
+    options.in_w = in_w;
+    options.max_batch = max_batch;
+    return tcnn_model_load(filename, &options, NULL);
+}
+
+static void Release(void *model)
+{
+    tcnn_model_free(model);
+}
+
+static void *Create(void *model)
+{
+    return tcnn_context_create(model);
+}
+
+static void Destroy(void *ctx)
+{
+    tcnn_context_free(ctx);
+}
+
+static void Run(void *ctx, const uint8_t *images, const int count, int *preds)
+{
+    if (count == 1)
+        preds[0] = tcnn_infer(ctx, images, NULL);
+    else
+        tcnn_infer_batch(ctx, images, count, preds);
+}
+
+int main(int argc, char *argv[])
+{
+    const Backend backend = { "tinycnn", Load, Release, Create, Destroy, Run };
+    return BenchMain(argc, argv, &backend);
+}
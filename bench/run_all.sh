@@ -0,0 +1,24 @@
+#!/bin/sh
+# Runs every backend that was built through the same benchmark modes, from
+# the build directory:
+#   ../bench/run_all.sh [input] [threads,...] [batch] [warmup] [reps] [json]
+# Backends that were not built (ORT and ncnn need their SDKs) are skipped.
+# All results go to one JSON Lines file, one object per backend, mode and
+# thread count.
+INPUT=${1:-../ImageData.txt}
+THREADS=${2:-1,$(nproc)}
+BATCH=${3:-8}
+WARMUP=${4:-2}
+REPS=${5:-5}
+JSON=${6:-bench.json}
+
+: > "$JSON"
+run() {
+    # run exe model, unless exe is missing
+    [ -x "./$1" ] || { echo "Skipping $1, not built"; return; }
+    "./$1" "$2" "$INPUT" all "$THREADS" "$BATCH" "$WARMUP" "$REPS" "$JSON"
+}
+run bench_const ../ModelParam.txt
+run bench_tinycnn ../models/model.tcnn
+run bench_ort ../models/model.onnx
+run bench_ncnn ../models/model
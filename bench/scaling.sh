@@ -0,0 +1,41 @@
+#!/bin/sh
+# Thread scaling of cnn_struct and cnn_const, run from the build directory:
+#   ../bench/scaling.sh [model] [input] [batch] [runs]
+# Prints a markdown table of the best elapsed time of every thread count out
+# of runs, doubling from 1 up to the cpus of the machine. Threads are bound
+# to cores (OMP_PROC_BIND), so every workspace is first touched on the NUMA
+# node it is used on. cnn_const always runs ../ModelParam.txt on
+# ../ImageData.txt, give cnn_struct a bigger packed dataset to load many cores.
+MODEL=${1:-../ModelParam.txt}
+INPUT=${2:-../ImageData.txt}
+BATCH=${3:-8}
+RUNS=${4:-10}
+CPUS=$(nproc)
+
+export OMP_PROC_BIND=close
+export OMP_PLACES=cores
+
+best() {
+    # best of RUNS elapsed times in ms
+    for i in $(seq "$RUNS"); do
+        "$@" | sed -n 's/^Elapsed time: \([0-9.]*\) ms$/\1/p'
+    done | sort -n | head -1
+}
+
+THREADS=1
+LIST=""
+while [ "$THREADS" -lt "$CPUS" ]; do
+    LIST="$LIST $THREADS"
+    THREADS=$((THREADS * 2))
+done
+LIST="$LIST $CPUS"
+
+echo "| Threads | cnn_struct | Speedup | cnn_const | Speedup |"
+echo "| :-----: | :--------: | :-----: | :-------: | :-----: |"
+for T in $LIST; do
+    S=$(best ./cnn_struct "$MODEL" "$INPUT" "$T" "$BATCH")
+    C=$(best ./cnn_const ../ModelParam.txt ../ImageData.txt "$T" "$BATCH")
+    [ -z "$S1" ] && S1=$S && C1=$C
+    awk -v t="$T" -v s="$S" -v s1="$S1" -v c="$C" -v c1="$C1" \
+        'BEGIN { printf "| %d | %.2f ms | %.2fx | %.2f ms | %.2fx |\n", t, s, s1 / s, c, c1 / c }'
+done
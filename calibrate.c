@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <math.h>
+#include "config.h"
+#include "layers.h"
+#include "model.h"
+#include "import.h"
+#include "dataset.h"
+#include "quant.h"
+#include "util.h"
+
+#define DEFAULT_SAMPLES     256
+
+Layer DemoLayers[NUM_LAYER];
+
+int Forward(
+    const Layer *layers, const int num_layers, const uint8_t *image,
+    float *input, float *blob, float *col, float *max_abs
+)
+{
+    // plain fp32 pass over the unfused layers, the reference of the int8 path,
+    // tracks the largest magnitude every layer writes when max_abs is set
+    int top_size = layers[0].in_c * layers[0].in_h * layers[0].in_w;
+    for (int i = 0; i < top_size; ++i)
+        input[i] = image[i] * INPUT_SCALE;
+    float *top = input;
+
+    for (int layer_i = 0; layer_i < num_layers; ++layer_i)
+    {
+        const Layer *layer = &layers[layer_i];
+        const int in_c = layer->in_c, in_h = layer->in_h, in_w = layer->in_w;
+        const int out_c = layer->out_c, out_h = layer->out_h, out_w = layer->out_w;
+        float *bottom = top;
+        if (layer->type == LAYER_CONV)
+        {
+            top = &blob[layer->top_offset];
+            top_size = ConvLayer(
+                bottom, top, in_c, in_h, in_w, out_c, out_h, out_w,
+                layer->weights, layer->packed, NULL, layer->kernel_size, layer->padding, col
+            );
+        }
+        else if (layer->type == LAYER_RELU)
+        {
+            ReLU(top, top_size, layer->alpha);
+        }
+        else if (layer->type == LAYER_MAXPOOL || layer->type == LAYER_AVGPOOL)
+        {
+            top = &blob[layer->top_offset];
+            top_size = PoolingLayer(
+                bottom, top, in_c, in_h, in_w, out_h, out_w, layer->kernel_size,
+                layer->stride, layer->padding, layer->type == LAYER_AVGPOOL
+            );
+        }
+        else if (layer->type == LAYER_FC)
+        {
+            if (layer->flat_offset >= 0)
+            {
+                bottom = &blob[layer->flat_offset];
+                FlattenBatch(top, bottom, 1, in_c, in_h * in_w);
+            }
+            else
+            {
+                bottom[top_size] = 1.0f;
+            }
+            top = &blob[layer->top_offset];
+            top_size = FCLayer(layer->packed, bottom, top, out_c, layer->in_feat + 1);
+        }
+        else
+        {
+            return -1;
+        }
+        for (int i = 0; max_abs != NULL && i < top_size; ++i)
+            max_abs[layer_i] = fabsf(top[i]) > max_abs[layer_i] ? fabsf(top[i]) : max_abs[layer_i];
+    }
+
+    int pred = 0;
+    for (int i = 1; i < top_size; ++i)
+    {
+        if (top[i] > top[pred])
+            pred = i;
+    }
+    return pred;
+}
+
+int main(int argc, char *argv[])
+{
+    // get settings
+    if (argc < 4)
+    {
+        printf("Usage: %s model input model_bin [samples]\n", argv[0]);
+        return 0;
+    }
+    int samples = DEFAULT_SAMPLES;
+    if (argc >= 5 && atoi(argv[4]) > 0)
+        samples = atoi(argv[4]);
+    if (strcmp(argv[1], argv[3]) == 0)
+    {
+        // the input model is mapped while the output is written
+        printf("Output has to differ from the input model\n");
+        return 1;
+    }
+    printf("Model: %s\n", argv[1]);
+    printf("Input: %s\n", argv[2]);
+    printf("Output: %s\n", argv[3]);
+
+    // model, text, binary, ONNX or ncnn
+    ModelFile model_file = { 0, };
+    ImportedModel imported = { 0, };
+    float *model_text = NULL;
+    const float *params = NULL;
+    size_t param_count = 0;
+    Layer *layers = DemoLayers;
+    int num_layers = 0;
+    if (IsModelFile(argv[1]))
+    {
+        if (LoadModelFile(argv[1], &model_file))
+        {
+            params = model_file.params;
+            param_count = model_file.param_count;
+            layers = model_file.layers;
+            num_layers = model_file.num_layers;
+        }
+    }
+    else if (IsImportedFile(argv[1]))
+    {
+        if (LoadImportedModel(argv[1], &imported))
+        {
+            params = imported.params;
+            param_count = imported.param_count;
+            layers = imported.layers;
+            num_layers = imported.num_layers;
+        }
+    }
+    else if ((model_text = LoadTextFloats(argv[1], &param_count)) != NULL)
+    {
+        params = model_text;
+        num_layers = BuildDemoModel(layers, params);
+    }
+
+    // images, packed or text
+    DatasetFile dataset = { 0, };
+    uint8_t *inputs = NULL;
+    const uint8_t *pixels = NULL;
+    int count = 0, height = IMG_HEIGHT, width = IMG_WIDTH;
+    if (IsDatasetFile(argv[2]))
+    {
+        if (LoadDatasetFile(argv[2], &dataset))
+        {
+            pixels = dataset.pixels;
+            count = dataset.count, height = dataset.height, width = dataset.width;
+        }
+    }
+    else
+    {
+        size_t size = 0;
+        inputs = LoadTextPixels(argv[2], &size);
+        pixels = inputs;
+        count = inputs != NULL && size % IMG_SIZE == 0 ? (int)(size / IMG_SIZE) : 0;
+    }
+    if (params == NULL || count == 0)
+    {
+        printf("Failed to load data\n");
+        return 1;
+    }
+
+    ModelShape shape;
+    if (InferShapes(layers, num_layers, 1, height, width, &shape) == 0 ||
+        shape.param_count > param_count || layers[num_layers - 1].type != LAYER_FC)
+    {
+        printf("Failed to build model\n");
+        return 1;
+    }
+    const size_t image_size = (size_t)height * width;
+    float *packed = PackLayers(layers, num_layers);
+    float *input = aligned_alloc(ALIGN_SIZE, AlignFloats(image_size) * sizeof(float));
+    float *blob = aligned_alloc(ALIGN_SIZE, AlignFloats(shape.blob_size) * sizeof(float));
+    float *col = aligned_alloc(ALIGN_SIZE, AlignFloats(shape.col_size + 1) * sizeof(float));
+    float *max_abs = calloc(num_layers, sizeof(float));
+    int *preds = malloc(count * sizeof(int));
+    if (packed == NULL || input == NULL || blob == NULL || col == NULL || max_abs == NULL || preds == NULL)
+    {
+        printf("Failed to allocate workspace\n");
+        return 1;
+    }
+
+    // the scale of every layer output comes from its largest value over an
+    // evenly spread sample of the images
+    samples = samples < count ? samples : count;
+    for (int s = 0; s < samples; ++s)
+    {
+        const size_t image_i = (size_t)s * count / samples;
+        Forward(layers, num_layers, &pixels[image_i * image_size], input, blob, col, max_abs);
+    }
+    for (int i = 0; i < num_layers; ++i)
+        layers[i].act_scale = max_abs[i] > 0.0f ? max_abs[i] / 127.0f : 1.0f;
+    printf("Calibrated on %d images\n", samples);
+
+    // compare against the int8 path on every image, built the way cnn_struct
+    // builds it
+    for (int i = 0; i < count; ++i)
+        preds[i] = Forward(layers, num_layers, &pixels[i * image_size], input, blob, col, NULL);
+    Layer *fused = malloc(num_layers * sizeof(Layer));
+    float *input_weights = NULL;
+    QuantModel quant = { 0, };
+    int ok = fused != NULL;
+    if (ok)
+    {
+        memcpy(fused, layers, num_layers * sizeof(Layer));
+        const int fused_count = FuseLayers(fused, num_layers);
+        ok = InferShapes(fused, fused_count, 1, height, width, &shape) &&
+            (input_weights = aligned_alloc(
+                ALIGN_SIZE, AlignFloats(fused[0].weight_count) * sizeof(float))) != NULL;
+        if (ok)
+        {
+            FoldInputScale(
+                &fused[0], fused[0].filters, fused[0].weight_count / fused[0].filters,
+                INPUT_SCALE, input_weights
+            );
+            ok = QuantizeModel(fused, fused_count, &quant);
+        }
+    }
+    void *workspace = ok ? aligned_alloc(ALIGN_SIZE, quant.workspace_size) : NULL;
+    if (workspace == NULL)
+    {
+        printf("Failed to quantize model\n");
+        return 1;
+    }
+    int differ = 0;
+    for (int i = 0; i < count; ++i)
+        differ += QuantForward(&quant, &pixels[i * image_size], workspace, NULL) != preds[i];
+    printf("Int8: %d of %d predictions differ from fp32\n", differ, count);
+    printf("Weights: %zu bytes int8, %zu bytes fp32\n", quant.weight_bytes, shape.param_count * sizeof(float));
+
+    if (SaveModelFile(argv[3], layers, num_layers, params, param_count) == 0)
+    {
+        printf("Failed to save model\n");
+        return 1;
+    }
+    printf("Saved %d layers with activation scales\n", num_layers);
+
+    free(workspace);
+    FreeQuantModel(&quant);
+    free(input_weights);
+    free(fused);
+    free(preds);
+    free(max_abs);
+    free(col);
+    free(blob);
+    free(input);
+    free(packed);
+    free(inputs);
+    free(model_text);
+    FreeDatasetFile(&dataset);
+    FreeModelFile(&model_file);
+    FreeImportedModel(&imported);
+    return 0;
+}
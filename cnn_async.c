@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "config.h"
+#include "dataset.h"
+#include "tinycnn.h"
+#include "util.h"
+
+// one request per image, submitted as it "arrives"
+typedef struct {
+    int64_t submit_time;
+    int64_t latency;
+    int pred;
+    tcnn_status status;
+} Request;
+
+DatasetFile Dataset = { 0, };
+Request *Requests = NULL;
+// the model file is reloaded every ReloadMs while the stream runs
+const char *ModelFile = NULL;
+int ReloadMs = 0;
+tcnn_handle *Handle = NULL;
+atomic_int Streaming = 1;
+int Reloads = 0;
+int ReloadsFailed = 0;
+
+void Complete(void *user, const int pred, const tcnn_status status)
+{
+    Request *request = user;
+    request->latency = NowNs() - request->submit_time;
+    request->pred = pred;
+    request->status = status;
+}
+
+int CompareLatency(const void *a, const void *b)
+{
+    const int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+void *ReloadMain(void *arg)
+{
+    (void)arg;
+    const struct timespec interval = { ReloadMs / 1000, ReloadMs % 1000 * 1000000 };
+    while (atomic_load(&Streaming))
+    {
+        nanosleep(&interval, NULL);
+        if (tcnn_handle_reload(Handle, ModelFile, NULL) == TCNN_OK)
+            ++Reloads;
+        else
+            ++ReloadsFailed;
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    // get settings
+    if (argc < 3)
+    {
+        printf("Usage: %s model input [threads] [batch] [timeout_us] [rate] [reload_ms]\n", argv[0]);
+        return 0;
+    }
+    tcnn_engine_options engine_options = tcnn_engine_default_options();
+    if (argc >= 4 && atoi(argv[3]) > 0)
+        engine_options.threads = atoi(argv[3]);
+    tcnn_options options = tcnn_default_options();
+    if (argc >= 5 && atoi(argv[4]) > 0)
+        options.max_batch = atoi(argv[4]);
+    const int64_t timeout_us = argc >= 6 ? atoll(argv[5]) : 0;
+    // requests per second, 0 submits them all at once
+    const double rate = argc >= 7 ? atof(argv[6]) : 0.0;
+    ModelFile = argv[1];
+    ReloadMs = argc >= 8 ? atoi(argv[7]) : 0;
+    printf("Model: %s\n", argv[1]);
+    printf("Input: %s\n", argv[2]);
+    printf("Threads: %d\n", engine_options.threads);
+    printf("Batch: %d\n", options.max_batch);
+    printf("Timeout: %lld us\n", (long long)timeout_us);
+    printf("Rate: %.0f/s\n", rate);
+    printf("Reload: %d ms\n", ReloadMs);
+
+    if (LoadDataset(argv[2], IMG_HEIGHT, IMG_WIDTH, &Dataset) == 0)
+    {
+        printf("Failed to load data\n");
+        return 1;
+    }
+    options.in_h = Dataset.height;
+    options.in_w = Dataset.width;
+    tcnn_status status;
+    tcnn_model *model = tcnn_model_load(argv[1], &options, &status);
+    if (model == NULL)
+    {
+        printf("Failed to load model: %s\n", tcnn_status_string(status));
+        return 1;
+    }
+    // the workers follow the handle, so reloads reach them between batches
+    Handle = tcnn_handle_create(model);
+    tcnn_engine *engine = Handle != NULL ? tcnn_handle_engine_create(Handle, &engine_options) : NULL;
+    Requests = calloc(Dataset.count, sizeof(Request));
+    if (engine == NULL || Requests == NULL)
+    {
+        printf("Failed to start engine\n");
+        return 1;
+    }
+    pthread_t reloader;
+    if (ReloadMs > 0 && pthread_create(&reloader, NULL, ReloadMain, NULL) != 0)
+        ReloadMs = 0;
+
+    // images are submitted one by one at the given rate, a full queue is
+    // retried until a worker frees a slot
+    const size_t in_size = (size_t)Dataset.height * Dataset.width;
+    const int64_t start_time = NowNs();
+    for (int i = 0; i < Dataset.count; ++i)
+    {
+        if (rate > 0.0)
+        {
+            const int64_t arrival = start_time + (int64_t)(i * 1e9 / rate);
+            const struct timespec ts = { arrival / 1000000000, arrival % 1000000000 };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+        Requests[i].submit_time = NowNs();
+        while (tcnn_submit(engine, &Dataset.pixels[i * in_size], timeout_us, Complete, &Requests[i]) != TCNN_OK)
+            sched_yield();
+    }
+    // freeing the engine runs what is still queued
+    tcnn_engine_free(engine);
+    printf("Elapsed time: %.2f ms\n", (NowNs() - start_time) / 1e6);
+    if (ReloadMs > 0)
+    {
+        atomic_store(&Streaming, 0);
+        pthread_join(reloader, NULL);
+        printf("Reloads: %d, failed: %d\n", Reloads, ReloadsFailed);
+    }
+
+    // latency of the requests that ran, from submit to callback
+    int64_t *latencies = malloc(Dataset.count * sizeof(int64_t));
+    int ran = 0;
+    for (int i = 0; i < Dataset.count; ++i)
+    {
+        if (Requests[i].status == TCNN_OK)
+            latencies[ran++] = Requests[i].latency;
+    }
+    qsort(latencies, ran, sizeof(int64_t), CompareLatency);
+    if (ran > 0)
+    {
+        printf(
+            "Latency: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+            latencies[ran / 2] / 1e3, latencies[(ran - 1) * 99 / 100] / 1e3, latencies[ran - 1] / 1e3
+        );
+    }
+    printf("Deadline missed: %d\n", Dataset.count - ran);
+
+#ifdef SHOW_RESULTS
+    // show predictions, -1 for requests dropped at their deadline
+    const int per_line = Dataset.count >= 10 ? Dataset.count / 10 : 1;
+    for (int i = 0; i < Dataset.count; ++i)
+    {
+        printf("%d ", Requests[i].pred);
+        if ((i + 1) % per_line == 0)
+            printf("\n");
+    }
+#endif
+
+    free(latencies);
+    free(Requests);
+    tcnn_handle_free(Handle);
+    FreeDatasetFile(&Dataset);
+    return 0;
+}
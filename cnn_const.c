@@ -2,8 +2,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stddef.h>
-#include <cblas.h>
 #include <omp.h>
+#include "gemm.h"
 
 #define IMG_COUNT       1000
 #define IMG_HEIGHT      16
@@ -11,23 +11,31 @@
 #define IMG_SIZE        (IMG_HEIGHT * IMG_WIDTH)
 #define ALIGN_SIZE      64
 #define MODEL_SIZE      11230
-#define MAX_THREADS     4
+#define PACKED_SIZE     12056
 #define BLOB_SIZE       1580
 #define IM2COL_BUF_SIZE 3744
+#define MAX_BATCH       16
+#define BATCH_SIZE      8
+#define BATCH_BLOB_SIZE 1653
 
 float ModelParam[MODEL_SIZE]
     __attribute__((aligned(ALIGN_SIZE))) = { 0.0f, };
-float Blobs[MAX_THREADS * BLOB_SIZE]
+float PackedParam[PACKED_SIZE]
     __attribute__((aligned(ALIGN_SIZE))) = { 0.0f, };
 float Inputs[IMG_COUNT * IMG_SIZE]
     __attribute__((aligned(ALIGN_SIZE))) = { 0.0f, };
-float Images[MAX_THREADS * (IMG_SIZE + 1)]
-    __attribute__((aligned(ALIGN_SIZE))) = { 0.0f, };
-float Im2Col_Buf[MAX_THREADS * IM2COL_BUF_SIZE]
-    __attribute__((aligned(ALIGN_SIZE))) = { 0.0f, };
 int Preds[IMG_COUNT]
     __attribute__((aligned(ALIGN_SIZE))) = { 0, };
 
+// buffers of one thread for a batch of up to MAX_BATCH images
+typedef struct {
+    float *blob;
+    float *image;
+    float *col;
+} Workspace;
+
+Workspace *Workspaces = NULL;
+
 int LoadArray(const char *filename, float *buffer, const size_t size)
 {
     FILE *file = fopen(filename, "r");
@@ -45,16 +53,53 @@ int LoadArray(const char *filename, float *buffer, const size_t size)
     return 1;
 }
 
+float *AllocFloats(const size_t count)
+{
+    // zeroed by the calling thread, whose NUMA node gets the pages
+    const size_t bytes = (count * sizeof(float) + ALIGN_SIZE - 1) / ALIGN_SIZE * ALIGN_SIZE;
+    float *buffer = aligned_alloc(ALIGN_SIZE, bytes);
+    if (buffer != NULL)
+        memset(buffer, 0, bytes);
+    return buffer;
+}
+
+int AllocWorkspace(Workspace *ws)
+{
+    ws->blob = AllocFloats(MAX_BATCH * BATCH_BLOB_SIZE);
+    ws->image = AllocFloats(MAX_BATCH * (IMG_SIZE + 1));
+    ws->col = AllocFloats(MAX_BATCH * IM2COL_BUF_SIZE);
+    return ws->blob != NULL && ws->image != NULL && ws->col != NULL;
+}
+
+void FreeWorkspace(Workspace *ws)
+{
+    free(ws->blob);
+    free(ws->image);
+    free(ws->col);
+}
+
+void PackModel()
+{
+    // rows are output channels or features, padded to whole panels
+    PackPanels(ModelParam, 6, 26, PackedParam);
+    PackPanels(ModelParam + 156, 8, 55, PackedParam + 208);
+    PackPanels(ModelParam + 596, 128, 73, PackedParam + 648);
+    PackPanels(ModelParam + 9940, 10, 129, PackedParam + 9992);
+}
+
 int Im2Col(
-    const float *data_im, float *data_col,
+    const float *data_im, float *data_col, const int batch,
     const int in_c, const int in_h, const int in_w,
     const int out_c, const int out_h, const int out_w,
     const int kernel_size, const int padding, const int stride
 )
 {
+    // images of a batch are placed side by side, the input is laid out as
+    // [in_c][batch][in_h * in_w] and every row of data_col as [batch][out_h * out_w]
     int col_i = 0;
     const int kk = kernel_size * kernel_size;
-    const int data_col_size = kk * in_c * out_h * out_w;
+    const int cols = batch * out_h * out_w;
+    const int data_col_size = kk * in_c * cols;
     for (int ch = 0; ch < in_c; ++ch)
     {
         for (int kh = 0; kh < kernel_size; ++kh)
@@ -62,16 +107,20 @@ int Im2Col(
             for (int kw = 0; kw < kernel_size; ++kw)
             {
                 int row_i = ch * kk + kh * kernel_size + kw;
-                for (int oh = 0; oh < out_h; ++oh)
+                for (int b = 0; b < batch; ++b)
                 {
-                    int ih = oh * stride + kh - padding;
-                    for (int ow = 0; ow < out_w; ++ow)
+                    const float *plane = &data_im[(ch * batch + b) * (in_h * in_w)];
+                    for (int oh = 0; oh < out_h; ++oh)
                     {
-                        int iw = ow * stride + kw - padding;
-                        if (ih >= 0 && ih < in_h && iw >= 0 && iw < in_w)
-                            data_col[row_i * (out_h * out_w) + col_i++] = data_im[ch * (in_h * in_w) + ih * in_w + iw];
-                        else
-                            data_col[row_i * (out_h * out_w) + col_i++] = 0.0f;
+                        int ih = oh * stride + kh - padding;
+                        for (int ow = 0; ow < out_w; ++ow)
+                        {
+                            int iw = ow * stride + kw - padding;
+                            if (ih >= 0 && ih < in_h && iw >= 0 && iw < in_w)
+                                data_col[row_i * cols + col_i++] = plane[ih * in_w + iw];
+                            else
+                                data_col[row_i * cols + col_i++] = 0.0f;
+                        }
                     }
                 }
                 col_i = 0;
@@ -79,29 +128,42 @@ int Im2Col(
         }
     }
     data_col += data_col_size;
-    for (int col = out_h * out_w; col--; *data_col++ = 1.0f);
-    return data_col_size + out_h * out_w;
+    for (int col = cols; col--; *data_col++ = 1.0f);
+    return data_col_size + cols;
+}
+
+int ConvLayerBatch(
+    const float *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *weights, const int kernel_size, const int padding, float *data_col
+)
+{
+    Im2Col(
+        bottom, data_col, batch, in_c, in_h, in_w, out_c, out_h, out_w, kernel_size, padding, 1
+    );
+    // one sgemm for the whole batch, top is laid out as [out_c][batch][out_h * out_w]
+    const int m = out_c;
+    const int n = batch * out_h * out_w;
+    const int k = kernel_size * kernel_size * in_c + 1;
+    GemmPanels(weights, data_col, top, m, n, k, n, n);
+    return m * n;
 }
 
 int ConvLayer(
     const float *bottom, float *top,
     const int in_c, const int in_h, const int in_w,
     const int out_c, const int out_h, const int out_w,
-    const float *weights, const int kernel_size, const int padding
+    const float *weights, const int kernel_size, const int padding, float *data_col
 )
 {
-    const int t_id = omp_get_thread_num();
-    float *data_col = &Im2Col_Buf[t_id * IM2COL_BUF_SIZE];
     Im2Col(
-        bottom, data_col, in_c, in_h, in_w, out_c, out_h, out_w, kernel_size, padding, 1
+        bottom, data_col, 1, in_c, in_h, in_w, out_c, out_h, out_w, kernel_size, padding, 1
     );
     const int m = out_c;
     const int n = out_h * out_w;
     const int k = kernel_size * kernel_size * in_c + 1;
-    cblas_sgemm(
-        CblasRowMajor, CblasNoTrans, CblasNoTrans,
-        m, n, k, 1.0f, weights, k, data_col, n, 0.0f, top, n
-    );
+    GemmPanels(weights, data_col, top, m, n, k, n, n);
     return m * n;
 }
 
@@ -152,15 +214,46 @@ inline int FCLayer(
     int out_feat, int in_feat
 )
 {
-    cblas_sgemv(
-        CblasRowMajor, CblasNoTrans,
-        out_feat, in_feat, 1.0f, Fc1, in_feat,
-        bottom, 1, 0.0f, top, 1
-    );
+    GemvPanels(Fc1, bottom, top, out_feat, in_feat);
     return out_feat;
 }
 
-void Reco(float *image, const int image_i, float *blob)
+int FCLayerBatch(
+    const float *Fc1, const float *bottom, float *top, const int batch,
+    int out_feat, int in_feat
+)
+{
+    // bottom holds one feature row per image, each row of top gets a trailing
+    // 1.0f so that it can feed the next fc layer directly
+    const int ldc = out_feat + 1;
+    GemmPanelsT(Fc1, bottom, top, batch, out_feat, in_feat, ldc);
+    for (int b = 0; b < batch; ++b)
+        top[b * ldc + out_feat] = 1.0f;
+    return batch * ldc;
+}
+
+int FlattenBatch(
+    const float *bottom, float *top, const int batch,
+    const int channels, const int spatial
+)
+{
+    // [channels][batch][spatial] -> [batch][channels * spatial + 1]
+    const int feat = channels * spatial;
+    for (int b = 0; b < batch; ++b)
+    {
+        float *row = &top[b * (feat + 1)];
+        for (int ch = 0; ch < channels; ++ch)
+        {
+            const float *plane = &bottom[(ch * batch + b) * spatial];
+            for (int s = 0; s < spatial; ++s)
+                row[ch * spatial + s] = plane[s];
+        }
+        row[feat] = 1.0f;
+    }
+    return batch * (feat + 1);
+}
+
+void Reco(float *image, int *preds, float *blob, float *col)
 {
     int top_size = 0;
     float *bottom = image;
@@ -172,11 +265,11 @@ void Reco(float *image, const int image_i, float *blob)
 
     memset(blob, 0, BLOB_SIZE * sizeof(float));
 
-    // parse model
-    const float *Conv1 = ModelParam;
-    const float *Conv2 = ModelParam + 156;
-    const float *Fc1 = ModelParam + 596;
-    const float *Fc2 = ModelParam + 9940;
+    // parse model, weights are packed into GEMM panels by PackModel()
+    const float *Conv1 = PackedParam;
+    const float *Conv2 = PackedParam + 208;
+    const float *Fc1 = PackedParam + 648;
+    const float *Fc2 = PackedParam + 9992;
 
     // Conv
     kernel_size = 5, padding = 0;
@@ -186,7 +279,7 @@ void Reco(float *image, const int image_i, float *blob)
     out_w = in_w - kernel_size + 1;
     top_size = ConvLayer(
         bottom, top, in_c, in_h, in_w, out_c, out_h, out_w,
-        Conv1, kernel_size, padding
+        Conv1, kernel_size, padding, col
     );
 
     // ReLU
@@ -214,7 +307,7 @@ void Reco(float *image, const int image_i, float *blob)
     out_w = in_w - kernel_size + 2 * padding + 1;
     top_size = ConvLayer(
         bottom, top, in_c, in_h, in_w, out_c, out_h, out_w,
-        Conv2, kernel_size, padding
+        Conv2, kernel_size, padding, col
     );
 
     // ReLU
@@ -263,23 +356,140 @@ void Reco(float *image, const int image_i, float *blob)
         }
     }
 
-    Preds[image_i] = pred;
+    preds[0] = pred;
 }
 
+void RecoBatch(float *images, int *preds, const int count, float *workspace, float *col)
+{
+    // images are [count][IMG_SIZE], which is the [c][batch][h * w] layout
+    // of a single channel, so every layer runs once for the whole batch
+    int top_size = 0;
+    float *bottom = images;
+    float *top = workspace;
+    int kernel_size;
+    int padding;
+    const float alpha = 0.1f;
+    int in_c, in_h, in_w, out_c, out_h, out_w;
+
+    // parse model, weights are packed into GEMM panels by PackModel()
+    const float *Conv1 = PackedParam;
+    const float *Conv2 = PackedParam + 208;
+    const float *Fc1 = PackedParam + 648;
+    const float *Fc2 = PackedParam + 9992;
+
+    // Conv
+    kernel_size = 5, padding = 0;
+    in_c = 1, in_h = IMG_HEIGHT, in_w = IMG_WIDTH;
+    out_c = 6;
+    out_h = in_h - kernel_size + 1;
+    out_w = in_w - kernel_size + 1;
+    top_size = ConvLayerBatch(
+        bottom, top, count, in_c, in_h, in_w, out_c, out_h, out_w,
+        Conv1, kernel_size, padding, col
+    );
+
+    // ReLU
+    ReLU(top, top_size, alpha);
+
+    // Max Pooling
+    bottom = top;
+    top = &top[top_size];
+    kernel_size = 2;
+    in_c = out_c, in_h = out_h, in_w = out_w;
+    out_h = out_h / kernel_size;
+    out_w = out_w / kernel_size;
+    top_size = MaxPoolingLayer(
+        bottom, top, in_c * count, in_h, in_w, out_c * count, out_h, out_w,
+        kernel_size, kernel_size
+    );
+
+    // Conv
+    bottom = top;
+    top = &top[top_size];
+    kernel_size = 3, padding = 1;
+    in_c = out_c, in_h = out_h, in_w = out_w;
+    out_c = 8;
+    out_h = in_h - kernel_size + 2 * padding + 1;
+    out_w = in_w - kernel_size + 2 * padding + 1;
+    top_size = ConvLayerBatch(
+        bottom, top, count, in_c, in_h, in_w, out_c, out_h, out_w,
+        Conv2, kernel_size, padding, col
+    );
+
+    // ReLU
+    ReLU(top, top_size, alpha);
+
+    // Max Pooling
+    bottom = top;
+    top = &top[top_size];
+    kernel_size = 2;
+    in_c = out_c, in_h = out_h, in_w = out_w;
+    out_h = out_h / kernel_size;
+    out_w = out_w / kernel_size;
+    top_size = MaxPoolingLayer(
+        bottom, top, in_c * count, in_h, in_w, out_c * count, out_h, out_w,
+        kernel_size, kernel_size
+    );
+
+    // Flatten
+    bottom = top;
+    top = &top[top_size];
+    top_size = FlattenBatch(bottom, top, count, out_c, out_h * out_w);
+
+    // FC
+    bottom = top;
+    top = &top[top_size];
+    in_w = out_c * out_h * out_w + 1;
+    out_w = 128;
+    top_size = FCLayerBatch(Fc1, bottom, top, count, out_w, in_w);
+
+    // ReLU
+    ReLU(top, top_size, alpha);
+
+    // FC
+    bottom = top;
+    top = &top[top_size];
+    in_w = out_w + 1;
+    out_w = 10;
+    top_size = FCLayerBatch(Fc2, bottom, top, count, out_w, in_w);
+
+    // argmax, rows of the last fc layer are out_w + 1 wide
+    for (int b = 0; b < count; ++b)
+    {
+        const float *row = &top[b * (out_w + 1)];
+        int pred = 0;
+        float max_value = row[0];
+        for (int i = 1; i < out_w; ++i)
+        {
+            if (row[i] > max_value)
+            {
+                max_value = row[i];
+                pred = i;
+            }
+        }
+        preds[b] = pred;
+    }
+}
+
+#ifndef CNN_CONST_NO_MAIN
 int main(int argc, char *argv[])
 {
     // get settings
     if (argc < 3)
     {
-        printf("Usage: %s model input [threads]\n", argv[0]);
+        printf("Usage: %s model input [threads] [batch]\n", argv[0]);
         return 0;
     }
-    int threads = omp_get_num_procs() > MAX_THREADS ? MAX_THREADS : omp_get_num_procs();
-    if (argc >= 4 && atoi(argv[3]) > 0 && atoi(argv[3]) < MAX_THREADS)
+    int threads = omp_get_num_procs();
+    if (argc >= 4 && atoi(argv[3]) > 0)
         threads = atoi(argv[3]);
+    int batch = BATCH_SIZE;
+    if (argc >= 5 && atoi(argv[4]) > 0 && atoi(argv[4]) <= MAX_BATCH)
+        batch = atoi(argv[4]);
     printf("Model: %s\n", argv[1]);
     printf("Input: %s\n", argv[2]);
     printf("Threads: %d\n", threads);
+    printf("Batch: %d\n", batch);
 
     // load model and input
     if (LoadArray(argv[1], ModelParam, MODEL_SIZE) == 0 ||
@@ -288,20 +498,44 @@ int main(int argc, char *argv[])
         printf("Failed to load data\n");
         return 1;
     }
+    PackModel();
+
+    // every thread allocates its own buffers, so with OMP_PROC_BIND they sit
+    // on the NUMA node of the core that uses them
+    Workspaces = calloc(threads, sizeof(Workspace));
+    int allocated = Workspaces != NULL;
+    if (allocated)
+    {
+        #pragma omp parallel num_threads(threads) reduction(&&:allocated)
+        allocated = AllocWorkspace(&Workspaces[omp_get_thread_num()]);
+    }
+    if (!allocated)
+    {
+        printf("Failed to allocate workspaces\n");
+        return 1;
+    }
 
-    // reco images
+    // reco images, idle threads take the next chunk of batch images
+    const int chunks = (IMG_COUNT + batch - 1) / batch;
     double start_time = omp_get_wtime();
-    #pragma omp parallel for num_threads(threads) schedule(static)
-    for (int i = 0; i < IMG_COUNT; ++i)
+    #pragma omp parallel for num_threads(threads) schedule(dynamic)
+    for (int chunk_i = 0; chunk_i < chunks; ++chunk_i)
     {
         int t_id = omp_get_thread_num();
-        float *image_ptr = &Images[t_id * (IMG_SIZE + 1)];
+        int image_i = chunk_i * batch;
+        int count = IMG_COUNT - image_i < batch ? IMG_COUNT - image_i : batch;
+        float *image_ptr = Workspaces[t_id].image;
+        float *blob = Workspaces[t_id].blob;
+        float *col = Workspaces[t_id].col;
         // norm
-        for (int j = 0; j < IMG_SIZE; ++j)
-            image_ptr[j] = Inputs[i * IMG_SIZE + j] / 255.0f;
-        image_ptr[IMG_SIZE] = 1.0f;
+        for (int j = 0; j < count * IMG_SIZE; ++j)
+            image_ptr[j] = Inputs[image_i * IMG_SIZE + j] / 255.0f;
+        image_ptr[count * IMG_SIZE] = 1.0f;
 
-        Reco(image_ptr, i, &Blobs[t_id * BLOB_SIZE]);
+        if (count == 1)
+            Reco(image_ptr, &Preds[image_i], blob, col);
+        else
+            RecoBatch(image_ptr, &Preds[image_i], count, blob, col);
     }
     printf("Elapsed time: %.2f ms\n", (omp_get_wtime() - start_time) * 1000.0);
 
@@ -315,5 +549,9 @@ int main(int argc, char *argv[])
     }
 #endif
 
+    for (int t = 0; t < threads; ++t)
+        FreeWorkspace(&Workspaces[t]);
+    free(Workspaces);
     return 0;
 }
+#endif  // CNN_CONST_NO_MAIN
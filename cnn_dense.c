@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <time.h>
+#include "config.h"
+#include "dataset.h"
+#include "tinycnn.h"
+#include "util.h"
+
+// images of the dataset per row of the page
+#define DEFAULT_TILES   32
+// unused bytes at the end of every page row, so the page is read with a row
+// stride as a window of a larger frame would be
+#define ROW_SLACK       64
+
+DatasetFile Dataset = { 0, };
+
+int main(int argc, char *argv[])
+{
+    // get settings
+    if (argc < 3)
+    {
+        printf("Usage: %s model input [tiles] [fp32|fp16|bf16|int8]\n", argv[0]);
+        return 0;
+    }
+    int tiles = DEFAULT_TILES;
+    if (argc >= 4 && atoi(argv[3]) > 0)
+        tiles = atoi(argv[3]);
+    const char *precision = argc >= 5 ? argv[4] : "fp32";
+    // names in the order of tcnn_precision
+    const char *names[] = { "fp32", "fp16", "bf16", "int8" };
+    tcnn_options options = tcnn_default_options();
+    options.max_batch = 1;
+    int known = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        if (strcmp(precision, names[i]) == 0)
+        {
+            options.precision = (tcnn_precision)i;
+            known = 1;
+        }
+    }
+    if (!known)
+    {
+        printf("Unknown precision: %s\n", precision);
+        return 1;
+    }
+    printf("Model: %s\n", argv[1]);
+    printf("Input: %s\n", argv[2]);
+    printf("Precision: %s\n", precision);
+
+    if (LoadDataset(argv[2], IMG_HEIGHT, IMG_WIDTH, &Dataset) == 0)
+    {
+        printf("Failed to load data\n");
+        return 1;
+    }
+    options.in_h = Dataset.height;
+    options.in_w = Dataset.width;
+    tcnn_status status;
+    tcnn_model *model = tcnn_model_load(argv[1], &options, &status);
+    if (model == NULL)
+    {
+        printf("Failed to load model: %s\n", tcnn_status_string(status));
+        return 1;
+    }
+
+    // the images tiled into one page, the missing tiles of the last row stay
+    // blank
+    if (tiles > Dataset.count)
+        tiles = Dataset.count;
+    const int grid_rows = (Dataset.count + tiles - 1) / tiles;
+    const int height = grid_rows * Dataset.height, width = tiles * Dataset.width;
+    const size_t stride = (size_t)width + ROW_SLACK;
+    uint8_t *page = calloc((size_t)height * stride, 1);
+    tcnn_dense *dense = tcnn_dense_create(model, height, width);
+    tcnn_context *ctx = tcnn_context_create(model);
+    int rows, cols;
+    const int step = dense != NULL ? tcnn_dense_map_size(dense, height, width, &rows, &cols) : 0;
+    if (page == NULL || dense == NULL || ctx == NULL || step == 0)
+    {
+        printf("Failed to set up dense mode\n");
+        return 1;
+    }
+    for (int i = 0; i < Dataset.count; ++i)
+    {
+        const uint8_t *image = &Dataset.pixels[(size_t)i * Dataset.height * Dataset.width];
+        uint8_t *tile = &page[(size_t)(i / tiles) * Dataset.height * stride + (size_t)(i % tiles) * Dataset.width];
+        for (int y = 0; y < Dataset.height; ++y)
+            memcpy(&tile[y * stride], &image[y * Dataset.width], Dataset.width);
+    }
+    printf("Page: %dx%d, map %dx%d, step %d\n", height, width, rows, cols, step);
+
+    // the whole map in one dense pass, against every window of it cropped
+    // and run on its own
+    const int positions = rows * cols;
+    int *dense_classes = malloc(positions * sizeof(int));
+    float *dense_scores = malloc(positions * sizeof(float));
+    int *crop_classes = malloc(positions * sizeof(int));
+    float *crop_scores = malloc(positions * sizeof(float));
+    uint8_t *window = malloc((size_t)Dataset.height * Dataset.width);
+    tcnn_model_info info;
+    tcnn_model_get_info(model, &info);
+    float *logits = malloc(info.classes * sizeof(float));
+    if (dense_classes == NULL || dense_scores == NULL || crop_classes == NULL || crop_scores == NULL ||
+        window == NULL || logits == NULL)
+    {
+        printf("Failed to allocate maps\n");
+        return 1;
+    }
+    double start_time = NowNs();
+    tcnn_infer_dense(dense, page, height, width, stride, dense_classes, dense_scores);
+    const double dense_time = (NowNs() - start_time) / 1e6;
+    start_time = NowNs();
+    for (int y = 0; y < rows; ++y)
+    {
+        for (int x = 0; x < cols; ++x)
+        {
+            const uint8_t *origin = &page[(size_t)y * step * stride + (size_t)x * step];
+            for (int r = 0; r < Dataset.height; ++r)
+                memcpy(&window[r * Dataset.width], &origin[r * stride], Dataset.width);
+            crop_classes[y * cols + x] = tcnn_infer(ctx, window, logits);
+            crop_scores[y * cols + x] = logits[crop_classes[y * cols + x]];
+        }
+    }
+    const double crop_time = (NowNs() - start_time) / 1e6;
+    printf("Dense: %.2f ms\n", dense_time);
+    printf("Crops: %.2f ms, %.1fx the dense pass\n", crop_time, crop_time / dense_time);
+
+    // the windows differ only where an inner conv pads
+    int agree = 0;
+    for (int i = 0; i < positions; ++i)
+        agree += dense_classes[i] == crop_classes[i];
+    printf(
+        "Agreement: %d of %d positions have the class of their cropped window, %.1f%%\n",
+        agree, positions, 100.0 * agree / positions
+    );
+
+#ifdef SHOW_RESULTS
+    // classes of the positions where a tile starts, the dataset predictions
+    const int per_line = Dataset.count >= 10 ? Dataset.count / 10 : 1;
+    const int tile_step = Dataset.height / step;
+    for (int i = 0; i < Dataset.count; ++i)
+    {
+        const int y = i / tiles * tile_step, x = i % tiles * (Dataset.width / step);
+        printf("%d ", Dataset.height % step == 0 && Dataset.width % step == 0 ? dense_classes[y * cols + x] : -1);
+        if ((i + 1) % per_line == 0)
+            printf("\n");
+    }
+#endif
+
+    free(logits);
+    free(window);
+    free(crop_scores);
+    free(crop_classes);
+    free(dense_scores);
+    free(dense_classes);
+    tcnn_context_free(ctx);
+    tcnn_dense_free(dense);
+    free(page);
+    tcnn_model_free(model);
+    FreeDatasetFile(&Dataset);
+    return 0;
+}
@@ -8,12 +8,9 @@
 #define IMG_WIDTH       16
 #define IMG_SIZE        (IMG_HEIGHT * IMG_WIDTH)
 #define ALIGN_SIZE      64
-#define MAX_THREADS     4
 
 float Inputs[IMG_COUNT * IMG_SIZE]
     __attribute__((aligned(ALIGN_SIZE))) = { 0.0f, };
-float Images[MAX_THREADS * IMG_SIZE]
-    __attribute__((aligned(ALIGN_SIZE))) = { 0.0f, };
 int Preds[IMG_COUNT]
     __attribute__((aligned(ALIGN_SIZE))) = { 0, };
 
@@ -42,8 +39,8 @@ int main(int argc, char *argv[])
         printf("Usage: %s model input [threads]\n", argv[0]);
         return 0;
     }
-    int threads = omp_get_num_procs() > MAX_THREADS ? MAX_THREADS : omp_get_num_procs();
-    if (argc >= 4 && std::stoi(argv[3]) > 0 && std::stoi(argv[3]) < MAX_THREADS)
+    int threads = omp_get_num_procs();
+    if (argc >= 4 && std::stoi(argv[3]) > 0)
         threads = std::stoi(argv[3]);
     printf("Model: %s\n", argv[1]);
     printf("Input: %s\n", argv[2]);
@@ -68,11 +65,11 @@ int main(int argc, char *argv[])
 
     // reco images
     double start_time = omp_get_wtime();
-    #pragma omp parallel for num_threads(threads) schedule(static)
+    #pragma omp parallel for num_threads(threads) schedule(dynamic)
     for (int i = 0; i < IMG_COUNT; ++i)
     {
-        int t_id = omp_get_thread_num();
-        float *image_ptr = &Images[t_id * (IMG_SIZE + 1)];
+        // on the stack of the thread that uses it
+        float image_ptr[IMG_SIZE] __attribute__((aligned(ALIGN_SIZE)));
         // norm
         for (int j = 0; j < IMG_SIZE; ++j)
             image_ptr[j] = Inputs[i * IMG_SIZE + j] / 255.0f;
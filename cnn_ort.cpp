@@ -44,7 +44,7 @@ int main(int argc, char *argv[])
         return 0;
     }
     int threads = omp_get_num_procs();
-    if (argc >= 4 && std::stoi(argv[3]) > 0 && std::stoi(argv[3]) < threads)
+    if (argc >= 4 && std::stoi(argv[3]) > 0)
         threads = std::stoi(argv[3]);
     std::printf("Model: %s\n", argv[1]);
     std::printf("Input: %s\n", argv[2]);
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <omp.h>
+#include "config.h"
+#include "dataset.h"
+#include "tinycnn.h"
+
+// chunks the reader can decode ahead of the workers, memory stays at this
+// many chunks however long the stream runs
+#define RING_SLOTS      4
+#define CHUNK_IMAGES    1024
+
+// one chunk of images in the ring
+typedef struct {
+    uint8_t *pixels;
+    // images in the chunk, 0 at the end of the stream and -1 after an error
+    int count;
+} Slot;
+
+Slot Ring[RING_SLOTS];
+sem_t SlotsFree;
+sem_t SlotsFilled;
+DatasetStream Stream;
+int ChunkImages = CHUNK_IMAGES;
+tcnn_model *Model = NULL;
+tcnn_context **Contexts = NULL;
+int *Preds = NULL;
+
+void *ReadChunks(void *arg)
+{
+    // decodes chunk n + 1 into a free slot while the workers run chunk n, the
+    // last slot it fills holds 0 or -1 and ends the stream
+    (void)arg;
+    for (int chunk_i = 0;; ++chunk_i)
+    {
+        Slot *slot = &Ring[chunk_i % RING_SLOTS];
+        sem_wait(&SlotsFree);
+        slot->count = ReadDatasetStream(&Stream, slot->pixels, ChunkImages);
+        sem_post(&SlotsFilled);
+        if (slot->count <= 0)
+            return NULL;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // get settings
+    if (argc < 3)
+    {
+        printf("Usage: %s model input|- [threads] [batch] [chunk]\n", argv[0]);
+        return 0;
+    }
+    int threads = omp_get_num_procs();
+    if (argc >= 4 && atoi(argv[3]) > 0)
+        threads = atoi(argv[3]);
+    int batch = BATCH_SIZE;
+    if (argc >= 5 && atoi(argv[4]) > 0)
+        batch = atoi(argv[4]);
+    if (argc >= 6 && atoi(argv[5]) > 0)
+        ChunkImages = atoi(argv[5]);
+    // the predictions own stdout, one per line, so the rest goes to stderr
+    fprintf(stderr, "Model: %s\n", argv[1]);
+    fprintf(stderr, "Input: %s\n", argv[2]);
+    fprintf(stderr, "Threads: %d\n", threads);
+    fprintf(stderr, "Batch: %d\n", batch);
+    fprintf(stderr, "Chunk: %d images, %d slots\n", ChunkImages, RING_SLOTS);
+
+    // the input is read as it arrives, a file, a pipe or stdin, and a packed
+    // stream gives the dims of the model
+    FILE *file = strcmp(argv[2], "-") == 0 ? stdin : fopen(argv[2], "rb");
+    if (file == NULL || OpenDatasetStream(file, IMG_HEIGHT, IMG_WIDTH, &Stream) == 0)
+    {
+        fprintf(stderr, "Failed to open data\n");
+        return 1;
+    }
+    tcnn_options options = tcnn_default_options();
+    options.max_batch = batch;
+    options.in_h = Stream.height;
+    options.in_w = Stream.width;
+    tcnn_status status;
+    Model = tcnn_model_load(argv[1], &options, &status);
+    if (Model == NULL)
+    {
+        fprintf(stderr, "Failed to load model: %s\n", tcnn_status_string(status));
+        return 1;
+    }
+    tcnn_model_info info;
+    tcnn_model_get_info(Model, &info);
+    const size_t image_size = (size_t)info.in_h * info.in_w;
+
+    // every worker runs its own context as in cnn_struct, the ring holds the
+    // chunks between the reader and the workers
+    const size_t bytes = (ChunkImages * image_size + ALIGN_SIZE - 1) / ALIGN_SIZE * ALIGN_SIZE;
+    Preds = malloc(ChunkImages * sizeof(int));
+    Contexts = calloc(threads, sizeof(tcnn_context *));
+    int allocated = Preds != NULL && Contexts != NULL;
+    for (int i = 0; i < RING_SLOTS; ++i)
+        allocated = (Ring[i].pixels = aligned_alloc(ALIGN_SIZE, bytes)) != NULL && allocated;
+    if (allocated)
+    {
+        #pragma omp parallel num_threads(threads) reduction(&&:allocated)
+        allocated = (Contexts[omp_get_thread_num()] = tcnn_context_create(Model)) != NULL;
+    }
+    if (!allocated)
+    {
+        fprintf(stderr, "Failed to allocate workspaces\n");
+        return 1;
+    }
+    fprintf(stderr, "Workspace: %zu bytes per thread, %zu bytes of ring\n", info.workspace_bytes, RING_SLOTS * bytes);
+
+    // the reader fills slots in order and the workers drain them in order, a
+    // slot goes back to the reader as soon as its images are inferred
+    sem_init(&SlotsFree, 0, RING_SLOTS);
+    sem_init(&SlotsFilled, 0, 0);
+    pthread_t reader;
+    if (pthread_create(&reader, NULL, ReadChunks, NULL) != 0)
+    {
+        fprintf(stderr, "Failed to start reader\n");
+        return 1;
+    }
+    long long total = 0;
+    int failed = 0;
+    double stalled = 0.0;
+    double start_time = omp_get_wtime();
+    for (int chunk_i = 0;; ++chunk_i)
+    {
+        const double wait_time = omp_get_wtime();
+        sem_wait(&SlotsFilled);
+        stalled += omp_get_wtime() - wait_time;
+        const Slot *slot = &Ring[chunk_i % RING_SLOTS];
+        const int count = slot->count;
+        if (count <= 0)
+        {
+            failed = count < 0;
+            break;
+        }
+        const int batches = (count + batch - 1) / batch;
+        #pragma omp parallel for num_threads(threads) schedule(dynamic)
+        for (int batch_i = 0; batch_i < batches; ++batch_i)
+        {
+            int t_id = omp_get_thread_num();
+            int image_i = batch_i * batch;
+            int size = count - image_i < batch ? count - image_i : batch;
+            tcnn_infer_batch(Contexts[t_id], &slot->pixels[image_i * image_size], size, &Preds[image_i]);
+        }
+        sem_post(&SlotsFree);
+
+        // the predictions of every chunk go out before the next one runs
+        for (int i = 0; i < count; ++i)
+            printf("%d\n", Preds[i]);
+        fflush(stdout);
+        total += count;
+    }
+    pthread_join(reader, NULL);
+    const double elapsed = (omp_get_wtime() - start_time) * 1000.0;
+    if (failed)
+        fprintf(stderr, "Malformed input after %lld images\n", total);
+    fprintf(stderr, "Images: %lld\n", total);
+    fprintf(stderr, "Elapsed time: %.2f ms, %.2f ms waiting for input\n", elapsed, stalled * 1000.0);
+
+    sem_destroy(&SlotsFree);
+    sem_destroy(&SlotsFilled);
+    free(Preds);
+    for (int t = 0; t < threads; ++t)
+        tcnn_context_free(Contexts[t]);
+    free(Contexts);
+    for (int i = 0; i < RING_SLOTS; ++i)
+        free(Ring[i].pixels);
+    tcnn_model_free(Model);
+    if (file != stdin)
+        fclose(file);
+    return failed;
+}
@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+#include "dataset.h"
+
+int main(int argc, char *argv[])
+{
+    // get settings
+    if (argc < 3)
+    {
+        printf("Usage: %s input_txt input_bin\n", argv[0]);
+        return 0;
+    }
+    printf("Input: %s\n", argv[1]);
+    printf("Output: %s\n", argv[2]);
+
+    // any number of IMG_HEIGHT x IMG_WIDTH images
+    size_t size = 0;
+    uint8_t *pixels = LoadTextPixels(argv[1], &size);
+    if (pixels == NULL || size % IMG_SIZE != 0)
+    {
+        printf("Failed to load data\n");
+        free(pixels);
+        return 1;
+    }
+    const int count = (int)(size / IMG_SIZE);
+    if (SaveDatasetFile(argv[2], pixels, count, IMG_HEIGHT, IMG_WIDTH) == 0)
+    {
+        printf("Failed to save data\n");
+        free(pixels);
+        return 1;
+    }
+    printf("Saved %d images of %dx%d\n", count, IMG_HEIGHT, IMG_WIDTH);
+
+    free(pixels);
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include "config.h"
+#include "layers.h"
+#include "model.h"
+#include "import.h"
+#include "dataset.h"
+
+Layer layers[NUM_LAYER]
+    __attribute__((aligned(ALIGN_SIZE))) = { 0.0f, };
+
+int main(int argc, char *argv[])
+{
+    // get settings
+    if (argc < 3)
+    {
+        printf("Usage: %s model_txt|model_onnx|model_param model_bin\n", argv[0]);
+        return 0;
+    }
+    printf("Input: %s\n", argv[1]);
+    printf("Output: %s\n", argv[2]);
+
+    // text params in the layout of the demo graph, or an ONNX or ncnn export
+    // with its own layers
+    size_t param_count = 0;
+    float *params = NULL;
+    Layer *model_layers = layers;
+    int num_layers = 0;
+    int in_h = IMG_HEIGHT, in_w = IMG_WIDTH;
+    ImportedModel imported = { 0, };
+    if (IsImportedFile(argv[1]))
+    {
+        if (LoadImportedModel(argv[1], &imported) == 0)
+        {
+            printf("Failed to import model\n");
+            return 1;
+        }
+        param_count = imported.param_count;
+        model_layers = imported.layers;
+        num_layers = imported.num_layers;
+        if (imported.in_h > 0 && imported.in_w > 0)
+            in_h = imported.in_h, in_w = imported.in_w;
+    }
+    else
+    {
+        params = LoadTextFloats(argv[1], &param_count);
+        if (params == NULL)
+        {
+            printf("Failed to load data\n");
+            return 1;
+        }
+        num_layers = BuildDemoModel(layers, params);
+    }
+
+    // the graph has to consume exactly the params of the file
+    ModelShape shape;
+    if (InferShapes(model_layers, num_layers, 1, in_h, in_w, &shape) == 0 ||
+        shape.param_count != param_count)
+    {
+        printf("Model does not match %zu params\n", param_count);
+        free(params);
+        FreeImportedModel(&imported);
+        return 1;
+    }
+
+    const float *weights = imported.params != NULL ? imported.params : params;
+    if (SaveModelFile(argv[2], model_layers, num_layers, weights, param_count) == 0)
+    {
+        printf("Failed to save model\n");
+        free(params);
+        FreeImportedModel(&imported);
+        return 1;
+    }
+    printf("Saved %d layers, %zu params\n", num_layers, param_count);
+
+    free(params);
+    FreeImportedModel(&imported);
+    return 0;
+}
@@ -1,15 +1,13 @@
 #ifndef CONFIG_H_
 #define CONFIG_H_
 
-#define IMG_COUNT       1000
+// dims of the images in text datasets, packed datasets carry their own
 #define IMG_HEIGHT      16
 #define IMG_WIDTH       16
 #define IMG_SIZE        (IMG_HEIGHT * IMG_WIDTH)
-#define BLOB_SIZE       1580
-#define MODEL_SIZE      11230
+#define INPUT_SCALE     (1.0f / 255.0f)
 #define NUM_LAYER       9
-#define MAX_THREADS     4
 #define ALIGN_SIZE      64
-#define IM2COL_BUF_SIZE 3744
+#define BATCH_SIZE      8
 
-#endif  // CONFIG_H_
\ No newline at end of file
+#endif  // CONFIG_H_
@@ -0,0 +1,646 @@
+#include <string.h>
+#include <stdint.h>
+#include "layers.h"
+#include "config.h"
+#include "simd.h"
+
+#define FORCE_INLINE static inline __attribute__((always_inline))
+// padded inputs up to this many floats are staged on the stack
+#define PAD_BUF_SIZE 2048
+#define PAD_SLACK    8
+// widest conv row the fused conv + relu + maxpool kernel keeps on the stack
+#define ROW_BUF_SIZE 256
+
+// input loads, with u8 set the input holds raw pixels that are widened on the fly
+FORCE_INLINE float LoadF(const void *base, const int i, const int u8)
+{
+    return u8 ? (float)((const uint8_t *)base)[i] : ((const float *)base)[i];
+}
+
+#ifdef SIMD_HAS_V8
+FORCE_INLINE v8f LoadV8(const void *base, const int i, const int u8)
+{
+    return u8 ? V8_LOAD_U8(&((const uint8_t *)base)[i]) : V8_LOAD(&((const float *)base)[i]);
+}
+#endif
+
+#ifdef SIMD_HAS_V4
+FORCE_INLINE v4f LoadV4(const void *base, const int i, const int u8)
+{
+    return u8 ? V4_LOAD_U8(&((const uint8_t *)base)[i]) : V4_LOAD(&((const float *)base)[i]);
+}
+#endif
+
+FORCE_INLINE const void *Offset(const void *base, const int i, const int u8)
+{
+    return (const char *)base + (size_t)i * (u8 ? sizeof(uint8_t) : sizeof(float));
+}
+
+// one output value with the bounds of the input checked for every tap
+FORCE_INLINE float ConvPoint(
+    const float *bottom, const int in_cs, const int in_c, const int in_h, const int in_w,
+    const float *weights, const float bias, const int oh, const int ow,
+    const int kernel_size, const int padding
+)
+{
+    const int kk = kernel_size * kernel_size;
+    float acc = bias;
+    for (int ch = 0; ch < in_c; ++ch)
+    {
+        for (int kh = 0; kh < kernel_size; ++kh)
+        {
+            int ih = oh + kh - padding;
+            if (ih < 0 || ih >= in_h)
+                continue;
+            for (int kw = 0; kw < kernel_size; ++kw)
+            {
+                int iw = ow + kw - padding;
+                if (iw >= 0 && iw < in_w)
+                    acc += bottom[ch * in_cs + ih * in_w + iw] * weights[ch * kk + kh * kernel_size + kw];
+            }
+        }
+    }
+    return acc;
+}
+
+// one output row of one filter, the bias is the trailing weight column
+FORCE_INLINE void ConvRow(
+    const float *bottom, const int in_cs, const int in_c, const int in_h, const int in_w,
+    const float *weights, const int oh, float *top, const int out_w,
+    const int kernel_size, const int padding
+)
+{
+    const int kk = kernel_size * kernel_size;
+    const float bias = weights[kk * in_c];
+    // kernel rows that fall inside the input
+    const int kh_lo = padding - oh > 0 ? padding - oh : 0;
+    const int kh_hi = in_h + padding - oh < kernel_size ? in_h + padding - oh : kernel_size;
+    // output columns whose taps all fall inside the input
+    const int ow_lo = padding < out_w ? padding : out_w;
+    int ow_hi = in_w - kernel_size + padding + 1;
+    ow_hi = ow_hi > out_w ? out_w : ow_hi < ow_lo ? ow_lo : ow_hi;
+
+    int ow = ow_lo;
+#ifdef SIMD_HAS_V8
+    for (; ow + 8 <= ow_hi; ow += 8)
+    {
+        v8f acc = V8_DUP(bias);
+        for (int ch = 0; ch < in_c; ++ch)
+        {
+            for (int kh = kh_lo; kh < kh_hi; ++kh)
+            {
+                const float *in = &bottom[ch * in_cs + (oh + kh - padding) * in_w + ow - padding];
+                const float *w = &weights[ch * kk + kh * kernel_size];
+                for (int kw = 0; kw < kernel_size; ++kw)
+                    acc = V8_FMA(acc, V8_LOAD(&in[kw]), V8_DUP(w[kw]));
+            }
+        }
+        V8_STORE(&top[ow], acc);
+    }
+#endif
+#ifdef SIMD_HAS_V4
+    for (; ow + 4 <= ow_hi; ow += 4)
+    {
+        v4f acc = V4_DUP(bias);
+        for (int ch = 0; ch < in_c; ++ch)
+        {
+            for (int kh = kh_lo; kh < kh_hi; ++kh)
+            {
+                const float *in = &bottom[ch * in_cs + (oh + kh - padding) * in_w + ow - padding];
+                const float *w = &weights[ch * kk + kh * kernel_size];
+                for (int kw = 0; kw < kernel_size; ++kw)
+                    acc = V4_FMA(acc, V4_LOAD(&in[kw]), V4_DUP(w[kw]));
+            }
+        }
+        V4_STORE(&top[ow], acc);
+    }
+#endif
+    for (; ow < ow_hi; ++ow)
+    {
+        top[ow] = ConvPoint(
+            bottom, in_cs, in_c, in_h, in_w, weights, bias, oh, ow, kernel_size, padding
+        );
+    }
+    // padded border columns
+    for (ow = 0; ow < ow_lo; ++ow)
+    {
+        top[ow] = ConvPoint(
+            bottom, in_cs, in_c, in_h, in_w, weights, bias, oh, ow, kernel_size, padding
+        );
+    }
+    for (ow = ow_hi; ow < out_w; ++ow)
+    {
+        top[ow] = ConvPoint(
+            bottom, in_cs, in_c, in_h, in_w, weights, bias, oh, ow, kernel_size, padding
+        );
+    }
+}
+
+// one output row of one filter over an unpadded (or already padded) input.
+// With u8 set, the input is uint8 pixels.
+// With pair set, rows oh and oh + 1 share the weight broadcasts and only their
+// element-wise max is stored. With overrun set, vectors may run past out_w into
+// columns that are computed and dropped, so the input must stay readable for
+// PAD_SLACK floats past its end.
+FORCE_INLINE void ConvRowValid(
+    const void *bottom, const int in_cs, const int in_c, const int in_w,
+    const float *weights, const int oh, float *top, const int out_w,
+    const int kernel_size, const int pair, const int overrun, const int u8
+)
+{
+    const int kk = kernel_size * kernel_size;
+    const float bias = weights[kk * in_c];
+    int ow = 0;
+#ifdef SIMD_HAS_V8
+    for (; overrun ? ow < out_w : ow + 8 <= out_w; ow += 8)
+    {
+        v8f acc0 = V8_DUP(bias);
+        v8f acc1 = acc0;
+        for (int ch = 0; ch < in_c; ++ch)
+        {
+            for (int kh = 0; kh < kernel_size; ++kh)
+            {
+                const int in_i = ch * in_cs + (oh + kh) * in_w + ow;
+                const float *w = &weights[ch * kk + kh * kernel_size];
+                for (int kw = 0; kw < kernel_size; ++kw)
+                {
+                    v8f wv = V8_DUP(w[kw]);
+                    acc0 = V8_FMA(acc0, LoadV8(bottom, in_i + kw, u8), wv);
+                    if (pair)
+                        acc1 = V8_FMA(acc1, LoadV8(bottom, in_i + in_w + kw, u8), wv);
+                }
+            }
+        }
+        if (pair)
+            acc0 = V8_MAX(acc0, acc1);
+        if (ow + 8 <= out_w)
+        {
+            V8_STORE(&top[ow], acc0);
+        }
+        else
+        {
+            float tail[8] __attribute__((aligned(32)));
+            V8_STORE(tail, acc0);
+            for (int i = 0; i < out_w - ow; ++i)
+                top[ow + i] = tail[i];
+        }
+    }
+#endif
+#ifdef SIMD_HAS_V4
+    for (; overrun ? ow < out_w : ow + 4 <= out_w; ow += 4)
+    {
+        v4f acc0 = V4_DUP(bias);
+        v4f acc1 = acc0;
+        for (int ch = 0; ch < in_c; ++ch)
+        {
+            for (int kh = 0; kh < kernel_size; ++kh)
+            {
+                const int in_i = ch * in_cs + (oh + kh) * in_w + ow;
+                const float *w = &weights[ch * kk + kh * kernel_size];
+                for (int kw = 0; kw < kernel_size; ++kw)
+                {
+                    v4f wv = V4_DUP(w[kw]);
+                    acc0 = V4_FMA(acc0, LoadV4(bottom, in_i + kw, u8), wv);
+                    if (pair)
+                        acc1 = V4_FMA(acc1, LoadV4(bottom, in_i + in_w + kw, u8), wv);
+                }
+            }
+        }
+        if (pair)
+            acc0 = V4_MAX(acc0, acc1);
+        if (ow + 4 <= out_w)
+        {
+            V4_STORE(&top[ow], acc0);
+        }
+        else
+        {
+            float tail[4] __attribute__((aligned(16)));
+            V4_STORE(tail, acc0);
+            for (int i = 0; i < out_w - ow; ++i)
+                top[ow + i] = tail[i];
+        }
+    }
+#endif
+    for (; ow < out_w; ++ow)
+    {
+        float acc0 = bias;
+        float acc1 = bias;
+        for (int ch = 0; ch < in_c; ++ch)
+        {
+            for (int kh = 0; kh < kernel_size; ++kh)
+            {
+                const int in_i = ch * in_cs + (oh + kh) * in_w + ow;
+                const float *w = &weights[ch * kk + kh * kernel_size];
+                for (int kw = 0; kw < kernel_size; ++kw)
+                {
+                    acc0 += LoadF(bottom, in_i + kw, u8) * w[kw];
+                    if (pair)
+                        acc1 += LoadF(bottom, in_i + in_w + kw, u8) * w[kw];
+                }
+            }
+        }
+        top[ow] = pair && acc1 > acc0 ? acc1 : acc0;
+    }
+}
+
+// copies the channels of one image into a zero-padded [in_c][ph][pw] tile
+FORCE_INLINE void PadImage(
+    const void *bottom, const int in_cs, const int in_c, const int in_h, const int in_w,
+    float *padded, const int padding, const int u8
+)
+{
+    const int ph = in_h + 2 * padding;
+    const int pw = in_w + 2 * padding;
+    memset(padded, 0, (in_c * ph * pw + PAD_SLACK) * sizeof(float));
+    for (int ch = 0; ch < in_c; ++ch)
+    {
+        for (int ih = 0; ih < in_h; ++ih)
+        {
+            float *dst = &padded[ch * ph * pw + (ih + padding) * pw + padding];
+            if (u8)
+            {
+                for (int iw = 0; iw < in_w; ++iw)
+                    dst[iw] = LoadF(bottom, ch * in_cs + ih * in_w + iw, 1);
+            }
+            else
+            {
+                memcpy(dst, Offset(bottom, ch * in_cs + ih * in_w, 0), in_w * sizeof(float));
+            }
+        }
+    }
+}
+
+FORCE_INLINE int ConvDirect(
+    const void *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *weights, const int kernel_size, const int padding, const int u8
+)
+{
+    // same [c][batch][h * w] layout as the im2col path
+    const int in_size = in_h * in_w;
+    const int out_size = out_h * out_w;
+    const int k = kernel_size * kernel_size * in_c + 1;
+    const int ph = in_h + 2 * padding;
+    const int pw = in_w + 2 * padding;
+    if (padding > 0 && in_c * ph * pw + PAD_SLACK <= PAD_BUF_SIZE)
+    {
+        // a small zero-padded tile turns the borders into plain vector work
+        float padded[PAD_BUF_SIZE] __attribute__((aligned(ALIGN_SIZE)));
+        for (int b = 0; b < batch; ++b)
+        {
+            PadImage(
+                Offset(bottom, b * in_size, u8), batch * in_size, in_c, in_h, in_w,
+                padded, padding, u8
+            );
+            for (int oc = 0; oc < out_c; ++oc)
+            {
+                float *top_ptr = &top[(oc * batch + b) * out_size];
+                for (int oh = 0; oh < out_h; ++oh)
+                {
+                    ConvRowValid(
+                        padded, ph * pw, in_c, pw, &weights[oc * k], oh,
+                        &top_ptr[oh * out_w], out_w, kernel_size, 0, 1, 0
+                    );
+                }
+            }
+        }
+        return out_c * batch * out_size;
+    }
+    for (int oc = 0; oc < out_c; ++oc)
+    {
+        for (int b = 0; b < batch; ++b)
+        {
+            float *top_ptr = &top[(oc * batch + b) * out_size];
+            for (int oh = 0; oh < out_h; ++oh)
+            {
+                if (padding == 0)
+                {
+                    ConvRowValid(
+                        Offset(bottom, b * in_size, u8), batch * in_size, in_c, in_w,
+                        &weights[oc * k], oh, &top_ptr[oh * out_w], out_w, kernel_size, 0, 0, u8
+                    );
+                }
+                else
+                {
+                    ConvRow(
+                        (const float *)bottom + b * in_size, batch * in_size, in_c, in_h, in_w,
+                        &weights[oc * k], oh, &top_ptr[oh * out_w], out_w, kernel_size, padding
+                    );
+                }
+            }
+        }
+    }
+    return out_c * batch * out_size;
+}
+
+FORCE_INLINE int ConvReluPool(
+    const void *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *weights, const int kernel_size, const int padding, const float alpha,
+    const int u8
+)
+{
+    // 2x2/s2 pooling of the conv output, out_h and out_w are the pooled dims.
+    // Leaky relu is monotonic for alpha >= 0, so it is applied once to the max
+    // of each window instead of to all four conv outputs.
+    const int in_size = in_h * in_w;
+    const int out_size = out_h * out_w;
+    const int k = kernel_size * kernel_size * in_c + 1;
+    const int ph = in_h + 2 * padding;
+    const int pw = in_w + 2 * padding;
+    const int conv_w = pw - kernel_size + 1;
+    float padded[PAD_BUF_SIZE] __attribute__((aligned(ALIGN_SIZE)));
+    float row[ROW_BUF_SIZE] __attribute__((aligned(ALIGN_SIZE)));
+    for (int b = 0; b < batch; ++b)
+    {
+        const void *src = Offset(bottom, b * in_size, u8);
+        int src_cs = batch * in_size;
+        int src_u8 = u8;
+        if (padding > 0)
+        {
+            PadImage(src, src_cs, in_c, in_h, in_w, padded, padding, u8);
+            src = padded;
+            src_cs = ph * pw;
+            src_u8 = 0;
+        }
+        for (int oc = 0; oc < out_c; ++oc)
+        {
+            float *top_ptr = &top[(oc * batch + b) * out_size];
+            for (int oy = 0; oy < out_h; ++oy)
+            {
+                // vertical max of conv rows 2 * oy and 2 * oy + 1
+                ConvRowValid(
+                    src, src_cs, in_c, pw, &weights[oc * k], 2 * oy,
+                    row, conv_w, kernel_size, 1, padding > 0, src_u8
+                );
+                for (int ox = 0; ox < out_w; ++ox)
+                {
+                    float max_value = row[2 * ox] > row[2 * ox + 1] ? row[2 * ox] : row[2 * ox + 1];
+                    top_ptr[oy * out_w + ox] = max_value > 0.0f ? max_value : max_value * alpha;
+                }
+            }
+        }
+    }
+    return out_c * batch * out_size;
+}
+
+int ConvDirectSupported(
+    const int in_c, const int in_h, const int in_w,
+    const int kernel_size, const int padding, const int u8
+)
+{
+    // uint8 input has no bounds-checked fallback, padded shapes need the tile
+    const int tile = in_c * (in_h + 2 * padding) * (in_w + 2 * padding) + PAD_SLACK;
+    if (!(kernel_size == 5 && padding == 0) && !(kernel_size == 3 && padding == 1))
+        return 0;
+    return !(u8 && padding > 0 && tile > PAD_BUF_SIZE);
+}
+
+int ConvReluPoolSupported(
+    const int in_c, const int in_h, const int in_w,
+    const int kernel_size, const int padding, const float alpha, const int pool_size
+)
+{
+    const int tile = in_c * (in_h + 2 * padding) * (in_w + 2 * padding) + PAD_SLACK;
+    const int conv_w = in_w + 2 * padding - kernel_size + 1;
+    if (!(kernel_size == 5 && padding == 0) && !(kernel_size == 3 && padding == 1))
+        return 0;
+    return pool_size == 2 && alpha >= 0.0f && conv_w + PAD_SLACK <= ROW_BUF_SIZE &&
+        (padding == 0 || tile <= PAD_BUF_SIZE);
+}
+
+FORCE_INLINE int ConvDirectDispatch(
+    const void *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *weights, const int kernel_size, const int padding, const int u8
+)
+{
+    // kernel size and padding are compile-time constants in each branch so
+    // that the tap loops are fully unrolled
+    if (!ConvDirectSupported(in_c, in_h, in_w, kernel_size, padding, u8))
+        return 0;
+    if (kernel_size == 5 && padding == 0)
+    {
+        return ConvDirect(
+            bottom, top, batch, in_c, in_h, in_w, out_c, out_h, out_w, weights, 5, 0, u8
+        );
+    }
+    if (kernel_size == 3 && padding == 1)
+    {
+        return ConvDirect(
+            bottom, top, batch, in_c, in_h, in_w, out_c, out_h, out_w, weights, 3, 1, u8
+        );
+    }
+    return 0;
+}
+
+FORCE_INLINE int ConvReluPoolDispatch(
+    const void *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *weights, const int kernel_size, const int padding,
+    const float alpha, const int pool_size, const int u8
+)
+{
+    if (!ConvReluPoolSupported(in_c, in_h, in_w, kernel_size, padding, alpha, pool_size))
+        return 0;
+    if (kernel_size == 5 && padding == 0)
+    {
+        return ConvReluPool(
+            bottom, top, batch, in_c, in_h, in_w, out_c, out_h, out_w, weights, 5, 0, alpha, u8
+        );
+    }
+    if (kernel_size == 3 && padding == 1)
+    {
+        return ConvReluPool(
+            bottom, top, batch, in_c, in_h, in_w, out_c, out_h, out_w, weights, 3, 1, alpha, u8
+        );
+    }
+    return 0;
+}
+
+int ConvDirectLayer(
+    const float *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *weights, const int kernel_size, const int padding
+)
+{
+    return ConvDirectDispatch(
+        bottom, top, batch, in_c, in_h, in_w, out_c, out_h, out_w,
+        weights, kernel_size, padding, 0
+    );
+}
+
+int ConvDirectLayerU8(
+    const uint8_t *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *weights, const int kernel_size, const int padding
+)
+{
+    return ConvDirectDispatch(
+        bottom, top, batch, in_c, in_h, in_w, out_c, out_h, out_w,
+        weights, kernel_size, padding, 1
+    );
+}
+
+int ConvReluPoolDirect(
+    const float *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *weights, const int kernel_size, const int padding,
+    const float alpha, const int pool_size
+)
+{
+    return ConvReluPoolDispatch(
+        bottom, top, batch, in_c, in_h, in_w, out_c, out_h, out_w,
+        weights, kernel_size, padding, alpha, pool_size, 0
+    );
+}
+
+int ConvReluPoolDirectU8(
+    const uint8_t *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *weights, const int kernel_size, const int padding,
+    const float alpha, const int pool_size
+)
+{
+    return ConvReluPoolDispatch(
+        bottom, top, batch, in_c, in_h, in_w, out_c, out_h, out_w,
+        weights, kernel_size, padding, alpha, pool_size, 1
+    );
+}
+
+FORCE_INLINE int ConvPlane(
+    const void *bottom, float *top, const int in_cs, const int in_rs,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *weights, const int kernel_size, const int padding,
+    const float alpha, const int pool_size, float *row, const int u8
+)
+{
+    // output row by output row, so that the few input rows under the kernel
+    // stay in cache for every filter of a wide plane
+    const int k = kernel_size * kernel_size * in_c + 1;
+    const int conv_w = in_w + 2 * padding - kernel_size + 1;
+    const int pair = pool_size == 2;
+    const int count = kernel_size + pair;
+    float *rows = &row[2 * conv_w];
+    for (int oy = 0; oy < out_h; ++oy)
+    {
+        // uint8 rows are widened once for all filters rather than on every
+        // load of every tap
+        const void *src = bottom;
+        int src_cs = in_cs, src_rs = in_rs, y0 = pair ? 2 * oy : oy;
+        if (u8)
+        {
+            for (int ch = 0; ch < in_c; ++ch)
+            {
+                for (int r = 0; r < count; ++r)
+                {
+                    const uint8_t *pixels = &((const uint8_t *)bottom)[ch * in_cs + (y0 + r) * in_rs];
+                    float *dst = &rows[(ch * count + r) * in_w];
+                    for (int x = 0; x < in_w; ++x)
+                        dst[x] = pixels[x];
+                }
+            }
+            src = rows, src_cs = count * in_w, src_rs = in_w, y0 = 0;
+        }
+        for (int oc = 0; oc < out_c; ++oc)
+        {
+            const float *w = &weights[oc * k];
+            float *dst = pair ? row : &top[(oc * out_h + oy) * out_w];
+            if (padding == 0)
+            {
+                ConvRowValid(src, src_cs, in_c, src_rs, w, y0, dst, conv_w, kernel_size, pair, 0, 0);
+            }
+            else
+            {
+                // the bounds checks cover the padding, the input is float
+                // with rows in_w apart here
+                ConvRow(bottom, in_cs, in_c, in_h, in_w, w, pair ? 2 * oy : oy, dst, conv_w, kernel_size, padding);
+                if (pair)
+                {
+                    ConvRow(
+                        bottom, in_cs, in_c, in_h, in_w, w, 2 * oy + 1, &row[conv_w], conv_w,
+                        kernel_size, padding
+                    );
+                    for (int x = 0; x < conv_w; ++x)
+                        row[x] = row[conv_w + x] > row[x] ? row[conv_w + x] : row[x];
+                }
+            }
+            if (!pair)
+                continue;
+            float *top_row = &top[(oc * out_h + oy) * out_w];
+            for (int ox = 0; ox < out_w; ++ox)
+            {
+                const float max_value = row[2 * ox] > row[2 * ox + 1] ? row[2 * ox] : row[2 * ox + 1];
+                top_row[ox] = max_value > 0.0f ? max_value : max_value * alpha;
+            }
+        }
+    }
+    return out_c * out_h * out_w;
+}
+
+FORCE_INLINE int ConvPlaneDispatch(
+    const void *bottom, float *top, const int in_cs, const int in_rs,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *weights, const int kernel_size, const int padding,
+    const float alpha, const int pool_size, float *row, const int u8
+)
+{
+    if ((pool_size != 1 && pool_size != 2) || (pool_size == 2 && alpha < 0.0f) || (u8 && padding > 0))
+        return 0;
+    if (kernel_size == 5 && padding == 0)
+    {
+        return ConvPlane(
+            bottom, top, in_cs, in_rs, in_c, in_h, in_w, out_c, out_h, out_w,
+            weights, 5, 0, alpha, pool_size, row, u8
+        );
+    }
+    if (kernel_size == 3 && padding == 1)
+    {
+        return ConvPlane(
+            bottom, top, in_cs, in_rs, in_c, in_h, in_w, out_c, out_h, out_w,
+            weights, 3, 1, alpha, pool_size, row, u8
+        );
+    }
+    return ConvPlane(
+        bottom, top, in_cs, in_rs, in_c, in_h, in_w, out_c, out_h, out_w,
+        weights, kernel_size, padding, alpha, pool_size, row, u8
+    );
+}
+
+int ConvPlaneDirect(
+    const float *bottom, float *top,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *weights, const int kernel_size, const int padding,
+    const float alpha, const int pool_size, float *row
+)
+{
+    return ConvPlaneDispatch(
+        bottom, top, in_h * in_w, in_w, in_c, in_h, in_w, out_c, out_h, out_w,
+        weights, kernel_size, padding, alpha, pool_size, row, 0
+    );
+}
+
+int ConvPlaneDirectU8(
+    const uint8_t *bottom, float *top, const int in_cs, const int in_rs,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *weights, const int kernel_size,
+    const float alpha, const int pool_size, float *row
+)
+{
+    return ConvPlaneDispatch(
+        bottom, top, in_cs, in_rs, in_c, in_h, in_w, out_c, out_h, out_w,
+        weights, kernel_size, 0, alpha, pool_size, row, 1
+    );
+}
@@ -0,0 +1,273 @@
+#include "dataset.h"
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+_Static_assert(sizeof(DatasetHeader) == 32, "DatasetHeader must stay 32 bytes");
+
+int IsDatasetFile(const char *filename)
+{
+    char magic[4];
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+        return 0;
+    size_t read = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    return read == sizeof(magic) && memcmp(magic, DATASET_MAGIC, sizeof(magic)) == 0;
+}
+
+int LoadDatasetFile(const char *filename, DatasetFile *dataset)
+{
+    memset(dataset, 0, sizeof(DatasetFile));
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(DatasetHeader))
+    {
+        close(fd);
+        return 0;
+    }
+    const size_t map_size = (size_t)st.st_size;
+    void *map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+    madvise(map, map_size, MADV_SEQUENTIAL);
+
+    // the count is bounded by the images the map holds, divided rather than
+    // multiplied so that a forged header cannot wrap around
+    const DatasetHeader *header = (const DatasetHeader *)map;
+    const uint64_t record_size = (uint64_t)header->height * header->width;
+    if (memcmp(header->magic, DATASET_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != DATASET_VERSION ||
+        header->height == 0 || header->width == 0 || record_size > INT32_MAX ||
+        header->count > INT32_MAX ||
+        header->count > (map_size - sizeof(DatasetHeader)) / record_size)
+    {
+        munmap(map, map_size);
+        return 0;
+    }
+
+    dataset->map = map;
+    dataset->map_size = map_size;
+    dataset->pixels = (const uint8_t *)&header[1];
+    dataset->count = (int)header->count;
+    dataset->height = (int)header->height;
+    dataset->width = (int)header->width;
+    return 1;
+}
+
+void FreeDatasetFile(DatasetFile *dataset)
+{
+    if (dataset->map != NULL)
+        munmap(dataset->map, dataset->map_size);
+    free(dataset->text);
+    memset(dataset, 0, sizeof(DatasetFile));
+}
+
+int SaveDatasetFile(
+    const char *filename, const uint8_t *pixels,
+    const int count, const int height, const int width
+)
+{
+    DatasetHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DATASET_MAGIC, sizeof(header.magic));
+    header.version = DATASET_VERSION;
+    header.count = (uint32_t)count;
+    header.height = (uint32_t)height;
+    header.width = (uint32_t)width;
+
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL)
+        return 0;
+    const size_t size = (size_t)count * height * width;
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(pixels, 1, size, file) == size;
+    return fclose(file) == 0 && ok;
+}
+
+int OpenDatasetStream(FILE *file, const int height, const int width, DatasetStream *stream)
+{
+    // the magic decides the format, the bytes of a text stream are kept
+    memset(stream, 0, sizeof(DatasetStream));
+    stream->file = file;
+    stream->height = height;
+    stream->width = width;
+    stream->pending_size = (int)fread(stream->pending, 1, sizeof(stream->pending), file);
+    if (stream->pending_size < (int)sizeof(stream->pending) ||
+        memcmp(stream->pending, DATASET_MAGIC, sizeof(stream->pending)) != 0)
+    {
+        return 1;
+    }
+    DatasetHeader header;
+    memcpy(header.magic, stream->pending, sizeof(header.magic));
+    const size_t rest = sizeof(header) - sizeof(header.magic);
+    if (fread((char *)&header + sizeof(header.magic), 1, rest, file) != rest ||
+        header.version != DATASET_VERSION || header.height == 0 || header.width == 0 ||
+        (uint64_t)header.height * header.width > INT32_MAX)
+    {
+        return 0;
+    }
+    stream->packed = 1;
+    stream->height = (int)header.height;
+    stream->width = (int)header.width;
+    stream->remaining = header.count > 0 ? header.count : UINT64_MAX;
+    stream->pending_size = 0;
+    return 1;
+}
+
+static uint8_t ToPixel(const float value)
+{
+    // text values are rounded and clamped to pixels
+    return value <= 0.0f ? 0 : value >= 255.0f ? 255 : (uint8_t)(value + 0.5f);
+}
+
+static int NextChar(DatasetStream *stream)
+{
+    if (stream->pending_pos < stream->pending_size)
+        return (unsigned char)stream->pending[stream->pending_pos++];
+    return getc_unlocked(stream->file);
+}
+
+static int NextValue(DatasetStream *stream, float *value)
+{
+    // 1 for a value, 0 at the end of the stream and -1 for a malformed token
+    int ch;
+    do
+        ch = NextChar(stream);
+    while (ch == ' ' || ch == '\n' || ch == '\r' || ch == '\t');
+    if (ch == EOF)
+        return 0;
+    char token[64];
+    size_t length = 0;
+    while (ch != EOF && ch != ' ' && ch != '\n' && ch != '\r' && ch != '\t')
+    {
+        if (length + 1 >= sizeof(token))
+            return -1;
+        token[length++] = (char)ch;
+        ch = NextChar(stream);
+    }
+    token[length] = '\0';
+    char *end;
+    *value = strtof(token, &end);
+    return *end == '\0' ? 1 : -1;
+}
+
+int ReadDatasetStream(DatasetStream *stream, uint8_t *pixels, const int count)
+{
+    if (stream->failed)
+        return -1;
+    const size_t image_size = (size_t)stream->height * stream->width;
+    if (stream->packed)
+    {
+        const int wanted = (uint64_t)count < stream->remaining ? count : (int)stream->remaining;
+        const size_t bytes = fread(pixels, 1, wanted * image_size, stream->file);
+        const int read = (int)(bytes / image_size);
+        stream->failed = bytes % image_size != 0 || (read < wanted && stream->remaining != UINT64_MAX);
+        if (stream->remaining != UINT64_MAX)
+            stream->remaining -= read;
+        return read > 0 || !stream->failed ? read : -1;
+    }
+
+    for (int image_i = 0; image_i < count; ++image_i)
+    {
+        uint8_t *image = &pixels[image_i * image_size];
+        for (size_t i = 0; i < image_size; ++i)
+        {
+            float value;
+            const int status = NextValue(stream, &value);
+            if (status == 0 && i == 0)
+                return image_i;
+            if (status <= 0)
+            {
+                stream->failed = 1;
+                return image_i > 0 ? image_i : -1;
+            }
+            image[i] = ToPixel(value);
+        }
+    }
+    return count;
+}
+
+static void *LoadText(const char *filename, const int pixels, size_t *size)
+{
+    // one pass through the stream tokenizer, the buffer doubles as it fills
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+        return NULL;
+    DatasetStream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.file = file;
+    const size_t value_size = pixels ? sizeof(uint8_t) : sizeof(float);
+    char *buffer = NULL;
+    size_t capacity = 0;
+    float value;
+    int status;
+    *size = 0;
+    while ((status = NextValue(&stream, &value)) == 1)
+    {
+        if (*size == capacity)
+        {
+            capacity = capacity > 0 ? capacity * 2 : 4096;
+            char *grown = aligned_alloc(ALIGN_SIZE, capacity * value_size);
+            if (grown == NULL)
+            {
+                status = -1;
+                break;
+            }
+            if (buffer != NULL)
+                memcpy(grown, buffer, *size * value_size);
+            free(buffer);
+            buffer = grown;
+        }
+        if (pixels)
+            ((uint8_t *)buffer)[*size] = ToPixel(value);
+        else
+            ((float *)buffer)[*size] = value;
+        ++*size;
+    }
+    fclose(file);
+    if (status < 0 || *size == 0)
+    {
+        free(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+uint8_t *LoadTextPixels(const char *filename, size_t *size)
+{
+    return LoadText(filename, 1, size);
+}
+
+float *LoadTextFloats(const char *filename, size_t *size)
+{
+    return LoadText(filename, 0, size);
+}
+
+int LoadDataset(const char *filename, const int height, const int width, DatasetFile *dataset)
+{
+    if (IsDatasetFile(filename))
+        return LoadDatasetFile(filename, dataset) && dataset->count > 0;
+    memset(dataset, 0, sizeof(DatasetFile));
+    const size_t image_size = (size_t)height * width;
+    size_t size = 0;
+    dataset->text = image_size > 0 ? LoadTextPixels(filename, &size) : NULL;
+    if (dataset->text == NULL || size % image_size != 0 || size / image_size > INT32_MAX)
+    {
+        FreeDatasetFile(dataset);
+        return 0;
+    }
+    dataset->pixels = dataset->text;
+    dataset->count = (int)(size / image_size);
+    dataset->height = height;
+    dataset->width = width;
+    return 1;
+}
@@ -0,0 +1,83 @@
+#ifndef DATASET_H_
+#define DATASET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define DATASET_MAGIC       "TCNI"
+#define DATASET_VERSION     1
+
+// Packed image dataset:
+//   DatasetHeader
+//   uint8_t pixels[count][height][width]
+// The pixels are mapped read-only and fed to the first layer as they are.
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t height;
+    uint32_t width;
+    uint8_t reserved[12];
+} DatasetHeader;
+
+typedef struct {
+    void *map;
+    size_t map_size;
+    // pixels parsed by LoadDataset() from a text file, NULL when mapped
+    uint8_t *text;
+    const uint8_t *pixels;
+    int count;
+    int height;
+    int width;
+} DatasetFile;
+
+int IsDatasetFile(const char *filename);
+
+int LoadDatasetFile(const char *filename, DatasetFile *dataset);
+
+void FreeDatasetFile(DatasetFile *dataset);
+
+int SaveDatasetFile(
+    const char *filename, const uint8_t *pixels,
+    const int count, const int height, const int width
+);
+
+// Incremental reader of a packed or text dataset from any stream, pipes
+// included, for datasets that are too large to load or have no end. A packed
+// stream with a count of 0 runs until the end of the input.
+typedef struct {
+    FILE *file;
+    int packed;
+    int height;
+    int width;
+    // images left in a packed stream
+    uint64_t remaining;
+    // bytes read to tell the formats apart, text is parsed from them first
+    char pending[4];
+    int pending_size, pending_pos;
+    // set once the input turned out malformed
+    int failed;
+} DatasetStream;
+
+// reads the header of a packed stream, text streams hold height x width
+// images, returns 0 for a malformed header
+int OpenDatasetStream(FILE *file, const int height, const int width, DatasetStream *stream);
+
+// reads up to count images into pixels, returns how many, 0 at the end of the
+// stream and -1 for malformed input or a partial last image, the images
+// before it are returned first
+int ReadDatasetStream(DatasetStream *stream, uint8_t *pixels, const int count);
+
+// whitespace separated values of a text file in an ALIGN_SIZE-aligned buffer,
+// NULL for an empty or malformed file, the pixels are rounded and clamped
+// like those of a text stream
+uint8_t *LoadTextPixels(const char *filename, size_t *size);
+
+float *LoadTextFloats(const char *filename, size_t *size);
+
+// a packed dataset is mapped and used in place, a text file holds any number
+// of height x width images and is parsed, returns 0 when there are none
+int LoadDataset(const char *filename, const int height, const int width, DatasetFile *dataset);
+
+#endif  // DATASET_H_
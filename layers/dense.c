@@ -0,0 +1,380 @@
+#include "dense.h"
+#include "config.h"
+#include "sparse.h"
+#include "util.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int IsConv(const Layer *layer)
+{
+    return layer->type == LAYER_CONV || layer->type == LAYER_CONV_RELU_POOL;
+}
+
+static int PoolSize(const Layer *layer)
+{
+    return layer->type == LAYER_CONV_RELU_POOL ? layer->pool_size : 1;
+}
+
+static int ConvDirect(const Layer *layer)
+{
+    // pool sizes the plane kernel fuses, the others pool a full conv plane
+    const int pool_size = PoolSize(layer);
+    return pool_size == 1 || (pool_size == 2 && layer->alpha >= 0.0f);
+}
+
+static int TrunkShapes(Layer *layers, const int trunk, const int in_h, const int in_w)
+{
+    // the dims InferShapes() gives the trunk, for a page
+    int h = in_h, w = in_w;
+    for (int i = 0; i < trunk; ++i)
+    {
+        Layer *layer = &layers[i];
+        layer->in_h = h, layer->in_w = w;
+        if (IsConv(layer))
+        {
+            const int pool_size = PoolSize(layer);
+            const int conv_h = h - layer->kernel_size + 2 * layer->padding + 1;
+            const int conv_w = w - layer->kernel_size + 2 * layer->padding + 1;
+            if (conv_h < pool_size || conv_w < pool_size)
+                return 0;
+            h = conv_h / pool_size, w = conv_w / pool_size;
+        }
+        else if (layer->type == LAYER_MAXPOOL || layer->type == LAYER_AVGPOOL)
+        {
+            h = PoolOutputSize(h, layer->kernel_size, layer->stride, layer->padding, layer->ceil_mode);
+            w = PoolOutputSize(w, layer->kernel_size, layer->stride, layer->padding, layer->ceil_mode);
+            if (h <= 0 || w <= 0)
+                return 0;
+        }
+        layer->out_h = h, layer->out_w = w;
+    }
+    return 1;
+}
+
+int PrepareDense(
+    const Layer *layers, const int num_layers, const HalfModel *half,
+    const int max_h, const int max_w, DenseModel *dense
+)
+{
+    memset(dense, 0, sizeof(DenseModel));
+    int trunk = 0;
+    while (trunk < num_layers && layers[trunk].type != LAYER_FC && layers[trunk].type != LAYER_FC_SPARSE)
+        ++trunk;
+    if (trunk == 0 || trunk == num_layers || !IsConv(&layers[0]) || layers[0].in_c != 1 ||
+        max_h < layers[0].in_h || max_w < layers[0].in_w)
+    {
+        return 0;
+    }
+    // the head is fc and relu only, the trunk has no fc
+    for (int i = trunk + 1; i < num_layers; ++i)
+    {
+        if (layers[i].type != LAYER_FC && layers[i].type != LAYER_FC_SPARSE && layers[i].type != LAYER_RELU)
+            return 0;
+    }
+
+    dense->layers = malloc(num_layers * sizeof(Layer));
+    if (dense->layers == NULL)
+        return 0;
+    memcpy(dense->layers, layers, num_layers * sizeof(Layer));
+    dense->num_layers = num_layers;
+    dense->trunk = trunk;
+    dense->half = half != NULL && half->storage != NULL ? half : NULL;
+    dense->in_h = layers[0].in_h, dense->in_w = layers[0].in_w;
+    dense->fc_h = layers[trunk].in_h, dense->fc_w = layers[trunk].in_w;
+    dense->classes = layers[num_layers - 1].out_c;
+    dense->max_h = max_h, dense->max_w = max_w;
+    dense->step = 1;
+    for (int i = 0; i < trunk; ++i)
+    {
+        if (layers[i].type == LAYER_MAXPOOL || layers[i].type == LAYER_AVGPOOL)
+            dense->step *= layers[i].stride;
+        else
+            dense->step *= PoolSize(&layers[i]);
+    }
+    if (TrunkShapes(dense->layers, trunk, max_h, max_w) == 0)
+    {
+        FreeDenseModel(dense);
+        return 0;
+    }
+
+    // every part is sized for the largest page, the dims only grow with it
+    for (int i = 0; i < trunk; ++i)
+    {
+        const Layer *layer = &dense->layers[i];
+        const size_t out_size = (size_t)layer->out_c * layer->out_h * layer->out_w;
+        size_t conv_size = out_size;
+        if (out_size > dense->act_size)
+            dense->act_size = out_size;
+        if (IsConv(layer))
+        {
+            const int conv_h = layer->in_h - layer->kernel_size + 2 * layer->padding + 1;
+            const int conv_w = layer->in_w - layer->kernel_size + 2 * layer->padding + 1;
+            conv_size = (size_t)layer->out_c * conv_h * conv_w;
+            size_t row_size = 2 * (size_t)conv_w;
+            if (i == 0)
+                row_size += (size_t)(layer->kernel_size + PoolSize(layer)) * layer->in_c * layer->in_w;
+            if (row_size > dense->row_size)
+                dense->row_size = row_size;
+            if (!ConvDirect(layer) && conv_size > dense->conv_size)
+                dense->conv_size = conv_size;
+            // the pixels are read in place unless they need padding or a
+            // float kernel
+            if (i == 0 && (layer->padding > 0 || !ConvDirect(layer)))
+                dense->image_size = (size_t)max_h * max_w;
+            if (dense->half != NULL && (size_t)layer->weight_count > dense->weights_size)
+                dense->weights_size = layer->weight_count;
+        }
+        // the kernels index the planes with int
+        if (conv_size > INT_MAX)
+        {
+            FreeDenseModel(dense);
+            return 0;
+        }
+    }
+    int width = 0;
+    for (int i = trunk; i < num_layers; ++i)
+    {
+        if (layers[i].type != LAYER_RELU && layers[i].out_feat + 1 > width)
+            width = layers[i].out_feat + 1;
+    }
+    dense->act_size = AlignFloats(dense->act_size);
+    dense->image_size = AlignFloats(dense->image_size);
+    dense->conv_size = AlignFloats(dense->conv_size);
+    dense->row_size = AlignFloats(dense->row_size);
+    dense->weights_size = AlignFloats(dense->weights_size);
+    dense->head_size = AlignFloats((size_t)DENSE_CHUNK * (layers[trunk].in_feat + 1)) +
+        2 * AlignFloats((size_t)DENSE_CHUNK * width);
+    return 1;
+}
+
+void FreeDenseModel(DenseModel *dense)
+{
+    free(dense->layers);
+    memset(dense, 0, sizeof(DenseModel));
+}
+
+size_t DenseWorkspaceSize(const DenseModel *dense)
+{
+    return 2 * dense->act_size + dense->image_size + dense->conv_size + dense->row_size +
+        dense->weights_size + dense->head_size;
+}
+
+int DenseMapSize(DenseModel *dense, const int height, const int width, int *rows, int *cols)
+{
+    // a position needs the whole window inside the page and the whole fc
+    // kernel inside the trunk output, which ceil-mode pooling can make differ
+    *rows = 0, *cols = 0;
+    if (height > dense->max_h || width > dense->max_w || height < dense->in_h || width < dense->in_w ||
+        TrunkShapes(dense->layers, dense->trunk, height, width) == 0)
+    {
+        return 0;
+    }
+    const Layer *last = &dense->layers[dense->trunk - 1];
+    *rows = (height - dense->in_h) / dense->step + 1;
+    *cols = (width - dense->in_w) / dense->step + 1;
+    if (last->out_h - dense->fc_h + 1 < *rows)
+        *rows = last->out_h - dense->fc_h + 1;
+    if (last->out_w - dense->fc_w + 1 < *cols)
+        *cols = last->out_w - dense->fc_w + 1;
+    return *rows > 0 && *cols > 0;
+}
+
+static const float *ConvWeights(const DenseModel *dense, const int layer_i, float *widened)
+{
+    const Layer *layer = &dense->layers[layer_i];
+    if (dense->half == NULL)
+        return layer->weights;
+    WidenHalf(dense->half->weights[layer_i], widened, layer->weight_count, dense->half->format);
+    return widened;
+}
+
+static void TrunkConv(
+    const DenseModel *dense, const int layer_i, const float *bottom, float *top,
+    const uint8_t *page, const size_t stride, float *image, float *conv, float *row, float *widened
+)
+{
+    // bottom is NULL for the first layer, which reads the page
+    const Layer *layer = &dense->layers[layer_i];
+    const float *weights = ConvWeights(dense, layer_i, widened);
+    const int in_c = layer->in_c, in_h = layer->in_h, in_w = layer->in_w;
+    const int out_c = layer->out_c, out_h = layer->out_h, out_w = layer->out_w;
+    const int kernel_size = layer->kernel_size, padding = layer->padding;
+    const int pool_size = PoolSize(layer);
+    if (bottom == NULL)
+    {
+        if (padding == 0 && ConvDirect(layer))
+        {
+            ConvPlaneDirectU8(
+                page, top, in_h * (int)stride, (int)stride, in_c, in_h, in_w, out_c, out_h, out_w,
+                weights, kernel_size, layer->alpha, pool_size, row
+            );
+            return;
+        }
+        for (int y = 0; y < in_h; ++y)
+        {
+            for (int x = 0; x < in_w; ++x)
+                image[y * in_w + x] = page[y * stride + x];
+        }
+        bottom = image;
+    }
+    if (ConvDirect(layer))
+    {
+        ConvPlaneDirect(
+            bottom, top, in_c, in_h, in_w, out_c, out_h, out_w,
+            weights, kernel_size, padding, layer->alpha, pool_size, row
+        );
+        return;
+    }
+    // other pool sizes run the conv at full resolution first
+    const int conv_h = in_h - kernel_size + 2 * padding + 1;
+    const int conv_w = in_w - kernel_size + 2 * padding + 1;
+    const int conv_size = ConvPlaneDirect(
+        bottom, conv, in_c, in_h, in_w, out_c, conv_h, conv_w,
+        weights, kernel_size, padding, 0.0f, 1, row
+    );
+    ReLU(conv, conv_size, layer->alpha);
+    PoolingLayer(conv, top, out_c, conv_h, conv_w, out_h, out_w, pool_size, pool_size, 0, 0);
+}
+
+static int Argmax(const float *row, const int classes)
+{
+    int pred = 0;
+    for (int i = 1; i < classes; ++i)
+    {
+        if (row[i] > row[pred])
+            pred = i;
+    }
+    return pred;
+}
+
+static void RunHead(
+    const DenseModel *dense, const float *map, const int map_h, const int map_w,
+    const int y, const int x0, const int count, float *head, int *classes, float *scores
+)
+{
+    // positions (y, x0) .. (y, x0 + count - 1) as one batch, the window of a
+    // position under the first fc kernel is its flattened input row
+    const Layer *fc = &dense->layers[dense->trunk];
+    const int in_c = fc->in_c, fc_h = dense->fc_h, fc_w = dense->fc_w;
+    const int feat = fc->in_feat;
+    float *bottom = head;
+    for (int b = 0; b < count; ++b)
+    {
+        float *row = &bottom[b * (feat + 1)];
+        for (int ch = 0; ch < in_c; ++ch)
+        {
+            for (int ky = 0; ky < fc_h; ++ky)
+            {
+                memcpy(
+                    &row[(ch * fc_h + ky) * fc_w], &map[((size_t)ch * map_h + y + ky) * map_w + x0 + b],
+                    fc_w * sizeof(float)
+                );
+            }
+        }
+        row[feat] = 1.0f;
+    }
+
+    // rows of the fc layers carry the trailing 1.0f as in RecoBatch()
+    float *buffers[2];
+    buffers[0] = &head[AlignFloats((size_t)DENSE_CHUNK * (feat + 1))];
+    buffers[1] = &buffers[0][(dense->head_size - (buffers[0] - head)) / 2];
+    int top_size = 0;
+    for (int i = dense->trunk; i < dense->num_layers; ++i)
+    {
+        const Layer *layer = &dense->layers[i];
+        if (layer->type == LAYER_RELU)
+        {
+            ReLU(bottom, top_size, layer->alpha);
+            continue;
+        }
+        float *top = bottom == buffers[0] ? buffers[1] : buffers[0];
+        if (layer->sparse != NULL)
+        {
+            top_size = SparseFCLayerBatch(
+                layer->sparse, bottom, top, count, layer->out_feat, layer->in_feat + 1
+            );
+        }
+        else if (dense->half != NULL)
+        {
+            top_size = HalfFCLayerBatch(
+                dense->half->weights[i], dense->half->format, bottom, top, count,
+                layer->out_feat, layer->in_feat + 1
+            );
+        }
+        else
+        {
+            top_size = FCLayerBatch(layer->packed, bottom, top, count, layer->out_feat, layer->in_feat + 1);
+        }
+        bottom = top;
+    }
+    for (int b = 0; b < count; ++b)
+    {
+        const float *logits = &bottom[b * (dense->classes + 1)];
+        const int pred = Argmax(logits, dense->classes);
+        if (classes != NULL)
+            classes[x0 + b] = pred;
+        if (scores != NULL)
+            scores[x0 + b] = logits[pred];
+    }
+}
+
+int DenseForward(
+    DenseModel *dense, const uint8_t *page, const int height, const int width, const size_t stride,
+    float *workspace, int *classes, float *scores
+)
+{
+    int rows, cols;
+    if (stride < (size_t)width || (size_t)height * stride > INT_MAX ||
+        DenseMapSize(dense, height, width, &rows, &cols) == 0)
+    {
+        return 0;
+    }
+    float *act[2] = { workspace, &workspace[dense->act_size] };
+    float *image = &act[1][dense->act_size];
+    float *conv = &image[dense->image_size];
+    float *row = &conv[dense->conv_size];
+    float *widened = &row[dense->row_size];
+    float *head = &widened[dense->weights_size];
+
+    // trunk, relu in place and the other layers between the two buffers
+    float *top = NULL;
+    int top_size = 0;
+    for (int i = 0; i < dense->trunk; ++i)
+    {
+        const Layer *layer = &dense->layers[i];
+        if (layer->type == LAYER_RELU)
+        {
+            ReLU(top, top_size, layer->alpha);
+            continue;
+        }
+        const float *bottom = top;
+        top = top == act[0] ? act[1] : act[0];
+        top_size = layer->out_c * layer->out_h * layer->out_w;
+        if (IsConv(layer))
+        {
+            TrunkConv(dense, i, bottom, top, page, stride, image, conv, row, widened);
+        }
+        else
+        {
+            PoolingLayer(
+                bottom, top, layer->in_c, layer->in_h, layer->in_w, layer->out_h, layer->out_w,
+                layer->kernel_size, layer->stride, layer->padding, layer->type == LAYER_AVGPOOL
+            );
+        }
+    }
+
+    // head, one row of positions at a time
+    const Layer *last = &dense->layers[dense->trunk - 1];
+    for (int y = 0; y < rows; ++y)
+    {
+        for (int x0 = 0; x0 < cols; x0 += DENSE_CHUNK)
+        {
+            RunHead(
+                dense, top, last->out_h, last->out_w, y, x0, cols - x0 < DENSE_CHUNK ? cols - x0 : DENSE_CHUNK,
+                head, classes != NULL ? &classes[y * cols] : NULL, scores != NULL ? &scores[y * cols] : NULL
+            );
+        }
+    }
+    return 1;
+}
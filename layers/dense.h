@@ -0,0 +1,65 @@
+#ifndef DENSE_H_
+#define DENSE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "layers.h"
+#include "half.h"
+
+// Dense mode over whole pages. The layers before the first fc layer, the
+// trunk, run once over the page, and the fc layers, the head, see every
+// in_h x in_w window of it as one position of a map: the first fc layer is a
+// convolution over the trunk output with a kernel of its input dims, the
+// later ones are 1x1 convolutions. Overlapping windows share all of the trunk
+// work. A window that meets the padding of an inner conv sees the pixels of
+// its neighbours there instead of zeros, which is the one difference to
+// running the window cropped.
+
+// positions the head runs as one fc batch
+#define DENSE_CHUNK     64
+
+typedef struct {
+    // copy of the model's layers, the trunk dims follow the page
+    Layer *layers;
+    int num_layers;
+    // layers before the first fc layer
+    int trunk;
+    // NULL for fp32 weights
+    const HalfModel *half;
+    // dims of a window, and of the input of the first fc layer for it
+    int in_h, in_w;
+    int fc_h, fc_w;
+    // pixels between neighbouring positions
+    int step;
+    int classes;
+    int max_h, max_w;
+    // floats of every part of the workspace for the largest page
+    size_t act_size, image_size, conv_size, row_size, weights_size, head_size;
+} DenseModel;
+
+// takes the layers as BuildModel() left them for in_h x in_w windows and
+// sizes the workspace for pages of up to max_h x max_w, returns 0 for a
+// model without fc head or a page smaller than one window
+int PrepareDense(
+    const Layer *layers, const int num_layers, const HalfModel *half,
+    const int max_h, const int max_w, DenseModel *dense
+);
+
+void FreeDenseModel(DenseModel *dense);
+
+// floats of the workspace DenseForward() runs in
+size_t DenseWorkspaceSize(const DenseModel *dense);
+
+// positions of the map of a height x width page, returns 0 when the page is
+// larger than the workspace or no window fits
+int DenseMapSize(DenseModel *dense, const int height, const int width, int *rows, int *cols);
+
+// runs a page whose rows are stride bytes apart and writes the class and its
+// logit for every position of the map, row-major, either may be NULL,
+// returns 0 when DenseMapSize() does
+int DenseForward(
+    DenseModel *dense, const uint8_t *page, const int height, const int width, const size_t stride,
+    float *workspace, int *classes, float *scores
+);
+
+#endif  // DENSE_H_
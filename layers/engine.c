@@ -0,0 +1,454 @@
+#define _GNU_SOURCE
+#include "tinycnn.h"
+#include "config.h"
+#include "util.h"
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_LINE      64
+// per-image cost a worker assumes before it has timed a batch, in ns
+#define INITIAL_COST    20000
+
+typedef struct {
+    const uint8_t *image;
+    // CLOCK_MONOTONIC in ns, 0 for none
+    int64_t deadline;
+    tcnn_callback callback;
+    void *user;
+} Job;
+
+typedef struct {
+    atomic_size_t seq;
+    Job job;
+} Slot;
+
+typedef struct {
+    tcnn_engine *engine;
+    int index;
+    pthread_t thread;
+    // set once the worker has its buffers
+    int ready;
+    tcnn_context *ctx;
+    // requests of a batch copied back to back for tcnn_infer_batch()
+    uint8_t *staging;
+    Job *jobs;
+    int *preds;
+    // moving average of the time one image of a batch takes, in ns
+    int64_t cost;
+} Worker;
+
+struct tcnn_engine {
+    // bounded MPMC queue after Vyukov, every slot carries the position it is
+    // free for (seq == pos) or filled at (seq == pos + 1), so producers and
+    // consumers only contend on their own end
+    _Alignas(CACHE_LINE) atomic_size_t head;
+    _Alignas(CACHE_LINE) atomic_size_t tail;
+    _Alignas(CACHE_LINE) Slot *slots;
+    size_t mask;
+    // one token per queued request, idle workers sleep on it
+    sem_t ready;
+    // submits in flight, the stop tokens wait for them, and a submit that
+    // sees stopping is rejected
+    atomic_int stopping;
+    atomic_int submitting;
+    // workers run model, or follow handle when it is set
+    const tcnn_model *model;
+    tcnn_handle *handle;
+    tcnn_model_info info;
+    int pin;
+    // position of worker 0 among the allowed cpus
+    int first_cpu;
+    Worker *workers;
+    int threads;
+    int started;
+    // posted by every worker once it has set itself up
+    sem_t setup;
+};
+
+struct tcnn_future {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int done;
+    int pred;
+    tcnn_status status;
+};
+
+static int Push(tcnn_engine *engine, const Job *job)
+{
+    size_t pos = atomic_load_explicit(&engine->tail, memory_order_relaxed);
+    Slot *slot;
+    for (;;)
+    {
+        slot = &engine->slots[pos & engine->mask];
+        const size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        const ptrdiff_t diff = (ptrdiff_t)(seq - pos);
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(
+                    &engine->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // full
+            return 0;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&engine->tail, memory_order_relaxed);
+        }
+    }
+    slot->job = *job;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return 1;
+}
+
+static int Pop(tcnn_engine *engine, Job *job)
+{
+    size_t pos = atomic_load_explicit(&engine->head, memory_order_relaxed);
+    Slot *slot;
+    for (;;)
+    {
+        slot = &engine->slots[pos & engine->mask];
+        const size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        const ptrdiff_t diff = (ptrdiff_t)(seq - (pos + 1));
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(
+                    &engine->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // empty, or the next push has claimed its slot but not filled it
+            return 0;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&engine->head, memory_order_relaxed);
+        }
+    }
+    *job = slot->job;
+    atomic_store_explicit(&slot->seq, pos + engine->mask + 1, memory_order_release);
+    return 1;
+}
+
+static int TakeJobs(tcnn_engine *engine, Job *jobs, const int max_jobs)
+{
+    // blocks for one request, then takes the ones already queued without
+    // waiting for more, returns 0 once the engine stops and the queue is empty
+    while (sem_wait(&engine->ready) != 0)
+        ;
+    while (Pop(engine, &jobs[0]) == 0)
+    {
+        if (atomic_load(&engine->stopping))
+            return 0;
+        sched_yield();
+    }
+    int count = 1;
+    while (count < max_jobs && sem_trywait(&engine->ready) == 0)
+    {
+        if (Pop(engine, &jobs[count]) == 0)
+        {
+            // a stop token or a push still being filled, leave it to the
+            // next wait
+            sem_post(&engine->ready);
+            break;
+        }
+        ++count;
+    }
+    return count;
+}
+
+static int CompareDeadline(const void *a, const void *b)
+{
+    // no deadline sorts last
+    const uint64_t x = (uint64_t)((const Job *)a)->deadline - 1;
+    const uint64_t y = (uint64_t)((const Job *)b)->deadline - 1;
+    return x < y ? -1 : x > y;
+}
+
+static void RunJobs(Worker *worker, Job *jobs, const int count)
+{
+    const size_t in_size = (size_t)worker->engine->info.in_h * worker->engine->info.in_w;
+    qsort(jobs, count, sizeof(Job), CompareDeadline);
+    int i = 0;
+    while (i < count)
+    {
+        const int64_t now = NowNs();
+        const int64_t deadline = jobs[i].deadline;
+        if (deadline != 0 && deadline <= now)
+        {
+            jobs[i].callback(jobs[i].user, -1, TCNN_ERR_DEADLINE);
+            ++i;
+            continue;
+        }
+        // as many requests as the earliest deadline among them still allows,
+        // the later ones finish with it
+        int n = 1;
+        while (i + n < count && (deadline == 0 || now + (n + 1) * worker->cost <= deadline))
+            ++n;
+        if (n == 1)
+        {
+            worker->preds[0] = tcnn_infer(worker->ctx, jobs[i].image, NULL);
+        }
+        else
+        {
+            for (int b = 0; b < n; ++b)
+                memcpy(&worker->staging[b * in_size], jobs[i + b].image, in_size);
+            tcnn_infer_batch(worker->ctx, worker->staging, n, worker->preds);
+        }
+        worker->cost += ((NowNs() - now) / n - worker->cost) / 8;
+        for (int b = 0; b < n; ++b)
+            jobs[i + b].callback(jobs[i + b].user, worker->preds[b], TCNN_OK);
+        i += n;
+    }
+}
+
+// cpus handed out to the engines of this process so far, every engine
+// starts where the one before it ended
+static atomic_int NextCpu;
+
+static void PinThread(const int index)
+{
+    // the index-th cpu this process may run on, so restricted cpusets work
+    cpu_set_t allowed, set;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0)
+        return;
+    int n = index % CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (CPU_ISSET(cpu, &allowed) && n-- == 0)
+        {
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            sched_setaffinity(0, sizeof(set), &set);
+            return;
+        }
+    }
+}
+
+static int SetupWorker(Worker *worker)
+{
+    // a context and a staging buffer of a full batch, allocated and touched
+    // by the worker so that they sit on the NUMA node it runs on
+    const tcnn_engine *engine = worker->engine;
+    const int max_batch = engine->info.max_batch;
+    const size_t staging_size =
+        ((size_t)max_batch * engine->info.in_h * engine->info.in_w + ALIGN_SIZE - 1) / ALIGN_SIZE * ALIGN_SIZE;
+    worker->cost = INITIAL_COST;
+    if (engine->handle != NULL)
+        worker->ctx = tcnn_handle_context_create(engine->handle);
+    else
+        worker->ctx = tcnn_context_create(engine->model);
+    worker->staging = aligned_alloc(ALIGN_SIZE, staging_size);
+    worker->jobs = malloc(max_batch * sizeof(Job));
+    worker->preds = malloc(max_batch * sizeof(int));
+    if (worker->ctx == NULL || worker->staging == NULL || worker->jobs == NULL || worker->preds == NULL)
+        return 0;
+    memset(worker->staging, 0, staging_size);
+    return 1;
+}
+
+static void *WorkerMain(void *arg)
+{
+    Worker *worker = arg;
+    tcnn_engine *engine = worker->engine;
+    if (engine->pin)
+        PinThread(engine->first_cpu + worker->index);
+    worker->ready = SetupWorker(worker);
+    sem_post(&engine->setup);
+    if (!worker->ready)
+        return NULL;
+    int count;
+    while ((count = TakeJobs(engine, worker->jobs, engine->info.max_batch)) > 0)
+        RunJobs(worker, worker->jobs, count);
+    return NULL;
+}
+
+tcnn_engine_options tcnn_engine_default_options(void)
+{
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    tcnn_engine_options options = { cpus > 0 ? (int)cpus : 1, 1024, 1 };
+    return options;
+}
+
+static tcnn_engine *CreateEngine(
+    const tcnn_model *model, tcnn_handle *handle, const tcnn_engine_options *options
+)
+{
+    const tcnn_engine_options defaults = tcnn_engine_default_options();
+    if (options == NULL)
+        options = &defaults;
+    tcnn_engine *engine = aligned_alloc(CACHE_LINE, (sizeof(tcnn_engine) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
+    if (engine == NULL)
+        return NULL;
+    memset(engine, 0, sizeof(tcnn_engine));
+    size_t size = 2;
+    while (size < (size_t)options->queue_size)
+        size *= 2;
+    engine->mask = size - 1;
+    // a reload keeps the dims and batch the staging buffers are sized for
+    engine->model = model;
+    engine->handle = handle;
+    if (handle != NULL)
+        tcnn_handle_get_info(handle, &engine->info);
+    else
+        tcnn_model_get_info(model, &engine->info);
+    engine->pin = options->pin;
+    engine->threads = options->threads > 0 ? options->threads : 1;
+    engine->first_cpu = engine->pin ? atomic_fetch_add(&NextCpu, engine->threads) & INT_MAX : 0;
+    atomic_init(&engine->head, 0);
+    atomic_init(&engine->tail, 0);
+    atomic_init(&engine->stopping, 0);
+    atomic_init(&engine->submitting, 0);
+    sem_init(&engine->ready, 0, 0);
+    sem_init(&engine->setup, 0, 0);
+    engine->slots = malloc(size * sizeof(Slot));
+    engine->workers = calloc(engine->threads, sizeof(Worker));
+    if (engine->slots == NULL || engine->workers == NULL)
+    {
+        tcnn_engine_free(engine);
+        return NULL;
+    }
+    for (size_t i = 0; i < size; ++i)
+        atomic_init(&engine->slots[i].seq, i);
+
+    int ready = 1;
+    for (int t = 0; t < engine->threads; ++t)
+    {
+        Worker *worker = &engine->workers[t];
+        worker->engine = engine;
+        worker->index = t;
+        if (pthread_create(&worker->thread, NULL, WorkerMain, worker) != 0)
+        {
+            ready = 0;
+            break;
+        }
+        ++engine->started;
+    }
+    for (int t = 0; t < engine->started; ++t)
+    {
+        while (sem_wait(&engine->setup) != 0)
+            ;
+    }
+    for (int t = 0; t < engine->started; ++t)
+        ready &= engine->workers[t].ready;
+    if (!ready)
+    {
+        tcnn_engine_free(engine);
+        return NULL;
+    }
+    return engine;
+}
+
+tcnn_engine *tcnn_engine_create(const tcnn_model *model, const tcnn_engine_options *options)
+{
+    return CreateEngine(model, NULL, options);
+}
+
+tcnn_engine *tcnn_handle_engine_create(tcnn_handle *handle, const tcnn_engine_options *options)
+{
+    return CreateEngine(NULL, handle, options);
+}
+
+void tcnn_engine_free(tcnn_engine *engine)
+{
+    if (engine == NULL)
+        return;
+    // one stop token per worker, each exits on the first it finds with the
+    // queue drained, posted once the submits in flight have queued theirs
+    atomic_store(&engine->stopping, 1);
+    while (atomic_load(&engine->submitting) > 0)
+        sched_yield();
+    for (int t = 0; t < engine->started; ++t)
+        sem_post(&engine->ready);
+    for (int t = 0; t < engine->started; ++t)
+        pthread_join(engine->workers[t].thread, NULL);
+    for (int t = 0; engine->workers != NULL && t < engine->threads; ++t)
+    {
+        Worker *worker = &engine->workers[t];
+        tcnn_context_free(worker->ctx);
+        free(worker->staging);
+        free(worker->jobs);
+        free(worker->preds);
+    }
+    sem_destroy(&engine->ready);
+    sem_destroy(&engine->setup);
+    free(engine->workers);
+    free(engine->slots);
+    free(engine);
+}
+
+tcnn_status tcnn_submit(
+    tcnn_engine *engine, const uint8_t *image, const int64_t timeout_us,
+    tcnn_callback callback, void *user
+)
+{
+    // a request queued behind the stop tokens would never run
+    Job job = { image, timeout_us > 0 ? NowNs() + timeout_us * 1000 : 0, callback, user };
+    atomic_fetch_add(&engine->submitting, 1);
+    tcnn_status status = TCNN_ERR_BUSY;
+    if (!atomic_load(&engine->stopping) && Push(engine, &job))
+    {
+        sem_post(&engine->ready);
+        status = TCNN_OK;
+    }
+    atomic_fetch_sub(&engine->submitting, 1);
+    return status;
+}
+
+static void CompleteFuture(void *user, const int pred, const tcnn_status status)
+{
+    tcnn_future *future = user;
+    pthread_mutex_lock(&future->lock);
+    future->pred = pred;
+    future->status = status;
+    future->done = 1;
+    pthread_cond_signal(&future->cond);
+    pthread_mutex_unlock(&future->lock);
+}
+
+tcnn_future *tcnn_submit_future(tcnn_engine *engine, const uint8_t *image, const int64_t timeout_us)
+{
+    tcnn_future *future = malloc(sizeof(tcnn_future));
+    if (future == NULL)
+        return NULL;
+    pthread_mutex_init(&future->lock, NULL);
+    pthread_cond_init(&future->cond, NULL);
+    future->done = 0;
+    if (tcnn_submit(engine, image, timeout_us, CompleteFuture, future) != TCNN_OK)
+    {
+        pthread_cond_destroy(&future->cond);
+        pthread_mutex_destroy(&future->lock);
+        free(future);
+        return NULL;
+    }
+    return future;
+}
+
+int tcnn_future_wait(tcnn_future *future, tcnn_status *status)
+{
+    pthread_mutex_lock(&future->lock);
+    while (!future->done)
+        pthread_cond_wait(&future->cond, &future->lock);
+    pthread_mutex_unlock(&future->lock);
+    const int pred = future->pred;
+    if (status != NULL)
+        *status = future->status;
+    pthread_cond_destroy(&future->cond);
+    pthread_mutex_destroy(&future->lock);
+    free(future);
+    return pred;
+}
@@ -0,0 +1,243 @@
+#include "gemm.h"
+#include "simd.h"
+#include <string.h>
+
+#define FORCE_INLINE static inline __attribute__((always_inline))
+#define P GEMM_PANEL
+// rows of x that GemmPanelsT runs against one panel at a time
+#define X_BLOCK 4
+
+// GEMM_PANEL floats, one panel column or a run of a row of b
+#if defined(SIMD_HAS_V8)
+typedef v8f pv;
+FORCE_INLINE pv PvLoad(const float *p) { return V8_LOAD(p); }
+FORCE_INLINE void PvStore(float *p, const pv v) { V8_STORE(p, v); }
+FORCE_INLINE pv PvDup(const float x) { return V8_DUP(x); }
+FORCE_INLINE pv PvFma(const pv acc, const pv a, const pv b) { return V8_FMA(acc, a, b); }
+FORCE_INLINE pv PvAdd(const pv a, const pv b) { return V8_ADD(a, b); }
+#elif defined(SIMD_HAS_V4)
+typedef struct { v4f lo, hi; } pv;
+FORCE_INLINE pv PvLoad(const float *p) { pv v = { V4_LOAD(p), V4_LOAD(&p[4]) }; return v; }
+FORCE_INLINE void PvStore(float *p, const pv v) { V4_STORE(p, v.lo); V4_STORE(&p[4], v.hi); }
+FORCE_INLINE pv PvDup(const float x) { pv v = { V4_DUP(x), V4_DUP(x) }; return v; }
+FORCE_INLINE pv PvFma(const pv acc, const pv a, const pv b)
+{
+    pv v = { V4_FMA(acc.lo, a.lo, b.lo), V4_FMA(acc.hi, a.hi, b.hi) };
+    return v;
+}
+FORCE_INLINE pv PvAdd(const pv a, const pv b) { pv v = { V4_ADD(a.lo, b.lo), V4_ADD(a.hi, b.hi) }; return v; }
+#else
+typedef struct { float v[P]; } pv;
+FORCE_INLINE pv PvLoad(const float *p) { pv v; memcpy(v.v, p, sizeof(v.v)); return v; }
+FORCE_INLINE void PvStore(float *p, const pv v) { memcpy(p, v.v, sizeof(v.v)); }
+FORCE_INLINE pv PvDup(const float x)
+{
+    pv v;
+    for (int i = 0; i < P; ++i)
+        v.v[i] = x;
+    return v;
+}
+FORCE_INLINE pv PvFma(pv acc, const pv a, const pv b)
+{
+    for (int i = 0; i < P; ++i)
+        acc.v[i] += a.v[i] * b.v[i];
+    return acc;
+}
+FORCE_INLINE pv PvAdd(pv a, const pv b)
+{
+    for (int i = 0; i < P; ++i)
+        a.v[i] += b.v[i];
+    return a;
+}
+#endif
+
+// the first count floats only, for the last panel and the tail of a row
+FORCE_INLINE pv PvLoadPart(const float *p, const int count)
+{
+    float buf[P] = { 0.0f, };
+    memcpy(buf, p, count * sizeof(float));
+    return PvLoad(buf);
+}
+
+FORCE_INLINE void PvStorePart(float *p, const pv v, const int count)
+{
+    if (count >= P)
+    {
+        PvStore(p, v);
+        return;
+    }
+    float buf[P];
+    PvStore(buf, v);
+    memcpy(p, buf, count * sizeof(float));
+}
+
+size_t PanelSize(const int rows, const int cols)
+{
+    return (size_t)(rows + P - 1) / P * P * cols;
+}
+
+void PackPanels(const float *src, const int rows, const int cols, float *dst)
+{
+    const int padded = (rows + P - 1) / P * P;
+    for (int r = 0; r < padded; ++r)
+    {
+        float *panel = &dst[(size_t)(r / P) * cols * P + r % P];
+        for (int col = 0; col < cols; ++col)
+            panel[col * P] = r < rows ? src[(size_t)r * cols + col] : 0.0f;
+    }
+}
+
+FORCE_INLINE void GemmBlock(
+    const float *panel, const float *b, float *c, const int rows, const int cols,
+    const int k, const int ldb, const int ldc
+)
+{
+    // P rows of c by up to P columns, one accumulator per row, the weights
+    // of a column are broadcast against a run of b
+    pv acc[P];
+    for (int r = 0; r < P; ++r)
+        acc[r] = PvDup(0.0f);
+    for (int i = 0; i < k; ++i)
+    {
+        const pv bv = cols >= P ? PvLoad(&b[(size_t)i * ldb]) : PvLoadPart(&b[(size_t)i * ldb], cols);
+        const float *w = &panel[i * P];
+        for (int r = 0; r < P; ++r)
+            acc[r] = PvFma(acc[r], PvDup(w[r]), bv);
+    }
+    for (int r = 0; r < rows; ++r)
+        PvStorePart(&c[(size_t)r * ldc], acc[r], cols);
+}
+
+void GemmPanels(
+    const float *a, const float *b, float *c,
+    const int m, const int n, const int k, const int ldb, const int ldc
+)
+{
+    for (int p = 0; p * P < m; ++p)
+    {
+        const float *panel = &a[(size_t)p * k * P];
+        const int rows = m - p * P < P ? m - p * P : P;
+        float *c_ptr = &c[(size_t)p * P * ldc];
+        int j = 0;
+        for (; j + P <= n; j += P)
+            GemmBlock(panel, &b[j], &c_ptr[j], rows, P, k, ldb, ldc);
+        if (j < n)
+            GemmBlock(panel, &b[j], &c_ptr[j], rows, n - j, k, ldb, ldc);
+    }
+}
+
+void GemvPanels(const float *a, const float *x, float *y, const int m, const int k)
+{
+    // a panel column times one input, two chains to hide the fma latency
+    for (int p = 0; p * P < m; ++p)
+    {
+        const float *panel = &a[(size_t)p * k * P];
+        pv acc0 = PvDup(0.0f), acc1 = PvDup(0.0f);
+        int i = 0;
+        for (; i + 2 <= k; i += 2)
+        {
+            acc0 = PvFma(acc0, PvLoad(&panel[i * P]), PvDup(x[i]));
+            acc1 = PvFma(acc1, PvLoad(&panel[(i + 1) * P]), PvDup(x[i + 1]));
+        }
+        if (i < k)
+            acc0 = PvFma(acc0, PvLoad(&panel[i * P]), PvDup(x[i]));
+        PvStorePart(&y[p * P], PvAdd(acc0, acc1), m - p * P);
+    }
+}
+
+void GemmPanelsT(
+    const float *a, const float *x, float *c,
+    const int batch, const int m, const int k, const int ldc
+)
+{
+    // every panel column is loaded once for X_BLOCK rows of x
+    for (int p = 0; p * P < m; ++p)
+    {
+        const float *panel = &a[(size_t)p * k * P];
+        const int rows = m - p * P;
+        int b = 0;
+        for (; b + X_BLOCK <= batch; b += X_BLOCK)
+        {
+            const float *x_ptr = &x[(size_t)b * k];
+            pv acc[X_BLOCK];
+            for (int j = 0; j < X_BLOCK; ++j)
+                acc[j] = PvDup(0.0f);
+            for (int i = 0; i < k; ++i)
+            {
+                const pv w = PvLoad(&panel[i * P]);
+                for (int j = 0; j < X_BLOCK; ++j)
+                    acc[j] = PvFma(acc[j], w, PvDup(x_ptr[(size_t)j * k + i]));
+            }
+            for (int j = 0; j < X_BLOCK; ++j)
+                PvStorePart(&c[(size_t)(b + j) * ldc + p * P], acc[j], rows);
+        }
+        for (; b < batch; ++b)
+        {
+            const float *x_ptr = &x[(size_t)b * k];
+            pv acc = PvDup(0.0f);
+            for (int i = 0; i < k; ++i)
+                acc = PvFma(acc, PvLoad(&panel[i * P]), PvDup(x_ptr[i]));
+            PvStorePart(&c[(size_t)b * ldc + p * P], acc, rows);
+        }
+    }
+}
+
+void SparseGemvPanels(
+    const float *blocks, const int *index, const int *offsets,
+    const float *x, float *y, const int m
+)
+{
+    // GemvPanels over the kept columns, the input is gathered by index
+    for (int p = 0; p * P < m; ++p)
+    {
+        pv acc0 = PvDup(0.0f), acc1 = PvDup(0.0f);
+        int j = offsets[p];
+        const int end = offsets[p + 1];
+        for (; j + 2 <= end; j += 2)
+        {
+            acc0 = PvFma(acc0, PvLoad(&blocks[(size_t)j * P]), PvDup(x[index[j]]));
+            acc1 = PvFma(acc1, PvLoad(&blocks[(size_t)(j + 1) * P]), PvDup(x[index[j + 1]]));
+        }
+        if (j < end)
+            acc0 = PvFma(acc0, PvLoad(&blocks[(size_t)j * P]), PvDup(x[index[j]]));
+        PvStorePart(&y[p * P], PvAdd(acc0, acc1), m - p * P);
+    }
+}
+
+void SparseGemmPanelsT(
+    const float *blocks, const int *index, const int *offsets,
+    const float *x, float *c, const int batch, const int m, const int k, const int ldc
+)
+{
+    // every kept block is loaded once for X_BLOCK rows of x
+    for (int p = 0; p * P < m; ++p)
+    {
+        const int rows = m - p * P;
+        const int start = offsets[p], end = offsets[p + 1];
+        int b = 0;
+        for (; b + X_BLOCK <= batch; b += X_BLOCK)
+        {
+            const float *x_ptr = &x[(size_t)b * k];
+            pv acc[X_BLOCK];
+            for (int j = 0; j < X_BLOCK; ++j)
+                acc[j] = PvDup(0.0f);
+            for (int i = start; i < end; ++i)
+            {
+                const pv w = PvLoad(&blocks[(size_t)i * P]);
+                const int col = index[i];
+                for (int j = 0; j < X_BLOCK; ++j)
+                    acc[j] = PvFma(acc[j], w, PvDup(x_ptr[(size_t)j * k + col]));
+            }
+            for (int j = 0; j < X_BLOCK; ++j)
+                PvStorePart(&c[(size_t)(b + j) * ldc + p * P], acc[j], rows);
+        }
+        for (; b < batch; ++b)
+        {
+            const float *x_ptr = &x[(size_t)b * k];
+            pv acc = PvDup(0.0f);
+            for (int i = start; i < end; ++i)
+                acc = PvFma(acc, PvLoad(&blocks[(size_t)i * P]), PvDup(x_ptr[index[i]]));
+            PvStorePart(&c[(size_t)b * ldc + p * P], acc, rows);
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef GEMM_H_
+#define GEMM_H_
+
+#include <stddef.h>
+
+// Small single-threaded GEMM/GEMV for the layer shapes of this repo, a few
+// rows of weights against short dots, where a BLAS spends more on argument
+// checks, threading and packing than on the arithmetic. The weights are
+// packed once into panels of GEMM_PANEL rows, [rows / P][cols][P] with the
+// last panel padded with zero rows, so that the kernels read P weights of
+// one column with a single load.
+#define GEMM_PANEL 8
+
+// floats of the packed copy of a rows x cols matrix
+size_t PanelSize(const int rows, const int cols);
+
+void PackPanels(const float *src, const int rows, const int cols, float *dst);
+
+// c[m][n] = a[m][k] * b[k][n], b and c row-major with strides ldb and ldc
+void GemmPanels(
+    const float *a, const float *b, float *c,
+    const int m, const int n, const int k, const int ldb, const int ldc
+);
+
+// y[m] = a[m][k] * x[k]
+void GemvPanels(const float *a, const float *x, float *y, const int m, const int k);
+
+// c[b][i] = x[b] . a[i] for every row b of x, x has stride k and c ldc
+void GemmPanelsT(
+    const float *a, const float *x, float *c,
+    const int batch, const int m, const int k, const int ldc
+);
+
+// block-sparse panels: only the nonzero panel columns are kept as blocks of
+// GEMM_PANEL floats, panel p owns blocks offsets[p] .. offsets[p + 1] - 1 and
+// block j is column index[j] of the dense panel, the product is the same as
+// with the dense panels
+void SparseGemvPanels(
+    const float *blocks, const int *index, const int *offsets,
+    const float *x, float *y, const int m
+);
+
+void SparseGemmPanelsT(
+    const float *blocks, const int *index, const int *offsets,
+    const float *x, float *c, const int batch, const int m, const int k, const int ldc
+);
+
+#endif  // GEMM_H_
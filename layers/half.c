@@ -0,0 +1,272 @@
+#include "half.h"
+#include "config.h"
+#include "simd.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FORCE_INLINE static inline __attribute__((always_inline))
+// columns of a weight row widened at a time by the batched fc layer
+#define ROW_CHUNK 512
+
+// the vector widening is used where the unit converts fp16 itself, bf16 is
+// a plain shift everywhere
+#if defined(SIMD_HAS_V8) && defined(V8_LOAD_F16)
+#define HALF_V8 1
+#elif defined(SIMD_HAS_V4) && defined(V4_LOAD_F16)
+#define HALF_V4 1
+#endif
+
+static uint16_t FloatToHalf(const float x)
+{
+    // rounds to nearest even, overflows to inf and keeps subnormals
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const int exp = (int)((bits >> 23) & 0xFF) - 127 + 15;
+    uint32_t mant = bits & 0x7FFFFF;
+    if (((bits >> 23) & 0xFF) == 0xFF)
+        return (uint16_t)(sign | 0x7C00 | (mant != 0 ? 0x200 : 0));
+    if (exp >= 31)
+        return (uint16_t)(sign | 0x7C00);
+    int shift = 13;
+    uint32_t base = (uint32_t)exp << 10;
+    if (exp <= 0)
+    {
+        if (exp < -10)
+            return (uint16_t)sign;
+        mant |= 0x800000;
+        shift = 14 - exp;
+        base = 0;
+    }
+    // a carry out of the mantissa bumps the exponent, which is still right
+    uint32_t h = base + (mant >> shift);
+    const uint32_t rest = mant & ((1u << shift) - 1), half = 1u << (shift - 1);
+    if (rest > half || (rest == half && (h & 1)))
+        ++h;
+    return (uint16_t)(sign | h);
+}
+
+static float HalfToFloat(const uint16_t h)
+{
+    const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    int exp = (h >> 10) & 0x1F;
+    uint32_t mant = h & 0x3FF;
+    uint32_t bits;
+    if (exp == 0x1F)
+    {
+        bits = sign | 0x7F800000 | (mant << 13);
+    }
+    else if (exp == 0 && mant == 0)
+    {
+        bits = sign;
+    }
+    else
+    {
+        // subnormals are normalized first
+        if (exp == 0)
+        {
+            exp = 1;
+            while ((mant & 0x400) == 0)
+            {
+                mant <<= 1;
+                --exp;
+            }
+            mant &= 0x3FF;
+        }
+        bits = sign | ((uint32_t)(exp + 127 - 15) << 23) | (mant << 13);
+    }
+    float x;
+    memcpy(&x, &bits, sizeof(x));
+    return x;
+}
+
+static uint16_t FloatToBf16(const float x)
+{
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    if ((bits & 0x7FFFFFFF) > 0x7F800000)
+        return (uint16_t)((bits >> 16) | 0x40);
+    return (uint16_t)((bits + 0x7FFF + ((bits >> 16) & 1)) >> 16);
+}
+
+static float Bf16ToFloat(const uint16_t h)
+{
+    const uint32_t bits = (uint32_t)h << 16;
+    float x;
+    memcpy(&x, &bits, sizeof(x));
+    return x;
+}
+
+FORCE_INLINE float Widen(const uint16_t h, const int bf16)
+{
+    return bf16 ? Bf16ToFloat(h) : HalfToFloat(h);
+}
+
+#ifdef HALF_V8
+FORCE_INLINE v8f WidenV8(const uint16_t *p, const int bf16)
+{
+    return bf16 ? V8_LOAD_BF16(p) : V8_LOAD_F16(p);
+}
+#endif
+
+#ifdef HALF_V4
+FORCE_INLINE v4f WidenV4(const uint16_t *p, const int bf16)
+{
+    return bf16 ? V4_LOAD_BF16(p) : V4_LOAD_F16(p);
+}
+#endif
+
+int ConvertHalfModel(const Layer *layers, const int num_layers, const HalfFormat format, HalfModel *model)
+{
+    memset(model, 0, sizeof(HalfModel));
+    size_t count = 0;
+    for (int i = 0; i < num_layers; ++i)
+        count += layers[i].weights != NULL ? (size_t)layers[i].weight_count : 0;
+    // every layer starts on a whole vector of halves
+    const size_t align = ALIGN_SIZE / sizeof(uint16_t);
+    const size_t padded = (count + (size_t)num_layers * align + align - 1) / align * align;
+    model->weights = calloc(num_layers, sizeof(uint16_t *));
+    model->storage = aligned_alloc(ALIGN_SIZE, padded * sizeof(uint16_t));
+    if (model->weights == NULL || model->storage == NULL)
+    {
+        FreeHalfModel(model);
+        return 0;
+    }
+    model->format = format;
+    model->num_layers = num_layers;
+
+    size_t used = 0;
+    for (int i = 0; i < num_layers; ++i)
+    {
+        const Layer *layer = &layers[i];
+        if (layer->weights == NULL)
+            continue;
+        uint16_t *dst = &model->storage[used];
+        for (int j = 0; j < layer->weight_count; ++j)
+            dst[j] = format == HALF_BF16 ? FloatToBf16(layer->weights[j]) : FloatToHalf(layer->weights[j]);
+        model->weights[i] = dst;
+        used += (layer->weight_count + align - 1) / align * align;
+        if (layer->type != LAYER_FC && layer->weight_count > model->widen_size)
+            model->widen_size = layer->weight_count;
+    }
+    model->weight_bytes = count * sizeof(uint16_t);
+    return 1;
+}
+
+void FreeHalfModel(HalfModel *model)
+{
+    free(model->weights);
+    free(model->storage);
+    memset(model, 0, sizeof(HalfModel));
+}
+
+FORCE_INLINE void WidenRow(const uint16_t *src, float *dst, const int count, const int bf16)
+{
+    int i = 0;
+#if defined(HALF_V8)
+    for (; i + 8 <= count; i += 8)
+        V8_STORE(&dst[i], WidenV8(&src[i], bf16));
+#elif defined(HALF_V4)
+    for (; i + 4 <= count; i += 4)
+        V4_STORE(&dst[i], WidenV4(&src[i], bf16));
+#endif
+    for (; i < count; ++i)
+        dst[i] = Widen(src[i], bf16);
+}
+
+void WidenHalf(const uint16_t *src, float *dst, const int count, const HalfFormat format)
+{
+    if (format == HALF_BF16)
+        WidenRow(src, dst, count, 1);
+    else
+        WidenRow(src, dst, count, 0);
+}
+
+// dot product of a weight row with the input, the row is fp32 when half is
+// 0, otherwise fp16 or bf16 widened on the fly
+FORCE_INLINE float Dot(const void *row, const float *x, const int count, const int half, const int bf16)
+{
+    const float *wf = (const float *)row;
+    const uint16_t *wh = (const uint16_t *)row;
+    float sum = 0.0f;
+    int i = 0;
+#if defined(HALF_V8)
+    v8f acc0 = V8_DUP(0.0f), acc1 = V8_DUP(0.0f);
+    for (; i + 16 <= count; i += 16)
+    {
+        acc0 = V8_FMA(acc0, half ? WidenV8(&wh[i], bf16) : V8_LOAD(&wf[i]), V8_LOAD(&x[i]));
+        acc1 = V8_FMA(acc1, half ? WidenV8(&wh[i + 8], bf16) : V8_LOAD(&wf[i + 8]), V8_LOAD(&x[i + 8]));
+    }
+    for (; i + 8 <= count; i += 8)
+        acc0 = V8_FMA(acc0, half ? WidenV8(&wh[i], bf16) : V8_LOAD(&wf[i]), V8_LOAD(&x[i]));
+    float lanes[8];
+    V8_STORE(lanes, V8_ADD(acc0, acc1));
+    for (int l = 0; l < 8; ++l)
+        sum += lanes[l];
+#elif defined(HALF_V4)
+    v4f acc0 = V4_DUP(0.0f), acc1 = V4_DUP(0.0f);
+    for (; i + 8 <= count; i += 8)
+    {
+        acc0 = V4_FMA(acc0, half ? WidenV4(&wh[i], bf16) : V4_LOAD(&wf[i]), V4_LOAD(&x[i]));
+        acc1 = V4_FMA(acc1, half ? WidenV4(&wh[i + 4], bf16) : V4_LOAD(&wf[i + 4]), V4_LOAD(&x[i + 4]));
+    }
+    for (; i + 4 <= count; i += 4)
+        acc0 = V4_FMA(acc0, half ? WidenV4(&wh[i], bf16) : V4_LOAD(&wf[i]), V4_LOAD(&x[i]));
+    float lanes[4];
+    V4_STORE(lanes, V4_ADD(acc0, acc1));
+    for (int l = 0; l < 4; ++l)
+        sum += lanes[l];
+#endif
+    for (; i < count; ++i)
+        sum += (half ? Widen(wh[i], bf16) : wf[i]) * x[i];
+    return sum;
+}
+
+FORCE_INLINE void FCRows(
+    const uint16_t *Fc1, const float *bottom, float *top, const int out_feat, const int in_feat,
+    const int bf16
+)
+{
+    for (int o = 0; o < out_feat; ++o)
+        top[o] = Dot(&Fc1[(size_t)o * in_feat], bottom, in_feat, 1, bf16);
+}
+
+int HalfFCLayer(
+    const uint16_t *Fc1, const HalfFormat format, const float *bottom, float *top,
+    int out_feat, int in_feat
+)
+{
+    // one pass over the weights, each row is widened in registers
+    if (format == HALF_BF16)
+        FCRows(Fc1, bottom, top, out_feat, in_feat, 1);
+    else
+        FCRows(Fc1, bottom, top, out_feat, in_feat, 0);
+    return out_feat;
+}
+
+int HalfFCLayerBatch(
+    const uint16_t *Fc1, const HalfFormat format, const float *bottom, float *top, const int batch,
+    int out_feat, int in_feat
+)
+{
+    // every chunk of a weight row is widened once and then used by all the
+    // images, rows of top get the trailing 1.0f like FCLayerBatch()
+    const int ldc = out_feat + 1;
+    float row[ROW_CHUNK];
+    for (int o = 0; o < out_feat; ++o)
+    {
+        const uint16_t *src = &Fc1[(size_t)o * in_feat];
+        for (int b = 0; b < batch; ++b)
+            top[b * ldc + o] = 0.0f;
+        for (int c = 0; c < in_feat; c += ROW_CHUNK)
+        {
+            const int count = in_feat - c < ROW_CHUNK ? in_feat - c : ROW_CHUNK;
+            WidenHalf(&src[c], row, count, format);
+            for (int b = 0; b < batch; ++b)
+                top[b * ldc + o] += Dot(row, &bottom[(size_t)b * in_feat + c], count, 0, 0);
+        }
+    }
+    for (int b = 0; b < batch; ++b)
+        top[b * ldc + out_feat] = 1.0f;
+    return batch * ldc;
+}
@@ -0,0 +1,45 @@
+#ifndef HALF_H_
+#define HALF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "layers.h"
+
+// Half-precision weight storage. The weights are narrowed once at load and
+// widened back to fp32 inside the kernels, activations stay fp32.
+typedef enum {
+    HALF_FP16,
+    HALF_BF16
+} HalfFormat;
+
+typedef struct {
+    HalfFormat format;
+    uint16_t *storage;
+    // per layer, NULL for layers without weights
+    const uint16_t **weights;
+    int num_layers;
+    size_t weight_bytes;
+    // floats of the largest conv weight bank, widened into scratch per call
+    int widen_size;
+} HalfModel;
+
+// narrows the weights of the layers left by BuildModel(), the layers keep
+// their fp32 pointers, which the caller may release afterwards
+int ConvertHalfModel(const Layer *layers, const int num_layers, const HalfFormat format, HalfModel *model);
+
+void FreeHalfModel(HalfModel *model);
+
+void WidenHalf(const uint16_t *src, float *dst, const int count, const HalfFormat format);
+
+// same contracts as FCLayer() and FCLayerBatch()
+int HalfFCLayer(
+    const uint16_t *Fc1, const HalfFormat format, const float *bottom, float *top,
+    int out_feat, int in_feat
+);
+
+int HalfFCLayerBatch(
+    const uint16_t *Fc1, const HalfFormat format, const float *bottom, float *top, const int batch,
+    int out_feat, int in_feat
+);
+
+#endif  // HALF_H_
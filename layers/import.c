@@ -0,0 +1,108 @@
+#include "import.h"
+#include "config.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+int IsImportedFile(const char *filename)
+{
+    return IsOnnxFile(filename) || IsNcnnFile(filename);
+}
+
+int LoadImportedModel(const char *filename, ImportedModel *model)
+{
+    if (IsNcnnFile(filename))
+        return LoadNcnnModel(filename, model);
+    return LoadOnnxModel(filename, model);
+}
+
+int InitTable(LayerTable *table, const int max_layers)
+{
+    memset(table, 0, sizeof(LayerTable));
+    table->layers = malloc((max_layers > 0 ? max_layers : 1) * sizeof(Layer));
+    table->offsets = malloc((max_layers > 0 ? max_layers : 1) * sizeof(ptrdiff_t));
+    table->max_layers = max_layers;
+    return table->layers != NULL && table->offsets != NULL;
+}
+
+Layer *AddLayer(LayerTable *table, const LayerType type, const size_t weight_count, float **weights)
+{
+    if (table->num_layers >= table->max_layers || weight_count > INT32_MAX)
+        return NULL;
+    if (weight_count > 0 && table->param_count + weight_count > table->capacity)
+    {
+        size_t capacity = table->capacity > 0 ? table->capacity : 1024;
+        while (capacity < table->param_count + weight_count)
+            capacity *= 2;
+        float *params = realloc(table->params, capacity * sizeof(float));
+        if (params == NULL)
+            return NULL;
+        table->params = params;
+        table->capacity = capacity;
+    }
+    Layer *layer = &table->layers[table->num_layers];
+    memset(layer, 0, sizeof(Layer));
+    layer->type = type;
+    layer->weight_count = (int)weight_count;
+    table->offsets[table->num_layers++] = weight_count > 0 ? (ptrdiff_t)table->param_count : -1;
+    if (weights != NULL)
+        *weights = &table->params[table->param_count];
+    table->param_count += weight_count;
+    return layer;
+}
+
+int FoldChannels(const LayerTable *table, const int flat)
+{
+    int i = table->num_layers - 1;
+    while (i >= 0 && (table->layers[i].type == LAYER_BIAS || table->layers[i].type == LAYER_BATCHNORM))
+        --i;
+    if (i < 0)
+        return 0;
+    const Layer *last = &table->layers[i];
+    if (last->type == LAYER_CONV && !flat)
+        return last->filters;
+    return last->type == LAYER_FC ? last->out_feat : 0;
+}
+
+int FinishImport(LayerTable *table, const int ok, ImportedModel *model)
+{
+    // the batched argmax reads the rows of a last fc layer
+    Layer *layers = table->layers;
+    float *params = table->params;
+    size_t param_count = table->param_count;
+    for (int i = 0; ok && i < table->num_layers; ++i)
+        layers[i].weights = table->offsets[i] >= 0 ? &params[table->offsets[i]] : NULL;
+    const int count = ok ? OptimizeLayers(layers, table->num_layers, params, &param_count) : 0;
+
+    // the weights move into an aligned buffer and the layers point there
+    const size_t bytes = (param_count * sizeof(float) + ALIGN_SIZE - 1) / ALIGN_SIZE * ALIGN_SIZE;
+    float *aligned = count > 0 && layers[count - 1].type == LAYER_FC ? aligned_alloc(ALIGN_SIZE, bytes > 0 ? bytes : ALIGN_SIZE) : NULL;
+    if (aligned != NULL)
+    {
+        memcpy(aligned, params, param_count * sizeof(float));
+        for (int i = 0; i < count; ++i)
+        {
+            if (layers[i].weights != NULL)
+                layers[i].weights = aligned + (layers[i].weights - params);
+        }
+        model->params = aligned;
+        model->param_count = param_count;
+        model->layers = layers;
+        model->num_layers = count;
+    }
+    else
+    {
+        free(layers);
+    }
+    free(table->offsets);
+    free(params);
+    memset(table, 0, sizeof(LayerTable));
+    return aligned != NULL;
+}
+
+void FreeImportedModel(ImportedModel *model)
+{
+    free(model->params);
+    free(model->layers);
+    memset(model, 0, sizeof(ImportedModel));
+}
@@ -0,0 +1,65 @@
+#ifndef IMPORT_H_
+#define IMPORT_H_
+
+#include <stddef.h>
+#include "layers.h"
+
+// Importers for the exports of other frameworks, without their libraries.
+// Each reads its graph into layers as it is, bias adds, batchnorms, layout
+// ops and the final softmax included, and OptimizeLayers() folds those into
+// the layers that run. The graph has to be a chain from the input to the
+// last fc layer.
+typedef struct {
+    // ALIGN_SIZE-aligned weights in the layout of the layers
+    float *params;
+    size_t param_count;
+    Layer *layers;
+    int num_layers;
+    // dims of the graph input, 0 when they are not fixed
+    int in_h, in_w;
+} ImportedModel;
+
+// an ONNX ModelProto starts with ir_version, field 1 as a varint
+int IsOnnxFile(const char *filename);
+
+int LoadOnnxModel(const char *filename, ImportedModel *model);
+
+// an ncnn .param file starts with its magic line, the weights are read from
+// the .bin file of the same name
+int IsNcnnFile(const char *filename);
+
+int LoadNcnnModel(const char *filename, ImportedModel *model);
+
+int IsImportedFile(const char *filename);
+
+// either of the formats above
+int LoadImportedModel(const char *filename, ImportedModel *model);
+
+// layers as an importer appends them, with the weights of every layer from
+// the start of params, -1 for none, since params grows
+typedef struct {
+    Layer *layers;
+    ptrdiff_t *offsets;
+    int num_layers, max_layers;
+    float *params;
+    size_t param_count, capacity;
+} LayerTable;
+
+int InitTable(LayerTable *table, const int max_layers);
+
+// appends a layer and weight_count floats of params for its weights, returns
+// NULL when out of memory or layers
+Layer *AddLayer(LayerTable *table, const LayerType type, const size_t weight_count, float **weights);
+
+// output channels of the last conv or fc layer when only bias and batchnorm
+// layers follow it, which can fold into it, 0 otherwise, a conv bias is per
+// channel so it does not fold once the activations are flat
+int FoldChannels(const LayerTable *table, const int flat);
+
+// when ok, optimizes the layers and moves them with their weights into model,
+// frees the table either way
+int FinishImport(LayerTable *table, const int ok, ImportedModel *model);
+
+void FreeImportedModel(ImportedModel *model);
+
+#endif  // IMPORT_H_
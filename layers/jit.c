@@ -0,0 +1,638 @@
+#include "jit.h"
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#if defined(__x86_64__)
+
+// The emitted code is straight-line AVX2 + FMA. Activations are kept
+// channels-last with the channels of every pixel padded to whole vectors, so
+// the output channels of a layer sit in the lanes of one register and every
+// tap is a broadcast of one input value times a vector of weights. All loops
+// are unrolled at compile time, every activation and weight access is an
+// immediate displacement from rsi (the blob) or rax (the layer's weights),
+// padding taps are simply not emitted, and relu / maxpool run on the
+// accumulators before anything is stored.
+
+#define LANES       8
+#define MAX_TENSORS 64
+
+enum { RAX = 0, RSI = 6, RDI = 7 };
+enum { MAP_0F = 1, MAP_0F38 = 2 };
+enum { PP_NONE = 0, PP_66 = 1, PP_F3 = 2 };
+enum {
+    OP_MOVUPS_LOAD = 0x10, OP_MOVUPS_STORE = 0x11, OP_BROADCASTSS = 0x18,
+    OP_PMOVZXBD = 0x31, OP_XORPS = 0x57, OP_CVTDQ2PS = 0x5B,
+    OP_MINPS = 0x5D, OP_MAXPS = 0x5F, OP_FMADD231PS = 0xB8
+};
+
+// registers of the fused epilogues
+#define YMM_TMP     12
+#define YMM_ALPHA   13
+#define YMM_ZERO    14
+#define YMM_BCAST   15
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    int failed;
+} CodeBuffer;
+
+// channels-last activation in the blob
+typedef struct {
+    int offset;
+    int h, w, c;
+    // floats per pixel, 1 for the input image and whole vectors otherwise
+    int ps;
+} JitTensor;
+
+static void EmitByte(CodeBuffer *buf, const uint8_t byte)
+{
+    if (buf->size == buf->capacity)
+    {
+        const size_t capacity = buf->capacity > 0 ? 2 * buf->capacity : 4096;
+        uint8_t *data = realloc(buf->data, capacity);
+        if (data == NULL)
+        {
+            buf->failed = 1;
+            return;
+        }
+        buf->data = data;
+        buf->capacity = capacity;
+    }
+    buf->data[buf->size++] = byte;
+}
+
+static void EmitInt32(CodeBuffer *buf, const int32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        EmitByte(buf, (uint8_t)((uint32_t)value >> (8 * i)));
+}
+
+static void EmitModRM(CodeBuffer *buf, const int reg, const int base, const int32_t disp)
+{
+    // [base + disp], base is never rsp or rbp so there is no sib byte
+    if (disp == 0)
+    {
+        EmitByte(buf, ((reg & 7) << 3) | base);
+    }
+    else if (disp >= -128 && disp <= 127)
+    {
+        EmitByte(buf, 0x40 | ((reg & 7) << 3) | base);
+        EmitByte(buf, (uint8_t)disp);
+    }
+    else
+    {
+        EmitByte(buf, 0x80 | ((reg & 7) << 3) | base);
+        EmitInt32(buf, disp);
+    }
+}
+
+static void EmitVex(
+    CodeBuffer *buf, const int map, const int pp, const int l,
+    const int reg, const int vvvv, const int rm_high
+)
+{
+    const int r = !(reg & 8);
+    const int b = !rm_high;
+    if (map == MAP_0F && b)
+    {
+        EmitByte(buf, 0xC5);
+        EmitByte(buf, (r << 7) | ((~vvvv & 15) << 3) | (l << 2) | pp);
+    }
+    else
+    {
+        EmitByte(buf, 0xC4);
+        EmitByte(buf, (r << 7) | (1 << 6) | (b << 5) | map);
+        EmitByte(buf, ((~vvvv & 15) << 3) | (l << 2) | pp);
+    }
+}
+
+// op ymm(reg), ymm(vvvv), [base + disp]
+static void EmitVecMem(
+    CodeBuffer *buf, const int map, const int pp, const int op,
+    const int reg, const int vvvv, const int base, const int32_t disp
+)
+{
+    EmitVex(buf, map, pp, 1, reg, vvvv, 0);
+    EmitByte(buf, op);
+    EmitModRM(buf, reg, base, disp);
+}
+
+// op ymm(reg), ymm(vvvv), ymm(rm)
+static void EmitVecReg(
+    CodeBuffer *buf, const int map, const int pp, const int op,
+    const int reg, const int vvvv, const int rm
+)
+{
+    EmitVex(buf, map, pp, 1, reg, vvvv, rm >= 8);
+    EmitByte(buf, op);
+    EmitByte(buf, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void EmitLoad(CodeBuffer *buf, const int dst, const int base, const int floats)
+{
+    EmitVecMem(buf, MAP_0F, PP_NONE, OP_MOVUPS_LOAD, dst, 0, base, floats * 4);
+}
+
+static void EmitStore(CodeBuffer *buf, const int base, const int floats, const int src)
+{
+    EmitVecMem(buf, MAP_0F, PP_NONE, OP_MOVUPS_STORE, src, 0, base, floats * 4);
+}
+
+static void EmitBroadcast(CodeBuffer *buf, const int dst, const int base, const int floats)
+{
+    EmitVecMem(buf, MAP_0F38, PP_66, OP_BROADCASTSS, dst, 0, base, floats * 4);
+}
+
+static void EmitFma(CodeBuffer *buf, const int acc, const int a, const int b)
+{
+    EmitVecReg(buf, MAP_0F38, PP_66, OP_FMADD231PS, acc, a, b);
+}
+
+static void EmitFmaMem(CodeBuffer *buf, const int acc, const int a, const int base, const int floats)
+{
+    EmitVecMem(buf, MAP_0F38, PP_66, OP_FMADD231PS, acc, a, base, floats * 4);
+}
+
+static void EmitMax(CodeBuffer *buf, const int dst, const int a, const int b)
+{
+    EmitVecReg(buf, MAP_0F, PP_NONE, OP_MAXPS, dst, a, b);
+}
+
+static void EmitMaxMem(CodeBuffer *buf, const int dst, const int a, const int base, const int floats)
+{
+    EmitVecMem(buf, MAP_0F, PP_NONE, OP_MAXPS, dst, a, base, floats * 4);
+}
+
+static void EmitMovImm64(CodeBuffer *buf, const int reg, const void *ptr)
+{
+    // mov reg, imm64
+    const uint64_t value = (uint64_t)(uintptr_t)ptr;
+    EmitByte(buf, 0x48);
+    EmitByte(buf, 0xB8 + reg);
+    for (int i = 0; i < 8; ++i)
+        EmitByte(buf, (uint8_t)(value >> (8 * i)));
+}
+
+static void EmitReLUSetup(CodeBuffer *buf, const int alpha_floats)
+{
+    // ymm14 = 0, ymm13 = alpha from the constant slot of the layer
+    EmitVecReg(buf, MAP_0F, PP_NONE, OP_XORPS, YMM_ZERO, YMM_ZERO, YMM_ZERO);
+    EmitBroadcast(buf, YMM_ALPHA, RAX, alpha_floats);
+}
+
+static void EmitReLU(CodeBuffer *buf, const int acc)
+{
+    // max(x, 0) + alpha * min(x, 0) holds for any alpha
+    EmitVecReg(buf, MAP_0F, PP_NONE, OP_MINPS, YMM_TMP, acc, YMM_ZERO);
+    EmitMax(buf, acc, acc, YMM_ZERO);
+    EmitFma(buf, acc, YMM_TMP, YMM_ALPHA);
+}
+
+static void EmitInput(CodeBuffer *buf, const JitTensor *in)
+{
+    // uint8 pixels widened to floats, the 1 / 255 is folded into the weights
+    const int size = in->h * in->w;
+    int i = 0;
+    for (; i + LANES <= size; i += LANES)
+    {
+        EmitVecMem(buf, MAP_0F38, PP_66, OP_PMOVZXBD, 0, 0, RDI, i);
+        EmitVecReg(buf, MAP_0F, PP_NONE, OP_CVTDQ2PS, 0, 0, 0);
+        EmitStore(buf, RSI, in->offset + i, 0);
+    }
+    for (; i < size; ++i)
+    {
+        // movzx eax, byte [rdi + i]; vcvtsi2ss xmm0, xmm0, eax; vmovss [rsi], xmm0
+        EmitByte(buf, 0x0F);
+        EmitByte(buf, 0xB6);
+        EmitModRM(buf, RAX, RDI, i);
+        EmitVex(buf, MAP_0F, PP_F3, 0, 0, 0, 0);
+        EmitByte(buf, 0x2A);
+        EmitByte(buf, 0xC0 | RAX);
+        EmitVex(buf, MAP_0F, PP_F3, 0, 0, 0, 0);
+        EmitByte(buf, OP_MOVUPS_STORE);
+        EmitModRM(buf, 0, RSI, (in->offset + i) * 4);
+    }
+}
+
+static void EmitConvGroup(
+    CodeBuffer *buf, const JitTensor *in, const int kernel_size, const int padding,
+    const int block, const int *ys, const int *xs, const int count
+)
+{
+    // up to 4 conv outputs of one channel block in ymm0-3, they share every
+    // weight load in ymm4 and broadcast their inputs into ymm5-8
+    const int taps = kernel_size * kernel_size * in->c;
+    for (int j = 0; j < count; ++j)
+        EmitLoad(buf, j, RAX, block + taps * LANES);
+    for (int kh = 0; kh < kernel_size; ++kh)
+    {
+        for (int kw = 0; kw < kernel_size; ++kw)
+        {
+            int valid[4];
+            int any = 0;
+            for (int j = 0; j < count; ++j)
+            {
+                const int iy = ys[j] + kh - padding;
+                const int ix = xs[j] + kw - padding;
+                valid[j] = iy >= 0 && iy < in->h && ix >= 0 && ix < in->w;
+                any |= valid[j];
+            }
+            if (!any)
+                continue;
+            for (int ic = 0; ic < in->c; ++ic)
+            {
+                const int weight = block + ((kh * kernel_size + kw) * in->c + ic) * LANES;
+                EmitLoad(buf, 4, RAX, weight);
+                for (int j = 0; j < count; ++j)
+                {
+                    if (!valid[j])
+                        continue;
+                    const int iy = ys[j] + kh - padding;
+                    const int ix = xs[j] + kw - padding;
+                    EmitBroadcast(buf, 5 + j, RSI, in->offset + (iy * in->w + ix) * in->ps + ic);
+                    EmitFma(buf, j, 5 + j, 4);
+                }
+            }
+        }
+    }
+}
+
+static void EmitConv(
+    CodeBuffer *buf, const Layer *layer, const JitTensor *in, const JitTensor *out,
+    const float *packed, const int pool_size, const int relu, const float alpha
+)
+{
+    const int kernel_size = layer->kernel_size;
+    const int padding = layer->padding;
+    const int block_size = (kernel_size * kernel_size * in->c + 1) * LANES;
+    const int blocks = out->ps / LANES;
+    EmitMovImm64(buf, RAX, packed);
+    if (relu)
+        EmitReLUSetup(buf, blocks * block_size);
+
+    int ys[4], xs[4];
+    if (pool_size > 1)
+    {
+        // the window is reduced in registers, relu goes after the max when it
+        // is monotonic
+        for (int oy = 0; oy < out->h; ++oy)
+        {
+            for (int ox = 0; ox < out->w; ++ox)
+            {
+                int count = 0;
+                for (int dy = 0; dy < pool_size; ++dy)
+                {
+                    for (int dx = 0; dx < pool_size; ++dx)
+                    {
+                        ys[count] = oy * pool_size + dy;
+                        xs[count++] = ox * pool_size + dx;
+                    }
+                }
+                for (int b = 0; b < blocks; ++b)
+                {
+                    EmitConvGroup(buf, in, kernel_size, padding, b * block_size, ys, xs, count);
+                    for (int j = 0; relu && alpha < 0.0f && j < count; ++j)
+                        EmitReLU(buf, j);
+                    for (int j = 1; j < count; ++j)
+                        EmitMax(buf, 0, 0, j);
+                    if (relu && alpha >= 0.0f)
+                        EmitReLU(buf, 0);
+                    EmitStore(buf, RSI, out->offset + (oy * out->w + ox) * out->ps + b * LANES, 0);
+                }
+            }
+        }
+        return;
+    }
+
+    // plain conv, 4 neighbouring outputs at a time
+    const int pixels = out->h * out->w;
+    for (int p = 0; p < pixels; p += 4)
+    {
+        const int count = pixels - p < 4 ? pixels - p : 4;
+        for (int j = 0; j < count; ++j)
+            ys[j] = (p + j) / out->w, xs[j] = (p + j) % out->w;
+        for (int b = 0; b < blocks; ++b)
+        {
+            EmitConvGroup(buf, in, kernel_size, padding, b * block_size, ys, xs, count);
+            for (int j = 0; j < count; ++j)
+            {
+                if (relu)
+                    EmitReLU(buf, j);
+                EmitStore(buf, RSI, out->offset + (p + j) * out->ps + b * LANES, j);
+            }
+        }
+    }
+}
+
+static void EmitMaxPool(
+    CodeBuffer *buf, const Layer *layer, const JitTensor *in, const JitTensor *out,
+    const float *packed, const int relu
+)
+{
+    // taps in the padding or past the edge are dropped here, every window
+    // keeps at least one
+    const int kernel_size = layer->kernel_size, stride = layer->stride, padding = layer->padding;
+    EmitMovImm64(buf, RAX, packed);
+    if (relu)
+        EmitReLUSetup(buf, 0);
+    for (int oy = 0; oy < out->h; ++oy)
+    {
+        for (int ox = 0; ox < out->w; ++ox)
+        {
+            for (int b = 0; b < out->ps / LANES; ++b)
+            {
+                int taps = 0;
+                for (int y = oy * stride - padding; y < oy * stride - padding + kernel_size; ++y)
+                {
+                    for (int x = ox * stride - padding; x < ox * stride - padding + kernel_size; ++x)
+                    {
+                        if (y < 0 || y >= in->h || x < 0 || x >= in->w)
+                            continue;
+                        const int disp = in->offset + (y * in->w + x) * in->ps + b * LANES;
+                        if (taps++ == 0)
+                            EmitLoad(buf, 0, RSI, disp);
+                        else
+                            EmitMaxMem(buf, 0, 0, RSI, disp);
+                    }
+                }
+                if (relu)
+                    EmitReLU(buf, 0);
+                EmitStore(buf, RSI, out->offset + (oy * out->w + ox) * out->ps + b * LANES, 0);
+            }
+        }
+    }
+}
+
+static void EmitStandaloneReLU(CodeBuffer *buf, const JitTensor *t, const float *packed)
+{
+    EmitMovImm64(buf, RAX, packed);
+    EmitReLUSetup(buf, 0);
+    for (int i = 0; i < t->h * t->w * t->ps; i += LANES)
+    {
+        EmitLoad(buf, 0, RSI, t->offset + i);
+        EmitReLU(buf, 0);
+        EmitStore(buf, RSI, t->offset + i, 0);
+    }
+}
+
+static int ZeroVector(const float *v)
+{
+    for (int i = 0; i < LANES; ++i)
+    {
+        if (v[i] != 0.0f)
+            return 0;
+    }
+    return 1;
+}
+
+static void EmitFC(
+    CodeBuffer *buf, const JitTensor *in, const JitTensor *out,
+    const float *packed, const int relu
+)
+{
+    // outputs in the lanes of up to 12 accumulators, one broadcast per input
+    // feature feeds all of them straight from the packed rows, weight vectors
+    // that are all zero, the blocks a pruned model drops, are not emitted
+    const int feat = in->h * in->w * in->c;
+    const int vectors = out->ps / LANES;
+    EmitMovImm64(buf, RAX, packed);
+    if (relu)
+        EmitReLUSetup(buf, (feat + 1) * out->ps);
+    for (int v0 = 0; v0 < vectors; v0 += 12)
+    {
+        const int count = vectors - v0 < 12 ? vectors - v0 : 12;
+        for (int v = 0; v < count; ++v)
+            EmitLoad(buf, v, RAX, feat * out->ps + (v0 + v) * LANES);
+        int j = 0;
+        for (int p = 0; p < in->h * in->w; ++p)
+        {
+            for (int c = 0; c < in->c; ++c, ++j)
+            {
+                int used = 0;
+                for (int v = 0; v < count; ++v)
+                    used += !ZeroVector(&packed[j * out->ps + (v0 + v) * LANES]);
+                if (used == 0)
+                    continue;
+                EmitBroadcast(buf, YMM_BCAST, RSI, in->offset + p * in->ps + c);
+                for (int v = 0; v < count; ++v)
+                {
+                    if (!ZeroVector(&packed[j * out->ps + (v0 + v) * LANES]))
+                        EmitFmaMem(buf, v, YMM_BCAST, RAX, j * out->ps + (v0 + v) * LANES);
+                }
+            }
+        }
+        for (int v = 0; v < count; ++v)
+        {
+            if (relu)
+                EmitReLU(buf, v);
+            EmitStore(buf, RSI, out->offset + (v0 + v) * LANES, v);
+        }
+    }
+}
+
+static int RoundUp(const int value, const int align)
+{
+    return (value + align - 1) / align * align;
+}
+
+static size_t PackedSize(const Layer *layer, const JitTensor *in, const JitTensor *out)
+{
+    // weights of the layer followed by one vector of constants
+    size_t size = LANES;
+    if (layer->type == LAYER_CONV || layer->type == LAYER_CONV_RELU_POOL)
+        size += (size_t)(out->ps / LANES) * (layer->kernel_size * layer->kernel_size * in->c + 1) * LANES;
+    else if (layer->type == LAYER_FC || layer->type == LAYER_FC_SPARSE)
+        size += (size_t)(in->h * in->w * in->c + 1) * out->ps;
+    return size;
+}
+
+static void PackLayer(
+    const Layer *layer, const JitTensor *in, const JitTensor *out, float *packed, const float alpha
+)
+{
+    const size_t size = PackedSize(layer, in, out);
+    memset(packed, 0, size * sizeof(float));
+    packed[size - LANES] = alpha;
+    if (layer->type == LAYER_CONV || layer->type == LAYER_CONV_RELU_POOL)
+    {
+        // [block][tap][in channel][lane] followed by the bias of the block
+        const int kk = layer->kernel_size * layer->kernel_size;
+        const int taps = kk * in->c;
+        const int block_size = (taps + 1) * LANES;
+        for (int oc = 0; oc < out->c; ++oc)
+        {
+            const float *w = &layer->weights[oc * (taps + 1)];
+            float *block = &packed[oc / LANES * block_size];
+            const int lane = oc % LANES;
+            for (int ic = 0; ic < in->c; ++ic)
+            {
+                for (int t = 0; t < kk; ++t)
+                    block[(t * in->c + ic) * LANES + lane] = w[ic * kk + t];
+            }
+            block[taps * LANES + lane] = w[taps];
+        }
+    }
+    else if (layer->type == LAYER_FC || layer->type == LAYER_FC_SPARSE)
+    {
+        // one row of out->ps outputs per (pixel, channel) in the order the
+        // code reads them, the flatten order of the weights is [c][h][w]
+        const int spatial = in->h * in->w;
+        const int feat = spatial * in->c;
+        for (int o = 0; o < out->c; ++o)
+        {
+            const float *w = &layer->weights[o * (feat + 1)];
+            for (int p = 0; p < spatial; ++p)
+            {
+                for (int c = 0; c < in->c; ++c)
+                    packed[(p * in->c + c) * out->ps + o] = w[c * spatial + p];
+            }
+            packed[feat * out->ps + o] = w[feat];
+        }
+    }
+}
+
+int JitCompile(const Layer *layers, const int num_layers, JitModel *jit)
+{
+    memset(jit, 0, sizeof(JitModel));
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("fma") ||
+        num_layers <= 0 || num_layers + 1 > MAX_TENSORS)
+    {
+        return 0;
+    }
+
+    // tensor i + 1 is the output of layer i, in-place relu keeps its input
+    JitTensor tensors[MAX_TENSORS];
+    int relu_fused[MAX_TENSORS] = { 0, };
+    tensors[0].h = layers[0].in_h, tensors[0].w = layers[0].in_w;
+    tensors[0].c = layers[0].in_c, tensors[0].ps = layers[0].in_c;
+    if (layers[0].in_c != 1)
+        return 0;
+    int region = tensors[0].h * tensors[0].w;
+    size_t packed_size = 0;
+    for (int i = 0; i < num_layers; ++i)
+    {
+        const Layer *layer = &layers[i];
+        JitTensor *in = &tensors[i];
+        JitTensor *out = &tensors[i + 1];
+        *out = *in;
+        if (layer->type == LAYER_CONV || layer->type == LAYER_CONV_RELU_POOL ||
+            layer->type == LAYER_MAXPOOL || layer->type == LAYER_FC || layer->type == LAYER_FC_SPARSE)
+        {
+            out->h = layer->out_h, out->w = layer->out_w, out->c = layer->out_c;
+            out->ps = RoundUp(out->c, LANES);
+        }
+        else if (layer->type != LAYER_RELU || in->ps % LANES != 0)
+        {
+            return 0;
+        }
+        if (layer->type == LAYER_CONV_RELU_POOL && layer->pool_size != 2)
+            return 0;
+        // a relu right after a conv, maxpool or fc runs on its accumulators
+        if (layer->type == LAYER_RELU && i > 0 && layers[i - 1].type != LAYER_RELU &&
+            layers[i - 1].type != LAYER_CONV_RELU_POOL)
+        {
+            relu_fused[i] = 1;
+        }
+        packed_size += PackedSize(layer, in, out);
+        if (out->h * out->w * out->ps > region)
+            region = out->h * out->w * out->ps;
+    }
+
+    // two ping-pong regions, relu works in place
+    region = RoundUp(region, ALIGN_SIZE / sizeof(float));
+    int side = 0;
+    tensors[0].offset = 0;
+    for (int i = 0; i < num_layers; ++i)
+    {
+        if (layers[i].type != LAYER_RELU)
+            side ^= 1;
+        tensors[i + 1].offset = side * region;
+    }
+
+    jit->weight_bytes = RoundUp(packed_size * sizeof(float), ALIGN_SIZE);
+    jit->weights = aligned_alloc(ALIGN_SIZE, jit->weight_bytes);
+    if (jit->weights == NULL)
+        return 0;
+    CodeBuffer buf = { 0, };
+    EmitInput(&buf, &tensors[0]);
+    float *packed = jit->weights;
+    for (int i = 0; i < num_layers; ++i)
+    {
+        const Layer *layer = &layers[i];
+        const JitTensor *in = &tensors[i];
+        const JitTensor *out = &tensors[i + 1];
+        const int relu_next = i + 1 < num_layers && relu_fused[i + 1];
+        const float alpha = relu_next ? layers[i + 1].alpha : layer->alpha;
+        PackLayer(layer, in, out, packed, alpha);
+        if (layer->type == LAYER_CONV)
+            EmitConv(&buf, layer, in, out, packed, 1, relu_next, alpha);
+        else if (layer->type == LAYER_CONV_RELU_POOL)
+            EmitConv(&buf, layer, in, out, packed, layer->pool_size, 1, alpha);
+        else if (layer->type == LAYER_MAXPOOL)
+            EmitMaxPool(&buf, layer, in, out, packed, relu_next);
+        else if (layer->type == LAYER_FC || layer->type == LAYER_FC_SPARSE)
+            EmitFC(&buf, in, out, packed, relu_next);
+        else if (!relu_fused[i])
+            EmitStandaloneReLU(&buf, out, packed);
+        packed += PackedSize(layer, in, out);
+    }
+    // vzeroupper; ret
+    EmitByte(&buf, 0xC5);
+    EmitByte(&buf, 0xF8);
+    EmitByte(&buf, 0x77);
+    EmitByte(&buf, 0xC3);
+    if (buf.failed)
+    {
+        free(buf.data);
+        JitFree(jit);
+        return 0;
+    }
+
+    void *code = mmap(NULL, buf.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+    {
+        free(buf.data);
+        JitFree(jit);
+        return 0;
+    }
+    memcpy(code, buf.data, buf.size);
+    free(buf.data);
+    if (mprotect(code, buf.size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(code, buf.size);
+        JitFree(jit);
+        return 0;
+    }
+    jit->code = code;
+    jit->code_size = buf.size;
+    jit->forward = (JitForward)code;
+    jit->blob_size = 2 * region;
+    jit->out_offset = tensors[num_layers].offset;
+    jit->classes = tensors[num_layers].c;
+    return 1;
+}
+
+#else
+
+int JitCompile(const Layer *layers, const int num_layers, JitModel *jit)
+{
+    // no code generator for this architecture, the interpreter runs instead
+    (void)layers, (void)num_layers;
+    memset(jit, 0, sizeof(JitModel));
+    return 0;
+}
+
+#endif
+
+void JitFree(JitModel *jit)
+{
+    if (jit->code != NULL)
+        munmap(jit->code, jit->code_size);
+    free(jit->weights);
+    memset(jit, 0, sizeof(JitModel));
+}
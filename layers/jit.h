@@ -0,0 +1,30 @@
+#ifndef JIT_H_
+#define JIT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "layers.h"
+
+// forward pass of one image, reads the uint8 pixels and leaves the logits at
+// blob[out_offset]
+typedef void (*JitForward)(const uint8_t *pixels, float *blob);
+
+typedef struct {
+    JitForward forward;
+    void *code;
+    size_t code_size;
+    // weights repacked for the emitted code, and their bytes
+    float *weights;
+    size_t weight_bytes;
+    int blob_size;
+    int out_offset;
+    int classes;
+} JitModel;
+
+// emits a forward function for the layers left by BuildModel(), returns 0
+// when the cpu or one of the layers is not supported by the jit
+int JitCompile(const Layer *layers, const int num_layers, JitModel *jit);
+
+void JitFree(JitModel *jit);
+
+#endif  // JIT_H_
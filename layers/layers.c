@@ -1,21 +1,22 @@
 #include "layers.h"
+#include "gemm.h"
 #include "config.h"
-#include <cblas.h>
-#include <omp.h>
-
-static float Im2Col_Buf[MAX_THREADS * IM2COL_BUF_SIZE]
-    __attribute__((aligned(ALIGN_SIZE))) = { 0.0f, };
+#include <stdlib.h>
+#include <string.h>
 
 static int Im2Col(
-    const float *data_im, float *data_col,
+    const float *data_im, float *data_col, const int batch,
     const int in_c, const int in_h, const int in_w,
     const int out_c, const int out_h, const int out_w,
     const int kernel_size, const int padding, const int stride
 )
 {
+    // images of a batch are placed side by side, the input is laid out as
+    // [in_c][batch][in_h * in_w] and every row of data_col as [batch][out_h * out_w]
     int col_i = 0;
     const int kk = kernel_size * kernel_size;
-    const int data_col_size = kk * in_c * out_h * out_w;
+    const int cols = batch * out_h * out_w;
+    const int data_col_size = kk * in_c * cols;
     for (int ch = 0; ch < in_c; ++ch)
     {
         for (int kh = 0; kh < kernel_size; ++kh)
@@ -23,16 +24,20 @@ static int Im2Col(
             for (int kw = 0; kw < kernel_size; ++kw)
             {
                 int row_i = ch * kk + kh * kernel_size + kw;
-                for (int oh = 0; oh < out_h; ++oh)
+                for (int b = 0; b < batch; ++b)
                 {
-                    int ih = oh * stride + kh - padding;
-                    for (int ow = 0; ow < out_w; ++ow)
+                    const float *plane = &data_im[(ch * batch + b) * (in_h * in_w)];
+                    for (int oh = 0; oh < out_h; ++oh)
                     {
-                        int iw = ow * stride + kw - padding;
-                        if (ih >= 0 && ih < in_h && iw >= 0 && iw < in_w)
-                            data_col[row_i * (out_h * out_w) + col_i++] = data_im[ch * (in_h * in_w) + ih * in_w + iw];
-                        else
-                            data_col[row_i * (out_h * out_w) + col_i++] = 0.0f;
+                        int ih = oh * stride + kh - padding;
+                        for (int ow = 0; ow < out_w; ++ow)
+                        {
+                            int iw = ow * stride + kw - padding;
+                            if (ih >= 0 && ih < in_h && iw >= 0 && iw < in_w)
+                                data_col[row_i * cols + col_i++] = plane[ih * in_w + iw];
+                            else
+                                data_col[row_i * cols + col_i++] = 0.0f;
+                        }
                     }
                 }
                 col_i = 0;
@@ -40,72 +45,128 @@ static int Im2Col(
         }
     }
     data_col += data_col_size;
-    for (int col = out_h * out_w; col--; *data_col++ = 1.0f);
-    return data_col_size + out_h * out_w;
+    for (int col = cols; col--; *data_col++ = 1.0f);
+    return data_col_size + cols;
 }
 
 int ConvLayer(
     const float *bottom, float *top,
     const int in_c, const int in_h, const int in_w,
     const int out_c, const int out_h, const int out_w,
-    const float *weights, const int kernel_size, const int padding
+    const float *weights, const float *packed, const float *winograd,
+    const int kernel_size, const int padding,
+    float *col_buf
 )
 {
-    const int t_id = omp_get_thread_num();
-    float *data_col = &Im2Col_Buf[t_id * IM2COL_BUF_SIZE];
+    // col_buf is only touched by shapes without a direct kernel
+    int top_size = winograd != NULL ? ConvWinograd(
+        bottom, top, 1, in_c, in_h, in_w, out_c, out_h, out_w, winograd, padding
+    ) : 0;
+    if (top_size == 0)
+    {
+        top_size = ConvDirectLayer(
+            bottom, top, 1, in_c, in_h, in_w, out_c, out_h, out_w,
+            weights, kernel_size, padding
+        );
+    }
+    if (top_size > 0)
+        return top_size;
+
     Im2Col(
-        bottom, data_col, in_c, in_h, in_w, out_c, out_h, out_w, kernel_size, padding, 1
+        bottom, col_buf, 1, in_c, in_h, in_w, out_c, out_h, out_w, kernel_size, padding, 1
     );
     const int m = out_c;
     const int n = out_h * out_w;
     const int k = kernel_size * kernel_size * in_c + 1;
-    cblas_sgemm(
-        CblasRowMajor, CblasNoTrans, CblasNoTrans,
-        m, n, k, 1.0f, weights, k, data_col, n, 0.0f, top, n
+    GemmPanels(packed, col_buf, top, m, n, k, n, n);
+    return m * n;
+}
+
+int ConvLayerBatch(
+    const float *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *weights, const float *packed, const float *winograd,
+    const int kernel_size, const int padding,
+    float *col_buf
+)
+{
+    int top_size = winograd != NULL ? ConvWinograd(
+        bottom, top, batch, in_c, in_h, in_w, out_c, out_h, out_w, winograd, padding
+    ) : 0;
+    if (top_size == 0)
+    {
+        top_size = ConvDirectLayer(
+            bottom, top, batch, in_c, in_h, in_w, out_c, out_h, out_w,
+            weights, kernel_size, padding
+        );
+    }
+    if (top_size > 0)
+        return top_size;
+
+    // col_buf holds (kernel_size^2 * in_c + 1) * batch * out_h * out_w floats
+    Im2Col(
+        bottom, col_buf, batch, in_c, in_h, in_w, out_c, out_h, out_w, kernel_size, padding, 1
     );
+    // one sgemm for the whole batch, top is laid out as [out_c][batch][out_h * out_w]
+    const int m = out_c;
+    const int n = batch * out_h * out_w;
+    const int k = kernel_size * kernel_size * in_c + 1;
+    GemmPanels(packed, col_buf, top, m, n, k, n, n);
     return m * n;
 }
 
-int MaxPoolingLayer(
-    const float *bottom, float *top,
+int ConvReluPoolLayer(
+    const float *bottom, float *top, const int batch,
     const int in_c, const int in_h, const int in_w,
     const int out_c, const int out_h, const int out_w,
-    const int kernel_size, const int stride
+    const float *weights, const float *packed, const float *winograd,
+    const int kernel_size, const int padding,
+    const float alpha, const int pool_size,
+    float *col_buf
 )
 {
-    int top_size = 0;
-    for (int ch = 0; ch < in_c; ++ch)
+    // out_h and out_w are the pooled dims
+    int top_size = winograd != NULL ? ConvReluPoolWinograd(
+        bottom, top, batch, in_c, in_h, in_w, out_c, out_h, out_w,
+        winograd, padding, alpha, pool_size
+    ) : 0;
+    if (top_size == 0)
     {
-        for (int oh = 0; oh < out_h; ++oh)
-        {
-            for (int ow = 0; ow < out_w; ++ow)
-            {
-                int in_pos = ch * in_h * in_w + oh * kernel_size * in_w + ow * kernel_size;
-                float max_value = bottom[in_pos];
-                for (int m = 0; m < kernel_size; ++m)
-                {
-                    for (int n = 0; n < kernel_size; ++n)
-                    {
-                        int index = in_pos + m * in_w + n;
-                        if ((ow >= in_w / stride && n >= in_w % kernel_size) ||
-                            (oh >= in_h / stride && m >= in_h % kernel_size))
-                        {
-                            continue;
-                        }
-                        max_value = bottom[index] > max_value ? bottom[index] : max_value;
-                    }
-                }
-                top[top_size++] = max_value;
-            }
-        }
+        top_size = ConvReluPoolDirect(
+            bottom, top, batch, in_c, in_h, in_w, out_c, out_h, out_w,
+            weights, kernel_size, padding, alpha, pool_size
+        );
     }
+    if (top_size > 0)
+        return top_size;
+
+    // unfused fallback, top needs room for the full-resolution conv output
+    const int conv_h = in_h - kernel_size + 2 * padding + 1;
+    const int conv_w = in_w - kernel_size + 2 * padding + 1;
+    const int conv_size = ConvLayerBatch(
+        bottom, top, batch, in_c, in_h, in_w, out_c, conv_h, conv_w,
+        weights, packed, winograd, kernel_size, padding, col_buf
+    );
+    ReLU(top, conv_size, alpha);
+    top_size = PoolingLayer(
+        top, &top[conv_size], out_c * batch, conv_h, conv_w, out_h, out_w, pool_size, pool_size, 0, 0
+    );
+    memmove(top, &top[conv_size], top_size * sizeof(float));
     return top_size;
 }
 
 void ReLU(float *data, const int size, const float alpha)
 {
+    // branch free so that the loop vectorizes, about half the values are
+    // negative, one of the two parts is 0 so the sum is exact
     for (int i = 0; i < size; ++i)
-        data[i] = data[i] > 0.0f ? data[i] : data[i] * alpha;
+    {
+        const float value = data[i];
+        const float pos = value > 0.0f ? value : 0.0f;
+        const float neg = value < 0.0f ? value : 0.0f;
+        data[i] = pos + neg * alpha;
+    }
 }
 
 int FCLayer(
@@ -113,10 +174,135 @@ int FCLayer(
     int out_feat, int in_feat
 )
 {
-    cblas_sgemv(
-        CblasRowMajor, CblasNoTrans,
-        out_feat, in_feat, 1.0f, Fc1, in_feat,
-        bottom, 1, 0.0f, top, 1
-    );
+    GemvPanels(Fc1, bottom, top, out_feat, in_feat);
     return out_feat;
-}
\ No newline at end of file
+}
+
+int FCLayerBatch(
+    const float *Fc1, const float *bottom, float *top, const int batch,
+    int out_feat, int in_feat
+)
+{
+    // bottom holds one feature row per image, each row of top gets a trailing
+    // 1.0f so that it can feed the next fc layer directly
+    const int ldc = out_feat + 1;
+    GemmPanelsT(Fc1, bottom, top, batch, out_feat, in_feat, ldc);
+    for (int b = 0; b < batch; ++b)
+        top[b * ldc + out_feat] = 1.0f;
+    return batch * ldc;
+}
+
+int FlattenBatch(
+    const float *bottom, float *top, const int batch,
+    const int channels, const int spatial
+)
+{
+    // [channels][batch][spatial] -> [batch][channels * spatial + 1]
+    const int feat = channels * spatial;
+    for (int b = 0; b < batch; ++b)
+    {
+        float *row = &top[b * (feat + 1)];
+        for (int ch = 0; ch < channels; ++ch)
+        {
+            const float *plane = &bottom[(ch * batch + b) * spatial];
+            for (int s = 0; s < spatial; ++s)
+                row[ch * spatial + s] = plane[s];
+        }
+        row[feat] = 1.0f;
+    }
+    return batch * (feat + 1);
+}
+
+int PlainMaxPool(const Layer *layer)
+{
+    // windows that tile the input, which is what the fused kernels pool
+    const int kernel_size = layer->kernel_size;
+    return layer->type == LAYER_MAXPOOL && layer->stride == kernel_size && layer->padding == 0 &&
+        layer->out_h == layer->in_h / kernel_size && layer->out_w == layer->in_w / kernel_size;
+}
+
+int FuseLayers(Layer *layers, const int num_layers)
+{
+    // rewrites every conv -> relu -> maxpool into one LAYER_CONV_RELU_POOL,
+    // returns the new number of layers
+    int count = 0;
+    for (int i = 0; i < num_layers; ++i)
+    {
+        layers[count] = layers[i];
+        if (i + 2 < num_layers && layers[i].type == LAYER_CONV &&
+            layers[i + 1].type == LAYER_RELU && PlainMaxPool(&layers[i + 2]))
+        {
+            layers[count].type = LAYER_CONV_RELU_POOL;
+            layers[count].alpha = layers[i + 1].alpha;
+            layers[count].pool_size = layers[i + 2].kernel_size;
+            layers[count].act_scale = layers[i + 2].act_scale;
+            i += 2;
+        }
+        ++count;
+    }
+    return count;
+}
+
+void FoldInputScale(
+    Layer *layer, const int rows, const int cols, const float scale, float *buffer
+)
+{
+    // copies the rows x cols weights of the first layer into buffer with every
+    // column but the trailing bias scaled, so the layer can take unscaled input
+    for (int r = 0; r < rows; ++r)
+    {
+        for (int c = 0; c < cols - 1; ++c)
+            buffer[r * cols + c] = layer->weights[r * cols + c] * scale;
+        buffer[r * cols + cols - 1] = layer->weights[r * cols + cols - 1];
+    }
+    layer->weights = buffer;
+}
+
+static int RunsGemm(const Layer *layer)
+{
+    // the same kernel choice as InferShapes() makes for the im2col columns
+    const int c = layer->in_c, h = layer->in_h, w = layer->in_w;
+    if (layer->type == LAYER_FC)
+        return 1;
+    if (layer->type == LAYER_CONV_RELU_POOL &&
+        ConvReluPoolSupported(c, h, w, layer->kernel_size, layer->padding, layer->alpha, layer->pool_size))
+    {
+        return 0;
+    }
+    return (layer->type == LAYER_CONV || layer->type == LAYER_CONV_RELU_POOL) &&
+        !ConvDirectSupported(c, h, w, layer->kernel_size, layer->padding, 0);
+}
+
+float *PackLayers(Layer *layers, const int num_layers)
+{
+    // rows are output channels or features, columns the weights of one with
+    // the bias last
+    size_t count = 0;
+    const size_t align = ALIGN_SIZE / sizeof(float);
+    for (int i = 0; i < num_layers; ++i)
+    {
+        Layer *layer = &layers[i];
+        layer->packed = NULL;
+        if (layer->weights != NULL && RunsGemm(layer))
+        {
+            const int rows = layer->type == LAYER_FC ? layer->out_feat : layer->filters;
+            count += (PanelSize(rows, layer->weight_count / rows) + align - 1) / align * align;
+        }
+    }
+    float *storage = count > 0 ? aligned_alloc(ALIGN_SIZE, count * sizeof(float)) : NULL;
+    if (storage == NULL)
+        return NULL;
+    size_t used = 0;
+    for (int i = 0; i < num_layers; ++i)
+    {
+        Layer *layer = &layers[i];
+        if (layer->weights == NULL || !RunsGemm(layer))
+            continue;
+        const int rows = layer->type == LAYER_FC ? layer->out_feat : layer->filters;
+        const int cols = layer->weight_count / rows;
+        PackPanels(layer->weights, rows, cols, &storage[used]);
+        layer->packed = &storage[used];
+        used += (PanelSize(rows, cols) + align - 1) / align * align;
+    }
+    return storage;
+}
@@ -1,16 +1,34 @@
 #ifndef LAYERS_H_
 #define LAYERS_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 typedef enum {
     LAYER_CONV,
     LAYER_MAXPOOL,
     LAYER_RELU,
-    LAYER_FC
+    LAYER_FC,
+    LAYER_CONV_RELU_POOL,
+    LAYER_AVGPOOL,
+    // fc with its zero blocks dropped, set up by SparsifyLayers
+    LAYER_FC_SPARSE,
+    // graph ops of imported models, folded away by OptimizeLayers before the
+    // model is built: batchnorm weights are [slope][mean][var][bias] rows of
+    // one value per channel with the epsilon in alpha, bias ones a value per
+    // channel, permute marks activations in [h][w][c] order for the fc layer
+    // after it, and softmax may only end the graph
+    LAYER_BATCHNORM,
+    LAYER_BIAS,
+    LAYER_PERMUTE,
+    LAYER_SOFTMAX
 } LayerType;
 
+typedef struct SparseMatrix SparseMatrix;
+
 typedef struct {
     LayerType type;
-    float *weights;
+    const float *weights;
     // conv
     int kernel_size;
     int filters;
@@ -20,27 +38,238 @@ typedef struct {
     // fc
     int in_feat;
     int out_feat;
+    // fused conv + relu + maxpool, conv and relu settings are shared above
+    int pool_size;
+    // maxpool and avgpool windows are kernel_size wide with padding on each
+    // side, stride 0 is the window size, set to it by InferShapes, and
+    // ceil_mode rounds the output dims up
+    int stride;
+    int ceil_mode;
+    // filled by InferShapes, fc layers are out_feat x 1 x 1
+    int in_c, in_h, in_w;
+    int out_c, out_h, out_w;
+    int weight_count;
+    // blob floats per image for the output, 0 for in-place layers, and for
+    // the flattened input of the first fc layer, placed by PlanMemory
+    int top_size, flat_size;
+    int top_offset, flat_offset;
+    // scale of the output activations for the int8 path, 0 when the model
+    // has not been calibrated
+    float act_scale;
+    // 3x3 filters in the Winograd domain, set by PrepareWinograd for layers
+    // that passed its check, NULL otherwise
+    const float *winograd;
+    // weights in GEMM panels for the fc layers and the convs that go through
+    // im2col, set by PackLayers
+    const float *packed;
+    // nonzero blocks of a LAYER_FC_SPARSE, set by SparsifyLayers
+    const SparseMatrix *sparse;
 } Layer;
 
+// sizes derived from the layers for one input image, in floats
+typedef struct {
+    size_t param_count;
+    int in_size;
+    // live activations at their peak, [c][batch][h * w] per tensor
+    int blob_size;
+    // im2col columns of the layers without a direct kernel
+    int col_size;
+    // float copy of the pixels when the first layer has no uint8 kernel
+    int image_size;
+} ModelShape;
+
+int InferShapes(
+    Layer *layers, const int num_layers,
+    const int in_c, const int in_h, const int in_w, ModelShape *shape
+);
+
+// assigns blob offsets so that tensors whose lifetimes do not overlap share
+// memory, sets shape->blob_size
+int PlanMemory(Layer *layers, const int num_layers, ModelShape *shape);
+
+// the conv layers run the Winograd kernel when winograd is set, then the
+// direct kernels, then im2col + GEMM on the packed weights
 int ConvLayer(
     const float *bottom, float *top,
     const int in_c, const int in_h, const int in_w,
     const int out_c, const int out_h, const int out_w,
+    const float *weights, const float *packed, const float *winograd,
+    const int kernel_size, const int padding,
+    float *col_buf
+);
+
+int ConvLayerBatch(
+    const float *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *weights, const float *packed, const float *winograd,
+    const int kernel_size, const int padding,
+    float *col_buf
+);
+
+// direct convolution for 5x5/valid and 3x3/pad-1, returns 0 for other shapes
+int ConvDirectSupported(
+    const int in_c, const int in_h, const int in_w,
+    const int kernel_size, const int padding, const int u8
+);
+
+int ConvDirectLayer(
+    const float *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
     const float *weights, const int kernel_size, const int padding
 );
 
-int MaxPoolingLayer(
+// same kernel reading uint8 pixels, returns 0 when the shape has no kernel
+int ConvDirectLayerU8(
+    const uint8_t *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *weights, const int kernel_size, const int padding
+);
+
+// fused conv + leaky relu + 2x2 maxpool for the shapes above, returns 0 when
+// there is no fused kernel for the layer
+int ConvReluPoolSupported(
+    const int in_c, const int in_h, const int in_w,
+    const int kernel_size, const int padding, const float alpha, const int pool_size
+);
+
+int ConvReluPoolDirect(
+    const float *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *weights, const int kernel_size, const int padding,
+    const float alpha, const int pool_size
+);
+
+int ConvReluPoolDirectU8(
+    const uint8_t *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *weights, const int kernel_size, const int padding,
+    const float alpha, const int pool_size
+);
+
+// direct convolution of one image of any size for dense mode, with pool_size
+// 2 the leaky relu and 2x2 maxpool are fused as above and out_h and out_w are
+// the pooled dims, row holds 2 * conv_w floats, returns 0 for pool sizes
+// other than 1 and 2
+int ConvPlaneDirect(
     const float *bottom, float *top,
     const int in_c, const int in_h, const int in_w,
     const int out_c, const int out_h, const int out_w,
-    const int kernel_size, const int stride
+    const float *weights, const int kernel_size, const int padding,
+    const float alpha, const int pool_size, float *row
+);
+
+// same without padding on uint8 pixels whose rows are in_rs and channels
+// in_cs bytes apart, so a window of a larger frame is read in place, row
+// holds (kernel_size + pool_size) * in_c * in_w more floats for the rows
+// being widened
+int ConvPlaneDirectU8(
+    const uint8_t *bottom, float *top, const int in_cs, const int in_rs,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *weights, const int kernel_size,
+    const float alpha, const int pool_size, float *row
+);
+
+// Winograd F(2x2, 3x3) for 3x3 layers of any padding, returns 0 for shapes
+// it does not take
+int WinogradSupported(
+    const int in_c, const int in_h, const int in_w, const int kernel_size, const int padding
+);
+
+// output channels of one block of the transformed filters
+#define WINOGRAD_BLOCK  8
+
+// floats of the transforms before output channel oc, a multiple of
+// WINOGRAD_BLOCK, so the layer's channels from oc on run on winograd + offset
+size_t WinogradOffset(const int in_c, const int oc);
+
+int ConvWinograd(
+    const float *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *winograd, const int padding
+);
+
+int ConvReluPoolWinograd(
+    const float *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *winograd, const int padding, const float alpha, const int pool_size
+);
+
+// transforms the filters of every 3x3 conv layer once, checks each against
+// the direct sum and sets layer->winograd for those within tolerance,
+// returns the storage of the transforms or NULL when no layer has any
+float *PrepareWinograd(Layer *layers, const int num_layers);
+
+int ConvReluPoolLayer(
+    const float *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *weights, const float *packed, const float *winograd,
+    const int kernel_size, const int padding,
+    const float alpha, const int pool_size,
+    float *col_buf
+);
+
+// max or average pooling of every [in_h][in_w] plane, taps in the padding or
+// past the edge in ceil mode are skipped, so they do not count in the
+// average either, 2x2 windows of stride 2 take a pairwise vector kernel
+int PoolingLayer(
+    const float *bottom, float *top, const int planes,
+    const int in_h, const int in_w, const int out_h, const int out_w,
+    const int kernel_size, const int stride, const int padding, const int average
+);
+
+// output dims of a pooling layer, 0 when the window does not fit
+int PoolOutputSize(
+    const int size, const int kernel_size, const int stride, const int padding, const int ceil_mode
 );
 
 void ReLU(float *data, const int size, const float alpha);
 
+// Fc1 is packed by PackLayers
 int FCLayer(
     const float *Fc1, const float *bottom, float *top,
     int out_feat, int in_feat
 );
 
+int FCLayerBatch(
+    const float *Fc1, const float *bottom, float *top, const int batch,
+    int out_feat, int in_feat
+);
+
+int FlattenBatch(
+    const float *bottom, float *top, const int batch,
+    const int channels, const int spatial
+);
+
+// a maxpool whose windows tile its input without padding, the pooling the
+// fused layer does
+int PlainMaxPool(const Layer *layer);
+
+int FuseLayers(Layer *layers, const int num_layers);
+
+// rewrites the graph ops of an imported model into the layers that run, with
+// weight_count set for every layer with weights since the dims are not known
+// yet: batchnorm and bias fold into the conv or fc rows before them, a
+// permute into the columns of the fc after it, and a final softmax is dropped
+// since the logits rank the classes the same, the weights point into params
+// in layer order and are packed to its front, returns the new number of
+// layers, 0 when an op is left that does not fold
+int OptimizeLayers(Layer *layers, const int num_layers, float *params, size_t *param_count);
+
+// packs the fp32 weights of the layers that run a GEMM into panels once and
+// sets layer->packed, returns the storage or NULL when none does
+float *PackLayers(Layer *layers, const int num_layers);
+
+void FoldInputScale(
+    Layer *layer, const int rows, const int cols, const float scale, float *buffer
+);
+
 #endif  // LAYERS_H_
\ No newline at end of file
@@ -0,0 +1,247 @@
+#include "model.h"
+#include "config.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+_Static_assert(sizeof(ModelHeader) == 64, "ModelHeader must stay 64 bytes");
+_Static_assert(sizeof(ModelLayerRecord) == 56, "ModelLayerRecord must stay 56 bytes");
+_Static_assert(offsetof(ModelLayerRecord, stride) == MODEL_RECORD_V1, "version 2 only appends to records");
+
+static size_t AlignUp(const size_t size, const size_t align)
+{
+    return (size + align - 1) / align * align;
+}
+
+int IsModelFile(const char *filename)
+{
+    char magic[4];
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+        return 0;
+    size_t read = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    return read == sizeof(magic) && memcmp(magic, MODEL_MAGIC, sizeof(magic)) == 0;
+}
+
+int LoadModelFile(const char *filename, ModelFile *model)
+{
+    memset(model, 0, sizeof(ModelFile));
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ModelHeader))
+    {
+        close(fd);
+        return 0;
+    }
+    const size_t map_size = (size_t)st.st_size;
+    void *map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+    madvise(map, map_size, MADV_WILLNEED);
+
+    // validate the header and the layer table before touching the payload,
+    // version 1 models are read with their shorter records
+    // counts are compared against what is left of the map by subtraction, so
+    // that forged sizes cannot wrap around
+    const ModelHeader *header = (const ModelHeader *)map;
+    const size_t record_size = header->version == 1 ? MODEL_RECORD_V1 : sizeof(ModelLayerRecord);
+    const uint64_t avail = header->payload_offset <= map_size ? (map_size - header->payload_offset) / sizeof(float) : 0;
+    if (memcmp(header->magic, MODEL_MAGIC, sizeof(header->magic)) != 0 ||
+        (header->version != 1 && header->version != MODEL_VERSION) ||
+        header->byte_order != MODEL_BYTE_ORDER ||
+        header->num_layers == 0 || header->num_layers > (map_size - sizeof(ModelHeader)) / record_size ||
+        header->payload_offset % ALIGN_SIZE != 0 ||
+        header->payload_offset < sizeof(ModelHeader) + header->num_layers * record_size ||
+        header->payload_offset > map_size ||
+        (header->scale_count != 0 && header->scale_count != header->num_layers) ||
+        header->param_count > avail || header->scale_count > avail - header->param_count)
+    {
+        munmap(map, map_size);
+        return 0;
+    }
+    const float *params = (const float *)((const char *)map + header->payload_offset);
+    Layer *layers = malloc(header->num_layers * sizeof(Layer));
+    if (layers == NULL)
+    {
+        munmap(map, map_size);
+        return 0;
+    }
+    for (uint32_t i = 0; i < header->num_layers; ++i)
+    {
+        const ModelLayerRecord *record = (const ModelLayerRecord *)((const char *)&header[1] + i * record_size);
+        if (record->type < LAYER_CONV || record->type > LAYER_AVGPOOL ||
+            (record->weight_offset >= 0 &&
+            (record->weight_count <= 0 ||
+             (uint64_t)record->weight_offset > header->param_count ||
+             (uint64_t)record->weight_count > header->param_count - (uint64_t)record->weight_offset)))
+        {
+            free(layers);
+            munmap(map, map_size);
+            return 0;
+        }
+        Layer *layer = &layers[i];
+        memset(layer, 0, sizeof(Layer));
+        layer->type = (LayerType)record->type;
+        layer->weights = record->weight_offset >= 0 ? &params[record->weight_offset] : NULL;
+        layer->kernel_size = record->kernel_size;
+        layer->filters = record->filters;
+        layer->padding = record->padding;
+        layer->alpha = record->alpha;
+        layer->in_feat = record->in_feat;
+        layer->out_feat = record->out_feat;
+        layer->pool_size = record->pool_size;
+        if (header->version > 1)
+        {
+            layer->stride = record->stride;
+            layer->ceil_mode = record->ceil_mode;
+        }
+        layer->act_scale = header->scale_count > 0 ? params[header->param_count + i] : 0.0f;
+    }
+
+    model->map = map;
+    model->map_size = map_size;
+    model->params = params;
+    model->param_count = header->param_count;
+    model->layers = layers;
+    model->num_layers = (int)header->num_layers;
+    return 1;
+}
+
+void FreeModelFile(ModelFile *model)
+{
+    if (model->map != NULL)
+        munmap(model->map, model->map_size);
+    free(model->layers);
+    memset(model, 0, sizeof(ModelFile));
+}
+
+void ReleaseModelParams(ModelFile *model)
+{
+    if (model->map != NULL)
+        munmap(model->map, model->map_size);
+    model->map = NULL;
+    model->map_size = 0;
+    model->params = NULL;
+    for (int i = 0; i < model->num_layers; ++i)
+        model->layers[i].weights = NULL;
+}
+
+int SaveModelFile(
+    const char *filename, const Layer *layers, const int num_layers,
+    const float *params, const size_t param_count
+)
+{
+    ModelHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MODEL_MAGIC, sizeof(header.magic));
+    header.version = MODEL_VERSION;
+    header.byte_order = MODEL_BYTE_ORDER;
+    header.num_layers = (uint32_t)num_layers;
+    header.param_count = param_count;
+    header.payload_offset = AlignUp(
+        sizeof(ModelHeader) + num_layers * sizeof(ModelLayerRecord), ALIGN_SIZE
+    );
+    for (int i = 0; i < num_layers; ++i)
+    {
+        if (layers[i].act_scale > 0.0f)
+            header.scale_count = (uint64_t)num_layers;
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL)
+        return 0;
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (int i = 0; ok && i < num_layers; ++i)
+    {
+        // weights of a layer run up to the weights of the next one
+        ModelLayerRecord record;
+        memset(&record, 0, sizeof(record));
+        record.type = layers[i].type;
+        record.kernel_size = layers[i].kernel_size;
+        record.filters = layers[i].filters;
+        record.padding = layers[i].padding;
+        record.alpha = layers[i].alpha;
+        record.in_feat = layers[i].in_feat;
+        record.out_feat = layers[i].out_feat;
+        record.pool_size = layers[i].pool_size;
+        record.stride = layers[i].stride;
+        record.ceil_mode = layers[i].ceil_mode;
+        record.weight_offset = -1;
+        if (layers[i].weights != NULL)
+        {
+            record.weight_offset = layers[i].weights - params;
+            int64_t end = (int64_t)param_count;
+            for (int j = i + 1; j < num_layers; ++j)
+            {
+                if (layers[j].weights != NULL)
+                {
+                    end = layers[j].weights - params;
+                    break;
+                }
+            }
+            record.weight_count = end - record.weight_offset;
+        }
+        ok = fwrite(&record, sizeof(record), 1, file) == 1;
+    }
+    static const char zeros[ALIGN_SIZE] = { 0, };
+    const size_t table_end = sizeof(ModelHeader) + num_layers * sizeof(ModelLayerRecord);
+    if (ok && header.payload_offset > table_end)
+        ok = fwrite(zeros, header.payload_offset - table_end, 1, file) == 1;
+    if (ok)
+        ok = fwrite(params, sizeof(float), param_count, file) == param_count;
+    for (int i = 0; ok && header.scale_count > 0 && i < num_layers; ++i)
+        ok = fwrite(&layers[i].act_scale, sizeof(float), 1, file) == 1;
+    return fclose(file) == 0 && ok;
+}
+
+int BuildDemoModel(Layer *layers, const float *params)
+{
+    // This is a simple demo where layers are created directly in the code,
+    // binary model files carry the same description in their layer table
+    memset(layers, 0, 9 * sizeof(Layer));
+    layers[0].type = LAYER_CONV;
+    layers[0].weights = params;
+    layers[0].filters = 6, layers[0].kernel_size = 5, layers[0].padding = 0;
+
+    layers[1].type = LAYER_RELU;
+    layers[1].weights = NULL;
+    layers[1].alpha = 0.1f;
+
+    layers[2].type = LAYER_MAXPOOL;
+    layers[2].weights = NULL;
+    layers[2].kernel_size = 2;
+
+    layers[3].type = LAYER_CONV;
+    layers[3].weights = params + 156;
+    layers[3].filters = 8, layers[3].kernel_size = 3, layers[3].padding = 1;
+
+    layers[4].type = LAYER_RELU;
+    layers[4].weights = NULL;
+    layers[4].alpha = 0.1f;
+
+    layers[5].type = LAYER_MAXPOOL;
+    layers[5].weights = NULL;
+    layers[5].kernel_size = 2;
+
+    layers[6].type = LAYER_FC;
+    layers[6].weights = params + 596;
+    layers[6].in_feat = 72, layers[6].out_feat = 128;
+
+    layers[7].type = LAYER_RELU;
+    layers[7].weights = NULL;
+    layers[7].alpha = 0.1f;
+
+    layers[8].type = LAYER_FC;
+    layers[8].weights = params + 9940;
+    layers[8].in_feat = 128, layers[8].out_feat = 10;
+    return 9;
+}
@@ -0,0 +1,78 @@
+#ifndef MODEL_H_
+#define MODEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "layers.h"
+
+#define MODEL_MAGIC         "TCNN"
+#define MODEL_VERSION       2
+// version 1 records end after weight_count, their pooling has no stride or
+// padding and rounds down
+#define MODEL_RECORD_V1     48
+#define MODEL_BYTE_ORDER    0x01020304u
+
+// Binary model container, written in host byte order:
+//   ModelHeader
+//   ModelLayerRecord[num_layers]
+//   float payload[param_count] at payload_offset, aligned to ALIGN_SIZE
+//   float act_scales[scale_count] right after the params, either none or one
+//   per layer, written by the calibration tool for the int8 path
+// The payload is mapped read-only and used in place, so processes loading the
+// same file share one page-cache copy of the weights.
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t num_layers;
+    uint64_t param_count;
+    uint64_t payload_offset;
+    uint64_t scale_count;
+    uint8_t reserved[24];
+} ModelHeader;
+
+typedef struct {
+    int32_t type;
+    int32_t kernel_size;
+    int32_t filters;
+    int32_t padding;
+    float alpha;
+    int32_t in_feat;
+    int32_t out_feat;
+    int32_t pool_size;
+    // in floats from the start of the payload, -1 for layers without weights
+    int64_t weight_offset;
+    int64_t weight_count;
+    // maxpool and avgpool, padding is shared with conv
+    int32_t stride;
+    int32_t ceil_mode;
+} ModelLayerRecord;
+
+typedef struct {
+    void *map;
+    size_t map_size;
+    const float *params;
+    size_t param_count;
+    // decoded layer table, sized by the header
+    Layer *layers;
+    int num_layers;
+} ModelFile;
+
+int IsModelFile(const char *filename);
+
+int LoadModelFile(const char *filename, ModelFile *model);
+
+void FreeModelFile(ModelFile *model);
+
+// unmaps the payload but keeps the layer table, for callers that hold the
+// weights in another form
+void ReleaseModelParams(ModelFile *model);
+
+int SaveModelFile(
+    const char *filename, const Layer *layers, const int num_layers,
+    const float *params, const size_t param_count
+);
+
+int BuildDemoModel(Layer *layers, const float *params);
+
+#endif  // MODEL_H_
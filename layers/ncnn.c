@@ -0,0 +1,496 @@
+#include "import.h"
+#include "half.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NCNN_MAGIC      7767517
+// params 0 to MAX_KEYS - 1 of a layer, arrays are written under key
+// ARRAY_KEY - k and only their first MAX_VALUES values are kept
+#define MAX_KEYS        32
+#define MAX_VALUES      4
+#define ARRAY_KEY       -23300
+// what ncnn reads for a shape param that is not set, and the paddings of
+// the SAME modes
+#define UNSET           -233
+#define PAD_SAME_UPPER  -233
+#define PAD_SAME_LOWER  -234
+#define MAX_BLOBS       2
+// tag in front of stored conv and fc weights, the other tags are for the
+// quantized formats
+#define TAG_FP32        0x00000000u
+#define TAG_FP16        0x01306B47u
+
+typedef struct {
+    const char *type;
+    int num_bottoms, num_tops;
+    const char *bottoms[MAX_BLOBS];
+    const char *top;
+    // counts are 0 for params that are not set and 1 for scalars
+    int counts[MAX_KEYS];
+    double values[MAX_KEYS][MAX_VALUES];
+} NcnnLayer;
+
+typedef struct {
+    char *name;
+    float *data;
+    int count;
+} Constant;
+
+typedef struct {
+    FILE *bin;
+    LayerTable table;
+    // blob the chain has reached, NULL before the Input layer
+    char *current;
+    // MemoryData blobs, a BinaryOp adds one as a bias
+    Constant *constants;
+    int num_constants;
+    // channels of the activations, 0 after the first fc layer
+    int channels;
+    // the activations are [h][w][c] after a Permute and flat after a
+    // Reshape or Flatten
+    int permuted;
+    int flat;
+    int softmax;
+    int in_h, in_w;
+} Import;
+
+static int ParseLayer(char *line, NcnnLayer *layer)
+{
+    // type name bottom_count top_count bottoms... tops... key=value...
+    memset(layer, 0, sizeof(NcnnLayer));
+    char *save = NULL;
+    layer->type = strtok_r(line, " \t\r\n", &save);
+    const char *name = layer->type != NULL ? strtok_r(NULL, " \t\r\n", &save) : NULL;
+    const char *bottoms = name != NULL ? strtok_r(NULL, " \t\r\n", &save) : NULL;
+    const char *tops = bottoms != NULL ? strtok_r(NULL, " \t\r\n", &save) : NULL;
+    if (tops == NULL)
+        return 0;
+    layer->num_bottoms = atoi(bottoms);
+    layer->num_tops = atoi(tops);
+    if (layer->num_bottoms < 0 || layer->num_bottoms > MAX_BLOBS || layer->num_tops != 1)
+        return 0;
+    for (int i = 0; i < layer->num_bottoms; ++i)
+    {
+        if ((layer->bottoms[i] = strtok_r(NULL, " \t\r\n", &save)) == NULL)
+            return 0;
+    }
+    if ((layer->top = strtok_r(NULL, " \t\r\n", &save)) == NULL)
+        return 0;
+
+    char *token;
+    while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL)
+    {
+        char *end;
+        long key = strtol(token, &end, 10);
+        if (*end != '=')
+            return 0;
+        const int array = key <= ARRAY_KEY;
+        if (array)
+            key = ARRAY_KEY - key;
+        if (key < 0 || key >= MAX_KEYS)
+            continue;
+        char *value = end + 1;
+        int count = 1;
+        if (array)
+        {
+            // n,v1,...,vn
+            count = (int)strtol(value, &end, 10);
+            if (count <= 0 || *end != ',')
+                return 0;
+            value = end + 1;
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            const double number = strtod(value, &end);
+            if (end == value || (i + 1 < count && *end != ','))
+                return 0;
+            if (i < MAX_VALUES)
+                layer->values[key][i] = number;
+            value = end + 1;
+        }
+        layer->counts[key] = count;
+    }
+    return 1;
+}
+
+static int Int(const NcnnLayer *layer, const int key, const int fallback)
+{
+    return layer->counts[key] > 0 ? (int)layer->values[key][0] : fallback;
+}
+
+static float Float(const NcnnLayer *layer, const int key, const float fallback)
+{
+    return layer->counts[key] > 0 ? (float)layer->values[key][0] : fallback;
+}
+
+static int ReadFloats(FILE *bin, float *data, const size_t count)
+{
+    return fread(data, sizeof(float), count, bin) == count;
+}
+
+static int ReadWeights(FILE *bin, float *data, const size_t count)
+{
+    // fp32 or fp16 weights after their tag, fp16 ones padded to 4 bytes
+    uint32_t tag;
+    if (fread(&tag, sizeof(tag), 1, bin) != 1)
+        return 0;
+    if (tag == TAG_FP32)
+        return ReadFloats(bin, data, count);
+    if (tag != TAG_FP16 || count > INT32_MAX)
+        return 0;
+    uint16_t *half = malloc((count + 1) * sizeof(uint16_t));
+    const int ok = half != NULL && fread(half, sizeof(uint16_t), (count + 1) / 2 * 2, bin) == (count + 1) / 2 * 2;
+    if (ok)
+        WidenHalf(half, data, (int)count, HALF_FP16);
+    free(half);
+    return ok;
+}
+
+static int ReadLayerWeights(Import *import, const size_t rows, const size_t cols, const int bias_term, float *weights)
+{
+    // rows x cols tagged weights and rows plain floats of bias, into the
+    // [rows][cols + 1] layout of the layers
+    float *data = malloc(rows * (cols + 1) * sizeof(float));
+    int ok = data != NULL && ReadWeights(import->bin, data, rows * cols);
+    if (ok && bias_term)
+        ok = ReadFloats(import->bin, &data[rows * cols], rows);
+    for (size_t r = 0; ok && r < rows; ++r)
+    {
+        memcpy(&weights[r * (cols + 1)], &data[r * cols], cols * sizeof(float));
+        weights[r * (cols + 1) + cols] = bias_term ? data[rows * cols + r] : 0.0f;
+    }
+    free(data);
+    return ok;
+}
+
+static int AddActivation(Import *import, const NcnnLayer *layer)
+{
+    // activation_type of a conv or fc, ReLU or leaky ReLU
+    const int type = Int(layer, 9, 0);
+    if (type == 0)
+        return 1;
+    if (type != 1 && type != 2)
+        return 0;
+    Layer *relu = AddLayer(&import->table, LAYER_RELU, 0, NULL);
+    if (relu == NULL)
+        return 0;
+    relu->alpha = type == 2 ? Float(layer, 10, 0.0f) : 0.0f;
+    return 1;
+}
+
+static int ImportConv(Import *import, const NcnnLayer *layer)
+{
+    // square kernels of stride 1 and dilation 1 with the same padding on
+    // every side, the weights are [f][c][kh][kw] like the rows of the layer
+    const int filters = Int(layer, 0, 0);
+    const int kernel_size = Int(layer, 1, 0);
+    const int pad = Int(layer, 4, 0);
+    int padding = pad;
+    if (pad == PAD_SAME_UPPER || pad == PAD_SAME_LOWER)
+        padding = kernel_size % 2 == 1 ? kernel_size / 2 : -1;
+    else if (Int(layer, 14, pad) != pad || Int(layer, 15, pad) != pad || Int(layer, 16, Int(layer, 15, pad)) != pad)
+        padding = -1;
+    const size_t row = (size_t)import->channels * kernel_size * kernel_size;
+    if (filters <= 0 || kernel_size <= 0 || padding < 0 || import->channels <= 0 || import->permuted ||
+        import->flat || Int(layer, 11, kernel_size) != kernel_size ||
+        Int(layer, 2, 1) != 1 || Int(layer, 12, Int(layer, 2, 1)) != 1 ||
+        Int(layer, 3, 1) != 1 || Int(layer, 13, Int(layer, 3, 1)) != 1 ||
+        Float(layer, 18, 0.0f) != 0.0f || Int(layer, 8, 0) != 0 || Int(layer, 19, 0) != 0 ||
+        (size_t)Int(layer, 6, 0) != filters * row)
+    {
+        return 0;
+    }
+    float *weights;
+    Layer *conv = AddLayer(&import->table, LAYER_CONV, filters * (row + 1), &weights);
+    if (conv == NULL || ReadLayerWeights(import, filters, row, Int(layer, 5, 0), weights) == 0)
+        return 0;
+    conv->filters = filters;
+    conv->kernel_size = kernel_size;
+    conv->padding = padding;
+    import->channels = filters;
+    return AddActivation(import, layer);
+}
+
+static int ImportPool(Import *import, const NcnnLayer *layer)
+{
+    // square windows with the same padding on every side, pad_mode 0 pads
+    // the tail for the last window, which is ceil mode, 1 drops it, the
+    // layers skip padding taps in the average
+    const int average = Int(layer, 0, 0);
+    const int kernel_size = Int(layer, 1, 0);
+    const int stride = Int(layer, 2, 1);
+    const int padding = Int(layer, 3, 0);
+    const int pad_mode = Int(layer, 5, 0);
+    if ((average != 0 && average != 1) || kernel_size <= 0 || stride <= 0 || padding < 0 ||
+        import->channels <= 0 || import->permuted || import->flat ||
+        Int(layer, 11, kernel_size) != kernel_size || Int(layer, 12, stride) != stride ||
+        Int(layer, 14, padding) != padding || Int(layer, 13, padding) != padding ||
+        Int(layer, 15, Int(layer, 13, padding)) != padding ||
+        Int(layer, 4, 0) != 0 || Int(layer, 7, 0) != 0 || (pad_mode != 0 && pad_mode != 1) ||
+        (average && Int(layer, 6, 0) != 0 && (padding > 0 || pad_mode == 0)))
+    {
+        return 0;
+    }
+    Layer *pool = AddLayer(&import->table, average ? LAYER_AVGPOOL : LAYER_MAXPOOL, 0, NULL);
+    if (pool == NULL)
+        return 0;
+    pool->kernel_size = kernel_size;
+    pool->stride = stride;
+    pool->padding = padding;
+    pool->ceil_mode = pad_mode == 0;
+    return 1;
+}
+
+static int ImportFC(Import *import, const NcnnLayer *layer)
+{
+    // flattens any input, [out][in] weights
+    const int out_feat = Int(layer, 0, 0);
+    const int weight_size = Int(layer, 2, 0);
+    if (out_feat <= 0 || weight_size <= 0 || weight_size % out_feat != 0 || Int(layer, 8, 0) != 0)
+        return 0;
+    const int in_feat = weight_size / out_feat;
+    float *weights;
+    Layer *fc = AddLayer(&import->table, LAYER_FC, (size_t)out_feat * (in_feat + 1), &weights);
+    if (fc == NULL || ReadLayerWeights(import, out_feat, in_feat, Int(layer, 1, 0), weights) == 0)
+        return 0;
+    fc->in_feat = in_feat;
+    fc->out_feat = out_feat;
+    import->channels = 0;
+    import->flat = 1;
+    import->permuted = 0;
+    return AddActivation(import, layer);
+}
+
+static int ImportBias(Import *import, const NcnnLayer *layer)
+{
+    // BinaryOp add of a MemoryData blob of one value per channel
+    const int channels = import->permuted ? 0 : FoldChannels(&import->table, import->flat);
+    if (channels == 0 || layer->num_bottoms != 2 || Int(layer, 0, 0) != 0 || Int(layer, 1, 0) != 0)
+        return 0;
+    const char *other = strcmp(layer->bottoms[0], import->current) == 0 ? layer->bottoms[1] : layer->bottoms[0];
+    const Constant *constant = NULL;
+    for (int i = 0; i < import->num_constants; ++i)
+    {
+        if (strcmp(import->constants[i].name, other) == 0)
+            constant = &import->constants[i];
+    }
+    float *weights;
+    if (constant == NULL || constant->count != channels ||
+        AddLayer(&import->table, LAYER_BIAS, channels, &weights) == NULL)
+    {
+        return 0;
+    }
+    memcpy(weights, constant->data, channels * sizeof(float));
+    return 1;
+}
+
+static int ImportNorm(Import *import, const NcnnLayer *layer)
+{
+    // slope, mean, var and bias, the order of the layer
+    const int channels = import->permuted ? 0 : FoldChannels(&import->table, import->flat);
+    float *weights;
+    Layer *norm = NULL;
+    if (channels == 0 || Int(layer, 0, 0) != channels ||
+        (norm = AddLayer(&import->table, LAYER_BATCHNORM, 4 * (size_t)channels, &weights)) == NULL ||
+        ReadFloats(import->bin, weights, 4 * (size_t)channels) == 0)
+    {
+        return 0;
+    }
+    norm->alpha = Float(layer, 1, 0.0f);
+    return 1;
+}
+
+static int ImportConstant(Import *import, const NcnnLayer *layer)
+{
+    // 1-D MemoryData, plain floats
+    const int count = Int(layer, 0, 0);
+    if (count <= 0 || Int(layer, 1, 0) != 0 || Int(layer, 2, 0) != 0)
+        return 0;
+    Constant *constant = &import->constants[import->num_constants];
+    constant->data = malloc(count * sizeof(float));
+    constant->name = strdup(layer->top);
+    if (constant->data == NULL || constant->name == NULL)
+    {
+        free(constant->data);
+        free(constant->name);
+        return 0;
+    }
+    constant->count = count;
+    ++import->num_constants;
+    return ReadFloats(import->bin, constant->data, count);
+}
+
+static int ImportReshape(Import *import, const NcnnLayer *layer)
+{
+    // before any layer there is one channel, so a reshape gives the input
+    // dims, after it only flattens are taken, the fc layers flatten anyway
+    const int w = Int(layer, 0, UNSET), h = Int(layer, 1, UNSET), c = Int(layer, 2, UNSET);
+    if (Int(layer, 3, 0) != 0)
+        return 0;
+    if (import->table.num_layers == 0 && w > 0 && h > 0 && (c == UNSET || c == 1))
+    {
+        import->in_h = h, import->in_w = w;
+        return 1;
+    }
+    if (h != UNSET || c != UNSET)
+        return 0;
+    import->flat = 1;
+    return 1;
+}
+
+static int ImportLayer(Import *import, const NcnnLayer *layer)
+{
+    const char *type = layer->type;
+    if (import->softmax)
+        return 0;
+    if (strcmp(type, "Convolution") == 0)
+        return ImportConv(import, layer);
+    if (strcmp(type, "ReLU") == 0)
+    {
+        // elementwise, but a permute has to reach its fc layer
+        Layer *relu = import->permuted ? NULL : AddLayer(&import->table, LAYER_RELU, 0, NULL);
+        if (relu == NULL)
+            return 0;
+        relu->alpha = Float(layer, 0, 0.0f);
+        return 1;
+    }
+    if (strcmp(type, "Pooling") == 0)
+        return ImportPool(import, layer);
+    if (strcmp(type, "InnerProduct") == 0)
+        return ImportFC(import, layer);
+    if (strcmp(type, "BinaryOp") == 0)
+        return ImportBias(import, layer);
+    if (strcmp(type, "BatchNorm") == 0)
+        return ImportNorm(import, layer);
+    if (strcmp(type, "Permute") == 0)
+    {
+        // order_type 3 is [h][w][c], 0 keeps the order
+        const int order = Int(layer, 0, 0);
+        if (order == 0)
+            return 1;
+        if (order != 3 || import->permuted || import->flat)
+            return 0;
+        import->permuted = 1;
+        return AddLayer(&import->table, LAYER_PERMUTE, 0, NULL) != NULL;
+    }
+    if (strcmp(type, "Reshape") == 0)
+        return ImportReshape(import, layer);
+    if (strcmp(type, "Flatten") == 0)
+    {
+        import->flat = 1;
+        return 1;
+    }
+    if (strcmp(type, "Softmax") == 0)
+    {
+        // nothing may follow
+        import->softmax = 1;
+        return AddLayer(&import->table, LAYER_SOFTMAX, 0, NULL) != NULL;
+    }
+    if (strcmp(type, "Dropout") == 0)
+        return Float(layer, 0, 1.0f) == 1.0f;
+    return strcmp(type, "Noop") == 0;
+}
+
+static int ImportNext(Import *import, const NcnnLayer *layer)
+{
+    // the Input starts the chain, MemoryData is set aside, every other layer
+    // has to read the blob the chain has reached
+    const int input = strcmp(layer->type, "Input") == 0;
+    if (input || strcmp(layer->type, "MemoryData") == 0)
+    {
+        if (layer->num_bottoms != 0)
+            return 0;
+        if (!input)
+            return ImportConstant(import, layer);
+        const int w = Int(layer, 0, 0), h = Int(layer, 1, 0), c = Int(layer, 2, 0);
+        if (import->current != NULL || c > 1)
+            return 0;
+        if (w > 0 && h > 0)
+            import->in_h = h, import->in_w = w;
+    }
+    else
+    {
+        const int chained = import->current != NULL && layer->num_bottoms >= 1 &&
+            (strcmp(layer->bottoms[0], import->current) == 0 ||
+            (layer->num_bottoms == 2 && strcmp(layer->bottoms[1], import->current) == 0));
+        if (!chained || ImportLayer(import, layer) == 0)
+            return 0;
+    }
+    free(import->current);
+    import->current = strdup(layer->top);
+    return import->current != NULL;
+}
+
+static int OpenBin(const char *filename, FILE **bin)
+{
+    // model.param -> model.bin
+    const size_t length = strlen(filename);
+    const size_t stem = length > 6 && strcmp(&filename[length - 6], ".param") == 0 ? length - 6 : length;
+    char *path = malloc(stem + 5);
+    if (path == NULL)
+        return 0;
+    memcpy(path, filename, stem);
+    strcpy(&path[stem], ".bin");
+    *bin = fopen(path, "rb");
+    free(path);
+    return *bin != NULL;
+}
+
+int IsNcnnFile(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+        return 0;
+    int magic = 0;
+    const int read = fscanf(file, "%d", &magic);
+    fclose(file);
+    return read == 1 && magic == NCNN_MAGIC;
+}
+
+int LoadNcnnModel(const char *filename, ImportedModel *model)
+{
+    memset(model, 0, sizeof(ImportedModel));
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+        return 0;
+    // the magic line, then the layer and blob counts
+    char *line = NULL;
+    size_t line_size = 0;
+    int magic = 0, layer_count = 0, blob_count = 0;
+    Import import;
+    memset(&import, 0, sizeof(Import));
+    import.channels = 1;
+    int ok = getline(&line, &line_size, file) > 0 && sscanf(line, "%d", &magic) == 1 &&
+        getline(&line, &line_size, file) > 0 && sscanf(line, "%d %d", &layer_count, &blob_count) == 2 &&
+        magic == NCNN_MAGIC && layer_count > 0 && layer_count <= 1 << 16 && OpenBin(filename, &import.bin);
+
+    // a conv or fc layer may add its activation
+    ok = ok && InitTable(&import.table, 2 * layer_count);
+    import.constants = ok ? calloc(layer_count, sizeof(Constant)) : NULL;
+    ok = ok && import.constants != NULL;
+    NcnnLayer layer;
+    for (int i = 0; ok && i < layer_count; ++i)
+    {
+        ok = getline(&line, &line_size, file) > 0 && ParseLayer(line, &layer) &&
+            ImportNext(&import, &layer);
+    }
+    // the weights of the file are used up
+    ok = ok && fgetc(import.bin) == EOF;
+    free(line);
+    fclose(file);
+    if (import.bin != NULL)
+        fclose(import.bin);
+
+    model->in_h = import.in_h, model->in_w = import.in_w;
+    ok = FinishImport(&import.table, ok, model);
+    for (int i = 0; i < import.num_constants; ++i)
+    {
+        free(import.constants[i].name);
+        free(import.constants[i].data);
+    }
+    free(import.constants);
+    free(import.current);
+    return ok;
+}
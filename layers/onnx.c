@@ -0,0 +1,813 @@
+#include "import.h"
+#include "config.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// TensorProto.data_type of float
+#define ONNX_FLOAT      1
+#define MAX_INPUTS      5
+#define MAX_DIMS        4
+#define MAX_INTS        8
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+} Bytes;
+
+typedef struct {
+    const uint8_t *pos;
+    const uint8_t *end;
+} Reader;
+
+typedef struct {
+    int number;
+    int wire;
+    // varint and fixed values, length-delimited ones are in bytes
+    uint64_t value;
+    Bytes bytes;
+} Field;
+
+typedef struct {
+    Bytes name;
+    int64_t dims[MAX_DIMS];
+    int num_dims;
+    int data_type;
+    // raw_data or packed float_data, little-endian floats either way
+    Bytes data;
+} Tensor;
+
+typedef struct {
+    Bytes op;
+    Bytes inputs[MAX_INPUTS];
+    int num_inputs;
+    Bytes output;
+    // the whole NodeProto, attributes are looked up in it by name
+    Bytes message;
+} Node;
+
+typedef struct {
+    Node *nodes;
+    int num_nodes;
+    Tensor *tensors;
+    int num_tensors;
+    // first graph input that is not an initializer, with its dims, 0 for
+    // dims that are not fixed
+    Bytes input;
+    int64_t in_dims[MAX_DIMS];
+    int num_in_dims;
+} Graph;
+
+typedef struct {
+    const Graph *graph;
+    LayerTable table;
+    // channels of the activations, 0 after the first fc layer
+    int channels;
+    // the activations are [h][w][c] after a Transpose and flat after a
+    // Reshape or Flatten
+    int channels_last;
+    int flat;
+    int softmax;
+} Import;
+
+static int ReadVarint(Reader *reader, uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64 && reader->pos < reader->end; shift += 7)
+    {
+        const uint8_t byte = *reader->pos++;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (byte < 0x80)
+            return 1;
+    }
+    return 0;
+}
+
+static int NextField(Reader *reader, Field *field)
+{
+    // 1 for a field, 0 at the end of the message, -1 for a malformed one
+    uint64_t key;
+    if (reader->pos >= reader->end)
+        return 0;
+    if (ReadVarint(reader, &key) == 0)
+        return -1;
+    field->number = (int)(key >> 3);
+    field->wire = (int)(key & 7);
+    field->value = 0;
+    field->bytes.data = NULL;
+    field->bytes.size = 0;
+    if (field->wire == 0)
+        return ReadVarint(reader, &field->value) ? 1 : -1;
+    if (field->wire == 1 || field->wire == 5)
+    {
+        const size_t size = field->wire == 1 ? 8 : 4;
+        if ((size_t)(reader->end - reader->pos) < size)
+            return -1;
+        memcpy(&field->value, reader->pos, size);
+        reader->pos += size;
+        return 1;
+    }
+    if (field->wire == 2)
+    {
+        uint64_t size;
+        if (ReadVarint(reader, &size) == 0 || size > (uint64_t)(reader->end - reader->pos))
+            return -1;
+        field->bytes.data = reader->pos;
+        field->bytes.size = (size_t)size;
+        reader->pos += size;
+        return 1;
+    }
+    return -1;
+}
+
+static Reader Open(const Bytes bytes)
+{
+    Reader reader = { bytes.data, bytes.data + bytes.size };
+    return reader;
+}
+
+static int IsName(const Bytes bytes, const char *name)
+{
+    return bytes.size == strlen(name) && memcmp(bytes.data, name, bytes.size) == 0;
+}
+
+static int SameName(const Bytes a, const Bytes b)
+{
+    return a.size == b.size && memcmp(a.data, b.data, a.size) == 0;
+}
+
+static int ReadInts(const Field *field, int64_t *ints, int count, const int max_count)
+{
+    // appends a repeated int64, packed or not, returns the new count or -1
+    // when there are more than max_count
+    if (field->wire == 0)
+    {
+        if (count >= max_count)
+            return -1;
+        ints[count++] = (int64_t)field->value;
+        return count;
+    }
+    if (field->wire != 2)
+        return -1;
+    Reader reader = Open(field->bytes);
+    uint64_t value;
+    while (reader.pos < reader.end)
+    {
+        if (count >= max_count || ReadVarint(&reader, &value) == 0)
+            return -1;
+        ints[count++] = (int64_t)value;
+    }
+    return count;
+}
+
+static int ParseTensor(const Bytes message, Tensor *tensor)
+{
+    memset(tensor, 0, sizeof(Tensor));
+    Reader reader = Open(message);
+    Field field;
+    int status;
+    while ((status = NextField(&reader, &field)) > 0)
+    {
+        if (field.number == 1)
+        {
+            tensor->num_dims = ReadInts(&field, tensor->dims, tensor->num_dims, MAX_DIMS);
+            if (tensor->num_dims < 0)
+                return 0;
+        }
+        else if (field.number == 2)
+        {
+            tensor->data_type = (int)field.value;
+        }
+        else if ((field.number == 4 || field.number == 9) && field.wire == 2)
+        {
+            tensor->data = field.bytes;
+        }
+        else if (field.number == 8)
+        {
+            tensor->name = field.bytes;
+        }
+        else if (field.number == 13 || field.number == 14)
+        {
+            // weights in an external file
+            return 0;
+        }
+    }
+    for (int i = 0; i < tensor->num_dims; ++i)
+    {
+        if (tensor->dims[i] < 0)
+            return 0;
+    }
+    return status == 0;
+}
+
+static int ParseNode(const Bytes message, Node *node)
+{
+    memset(node, 0, sizeof(Node));
+    node->message = message;
+    Reader reader = Open(message);
+    Field field;
+    int status;
+    int outputs = 0;
+    while ((status = NextField(&reader, &field)) > 0)
+    {
+        if (field.number == 1)
+        {
+            if (node->num_inputs >= MAX_INPUTS)
+                return 0;
+            node->inputs[node->num_inputs++] = field.bytes;
+        }
+        else if (field.number == 2)
+        {
+            if (outputs++ == 0)
+                node->output = field.bytes;
+        }
+        else if (field.number == 4)
+        {
+            node->op = field.bytes;
+        }
+        else if (field.number == 5)
+        {
+            // attributes are read later without checks
+            Reader attribute = Open(field.bytes);
+            Field inner;
+            while ((status = NextField(&attribute, &inner)) > 0)
+                ;
+            if (status < 0)
+                return 0;
+        }
+    }
+    // Dropout may list its mask as a second output, which nothing reads
+    return status == 0 && outputs >= 1 && node->num_inputs >= 1;
+}
+
+static void ParseInput(const Bytes message, Bytes *name, int64_t *in_dims, int *num_in_dims)
+{
+    // ValueInfoProto.type.tensor_type.shape.dim[].dim_value
+    Reader reader = Open(message);
+    Field field;
+    *num_in_dims = 0;
+    while (NextField(&reader, &field) > 0)
+    {
+        if (field.number == 1)
+            *name = field.bytes;
+        if (field.number != 2 || field.wire != 2)
+            continue;
+        Reader type = Open(field.bytes);
+        Field tensor_type;
+        while (NextField(&type, &tensor_type) > 0)
+        {
+            if (tensor_type.number != 1 || tensor_type.wire != 2)
+                continue;
+            Reader tensor = Open(tensor_type.bytes);
+            Field shape;
+            while (NextField(&tensor, &shape) > 0)
+            {
+                if (shape.number != 2 || shape.wire != 2)
+                    continue;
+                Reader dims = Open(shape.bytes);
+                Field dim;
+                while (NextField(&dims, &dim) > 0 && *num_in_dims < MAX_DIMS)
+                {
+                    if (dim.number != 1 || dim.wire != 2)
+                        continue;
+                    Reader value = Open(dim.bytes);
+                    Field inner;
+                    int64_t size = 0;
+                    while (NextField(&value, &inner) > 0)
+                    {
+                        if (inner.number == 1 && inner.wire == 0)
+                            size = (int64_t)inner.value;
+                    }
+                    in_dims[(*num_in_dims)++] = size;
+                }
+            }
+        }
+    }
+}
+
+static const Tensor *FindTensor(const Graph *graph, const Bytes name)
+{
+    for (int i = 0; i < graph->num_tensors; ++i)
+    {
+        if (SameName(graph->tensors[i].name, name))
+            return &graph->tensors[i];
+    }
+    return NULL;
+}
+
+static int ParseGraph(const Bytes message, Graph *graph)
+{
+    // counts the nodes and initializers first, then fills them in
+    memset(graph, 0, sizeof(Graph));
+    Reader reader = Open(message);
+    Field field;
+    int status;
+    while ((status = NextField(&reader, &field)) > 0)
+    {
+        graph->num_nodes += field.number == 1 && field.wire == 2;
+        graph->num_tensors += field.number == 5 && field.wire == 2;
+    }
+    if (status < 0 || graph->num_nodes == 0)
+        return 0;
+    graph->nodes = malloc(graph->num_nodes * sizeof(Node));
+    graph->tensors = malloc((graph->num_tensors + 1) * sizeof(Tensor));
+    if (graph->nodes == NULL || graph->tensors == NULL)
+        return 0;
+
+    int node_i = 0, tensor_i = 0;
+    reader = Open(message);
+    while (NextField(&reader, &field) > 0)
+    {
+        if (field.number == 1 && field.wire == 2 && ParseNode(field.bytes, &graph->nodes[node_i++]) == 0)
+            return 0;
+        if (field.number == 5 && field.wire == 2 && ParseTensor(field.bytes, &graph->tensors[tensor_i++]) == 0)
+            return 0;
+    }
+
+    // older exports list the initializers among the inputs as well
+    reader = Open(message);
+    while (NextField(&reader, &field) > 0)
+    {
+        if (field.number != 11 || field.wire != 2)
+            continue;
+        ParseInput(field.bytes, &graph->input, graph->in_dims, &graph->num_in_dims);
+        if (FindTensor(graph, graph->input) == NULL)
+            return 1;
+    }
+    return 0;
+}
+
+static void FreeGraph(Graph *graph)
+{
+    free(graph->nodes);
+    free(graph->tensors);
+}
+
+static int GetAttribute(const Node *node, const char *name, Field *value)
+{
+    // the value field of the AttributeProto, ints in value->bytes when packed
+    Reader reader = Open(node->message);
+    Field field;
+    while (NextField(&reader, &field) > 0)
+    {
+        if (field.number != 5)
+            continue;
+        Reader attribute = Open(field.bytes);
+        Field inner;
+        int found = 0;
+        Field result = { 0, };
+        while (NextField(&attribute, &inner) > 0)
+        {
+            if (inner.number == 1)
+                found = IsName(inner.bytes, name);
+            else if (inner.number >= 2 && inner.number <= 8)
+                result = inner;
+        }
+        if (found)
+        {
+            *value = result;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int64_t IntAttribute(const Node *node, const char *name, const int64_t fallback)
+{
+    Field value;
+    return GetAttribute(node, name, &value) && value.number == 3 ? (int64_t)value.value : fallback;
+}
+
+static float FloatAttribute(const Node *node, const char *name, const float fallback)
+{
+    Field value;
+    float result = fallback;
+    if (GetAttribute(node, name, &value) && value.number == 2)
+        memcpy(&result, &value.value, sizeof(float));
+    return result;
+}
+
+static int IntsAttribute(const Node *node, const char *name, int64_t *ints)
+{
+    // the count, 0 when the attribute is missing, -1 when it is too long
+    Reader reader = Open(node->message);
+    Field field;
+    while (NextField(&reader, &field) > 0)
+    {
+        if (field.number != 5)
+            continue;
+        Reader attribute = Open(field.bytes);
+        Field inner;
+        int found = 0;
+        int count = 0;
+        while (NextField(&attribute, &inner) > 0 && count >= 0)
+        {
+            if (inner.number == 1)
+                found = IsName(inner.bytes, name);
+            else if (inner.number == 8)
+                count = ReadInts(&inner, ints, count, MAX_INTS);
+        }
+        if (found)
+            return count;
+    }
+    return 0;
+}
+
+static int AllEqual(const int64_t *ints, const int count, const int64_t value)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        if (ints[i] != value)
+            return 0;
+    }
+    return 1;
+}
+
+static int AutoPad(const Node *node, const int kernel_size)
+{
+    // the padding auto_pad asks for, 0 for NOTSET and VALID and -1 for
+    // what a stride-1 layer of the same padding on every side cannot do
+    Field field;
+    if (!GetAttribute(node, "auto_pad", &field) || field.number != 4 ||
+        IsName(field.bytes, "NOTSET") || IsName(field.bytes, "VALID"))
+    {
+        return 0;
+    }
+    if ((IsName(field.bytes, "SAME_UPPER") || IsName(field.bytes, "SAME_LOWER")) && kernel_size % 2 == 1)
+        return kernel_size / 2;
+    return -1;
+}
+
+static int Padding(const Node *node)
+{
+    // pads, the same on every side, 0 when missing and -1 otherwise
+    int64_t ints[MAX_INTS];
+    const int count = IntsAttribute(node, "pads", ints);
+    if (count < 0 || (count > 0 && !AllEqual(ints, count, ints[0])))
+        return -1;
+    return count > 0 ? (int)ints[0] : 0;
+}
+
+static size_t TensorCount(const Tensor *tensor)
+{
+    // values the dims hold, SIZE_MAX when their product overflows
+    size_t count = 1;
+    for (int i = 0; i < tensor->num_dims; ++i)
+    {
+        const size_t dim = (size_t)tensor->dims[i];
+        if (dim != 0 && count > SIZE_MAX / dim)
+            return SIZE_MAX;
+        count *= dim;
+    }
+    return count;
+}
+
+static const float *FloatData(const Tensor *tensor, const size_t count)
+{
+    // count floats that the dims have to hold as well, the weights are
+    // copied out with memcpy since raw_data has no alignment
+    if (tensor == NULL || tensor->data_type != ONNX_FLOAT || TensorCount(tensor) != count ||
+        tensor->data.size / sizeof(float) != count || tensor->data.size % sizeof(float) != 0)
+    {
+        return NULL;
+    }
+    return (const float *)tensor->data.data;
+}
+
+static int ImportConv(Import *import, const Node *node)
+{
+    // square kernels of stride 1 and dilation 1 with the same padding on
+    // every side, the ONNX [f][c][kh][kw] weights are the rows of the layer
+    // with the bias appended
+    const Graph *graph = import->graph;
+    const Tensor *weight = node->num_inputs >= 2 ? FindTensor(graph, node->inputs[1]) : NULL;
+    const Tensor *bias = node->num_inputs >= 3 ? FindTensor(graph, node->inputs[2]) : NULL;
+    if (weight == NULL || weight->num_dims != 4 || weight->dims[2] != weight->dims[3] ||
+        weight->dims[1] != import->channels || weight->dims[0] <= 0 || weight->dims[2] <= 0 ||
+        import->channels_last || import->flat)
+    {
+        return 0;
+    }
+    const int filters = (int)weight->dims[0];
+    const int kernel_size = (int)weight->dims[2];
+    const size_t row = (size_t)weight->dims[1] * kernel_size * kernel_size;
+    int64_t ints[MAX_INTS];
+    int count;
+    if (IntAttribute(node, "group", 1) != 1 ||
+        (count = IntsAttribute(node, "strides", ints)) < 0 || !AllEqual(ints, count, 1) ||
+        (count = IntsAttribute(node, "dilations", ints)) < 0 || !AllEqual(ints, count, 1) ||
+        (count = IntsAttribute(node, "kernel_shape", ints)) < 0 || !AllEqual(ints, count, kernel_size))
+    {
+        return 0;
+    }
+    const int auto_pad = AutoPad(node, kernel_size);
+    const int padding = auto_pad != 0 ? auto_pad : Padding(node);
+    const float *weight_data = FloatData(weight, filters * row);
+    const float *bias_data = bias != NULL ? FloatData(bias, filters) : NULL;
+    if (padding < 0 || weight_data == NULL || (bias != NULL && bias_data == NULL))
+        return 0;
+    float *weights;
+    Layer *layer = AddLayer(&import->table, LAYER_CONV, filters * (row + 1), &weights);
+    if (layer == NULL)
+        return 0;
+    for (int f = 0; f < filters; ++f)
+    {
+        memcpy(&weights[f * (row + 1)], &weight_data[f * row], row * sizeof(float));
+        weights[f * (row + 1) + row] = 0.0f;
+        if (bias_data != NULL)
+            memcpy(&weights[f * (row + 1) + row], &bias_data[f], sizeof(float));
+    }
+    layer->filters = filters;
+    layer->kernel_size = kernel_size;
+    layer->padding = padding;
+    import->channels = filters;
+    return 1;
+}
+
+static int ImportPool(Import *import, const Node *node, const int average)
+{
+    // square windows with the same padding on every side, the layers skip
+    // padding taps in the average, which is count_include_pad = 0
+    int64_t ints[MAX_INTS];
+    int count = IntsAttribute(node, "kernel_shape", ints);
+    if (count <= 0 || !AllEqual(ints, count, ints[0]) || import->channels_last || import->flat ||
+        import->table.num_layers == 0)
+    {
+        return 0;
+    }
+    const int kernel_size = (int)ints[0];
+    count = IntsAttribute(node, "strides", ints);
+    if (count < 0 || (count > 0 && !AllEqual(ints, count, ints[0])))
+        return 0;
+    // the ONNX default stride is 1, not the window
+    const int stride = count > 0 ? (int)ints[0] : 1;
+    const int padding = Padding(node);
+    if (padding < 0 || AutoPad(node, kernel_size) != 0 ||
+        (count = IntsAttribute(node, "dilations", ints)) < 0 || !AllEqual(ints, count, 1) ||
+        IntAttribute(node, "storage_order", 0) != 0 ||
+        (average && padding > 0 && IntAttribute(node, "count_include_pad", 0) != 0))
+    {
+        return 0;
+    }
+    Layer *layer = AddLayer(&import->table, average ? LAYER_AVGPOOL : LAYER_MAXPOOL, 0, NULL);
+    if (layer == NULL)
+        return 0;
+    layer->kernel_size = kernel_size;
+    layer->stride = stride;
+    layer->padding = padding;
+    layer->ceil_mode = (int)IntAttribute(node, "ceil_mode", 0);
+    return 1;
+}
+
+static int ImportFC(Import *import, const Node *node, const int gemm)
+{
+    // MatMul weights are [in][out], Gemm ones [out][in] with transB, the
+    // rows of the layer are [out][in + 1] with the bias last, which a
+    // following Add or the third Gemm input fills in
+    const Graph *graph = import->graph;
+    const Tensor *weight = node->num_inputs >= 2 ? FindTensor(graph, node->inputs[1]) : NULL;
+    const Tensor *bias = gemm && node->num_inputs >= 3 ? FindTensor(graph, node->inputs[2]) : NULL;
+    if (weight == NULL || weight->num_dims != 2 || weight->dims[0] <= 0 || weight->dims[1] <= 0 ||
+        (import->channels != 0 && !import->flat) || import->table.num_layers == 0 ||
+        (gemm && IntAttribute(node, "transA", 0) != 0))
+    {
+        return 0;
+    }
+    const int trans = gemm && IntAttribute(node, "transB", 0) != 0;
+    const float alpha = gemm ? FloatAttribute(node, "alpha", 1.0f) : 1.0f;
+    const float beta = gemm ? FloatAttribute(node, "beta", 1.0f) : 1.0f;
+    const int in_feat = (int)weight->dims[trans ? 1 : 0];
+    const int out_feat = (int)weight->dims[trans ? 0 : 1];
+    const float *weight_data = FloatData(weight, (size_t)in_feat * out_feat);
+    const float *bias_data = bias != NULL ? FloatData(bias, out_feat) : NULL;
+    if (weight_data == NULL || (bias != NULL && bias_data == NULL))
+        return 0;
+
+    // the first fc layer takes the flattened activations
+    import->channels = 0;
+    float *weights;
+    Layer *layer = AddLayer(&import->table, LAYER_FC, (size_t)out_feat * (in_feat + 1), &weights);
+    if (layer == NULL)
+        return 0;
+    for (int o = 0; o < out_feat; ++o)
+    {
+        float *row = &weights[(size_t)o * (in_feat + 1)];
+        for (int i = 0; i < in_feat; ++i)
+        {
+            float value;
+            memcpy(&value, &weight_data[trans ? (size_t)o * in_feat + i : (size_t)i * out_feat + o], sizeof(float));
+            row[i] = alpha * value;
+        }
+        row[in_feat] = 0.0f;
+        if (bias_data != NULL)
+        {
+            memcpy(&row[in_feat], &bias_data[o], sizeof(float));
+            row[in_feat] *= beta;
+        }
+    }
+    layer->in_feat = in_feat;
+    layer->out_feat = out_feat;
+    return 1;
+}
+
+static int ImportBias(Import *import, const Node *node, const Bytes current)
+{
+    // Add of a constant after a conv or fc layer is a bias, [c][1][1] for a
+    // conv and [out] for an fc layer, leading dims of 1 aside
+    const int channels = import->channels_last ? 0 : FoldChannels(&import->table, import->flat);
+    if (channels == 0 || node->num_inputs != 2)
+        return 0;
+    const Bytes other = SameName(node->inputs[0], current) ? node->inputs[1] : node->inputs[0];
+    const Tensor *bias = FindTensor(import->graph, other);
+    const int conv = import->channels != 0;
+    const int dim = bias != NULL ? bias->num_dims - (conv ? 3 : 1) : -1;
+    if (dim < 0 || bias->dims[dim] != channels ||
+        (conv && (bias->dims[dim + 1] != 1 || bias->dims[dim + 2] != 1)))
+    {
+        return 0;
+    }
+    const float *bias_data = FloatData(bias, channels);
+    float *weights;
+    Layer *layer = bias_data != NULL ? AddLayer(&import->table, LAYER_BIAS, channels, &weights) : NULL;
+    if (layer == NULL)
+        return 0;
+    memcpy(weights, bias_data, channels * sizeof(float));
+    return 1;
+}
+
+static int ImportNorm(Import *import, const Node *node)
+{
+    // BatchNormalization in inference mode after a conv or fc layer, its
+    // scale, B, mean and var inputs are taken in the order of the layer
+    static const int order[4] = { 1, 3, 4, 2 };
+    const int channels = import->channels_last ? 0 : FoldChannels(&import->table, import->flat);
+    if (channels == 0 || node->num_inputs != 5 || IntAttribute(node, "training_mode", 0) != 0)
+        return 0;
+    const float *data[4];
+    for (int k = 0; k < 4; ++k)
+    {
+        data[k] = FloatData(FindTensor(import->graph, node->inputs[order[k]]), channels);
+        if (data[k] == NULL)
+            return 0;
+    }
+    float *weights;
+    Layer *layer = AddLayer(&import->table, LAYER_BATCHNORM, 4 * (size_t)channels, &weights);
+    if (layer == NULL)
+        return 0;
+    for (int k = 0; k < 4; ++k)
+        memcpy(&weights[k * channels], data[k], channels * sizeof(float));
+    layer->alpha = FloatAttribute(node, "epsilon", 1e-5f);
+    return 1;
+}
+
+static int ImportLayout(Import *import, const Node *node)
+{
+    // before the first conv there is one channel, so any of these only moves
+    // it around, after it a Transpose between [c][h][w] and [h][w][c] is
+    // tracked and the first Reshape or Flatten fixes the order of the
+    // features, with a permute layer for [h][w][c], later ones see rows of
+    // features already
+    if (import->table.num_layers == 0 || import->channels == 0)
+        return 1;
+    if (IsName(node->op, "Transpose"))
+    {
+        if (import->flat)
+            return 0;
+        int64_t perm[MAX_INTS];
+        const int count = IntsAttribute(node, "perm", perm);
+        if (count == 4 && perm[0] == 0 && perm[1] == 2 && perm[2] == 3 && perm[3] == 1 && !import->channels_last)
+            import->channels_last = 1;
+        else if (count == 4 && perm[0] == 0 && perm[1] == 3 && perm[2] == 1 && perm[3] == 2 && import->channels_last)
+            import->channels_last = 0;
+        else
+            return 0;
+        return 1;
+    }
+    if (import->flat)
+        return 1;
+    import->flat = 1;
+    if (import->channels_last && AddLayer(&import->table, LAYER_PERMUTE, 0, NULL) == NULL)
+        return 0;
+    import->channels_last = 0;
+    return 1;
+}
+
+static int ImportNode(Import *import, const Node *node, const Bytes current)
+{
+    const Bytes op = node->op;
+    if (import->softmax)
+        return 0;
+    if (IsName(op, "Conv"))
+        return ImportConv(import, node);
+    if (IsName(op, "Relu") || IsName(op, "LeakyRelu"))
+    {
+        // elementwise, so any layout
+        Layer *layer = AddLayer(&import->table, LAYER_RELU, 0, NULL);
+        if (layer == NULL)
+            return 0;
+        layer->alpha = IsName(op, "Relu") ? 0.0f : FloatAttribute(node, "alpha", 0.01f);
+        return 1;
+    }
+    if (IsName(op, "MaxPool") || IsName(op, "AveragePool"))
+        return ImportPool(import, node, IsName(op, "AveragePool"));
+    if (IsName(op, "Gemm") || IsName(op, "MatMul"))
+        return ImportFC(import, node, IsName(op, "Gemm"));
+    if (IsName(op, "Add"))
+        return ImportBias(import, node, current);
+    if (IsName(op, "BatchNormalization"))
+        return ImportNorm(import, node);
+    if (IsName(op, "Reshape") || IsName(op, "Flatten") || IsName(op, "Transpose"))
+        return ImportLayout(import, node);
+    if (IsName(op, "Softmax"))
+    {
+        // nothing may follow
+        import->softmax = 1;
+        return AddLayer(&import->table, LAYER_SOFTMAX, 0, NULL) != NULL;
+    }
+    return IsName(op, "Identity") || IsName(op, "Dropout");
+}
+
+static int ImportGraph(const Graph *graph, ImportedModel *model)
+{
+    // walks the nodes as a chain from the graph input, one layer at most for
+    // each
+    Import import;
+    memset(&import, 0, sizeof(Import));
+    import.graph = graph;
+    import.channels = 1;
+    int ok = InitTable(&import.table, graph->num_nodes);
+    Bytes current = graph->input;
+    for (int i = 0; ok && i < graph->num_nodes; ++i)
+    {
+        const Node *node = &graph->nodes[i];
+        const int chained = SameName(node->inputs[0], current) ||
+            (IsName(node->op, "Add") && node->num_inputs == 2 && SameName(node->inputs[1], current));
+        ok = chained && ImportNode(&import, node, current);
+        current = node->output;
+    }
+
+    // dims of the graph input as [n][1][h][w], [n][h][w][1] or [n][h][w],
+    // the first conv checked that there is one channel
+    const int64_t *dims = graph->in_dims;
+    if (graph->num_in_dims == 4 && (dims[1] == 1 || dims[3] == 1))
+    {
+        model->in_h = (int)(dims[1] == 1 ? dims[2] : dims[1]);
+        model->in_w = (int)(dims[1] == 1 ? dims[3] : dims[2]);
+    }
+    else if (graph->num_in_dims == 3)
+    {
+        model->in_h = (int)dims[1];
+        model->in_w = (int)dims[2];
+    }
+    return FinishImport(&import.table, ok, model);
+}
+
+int IsOnnxFile(const char *filename)
+{
+    unsigned char key;
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+        return 0;
+    const size_t read = fread(&key, 1, 1, file);
+    fclose(file);
+    return read == 1 && key == 0x08;
+}
+
+int LoadOnnxModel(const char *filename, ImportedModel *model)
+{
+    memset(model, 0, sizeof(ImportedModel));
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+        return 0;
+    uint8_t *buffer = NULL;
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) > 0 && fseek(file, 0, SEEK_SET) == 0)
+        buffer = malloc(size);
+    const int read = buffer != NULL && fread(buffer, 1, size, file) == (size_t)size;
+    fclose(file);
+    if (!read)
+    {
+        free(buffer);
+        return 0;
+    }
+
+    // ModelProto.graph
+    const Bytes message = { buffer, (size_t)size };
+    Reader reader = Open(message);
+    Field field;
+    int status;
+    Bytes graph_message = { NULL, 0 };
+    while ((status = NextField(&reader, &field)) > 0)
+    {
+        if (field.number == 7 && field.wire == 2)
+            graph_message = field.bytes;
+    }
+    Graph graph;
+    memset(&graph, 0, sizeof(Graph));
+    const int ok = status == 0 && graph_message.data != NULL &&
+        ParseGraph(graph_message, &graph) && ImportGraph(&graph, model);
+    FreeGraph(&graph);
+    free(buffer);
+    return ok;
+}
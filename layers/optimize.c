@@ -0,0 +1,163 @@
+#include "layers.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int IsGraphOp(const LayerType type)
+{
+    return type == LAYER_BATCHNORM || type == LAYER_BIAS || type == LAYER_PERMUTE || type == LAYER_SOFTMAX;
+}
+
+static float *Writable(const Layer *layer, float *params)
+{
+    // the importers own params, the layers only see them as const
+    return params + (layer->weights - params);
+}
+
+static int Rows(const Layer *layer)
+{
+    // output channels of a conv or fc layer, 0 for the other layers
+    if (layer->type == LAYER_CONV)
+        return layer->filters;
+    return layer->type == LAYER_FC ? layer->out_feat : 0;
+}
+
+static int FoldNorms(Layer *layers, const int num_layers, float *params)
+{
+    // batchnorm and bias layers scale and shift the output channels of the
+    // conv or fc before them, which is the same as scaling its rows and
+    // shifting the bias at the end of every row, returns the new number of
+    // layers or -1
+    int count = 0;
+    for (int i = 0; i < num_layers; ++i)
+    {
+        const Layer *layer = &layers[i];
+        if (layer->type != LAYER_BATCHNORM && layer->type != LAYER_BIAS)
+        {
+            layers[count++] = layers[i];
+            continue;
+        }
+        Layer *target = count > 0 ? &layers[count - 1] : NULL;
+        const int rows = target != NULL ? Rows(target) : 0;
+        const int channels = layer->type == LAYER_BATCHNORM ? layer->weight_count / 4 : layer->weight_count;
+        if (rows <= 0 || channels != rows || layer->weights == NULL || target->weights == NULL ||
+            target->weight_count % rows != 0)
+        {
+            return -1;
+        }
+        const int cols = target->weight_count / rows;
+        float *weights = Writable(target, params);
+        for (int r = 0; r < rows; ++r)
+        {
+            float scale = 1.0f;
+            float shift = layer->weights[r];
+            if (layer->type == LAYER_BATCHNORM)
+            {
+                const float slope = layer->weights[r], mean = layer->weights[rows + r];
+                const float var = layer->weights[2 * rows + r], bias = layer->weights[3 * rows + r];
+                scale = slope / sqrtf(var + layer->alpha);
+                shift = bias - mean * scale;
+            }
+            float *row = &weights[(size_t)r * cols];
+            for (int c = 0; c < cols; ++c)
+                row[c] *= scale;
+            row[cols - 1] += shift;
+        }
+    }
+    return count;
+}
+
+static int FoldPermute(Layer *layers, const int num_layers, float *params)
+{
+    // the fc layer after a permute takes its inputs in [h][w][c] order, the
+    // layers flatten [c][h][w], so its columns are put in that order once,
+    // the channels are those of the last conv, returns the new number of
+    // layers or -1
+    int count = 0;
+    int channels = 1;
+    for (int i = 0; i < num_layers; ++i)
+    {
+        const Layer *layer = &layers[i];
+        if (layer->type == LAYER_CONV)
+            channels = layer->filters;
+        if (layer->type != LAYER_PERMUTE)
+        {
+            layers[count++] = layers[i];
+            continue;
+        }
+        const Layer *fc = i + 1 < num_layers ? &layers[i + 1] : NULL;
+        if (fc == NULL || fc->type != LAYER_FC || fc->weights == NULL ||
+            fc->in_feat <= 0 || fc->in_feat % channels != 0 ||
+            fc->weight_count != fc->out_feat * (fc->in_feat + 1))
+        {
+            return -1;
+        }
+        const int spatial = fc->in_feat / channels;
+        if (channels == 1 || spatial == 1)
+            continue;
+        float *row = malloc(fc->in_feat * sizeof(float));
+        if (row == NULL)
+            return -1;
+        float *weights = Writable(fc, params);
+        for (int o = 0; o < fc->out_feat; ++o)
+        {
+            float *dst = &weights[(size_t)o * (fc->in_feat + 1)];
+            memcpy(row, dst, fc->in_feat * sizeof(float));
+            for (int ch = 0; ch < channels; ++ch)
+            {
+                for (int s = 0; s < spatial; ++s)
+                    dst[ch * spatial + s] = row[s * channels + ch];
+            }
+        }
+        free(row);
+    }
+    return count;
+}
+
+static int DropSoftmax(Layer *layers, const int num_layers)
+{
+    // a softmax only rescales the logits, the argmax stays, and the other
+    // formats return logits as well
+    if (num_layers > 0 && layers[num_layers - 1].type == LAYER_SOFTMAX)
+        return num_layers - 1;
+    return num_layers;
+}
+
+static int PackParams(Layer *layers, const int num_layers, float *params, size_t *param_count)
+{
+    // folded ops leave their weights behind, the rest move down over them
+    size_t offset = 0;
+    for (int i = 0; i < num_layers; ++i)
+    {
+        Layer *layer = &layers[i];
+        if (layer->weights == NULL)
+            continue;
+        if (layer->weights < params + offset || layer->weight_count <= 0 ||
+            (size_t)(layer->weights - params) + layer->weight_count > *param_count)
+        {
+            return 0;
+        }
+        memmove(params + offset, layer->weights, layer->weight_count * sizeof(float));
+        layer->weights = params + offset;
+        offset += layer->weight_count;
+    }
+    *param_count = offset;
+    return 1;
+}
+
+int OptimizeLayers(Layer *layers, const int num_layers, float *params, size_t *param_count)
+{
+    int count = FoldNorms(layers, num_layers, params);
+    if (count >= 0)
+        count = FoldPermute(layers, count, params);
+    if (count >= 0)
+        count = DropSoftmax(layers, count);
+    if (count <= 0)
+        return 0;
+    for (int i = 0; i < count; ++i)
+    {
+        if (IsGraphOp(layers[i].type))
+            return 0;
+    }
+    return PackParams(layers, count, params, param_count) ? count : 0;
+}
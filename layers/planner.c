@@ -0,0 +1,126 @@
+#include "layers.h"
+#include "config.h"
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// one blob tensor, live from the step that writes it to the last step that
+// reads it
+typedef struct {
+    int64_t size;
+    int first;
+    int last;
+    int *offset;
+} Tensor;
+
+static int64_t AlignSize(const int size)
+{
+    const int64_t align = ALIGN_SIZE / sizeof(float);
+    return (size + align - 1) / align * align;
+}
+
+static int CompareTensors(const void *a, const void *b)
+{
+    // largest first, ties in execution order
+    const Tensor *ta = *(const Tensor *const *)a;
+    const Tensor *tb = *(const Tensor *const *)b;
+    if (ta->size != tb->size)
+        return tb->size > ta->size ? 1 : -1;
+    return ta->first - tb->first;
+}
+
+int PlanMemory(Layer *layers, const int num_layers, ModelShape *shape)
+{
+    // step 2 * i flattens the input of layer i and step 2 * i + 1 runs it.
+    // A tensor lives until the next layer that writes a new one has read it,
+    // in-place layers like relu only extend the lifetime of their input.
+    Tensor *tensors = malloc(2 * num_layers * sizeof(Tensor));
+    Tensor **order = malloc(2 * num_layers * sizeof(Tensor *));
+    if (tensors == NULL || order == NULL)
+    {
+        free(tensors);
+        free(order);
+        return 0;
+    }
+    Tensor *current = NULL;
+    int count = 0;
+    for (int i = 0; i < num_layers; ++i)
+    {
+        Layer *layer = &layers[i];
+        layer->top_offset = -1;
+        layer->flat_offset = -1;
+        if (layer->top_size == 0)
+        {
+            if (current == NULL)
+            {
+                free(tensors);
+                free(order);
+                return 0;
+            }
+            current->last = 2 * i + 1;
+            continue;
+        }
+        if (current != NULL)
+            current->last = layer->flat_size > 0 ? 2 * i : 2 * i + 1;
+        if (layer->flat_size > 0)
+        {
+            Tensor *flat = &tensors[count++];
+            flat->size = AlignSize(layer->flat_size);
+            flat->first = 2 * i, flat->last = 2 * i + 1;
+            flat->offset = &layer->flat_offset;
+        }
+        current = &tensors[count++];
+        current->size = AlignSize(layer->top_size);
+        current->first = 2 * i + 1, current->last = 2 * i + 1;
+        current->offset = &layer->top_offset;
+    }
+    // the output is read by the argmax after the last layer
+    if (current != NULL)
+        current->last = 2 * num_layers;
+
+    // greedy by size: every tensor takes the lowest offset that does not
+    // collide with an already placed tensor alive at the same time
+    for (int n = 0; n < count; ++n)
+        order[n] = &tensors[n];
+    qsort(order, count, sizeof(Tensor *), CompareTensors);
+    shape->blob_size = 0;
+    for (int n = 0; n < count; ++n)
+    {
+        Tensor *tensor = order[n];
+        int64_t offset = 0;
+        for (int moved = 1; moved; )
+        {
+            moved = 0;
+            for (int m = 0; m < n; ++m)
+            {
+                const Tensor *placed = order[m];
+                if (tensor->first <= placed->last && placed->first <= tensor->last &&
+                    offset < *placed->offset + placed->size && *placed->offset < offset + tensor->size)
+                {
+                    offset = *placed->offset + placed->size;
+                    moved = 1;
+                }
+            }
+        }
+        // the arena is indexed with int, so a plan past INT_MAX is rejected
+        if (offset + tensor->size > INT_MAX)
+        {
+            free(tensors);
+            free(order);
+            return 0;
+        }
+        *tensor->offset = (int)offset;
+        if (offset + tensor->size > shape->blob_size)
+            shape->blob_size = (int)(offset + tensor->size);
+    }
+    free(tensors);
+    free(order);
+
+    // in-place layers work on the tensor of the layer before them
+    for (int i = 1; i < num_layers; ++i)
+    {
+        if (layers[i].top_size == 0)
+            layers[i].top_offset = layers[i - 1].top_offset;
+    }
+    return 1;
+}
@@ -0,0 +1,251 @@
+#include <float.h>
+#include "layers.h"
+#include "simd.h"
+
+// padded row the separable kernel keeps on the stack, wider planes take the
+// plain loop
+#define POOL_ROW_SIZE 2048
+
+static int ClipWindow(const int start, const int kernel_size, const int size, int *end)
+{
+    // the taps of a window that lie inside the input, returns the first
+    *end = start + kernel_size < size ? start + kernel_size : size;
+    return start > 0 ? start : 0;
+}
+
+static float PoolWindow(
+    const float *plane, const int in_h, const int in_w,
+    const int y0, const int x0, const int kernel_size, const int average
+)
+{
+    // one window by the plain loop
+    int y1, x1;
+    const int ys = ClipWindow(y0, kernel_size, in_h, &y1);
+    const int xs = ClipWindow(x0, kernel_size, in_w, &x1);
+    float value = average ? 0.0f : -FLT_MAX;
+    for (int y = ys; y < y1; ++y)
+    {
+        for (int x = xs; x < x1; ++x)
+        {
+            const float v = plane[y * in_w + x];
+            value = average ? value + v : v > value ? v : value;
+        }
+    }
+    return average ? value / ((y1 - ys) * (x1 - xs)) : value;
+}
+
+static inline void Pool2x2(
+    const float *plane, float *out, const int in_h, const int in_w,
+    const int out_h, const int out_w, const int average
+)
+{
+    // stride 2 without padding: the two rows of the windows are combined
+    // lane by lane, then adjacent lanes in pairs, which leaves the outputs
+    // in order, windows over the edge of an odd plane in ceil mode are
+    // clipped by PoolWindow()
+    for (int oy = 0; oy < out_h; ++oy)
+    {
+        const float *r0 = &plane[2 * oy * in_w];
+        const float *r1 = &r0[in_w];
+        float *dst = &out[oy * out_w];
+        int ox = 0;
+        if (2 * oy + 1 < in_h)
+        {
+#if defined(SIMD_HAS_V8)
+            for (; 2 * ox + 16 <= in_w; ox += 8)
+            {
+                const v8f a0 = V8_LOAD(&r0[2 * ox]), a1 = V8_LOAD(&r1[2 * ox]);
+                const v8f b0 = V8_LOAD(&r0[2 * ox + 8]), b1 = V8_LOAD(&r1[2 * ox + 8]);
+                if (average)
+                    V8_STORE(&dst[ox], V8_MUL(V8_PAIR_ADD(V8_ADD(a0, a1), V8_ADD(b0, b1)), V8_DUP(0.25f)));
+                else
+                    V8_STORE(&dst[ox], V8_PAIR_MAX(V8_MAX(a0, a1), V8_MAX(b0, b1)));
+            }
+#endif
+#if defined(SIMD_HAS_V4)
+            for (; 2 * ox + 8 <= in_w; ox += 4)
+            {
+                const v4f a0 = V4_LOAD(&r0[2 * ox]), a1 = V4_LOAD(&r1[2 * ox]);
+                const v4f b0 = V4_LOAD(&r0[2 * ox + 4]), b1 = V4_LOAD(&r1[2 * ox + 4]);
+                if (average)
+                    V4_STORE(&dst[ox], V4_MUL(V4_PAIR_ADD(V4_ADD(a0, a1), V4_ADD(b0, b1)), V4_DUP(0.25f)));
+                else
+                    V4_STORE(&dst[ox], V4_PAIR_MAX(V4_MAX(a0, a1), V4_MAX(b0, b1)));
+            }
+#endif
+            for (; 2 * ox + 2 <= in_w; ++ox)
+            {
+                const float *p0 = &r0[2 * ox], *p1 = &r1[2 * ox];
+                if (average)
+                {
+                    dst[ox] = (p0[0] + p0[1] + p1[0] + p1[1]) * 0.25f;
+                    continue;
+                }
+                const float m0 = p0[0] > p0[1] ? p0[0] : p0[1];
+                const float m1 = p1[0] > p1[1] ? p1[0] : p1[1];
+                dst[ox] = m0 > m1 ? m0 : m1;
+            }
+        }
+        for (; ox < out_w; ++ox)
+            dst[ox] = PoolWindow(plane, in_h, in_w, 2 * oy, 2 * ox, 2, average);
+    }
+}
+
+static void CombineRow(float *row, const float *src, const int size, const int average)
+{
+    // row = row + src or max(row, src)
+    int x = 0;
+#if defined(SIMD_HAS_V8)
+    for (; x + 8 <= size; x += 8)
+    {
+        const v8f a = V8_LOAD(&row[x]), b = V8_LOAD(&src[x]);
+        V8_STORE(&row[x], average ? V8_ADD(a, b) : V8_MAX(a, b));
+    }
+#endif
+#if defined(SIMD_HAS_V4)
+    for (; x + 4 <= size; x += 4)
+    {
+        const v4f a = V4_LOAD(&row[x]), b = V4_LOAD(&src[x]);
+        V4_STORE(&row[x], average ? V4_ADD(a, b) : V4_MAX(a, b));
+    }
+#endif
+    for (; x < size; ++x)
+        row[x] = average ? row[x] + src[x] : src[x] > row[x] ? src[x] : row[x];
+}
+
+static void PoolRows(
+    const float *plane, float *out, const int in_h, const int in_w,
+    const int out_h, const int out_w, const int kernel_size, const int stride, const int padding,
+    const int average, float *row, const float *col_scale
+)
+{
+    // separable: the input rows of a window row are reduced into row, whose
+    // padding holds the identity of the reduction, then every window reduces
+    // its columns of row, contiguous loads when the stride is 1
+    const float fill = average ? 0.0f : -FLT_MAX;
+    const int width = (out_w - 1) * stride + kernel_size;
+    for (int x = 0; x < padding; ++x)
+        row[x] = fill;
+    for (int x = padding + in_w; x < width; ++x)
+        row[x] = fill;
+    float *inner = &row[padding];
+    for (int oy = 0; oy < out_h; ++oy)
+    {
+        int y1;
+        const int ys = ClipWindow(oy * stride - padding, kernel_size, in_h, &y1);
+        for (int x = 0; x < in_w; ++x)
+            inner[x] = plane[ys * in_w + x];
+        for (int y = ys + 1; y < y1; ++y)
+            CombineRow(inner, &plane[y * in_w], in_w, average);
+        const float row_scale = 1.0f / (y1 - ys);
+        float *dst = &out[oy * out_w];
+        int ox = 0;
+        if (stride == 1)
+        {
+#if defined(SIMD_HAS_V8)
+            for (; ox + 8 <= out_w; ox += 8)
+            {
+                v8f acc = V8_LOAD(&row[ox]);
+                for (int kx = 1; kx < kernel_size; ++kx)
+                    acc = average ? V8_ADD(acc, V8_LOAD(&row[ox + kx])) : V8_MAX(acc, V8_LOAD(&row[ox + kx]));
+                if (average)
+                    acc = V8_MUL(acc, V8_MUL(V8_LOAD(&col_scale[ox]), V8_DUP(row_scale)));
+                V8_STORE(&dst[ox], acc);
+            }
+#endif
+#if defined(SIMD_HAS_V4)
+            for (; ox + 4 <= out_w; ox += 4)
+            {
+                v4f acc = V4_LOAD(&row[ox]);
+                for (int kx = 1; kx < kernel_size; ++kx)
+                    acc = average ? V4_ADD(acc, V4_LOAD(&row[ox + kx])) : V4_MAX(acc, V4_LOAD(&row[ox + kx]));
+                if (average)
+                    acc = V4_MUL(acc, V4_MUL(V4_LOAD(&col_scale[ox]), V4_DUP(row_scale)));
+                V4_STORE(&dst[ox], acc);
+            }
+#endif
+        }
+        for (; ox < out_w; ++ox)
+        {
+            const float *window = &row[ox * stride];
+            float acc = window[0];
+            for (int kx = 1; kx < kernel_size; ++kx)
+                acc = average ? acc + window[kx] : window[kx] > acc ? window[kx] : acc;
+            dst[ox] = average ? acc * col_scale[ox] * row_scale : acc;
+        }
+    }
+}
+
+int PoolingLayer(
+    const float *bottom, float *top, const int planes,
+    const int in_h, const int in_w, const int out_h, const int out_w,
+    const int kernel_size, const int stride, const int padding, const int average
+)
+{
+    const int in_size = in_h * in_w, out_size = out_h * out_w;
+    if (kernel_size == 2 && stride == 2 && padding == 0)
+    {
+        // the two calls let the compiler drop the average tests from the
+        // loops
+        for (int p = 0; p < planes; ++p)
+        {
+            if (average)
+                Pool2x2(&bottom[p * in_size], &top[p * out_size], in_h, in_w, out_h, out_w, 1);
+            else
+                Pool2x2(&bottom[p * in_size], &top[p * out_size], in_h, in_w, out_h, out_w, 0);
+        }
+        return planes * out_size;
+    }
+
+    const int width = (out_w - 1) * stride + kernel_size;
+    if (width <= POOL_ROW_SIZE && padding + in_w <= POOL_ROW_SIZE)
+    {
+        // 1 / the taps of every window column that lie inside the input
+        float row[POOL_ROW_SIZE];
+        float col_scale[POOL_ROW_SIZE];
+        for (int ox = 0; ox < out_w; ++ox)
+        {
+            int x1;
+            const int xs = ClipWindow(ox * stride - padding, kernel_size, in_w, &x1);
+            col_scale[ox] = 1.0f / (x1 - xs);
+        }
+        for (int p = 0; p < planes; ++p)
+        {
+            PoolRows(
+                &bottom[p * in_size], &top[p * out_size], in_h, in_w, out_h, out_w,
+                kernel_size, stride, padding, average, row, col_scale
+            );
+        }
+        return planes * out_size;
+    }
+
+    for (int p = 0; p < planes; ++p)
+    {
+        for (int oy = 0; oy < out_h; ++oy)
+        {
+            for (int ox = 0; ox < out_w; ++ox)
+            {
+                top[p * out_size + oy * out_w + ox] = PoolWindow(
+                    &bottom[p * in_size], in_h, in_w, oy * stride - padding, ox * stride - padding,
+                    kernel_size, average
+                );
+            }
+        }
+    }
+    return planes * out_size;
+}
+
+int PoolOutputSize(
+    const int size, const int kernel_size, const int stride, const int padding, const int ceil_mode
+)
+{
+    // with ceil_mode the last window may hang over the input, but it has to
+    // start inside it or in the left padding
+    const int span = size + 2 * padding - kernel_size;
+    if (span < 0 || stride <= 0)
+        return 0;
+    int out = (ceil_mode ? (span + stride - 1) / stride : span / stride) + 1;
+    if (ceil_mode && (out - 1) * stride >= size + padding)
+        --out;
+    return out;
+}
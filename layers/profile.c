@@ -0,0 +1,304 @@
+#define _GNU_SOURCE
+#include "profile.h"
+#ifdef USE_PROFILE
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+
+// PROFILE_INT8 and PROFILE_JIT come before layer 0 in the totals
+#define PSEUDO_LAYERS   2
+
+static const char *LayerNames[] = { "conv", "maxpool", "relu", "fc", "conv_relu_pool", "avgpool", "fc_sparse" };
+
+#ifdef __linux__
+static int OpenCounter(const uint32_t type, const uint64_t config, const int group)
+{
+    // the calling thread on any cpu, user space only so that it also opens
+    // with perf_event_paranoid 2
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+static void OpenCounters(Profile *profile)
+{
+    profile->leader = -1;
+    profile->open_count = 0;
+    for (int c = 0; c < PROFILE_COUNTERS; ++c)
+        profile->fds[c] = profile->slots[c] = -1;
+#ifdef __linux__
+    // in the order of ProfileCounter
+    const uint32_t types[PROFILE_COUNTERS] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE
+    };
+    const uint64_t configs[PROFILE_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+    for (int c = 0; c < PROFILE_COUNTERS; ++c)
+    {
+        const int fd = OpenCounter(types[c], configs[c], profile->leader);
+        if (fd < 0)
+            continue;
+        if (profile->leader < 0)
+            profile->leader = fd;
+        profile->fds[c] = fd;
+        profile->slots[c] = profile->open_count++;
+    }
+#endif
+}
+
+static void ReadCounters(const Profile *profile, uint64_t *counters)
+{
+    // one read of the group: the number of counters, then their values
+    uint64_t values[PROFILE_COUNTERS + 1] = { 0, };
+    if (profile->leader >= 0 && read(profile->leader, values, sizeof(values)) <= 0)
+        values[0] = 0;
+    for (int c = 0; c < PROFILE_COUNTERS; ++c)
+        counters[c] = profile->slots[c] >= 0 && (uint64_t)profile->slots[c] < values[0] ? values[profile->slots[c] + 1] : 0;
+}
+
+Profile *ProfileCreate(const int num_layers)
+{
+    Profile *profile = calloc(1, sizeof(Profile));
+    if (profile == NULL)
+        return NULL;
+    profile->num_layers = num_layers;
+    profile->totals = calloc(num_layers + PSEUDO_LAYERS, sizeof(ProfileTotal));
+    profile->events = malloc(PROFILE_MAX_EVENTS * sizeof(ProfileEvent));
+    if (profile->totals == NULL || profile->events == NULL)
+    {
+        ProfileFree(profile);
+        return NULL;
+    }
+    profile->thread_id = (int)syscall(SYS_gettid);
+    OpenCounters(profile);
+    return profile;
+}
+
+void ProfileFree(Profile *profile)
+{
+    if (profile == NULL)
+        return;
+    for (int c = 0; c < PROFILE_COUNTERS; ++c)
+    {
+        if (profile->fds[c] >= 0)
+            close(profile->fds[c]);
+    }
+    free(profile->totals);
+    free(profile->events);
+    free(profile);
+}
+
+void ProfileBegin(Profile *profile)
+{
+    ReadCounters(profile, profile->counters);
+    profile->start = NowNs();
+}
+
+void ProfileEnd(Profile *profile, const int layer, const int batch)
+{
+    const int64_t end = NowNs();
+    uint64_t counters[PROFILE_COUNTERS];
+    ReadCounters(profile, counters);
+    for (int c = 0; c < PROFILE_COUNTERS; ++c)
+        counters[c] -= profile->counters[c];
+
+    ProfileTotal *total = &profile->totals[layer + PSEUDO_LAYERS];
+    ++total->calls;
+    total->images += batch;
+    total->duration += end - profile->start;
+    for (int c = 0; c < PROFILE_COUNTERS; ++c)
+        total->counters[c] += counters[c];
+    if (profile->event_count == PROFILE_MAX_EVENTS)
+        return;
+    ProfileEvent *event = &profile->events[profile->event_count++];
+    event->start = profile->start;
+    event->duration = end - profile->start;
+    event->layer = layer;
+    event->batch = batch;
+    memcpy(event->counters, counters, sizeof(counters));
+}
+
+static void LayerLabel(const Layer *layers, const int layer, char *label, const size_t size)
+{
+    // index, type and dims, from the layer table
+    if (layer == PROFILE_JIT)
+    {
+        snprintf(label, size, "jit forward");
+        return;
+    }
+    if (layer == PROFILE_INT8)
+    {
+        snprintf(label, size, "int8 forward");
+        return;
+    }
+    const Layer *l = &layers[layer];
+    snprintf(
+        label, size, "%d %s %dx%dx%d->%dx%dx%d", layer, LayerNames[l->type],
+        l->in_c, l->in_h, l->in_w, l->out_c, l->out_h, l->out_w
+    );
+}
+
+static void SumTotals(ProfileTotal *sum, const ProfileTotal *total)
+{
+    sum->calls += total->calls;
+    sum->images += total->images;
+    sum->duration += total->duration;
+    for (int c = 0; c < PROFILE_COUNTERS; ++c)
+        sum->counters[c] += total->counters[c];
+}
+
+static void PrintTotal(const char *label, const ProfileTotal *total, const int64_t all_duration, const int *available, FILE *out)
+{
+    const double images = total->images > 0 ? (double)total->images : 1.0;
+    fprintf(
+        out, "%-36s %8lld %9lld %10.3f %9.3f %6.1f%%", label, (long long)total->calls, (long long)total->images,
+        total->duration / 1e6, total->duration / 1e3 / images,
+        all_duration > 0 ? 100.0 * total->duration / all_duration : 0.0
+    );
+    if (available[COUNTER_CYCLES])
+        fprintf(out, " %12.0f", total->counters[COUNTER_CYCLES] / images);
+    if (available[COUNTER_CYCLES] && available[COUNTER_INSTRUCTIONS])
+    {
+        const uint64_t cycles = total->counters[COUNTER_CYCLES];
+        fprintf(out, " %5.2f", cycles > 0 ? (double)total->counters[COUNTER_INSTRUCTIONS] / cycles : 0.0);
+    }
+    if (available[COUNTER_L1D_MISSES])
+        fprintf(out, " %10.1f", total->counters[COUNTER_L1D_MISSES] / images);
+    if (available[COUNTER_BRANCH_MISSES])
+        fprintf(out, " %10.1f", total->counters[COUNTER_BRANCH_MISSES] / images);
+    fprintf(out, "\n");
+}
+
+static void PrintHeader(const char *title, const int *available, FILE *out)
+{
+    fprintf(out, "%-36s %8s %9s %10s %9s %7s", title, "calls", "images", "total ms", "us/image", "share");
+    if (available[COUNTER_CYCLES])
+        fprintf(out, " %12s", "cycles/image");
+    if (available[COUNTER_CYCLES] && available[COUNTER_INSTRUCTIONS])
+        fprintf(out, " %5s", "IPC");
+    if (available[COUNTER_L1D_MISSES])
+        fprintf(out, " %10s", "L1d miss/i");
+    if (available[COUNTER_BRANCH_MISSES])
+        fprintf(out, " %10s", "br miss/i");
+    fprintf(out, "\n");
+}
+
+void ProfileReport(Profile *const *profiles, const int count, const Layer *layers, FILE *out)
+{
+    if (count <= 0)
+        return;
+    const int num_layers = profiles[0]->num_layers;
+    int available[PROFILE_COUNTERS] = { 0, };
+    int64_t all_duration = 0;
+    for (int p = 0; p < count; ++p)
+    {
+        for (int c = 0; c < PROFILE_COUNTERS; ++c)
+            available[c] |= profiles[p]->slots[c] >= 0;
+        for (int i = 0; i < num_layers + PSEUDO_LAYERS; ++i)
+            all_duration += profiles[p]->totals[i].duration;
+    }
+    if (!available[COUNTER_CYCLES] && !available[COUNTER_INSTRUCTIONS] &&
+        !available[COUNTER_L1D_MISSES] && !available[COUNTER_BRANCH_MISSES])
+    {
+        fprintf(out, "Profile: no perf counters on this system, times only\n");
+    }
+
+    // every layer over all threads, steps that never ran are left out
+    char label[64];
+    PrintHeader("layer", available, out);
+    for (int i = 0; i < num_layers + PSEUDO_LAYERS; ++i)
+    {
+        ProfileTotal sum = { 0, };
+        for (int p = 0; p < count; ++p)
+            SumTotals(&sum, &profiles[p]->totals[i]);
+        if (sum.calls == 0)
+            continue;
+        LayerLabel(layers, i - PSEUDO_LAYERS, label, sizeof(label));
+        PrintTotal(label, &sum, all_duration, available, out);
+    }
+
+    // every thread over all layers, images are counted once per layer, so
+    // us/image is the forward pass of one image
+    PrintHeader("thread", available, out);
+    for (int p = 0; p < count; ++p)
+    {
+        ProfileTotal sum = { 0, };
+        int64_t images = 0;
+        for (int i = 0; i < num_layers + PSEUDO_LAYERS; ++i)
+        {
+            SumTotals(&sum, &profiles[p]->totals[i]);
+            // the first step of every call is the input layer or a pseudo
+            // layer, so these count the images once
+            if (i < PSEUDO_LAYERS + 1)
+                images += profiles[p]->totals[i].images;
+        }
+        sum.images = images;
+        snprintf(label, sizeof(label), "%d tid %d", p, profiles[p]->thread_id);
+        PrintTotal(label, &sum, all_duration, available, out);
+    }
+}
+
+int ProfileWriteTrace(Profile *const *profiles, const int count, const Layer *layers, const char *filename)
+{
+    FILE *file = fopen(filename, "w");
+    if (file == NULL)
+        return 0;
+    const char *counter_names[PROFILE_COUNTERS] = { "cycles", "instructions", "l1d_misses", "branch_misses" };
+    // timestamps in us from the first event
+    int64_t origin = INT64_MAX;
+    for (int p = 0; p < count; ++p)
+    {
+        if (profiles[p]->event_count > 0 && profiles[p]->events[0].start < origin)
+            origin = profiles[p]->events[0].start;
+    }
+    const int pid = (int)getpid();
+    char label[64];
+    int first = 1;
+    fprintf(file, "{\"traceEvents\": [\n");
+    for (int p = 0; p < count; ++p)
+    {
+        const Profile *profile = profiles[p];
+        fprintf(
+            file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"context %d\"}}",
+            first ? "" : ",\n", pid, profile->thread_id, p
+        );
+        first = 0;
+        for (int e = 0; e < profile->event_count; ++e)
+        {
+            const ProfileEvent *event = &profile->events[e];
+            LayerLabel(layers, event->layer, label, sizeof(label));
+            fprintf(
+                file, ",\n{\"name\": \"%s\", \"cat\": \"layer\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, "
+                "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"batch\": %d",
+                label, pid, profile->thread_id, (event->start - origin) / 1e3, event->duration / 1e3, event->batch
+            );
+            for (int c = 0; c < PROFILE_COUNTERS; ++c)
+            {
+                if (profile->slots[c] >= 0)
+                    fprintf(file, ", \"%s\": %llu", counter_names[c], (unsigned long long)event->counters[c]);
+            }
+            fprintf(file, "}}");
+        }
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+#endif  // USE_PROFILE
@@ -0,0 +1,88 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include "layers.h"
+
+// Per-layer profiling of the interpreter, built with -DUSE_PROFILE. Every
+// context gets a Profile on the thread that creates it, and every step of the
+// layer loop is bracketed by PROFILE_BEGIN/PROFILE_END, which compile to
+// nothing otherwise. A step records its wall time and, on Linux, the delta of
+// a perf_event_open group counting the calling thread in user space: cycles,
+// instructions, L1d read misses and branch misses. Counters the kernel or
+// the cpu does not offer read as 0 and are left out of the report.
+#define PROFILE_COUNTERS    4
+// events kept per context for the trace, later calls only add to the totals
+#define PROFILE_MAX_EVENTS  65536
+// pseudo layers of the paths that run the whole model in one call
+#define PROFILE_JIT         -1
+#define PROFILE_INT8        -2
+
+typedef enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_L1D_MISSES,
+    COUNTER_BRANCH_MISSES
+} ProfileCounter;
+
+typedef struct {
+    int64_t start;
+    int64_t duration;
+    int layer;
+    int batch;
+    uint64_t counters[PROFILE_COUNTERS];
+} ProfileEvent;
+
+typedef struct {
+    int64_t calls;
+    int64_t images;
+    int64_t duration;
+    uint64_t counters[PROFILE_COUNTERS];
+} ProfileTotal;
+
+typedef struct {
+    // perf group, the leader is the first counter that opened, -1 for none
+    int leader;
+    int fds[PROFILE_COUNTERS];
+    // position of every open counter in the group read, -1 when closed
+    int slots[PROFILE_COUNTERS];
+    int open_count;
+    int thread_id;
+    // state at PROFILE_BEGIN
+    int64_t start;
+    uint64_t counters[PROFILE_COUNTERS];
+    // totals of the pseudo layers first, then of every layer
+    ProfileTotal *totals;
+    int num_layers;
+    ProfileEvent *events;
+    int event_count;
+} Profile;
+
+#ifdef USE_PROFILE
+#define PROFILE_BEGIN(profile)              ProfileBegin(profile)
+#define PROFILE_END(profile, layer, batch)  ProfileEnd(profile, layer, batch)
+#else
+#define PROFILE_BEGIN(profile)
+#define PROFILE_END(profile, layer, batch)
+#endif
+
+// opens the counters of the calling thread, NULL when out of memory
+Profile *ProfileCreate(const int num_layers);
+
+void ProfileFree(Profile *profile);
+
+void ProfileBegin(Profile *profile);
+
+// closes the step opened by ProfileBegin(), which ran layer on batch images
+void ProfileEnd(Profile *profile, const int layer, const int batch);
+
+// prints the per-layer totals over all profiles, then the totals of every
+// thread
+void ProfileReport(Profile *const *profiles, const int count, const Layer *layers, FILE *out);
+
+// writes the events of all profiles as Chrome trace JSON (chrome://tracing,
+// Perfetto), returns 0 when the file cannot be written
+int ProfileWriteTrace(Profile *const *profiles, const int count, const Layer *layers, const char *filename);
+
+#endif  // PROFILE_H_
@@ -0,0 +1,710 @@
+#include "quant.h"
+#include "config.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_FEATURE_DOTPROD)
+#include <arm_neon.h>
+#endif
+
+#define LANES   8
+#define ZERO    128
+// bytes after every tensor, the dot products read up to 3 past its end
+#define SLACK   8
+// channels of a pixel a pooling layer sums at once
+#define POOL_CHUNK  64
+
+static const int32_t FlatBase[1] = { 0 };
+
+static size_t AlignBytes(const size_t size)
+{
+    return (size + ALIGN_SIZE - 1) / ALIGN_SIZE * ALIGN_SIZE;
+}
+
+static inline uint32_t Load32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint8_t Quantize(const float x, const float inv_scale)
+{
+    // rounds half up, clamped in float so that loops over it vectorize
+    float q = x * inv_scale + (ZERO + 0.5f);
+    q = q < 0.0f ? 0.0f : q > 255.0f ? 255.0f : q;
+    return (uint8_t)q;
+}
+
+static inline float LeakyReLU(const float x, const float alpha)
+{
+    return x > 0.0f ? x : x * alpha;
+}
+
+// out[n][mp] = sum over groups g of the 4 uint8 at in + bases[p] + offsets[g]
+// times the 4 int8 of w[g][m], w is packed as [groups][mp][4] so that one
+// group of one output channel forms a 32-bit lane
+#if defined(__AVX2__)
+
+__attribute__((target("avxvnni")))
+static void GemmVnni(
+    const uint8_t *in, const int32_t *bases, const int n, const int32_t *offsets,
+    const int groups, const int8_t *w, const int mp, int32_t *out
+)
+{
+    int p = 0;
+    for (; p + 4 <= n; p += 4)
+    {
+        // 4 pixels share every weight load
+        const uint8_t *r0 = &in[bases[p]], *r1 = &in[bases[p + 1]];
+        const uint8_t *r2 = &in[bases[p + 2]], *r3 = &in[bases[p + 3]];
+        for (int b = 0; b < mp; b += LANES)
+        {
+            __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+            __m256i acc2 = _mm256_setzero_si256(), acc3 = _mm256_setzero_si256();
+            for (int g = 0; g < groups; ++g)
+            {
+                const int o = offsets[g];
+                const __m256i wv = _mm256_loadu_si256((const __m256i *)&w[(g * mp + b) * 4]);
+                acc0 = _mm256_dpbusd_avx_epi32(acc0, _mm256_set1_epi32(Load32(&r0[o])), wv);
+                acc1 = _mm256_dpbusd_avx_epi32(acc1, _mm256_set1_epi32(Load32(&r1[o])), wv);
+                acc2 = _mm256_dpbusd_avx_epi32(acc2, _mm256_set1_epi32(Load32(&r2[o])), wv);
+                acc3 = _mm256_dpbusd_avx_epi32(acc3, _mm256_set1_epi32(Load32(&r3[o])), wv);
+            }
+            _mm256_storeu_si256((__m256i *)&out[p * mp + b], acc0);
+            _mm256_storeu_si256((__m256i *)&out[(p + 1) * mp + b], acc1);
+            _mm256_storeu_si256((__m256i *)&out[(p + 2) * mp + b], acc2);
+            _mm256_storeu_si256((__m256i *)&out[(p + 3) * mp + b], acc3);
+        }
+    }
+    for (; p < n; ++p)
+    {
+        // single pixels (fc layers) take 4 blocks of outputs at a time instead
+        const uint8_t *r = &in[bases[p]];
+        int b = 0;
+        for (; b + 4 * LANES <= mp; b += 4 * LANES)
+        {
+            __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+            __m256i acc2 = _mm256_setzero_si256(), acc3 = _mm256_setzero_si256();
+            for (int g = 0; g < groups; ++g)
+            {
+                const int8_t *wp = &w[(g * mp + b) * 4];
+                const __m256i a = _mm256_set1_epi32(Load32(&r[offsets[g]]));
+                acc0 = _mm256_dpbusd_avx_epi32(acc0, a, _mm256_loadu_si256((const __m256i *)wp));
+                acc1 = _mm256_dpbusd_avx_epi32(acc1, a, _mm256_loadu_si256((const __m256i *)&wp[32]));
+                acc2 = _mm256_dpbusd_avx_epi32(acc2, a, _mm256_loadu_si256((const __m256i *)&wp[64]));
+                acc3 = _mm256_dpbusd_avx_epi32(acc3, a, _mm256_loadu_si256((const __m256i *)&wp[96]));
+            }
+            _mm256_storeu_si256((__m256i *)&out[p * mp + b], acc0);
+            _mm256_storeu_si256((__m256i *)&out[p * mp + b + LANES], acc1);
+            _mm256_storeu_si256((__m256i *)&out[p * mp + b + 2 * LANES], acc2);
+            _mm256_storeu_si256((__m256i *)&out[p * mp + b + 3 * LANES], acc3);
+        }
+        for (; b < mp; b += LANES)
+        {
+            __m256i acc = _mm256_setzero_si256();
+            for (int g = 0; g < groups; ++g)
+            {
+                const __m256i wv = _mm256_loadu_si256((const __m256i *)&w[(g * mp + b) * 4]);
+                acc = _mm256_dpbusd_avx_epi32(acc, _mm256_set1_epi32(Load32(&r[offsets[g]])), wv);
+            }
+            _mm256_storeu_si256((__m256i *)&out[p * mp + b], acc);
+        }
+    }
+}
+
+static inline __m256i WidenPixels(const uint8_t *p)
+{
+    // 4 uint8 as int16, repeated for the 4 lanes of each 128-bit half
+    return _mm256_broadcastq_epi64(_mm_cvtepu8_epi16(_mm_cvtsi32_si128((int)Load32(p))));
+}
+
+static inline void MaddBlock(const int8_t *wp, const __m256i a, __m256i *lo, __m256i *hi)
+{
+    // exact int16 products summed in pairs, lanes 0-3 of the block go to lo
+    // and lanes 4-7 to hi
+    const __m256i wlo = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)wp));
+    const __m256i whi = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)&wp[16]));
+    *lo = _mm256_add_epi32(*lo, _mm256_madd_epi16(wlo, a));
+    *hi = _mm256_add_epi32(*hi, _mm256_madd_epi16(whi, a));
+}
+
+static inline void StoreBlock(int32_t *out, const __m256i lo, const __m256i hi)
+{
+    // the remaining pairs are added once, hadd leaves the lanes as 0 1 4 5 2 3 6 7
+    const __m256i sum = _mm256_hadd_epi32(lo, hi);
+    _mm256_storeu_si256((__m256i *)out, _mm256_permute4x64_epi64(sum, 0xD8));
+}
+
+static void GemmAvx2(
+    const uint8_t *in, const int32_t *bases, const int n, const int32_t *offsets,
+    const int groups, const int8_t *w, const int mp, int32_t *out
+)
+{
+    // same layout without vnni, maddubs would saturate on uint8 * int8 pairs
+    // so the values are widened to int16 first
+    int p = 0;
+    for (; p + 2 <= n; p += 2)
+    {
+        const uint8_t *r0 = &in[bases[p]], *r1 = &in[bases[p + 1]];
+        for (int b = 0; b < mp; b += LANES)
+        {
+            __m256i lo0 = _mm256_setzero_si256(), hi0 = _mm256_setzero_si256();
+            __m256i lo1 = _mm256_setzero_si256(), hi1 = _mm256_setzero_si256();
+            for (int g = 0; g < groups; ++g)
+            {
+                const int8_t *wp = &w[(g * mp + b) * 4];
+                MaddBlock(wp, WidenPixels(&r0[offsets[g]]), &lo0, &hi0);
+                MaddBlock(wp, WidenPixels(&r1[offsets[g]]), &lo1, &hi1);
+            }
+            StoreBlock(&out[p * mp + b], lo0, hi0);
+            StoreBlock(&out[(p + 1) * mp + b], lo1, hi1);
+        }
+    }
+    for (; p < n; ++p)
+    {
+        const uint8_t *r = &in[bases[p]];
+        int b = 0;
+        for (; b + 2 * LANES <= mp; b += 2 * LANES)
+        {
+            __m256i lo0 = _mm256_setzero_si256(), hi0 = _mm256_setzero_si256();
+            __m256i lo1 = _mm256_setzero_si256(), hi1 = _mm256_setzero_si256();
+            for (int g = 0; g < groups; ++g)
+            {
+                const int8_t *wp = &w[(g * mp + b) * 4];
+                const __m256i a = WidenPixels(&r[offsets[g]]);
+                MaddBlock(wp, a, &lo0, &hi0);
+                MaddBlock(&wp[32], a, &lo1, &hi1);
+            }
+            StoreBlock(&out[p * mp + b], lo0, hi0);
+            StoreBlock(&out[p * mp + b + LANES], lo1, hi1);
+        }
+        for (; b < mp; b += LANES)
+        {
+            __m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256();
+            for (int g = 0; g < groups; ++g)
+                MaddBlock(&w[(g * mp + b) * 4], WidenPixels(&r[offsets[g]]), &lo, &hi);
+            StoreBlock(&out[p * mp + b], lo, hi);
+        }
+    }
+}
+
+#elif defined(__ARM_FEATURE_DOTPROD)
+
+static void GemmDot(
+    const uint8_t *in, const int32_t *bases, const int n, const int32_t *offsets,
+    const int groups, const int8_t *w, const int mp, const int32_t *row_sums, int32_t *out
+)
+{
+    // sdot multiplies int8 by int8, so the pixels are moved to int8 by
+    // flipping the top bit and 128 * sum(w) is added back at the end
+    for (int p = 0; p < n; ++p)
+    {
+        const uint8_t *r = &in[bases[p]];
+        for (int b = 0; b < mp; b += LANES)
+        {
+            int32x4_t acc0 = vdupq_n_s32(0), acc1 = vdupq_n_s32(0);
+            for (int g = 0; g < groups; ++g)
+            {
+                const int8x16_t a = vreinterpretq_s8_u32(vdupq_n_u32(Load32(&r[offsets[g]]) ^ 0x80808080u));
+                acc0 = vdotq_s32(acc0, vld1q_s8(&w[(g * mp + b) * 4]), a);
+                acc1 = vdotq_s32(acc1, vld1q_s8(&w[(g * mp + b) * 4 + 16]), a);
+            }
+            const int32x4_t zero = vdupq_n_s32(ZERO);
+            vst1q_s32(&out[p * mp + b], vmlaq_s32(acc0, zero, vld1q_s32(&row_sums[b])));
+            vst1q_s32(&out[p * mp + b + 4], vmlaq_s32(acc1, zero, vld1q_s32(&row_sums[b + 4])));
+        }
+    }
+}
+
+#else
+
+static void GemmScalar(
+    const uint8_t *in, const int32_t *bases, const int n, const int32_t *offsets,
+    const int groups, const int8_t *w, const int mp, int32_t *out
+)
+{
+    for (int p = 0; p < n; ++p)
+    {
+        for (int m = 0; m < mp; ++m)
+        {
+            int32_t sum = 0;
+            for (int g = 0; g < groups; ++g)
+            {
+                for (int t = 0; t < 4; ++t)
+                    sum += in[bases[p] + offsets[g] + t] * w[(g * mp + m) * 4 + t];
+            }
+            out[p * mp + m] = sum;
+        }
+    }
+}
+
+#endif
+
+static void GemmU8S8(
+    const uint8_t *in, const int32_t *bases, const int n, const QuantLayer *layer, int32_t *out,
+    const int vnni
+)
+{
+    const int groups = layer->kp / 4;
+#if defined(__AVX2__)
+    if (vnni)
+        GemmVnni(in, bases, n, layer->offsets, groups, layer->weights, layer->mp, out);
+    else
+        GemmAvx2(in, bases, n, layer->offsets, groups, layer->weights, layer->mp, out);
+#elif defined(__ARM_FEATURE_DOTPROD)
+    (void)vnni;
+    GemmDot(in, bases, n, layer->offsets, groups, layer->weights, layer->mp, layer->row_sums, out);
+#else
+    (void)vnni;
+    GemmScalar(in, bases, n, layer->offsets, groups, layer->weights, layer->mp, out);
+#endif
+}
+
+static int PaddedChannels(const int c)
+{
+    // groups of 4 run along the channels, a single channel groups along x
+    return c == 1 ? 1 : (c + 3) / 4 * 4;
+}
+
+static void InputGeometry(const Layer *layers, const int num_layers, int i, int *pad, int *cp)
+{
+    // the layout of a tensor follows its consumer, relus work in place and
+    // pass it through
+    while (i < num_layers && layers[i].type == LAYER_RELU)
+        ++i;
+    *pad = 0, *cp = 1;
+    if (i == num_layers)
+        return;
+    if (layers[i].type == LAYER_CONV || layers[i].type == LAYER_CONV_RELU_POOL)
+        *pad = layers[i].padding;
+    *cp = PaddedChannels(layers[i].in_c);
+}
+
+static size_t TensorBytes(const int h, const int w, const int pad, const int cp)
+{
+    return (size_t)(h + 2 * pad) * (w + 2 * pad) * cp + SLACK;
+}
+
+static int SourceIndex(const QuantLayer *q, const int k, int32_t *byte)
+{
+    // maps a packed dot position to its byte offset from the pixel base and
+    // to the index into the float weights of one output channel, -1 for the
+    // padding positions that get a zero weight
+    const int in_pw = q->in_w + 2 * q->in_pad;
+    if (q->type == LAYER_FC)
+    {
+        const int hw = q->in_h * q->in_w;
+        const int c = k % q->in_cp, pixel = k / q->in_cp;
+        *byte = k;
+        return c < q->in_c && pixel < hw ? c * hw + pixel : -1;
+    }
+    const int kernel_size = q->kernel_size;
+    if (q->in_cp == 1)
+    {
+        const int row = (kernel_size + 3) / 4 * 4;
+        const int kh = k / row, kw = k % row;
+        *byte = kh * in_pw + kw;
+        return kw < kernel_size ? kh * kernel_size + kw : -1;
+    }
+    const int tap = k / q->in_cp, c = k % q->in_cp;
+    const int kh = tap / kernel_size, kw = tap % kernel_size;
+    *byte = (kh * in_pw + kw) * q->in_cp + c;
+    return c < q->in_c ? (c * kernel_size + kh) * kernel_size + kw : -1;
+}
+
+static size_t PackLayer(QuantLayer *q, const Layer *layer, const float in_scale, uint8_t *storage)
+{
+    // weights, row sums, scales, bias, group offsets and pixel bases of one
+    // layer, returns the bytes used and only writes when storage is set
+    const int groups = q->kp / 4;
+    const int n = q->type == LAYER_FC ? 0 : q->conv_h * q->conv_w;
+    const size_t weight_bytes = AlignBytes((size_t)q->kp * q->mp);
+    const size_t vector_bytes = AlignBytes(q->mp * sizeof(float));
+    const size_t offset_bytes = AlignBytes(groups * sizeof(int32_t));
+    const size_t base_bytes = AlignBytes(n * sizeof(int32_t));
+    const size_t size = weight_bytes + 3 * vector_bytes + offset_bytes + base_bytes;
+    if (storage == NULL)
+        return size;
+    int8_t *weights = (int8_t *)storage;
+    int32_t *row_sums = (int32_t *)&storage[weight_bytes];
+    float *scales = (float *)&storage[weight_bytes + vector_bytes];
+    float *bias = (float *)&storage[weight_bytes + 2 * vector_bytes];
+    int32_t *offsets = (int32_t *)&storage[weight_bytes + 3 * vector_bytes];
+    int32_t *bases = (int32_t *)&storage[weight_bytes + 3 * vector_bytes + offset_bytes];
+    memset(storage, 0, size);
+    for (int g = 0; g < groups; ++g)
+        SourceIndex(q, 4 * g, &offsets[g]);
+    for (int p = 0; p < n; ++p)
+        bases[p] = ((p / q->conv_w) * (q->in_w + 2 * q->in_pad) + p % q->conv_w) * q->in_cp;
+
+    for (int m = 0; m < q->out_c; ++m)
+    {
+        const float *w = &layer->weights[m * (q->k + 1)];
+        float max_value = 0.0f;
+        for (int k = 0; k < q->k; ++k)
+            max_value = fabsf(w[k]) > max_value ? fabsf(w[k]) : max_value;
+        const float w_scale = max_value > 0.0f ? max_value / 127.0f : 1.0f;
+        int32_t sum = 0;
+        for (int k = 0; k < q->kp; ++k)
+        {
+            int32_t byte;
+            const int source = SourceIndex(q, k, &byte);
+            if (source < 0)
+                continue;
+            const long v = lrintf(w[source] / w_scale);
+            const int8_t qv = (int8_t)(v < -127 ? -127 : v > 127 ? 127 : v);
+            weights[((k / 4) * q->mp + m) * 4 + k % 4] = qv;
+            sum += qv;
+        }
+        row_sums[m] = sum;
+        scales[m] = in_scale * w_scale;
+        bias[m] = w[q->k];
+    }
+    q->weights = weights;
+    q->row_sums = row_sums;
+    q->scales = scales;
+    q->bias = bias;
+    q->offsets = offsets;
+    q->bases = n > 0 ? bases : FlatBase;
+    return size;
+}
+
+static size_t BuildLayers(const Layer *layers, const int num_layers, QuantModel *model, uint8_t *storage)
+{
+    // walks the layers twice, once to size the storage and once to fill it,
+    // returns the bytes of storage or 0 for an unsupported graph
+    float in_scale = 1.0f;
+    int in_zero = 0;
+    size_t used = 0;
+    int count = 0;
+    for (int i = 0; i < num_layers; ++i)
+    {
+        const Layer *layer = &layers[i];
+        QuantLayer *q = &model->layers[count];
+        memset(q, 0, sizeof(QuantLayer));
+        q->type = layer->type;
+        q->kernel_size = layer->kernel_size;
+        q->padding = layer->padding;
+        q->pool_size = layer->type == LAYER_CONV_RELU_POOL ? layer->pool_size : 1;
+        q->stride = layer->stride;
+        q->in_c = layer->in_c, q->in_h = layer->in_h, q->in_w = layer->in_w;
+        q->out_c = layer->out_c, q->out_h = layer->out_h, q->out_w = layer->out_w;
+        q->in_zero = in_zero;
+        InputGeometry(layers, num_layers, i, &q->in_pad, &q->in_cp);
+        float out_scale = layer->act_scale;
+        if (layer->type == LAYER_CONV_RELU_POOL)
+        {
+            q->relu = 1;
+            q->alpha = layer->alpha;
+        }
+        else if ((layer->type == LAYER_CONV || layer->type == LAYER_FC) &&
+            i + 1 < num_layers && layers[i + 1].type == LAYER_RELU)
+        {
+            // the relu is applied before requantization, the output takes
+            // its scale
+            q->relu = 1;
+            q->alpha = layers[i + 1].alpha;
+            out_scale = layers[++i].act_scale;
+        }
+        InputGeometry(layers, num_layers, i + 1, &q->out_pad, &q->out_cp);
+
+        if (layer->type == LAYER_CONV || layer->type == LAYER_CONV_RELU_POOL)
+        {
+            const int kernel_size = layer->kernel_size;
+            q->conv_h = layer->in_h + 2 * layer->padding - kernel_size + 1;
+            q->conv_w = layer->in_w + 2 * layer->padding - kernel_size + 1;
+            q->k = kernel_size * kernel_size * layer->in_c;
+            q->kp = q->in_cp == 1 ? kernel_size * ((kernel_size + 3) / 4 * 4) :
+                kernel_size * kernel_size * q->in_cp;
+        }
+        else if (layer->type == LAYER_FC)
+        {
+            q->k = layer->in_feat;
+            q->kp = (layer->in_h * layer->in_w * q->in_cp + 3) / 4 * 4;
+        }
+        if (q->kp > 0)
+        {
+            q->mp = (q->out_c + LANES - 1) / LANES * LANES;
+            used += PackLayer(q, layer, in_scale, storage ? &storage[used] : NULL);
+            if (storage != NULL)
+                model->weight_bytes += (size_t)q->k * q->out_c;
+        }
+        else if (layer->type == LAYER_RELU)
+        {
+            // relu on a pooling or a fused layer keeps the scale of its input
+            out_scale = in_scale;
+            if (storage != NULL)
+            {
+                uint8_t *lut = &storage[used];
+                for (int v = 0; v < 256; ++v)
+                    lut[v] = Quantize(LeakyReLU((v - ZERO) * in_scale, layer->alpha), 1.0f / in_scale);
+                q->lut = lut;
+            }
+            used += AlignBytes(256);
+        }
+        else if (layer->type == LAYER_MAXPOOL || layer->type == LAYER_AVGPOOL)
+        {
+            out_scale = in_scale;
+        }
+        else
+        {
+            return 0;
+        }
+
+        // the last layer leaves float logits
+        const int last = i + 1 == num_layers;
+        if (last && layer->type != LAYER_FC)
+            return 0;
+        if (!last && out_scale <= 0.0f)
+            return 0;
+        q->out_scale = last ? 0.0f : out_scale;
+        in_scale = out_scale;
+        in_zero = ZERO;
+        ++count;
+    }
+    model->num_layers = count;
+    return used;
+}
+
+int QuantizeModel(const Layer *layers, const int num_layers, QuantModel *model)
+{
+    memset(model, 0, sizeof(QuantModel));
+    model->layers = malloc(num_layers * sizeof(QuantLayer));
+    if (model->layers == NULL)
+        return 0;
+    const size_t storage_size = BuildLayers(layers, num_layers, model, NULL);
+    if (storage_size == 0 || (model->storage = aligned_alloc(ALIGN_SIZE, storage_size)) == NULL)
+    {
+        FreeQuantModel(model);
+        return 0;
+    }
+    BuildLayers(layers, num_layers, model, model->storage);
+
+    // scratch of one image: two ping-pong tensors, the float values of one
+    // pixel during requantization and the int32 accumulators
+    const QuantLayer *first = &model->layers[0];
+    size_t tensor = TensorBytes(first->in_h, first->in_w, first->in_pad, first->in_cp);
+    size_t values = 0, acc = 0;
+    for (int i = 0; i < model->num_layers; ++i)
+    {
+        const QuantLayer *q = &model->layers[i];
+        const size_t out_size = TensorBytes(q->out_h, q->out_w, q->out_pad, q->out_cp);
+        tensor = out_size > tensor ? out_size : tensor;
+        values = 2 * (size_t)q->mp > values ? 2 * (size_t)q->mp : values;
+        const size_t pixels = q->type == LAYER_FC ? 1 : (size_t)q->conv_h * q->conv_w;
+        acc = pixels * q->mp > acc ? pixels * q->mp : acc;
+    }
+    model->tensor_bytes = AlignBytes(tensor);
+    model->values_offset = 2 * model->tensor_bytes;
+    model->acc_offset = model->values_offset + AlignBytes(values * sizeof(float));
+    model->workspace_size = model->acc_offset + AlignBytes(acc * sizeof(int32_t));
+    model->classes = model->layers[model->num_layers - 1].out_c;
+
+#if defined(__AVX2__)
+    __builtin_cpu_init();
+    model->vnni = __builtin_cpu_supports("avxvnni") != 0;
+#endif
+    return 1;
+}
+
+void FreeQuantModel(QuantModel *model)
+{
+    free(model->layers);
+    free(model->storage);
+    memset(model, 0, sizeof(QuantModel));
+}
+
+static inline float Dequantize(const QuantLayer *layer, const int32_t *acc, const int m)
+{
+    return (float)(acc[m] - layer->in_zero * layer->row_sums[m]) * layer->scales[m] + layer->bias[m];
+}
+
+static inline void RequantizeMax(
+    const int32_t *acc, const float *scales, const float *offset, const float alpha,
+    const int mp, float *values
+)
+{
+    // values = max(values, relu(acc * scales + offset)), a slope of 1 leaves
+    // the relu out
+#if defined(__AVX2__)
+    const __m256 slope = _mm256_set1_ps(alpha - 1.0f);
+    for (int m = 0; m < mp; m += LANES)
+    {
+        const __m256 r = _mm256_fmadd_ps(
+            _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)&acc[m])),
+            _mm256_loadu_ps(&scales[m]), _mm256_loadu_ps(&offset[m])
+        );
+        const __m256 v = _mm256_fmadd_ps(_mm256_min_ps(r, _mm256_setzero_ps()), slope, r);
+        _mm256_storeu_ps(&values[m], _mm256_max_ps(v, _mm256_loadu_ps(&values[m])));
+    }
+#else
+    for (int m = 0; m < mp; ++m)
+    {
+        const float r = (float)acc[m] * scales[m] + offset[m];
+        const float v = r < 0.0f ? r * alpha : r;
+        values[m] = v > values[m] ? v : values[m];
+    }
+#endif
+}
+
+static inline uint8_t *Pixel(
+    uint8_t *tensor, const int y, const int x, const int w, const int pad, const int cp
+)
+{
+    return &tensor[((y + pad) * (w + 2 * pad) + x + pad) * cp];
+}
+
+static void RequantizeConv(const QuantLayer *q, const int32_t *acc, float *values, uint8_t *out)
+{
+    // int32 accumulators to uint8 outputs with the fused relu and max pool,
+    // the inner loops run over the output channels of one pixel
+    const int pool = q->pool_size;
+    const int mp = q->mp;
+    const float alpha = q->relu ? q->alpha : 1.0f;
+    // a negative slope is not monotonic, it is applied before the max
+    const float pre_alpha = alpha < 0.0f ? alpha : 1.0f;
+    const float inv_scale = 1.0f / q->out_scale;
+    const float *scales = q->scales;
+    float *offset = &values[mp];
+    for (int m = 0; m < mp; ++m)
+        offset[m] = q->bias[m] - (float)q->in_zero * (float)q->row_sums[m] * scales[m];
+    for (int y = 0; y < q->out_h; ++y)
+    {
+        for (int x = 0; x < q->out_w; ++x)
+        {
+            for (int m = 0; m < mp; ++m)
+                values[m] = -INFINITY;
+            for (int py = 0; py < pool; ++py)
+            {
+                for (int px = 0; px < pool; ++px)
+                {
+                    const int32_t *a = &acc[((y * pool + py) * q->conv_w + x * pool + px) * mp];
+                    RequantizeMax(a, scales, offset, pre_alpha, mp, values);
+                }
+            }
+            uint8_t *dst = Pixel(out, y, x, q->out_w, q->out_pad, q->out_cp);
+            for (int m = 0; m < q->out_cp; ++m)
+            {
+                const float v = values[m] < 0.0f ? values[m] * alpha : values[m];
+                dst[m] = m < q->out_c ? Quantize(v, inv_scale) : ZERO;
+            }
+        }
+    }
+}
+
+static void PoolU8(const QuantLayer *q, const uint8_t *in, uint8_t *out, const int average)
+{
+    // max commutes with the monotonic quantization and the mean with the
+    // affine one, so both pool the bytes and keep the scale, the channels of
+    // a pixel are contiguous
+    const int kernel_size = q->kernel_size, stride = q->stride, padding = q->padding;
+    const int cp = q->in_cp;
+    for (int y = 0; y < q->out_h; ++y)
+    {
+        const int y0 = y * stride - padding;
+        const int ys = y0 > 0 ? y0 : 0, y1 = y0 + kernel_size < q->in_h ? y0 + kernel_size : q->in_h;
+        for (int x = 0; x < q->out_w; ++x)
+        {
+            const int x0 = x * stride - padding;
+            const int xs = x0 > 0 ? x0 : 0, x1 = x0 + kernel_size < q->in_w ? x0 + kernel_size : q->in_w;
+            const uint32_t count = (uint32_t)((y1 - ys) * (x1 - xs));
+            uint8_t *dst = Pixel(out, y, x, q->out_w, q->out_pad, q->out_cp);
+            for (int c0 = 0; c0 < cp; c0 += POOL_CHUNK)
+            {
+                const int chunk = cp - c0 < POOL_CHUNK ? cp - c0 : POOL_CHUNK;
+                uint32_t acc[POOL_CHUNK] = { 0, };
+                for (int m = ys; m < y1; ++m)
+                {
+                    for (int n = xs; n < x1; ++n)
+                    {
+                        const uint8_t *src = &Pixel((uint8_t *)in, m, n, q->in_w, q->in_pad, cp)[c0];
+                        for (int c = 0; c < chunk; ++c)
+                            acc[c] = average ? acc[c] + src[c] : src[c] > acc[c] ? src[c] : acc[c];
+                    }
+                }
+                for (int c = 0; c < chunk; ++c)
+                    dst[c0 + c] = (uint8_t)(average ? (acc[c] + count / 2) / count : acc[c]);
+            }
+        }
+    }
+}
+
+int QuantForward(const QuantModel *model, const uint8_t *pixels, void *workspace, float *logits)
+{
+    // tensors are [h + 2 pad][w + 2 pad][cp] uint8 with the zero point in the
+    // border, laid out for the layer that reads them
+    uint8_t *base = workspace;
+    uint8_t *buffers[2] = { base, base + model->tensor_bytes };
+    float *values = (float *)(base + model->values_offset);
+    int32_t *acc = (int32_t *)(base + model->acc_offset);
+
+    // the pixels go into the first tensor with a border of 0
+    const QuantLayer *first = &model->layers[0];
+    memset(buffers[0], 0, TensorBytes(first->in_h, first->in_w, first->in_pad, first->in_cp));
+    for (int y = 0; y < first->in_h; ++y)
+    {
+        memcpy(
+            Pixel(buffers[0], y, 0, first->in_w, first->in_pad, 1),
+            &pixels[y * first->in_w], first->in_w
+        );
+    }
+    const uint8_t *bottom = buffers[0];
+    int current = 1;
+
+    for (int i = 0; i < model->num_layers; ++i)
+    {
+        const QuantLayer *q = &model->layers[i];
+        uint8_t *top = buffers[current];
+        if (q->out_pad > 0)
+            memset(top, ZERO, TensorBytes(q->out_h, q->out_w, q->out_pad, q->out_cp));
+        if (q->type == LAYER_CONV || q->type == LAYER_CONV_RELU_POOL)
+        {
+            GemmU8S8(bottom, q->bases, q->conv_h * q->conv_w, q, acc, model->vnni);
+            RequantizeConv(q, acc, values, top);
+        }
+        else if (q->type == LAYER_MAXPOOL || q->type == LAYER_AVGPOOL)
+        {
+            PoolU8(q, bottom, top, q->type == LAYER_AVGPOOL);
+        }
+        else if (q->type == LAYER_RELU)
+        {
+            // in place
+            const size_t size = TensorBytes(q->in_h, q->in_w, q->in_pad, q->in_cp) - SLACK;
+            top = (uint8_t *)bottom;
+            for (size_t j = 0; j < size; ++j)
+                top[j] = q->lut[top[j]];
+            continue;
+        }
+        else
+        {
+            GemmU8S8(bottom, q->bases, 1, q, acc, model->vnni);
+            if (q->out_scale == 0.0f)
+            {
+                int pred = 0;
+                float best = -INFINITY;
+                for (int m = 0; m < q->out_c; ++m)
+                {
+                    const float v = Dequantize(q, acc, m);
+                    if (logits != NULL)
+                        logits[m] = v;
+                    if (v > best)
+                        best = v, pred = m;
+                }
+                return pred;
+            }
+            const float inv_scale = 1.0f / q->out_scale;
+            for (int m = 0; m < q->out_cp; ++m)
+            {
+                const float v = m < q->out_c ? Dequantize(q, acc, m) : 0.0f;
+                top[m] = Quantize(q->relu ? LeakyReLU(v, q->alpha) : v, inv_scale);
+            }
+        }
+        bottom = top;
+        current ^= 1;
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+#ifndef QUANT_H_
+#define QUANT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "layers.h"
+
+// Int8 inference. Weights are quantized symmetrically per output channel,
+// activations are uint8 with a zero point of 128 (the input pixels use 0)
+// and a per-tensor scale from calibration, dot products accumulate in int32.
+typedef struct {
+    LayerType type;
+    int kernel_size;
+    int padding;
+    int pool_size;
+    // of the maxpool and avgpool layers
+    int stride;
+    int in_c, in_h, in_w;
+    int out_c, out_h, out_w;
+    int conv_h, conv_w;
+    // relu folded into the requantization of the output
+    int relu;
+    float alpha;
+    // tensors are [h + 2 pad][w + 2 pad][cp] with channels padded to 4, or a
+    // single channel grouped along x
+    int in_pad, in_cp;
+    int out_pad, out_cp;
+    // dot length, then padded to groups of 4, and output channels padded to 8
+    int k, kp, mp;
+    // [kp / 4][mp][4]
+    const int8_t *weights;
+    const int32_t *row_sums;
+    // input scale * weight scale of every output channel
+    const float *scales;
+    const float *bias;
+    // byte offset of every group of 4 inputs from the base of an output pixel,
+    // and the base of every output pixel in the input tensor
+    const int32_t *offsets;
+    const int32_t *bases;
+    int in_zero;
+    // 0 for the float logits of the last layer
+    float out_scale;
+    // in-place relu on quantized values
+    const uint8_t *lut;
+} QuantLayer;
+
+typedef struct {
+    QuantLayer *layers;
+    int num_layers;
+    void *storage;
+    size_t weight_bytes;
+    // bytes of scratch one image needs, two tensors then the requantization
+    // values and the accumulators
+    size_t workspace_size;
+    size_t tensor_bytes, values_offset, acc_offset;
+    int classes;
+    int vnni;
+} QuantModel;
+
+// quantizes the layers left by BuildModel(), every layer but the last needs
+// an act_scale, returns 0 otherwise
+int QuantizeModel(const Layer *layers, const int num_layers, QuantModel *model);
+
+void FreeQuantModel(QuantModel *model);
+
+// runs one image and returns the predicted class, the float logits are
+// written to logits unless it is NULL
+int QuantForward(const QuantModel *model, const uint8_t *pixels, void *workspace, float *logits);
+
+#endif  // QUANT_H_
@@ -0,0 +1,127 @@
+#include "layers.h"
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+static int Max(const int a, const int b)
+{
+    return a > b ? a : b;
+}
+
+static int Size(const int64_t size, int *out)
+{
+    // dims come from model files, so every product is taken in 64 bits and
+    // has to fit the int sizes of the layers
+    if (size < 0 || size > INT_MAX)
+        return 0;
+    *out = (int)size;
+    return 1;
+}
+
+int InferShapes(
+    Layer *layers, const int num_layers,
+    const int in_c, const int in_h, const int in_w, ModelShape *shape
+)
+{
+    // walks the layers in the order Reco runs them, fills in their dims and
+    // sizes the workspaces, returns 0 for a graph that cannot run on this input
+    int c = in_c, h = in_h, w = in_w;
+    int flat = 0;
+    memset(shape, 0, sizeof(ModelShape));
+    if (num_layers <= 0 || in_c <= 0 || in_h <= 0 || in_w <= 0 ||
+        !Size((int64_t)in_c * in_h * in_w, &shape->in_size))
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < num_layers; ++i)
+    {
+        Layer *layer = &layers[i];
+        layer->in_c = c, layer->in_h = h, layer->in_w = w;
+        layer->weight_count = 0;
+        layer->top_size = 0, layer->flat_size = 0;
+        if (layer->type == LAYER_CONV || layer->type == LAYER_CONV_RELU_POOL)
+        {
+            const int fused = layer->type == LAYER_CONV_RELU_POOL;
+            const int kernel_size = layer->kernel_size;
+            const int padding = layer->padding;
+            const int pool_size = fused ? layer->pool_size : 1;
+            if (flat || kernel_size <= 0 || padding < 0 || layer->filters <= 0 || pool_size <= 0)
+                return 0;
+            int conv_h, conv_w, k;
+            if (!Size((int64_t)h - kernel_size + 2 * (int64_t)padding + 1, &conv_h) ||
+                !Size((int64_t)w - kernel_size + 2 * (int64_t)padding + 1, &conv_w) ||
+                !Size((int64_t)kernel_size * kernel_size * c + 1, &k) ||
+                !Size((int64_t)layer->filters * k, &layer->weight_count) ||
+                conv_h < pool_size || conv_w < pool_size)
+            {
+                return 0;
+            }
+
+            // the fused fallback runs the conv at full resolution into top,
+            // shapes without a direct kernel go through im2col
+            int64_t extra = 0;
+            int needs_col = 0;
+            int reads_u8 = 1;
+            if (!fused || !ConvReluPoolSupported(c, h, w, kernel_size, padding, layer->alpha, pool_size))
+            {
+                extra = fused ? (int64_t)layer->filters * conv_h * conv_w : 0;
+                needs_col = !ConvDirectSupported(c, h, w, kernel_size, padding, 0);
+                reads_u8 = !fused && ConvDirectSupported(c, h, w, kernel_size, padding, 1);
+            }
+            int col_size = 0;
+            if (needs_col && !Size((int64_t)k * conv_h * conv_w, &col_size))
+                return 0;
+            shape->col_size = Max(shape->col_size, col_size);
+            if (i == 0 && !reads_u8)
+                shape->image_size = shape->in_size;
+
+            c = layer->filters, h = conv_h / pool_size, w = conv_w / pool_size;
+            if (!Size((int64_t)c * h * w + extra, &layer->top_size))
+                return 0;
+        }
+        else if (layer->type == LAYER_MAXPOOL || layer->type == LAYER_AVGPOOL)
+        {
+            // a window may not lie in the padding entirely
+            const int kernel_size = layer->kernel_size;
+            if (layer->stride == 0)
+                layer->stride = kernel_size;
+            if (flat || kernel_size <= 0 || layer->stride < 0 || layer->padding < 0 ||
+                2 * (int64_t)layer->padding > kernel_size ||
+                (int64_t)Max(h, w) + 2 * (int64_t)layer->padding > INT_MAX)
+            {
+                return 0;
+            }
+            h = PoolOutputSize(h, kernel_size, layer->stride, layer->padding, layer->ceil_mode);
+            w = PoolOutputSize(w, kernel_size, layer->stride, layer->padding, layer->ceil_mode);
+            if (h <= 0 || w <= 0 || !Size((int64_t)c * h * w, &layer->top_size))
+                return 0;
+        }
+        else if (layer->type == LAYER_FC)
+        {
+            // the first fc layer flattens its input into rows with a trailing
+            // 1.0f, and every fc output row carries one as well
+            int feat;
+            if (!Size((int64_t)c * h * w, &feat) || (layer->in_feat != 0 && layer->in_feat != feat) ||
+                layer->out_feat <= 0 || feat == INT_MAX || layer->out_feat == INT_MAX ||
+                !Size((int64_t)layer->out_feat * (feat + 1), &layer->weight_count))
+            {
+                return 0;
+            }
+            layer->in_feat = feat;
+            layer->flat_size = flat ? 0 : feat + 1;
+            flat = 1;
+            c = layer->out_feat, h = 1, w = 1;
+            layer->top_size = c + 1;
+        }
+        else if (layer->type != LAYER_RELU)
+        {
+            return 0;
+        }
+        if (layer->weight_count > 0 && layer->weights == NULL)
+            return 0;
+        layer->out_c = c, layer->out_h = h, layer->out_w = w;
+        shape->param_count += layer->weight_count;
+    }
+    return PlanMemory(layers, num_layers, shape);
+}
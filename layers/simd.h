@@ -0,0 +1,96 @@
+#ifndef SIMD_H_
+#define SIMD_H_
+
+// Thin wrappers over the vector units the kernels are written for:
+// V8 is AVX2 + FMA on x86, V4 is NEON on ARM and SSE on x86.
+
+#include <stdint.h>
+#include <string.h>
+
+// 4 bytes from an unaligned address
+static inline uint32_t SimdLoadU32(const void *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define SIMD_HAS_V8 1
+typedef __m256 v8f;
+#define V8_LOAD(p)          _mm256_loadu_ps(p)
+#define V8_STORE(p, v)      _mm256_storeu_ps(p, v)
+#define V8_DUP(x)           _mm256_set1_ps(x)
+#define V8_FMA(acc, a, b)   _mm256_fmadd_ps(a, b, acc)
+#define V8_MAX(a, b)        _mm256_max_ps(a, b)
+#define V8_MUL(a, b)        _mm256_mul_ps(a, b)
+#define V8_ADD(a, b)        _mm256_add_ps(a, b)
+#define V8_SUB(a, b)        _mm256_sub_ps(a, b)
+// max and sum of adjacent lanes, the 4 pairs of a then the 4 pairs of b
+#define V8_PAIR_MAX(a, b)   V8_PAIRS(_mm256_max_ps(_mm256_shuffle_ps(a, b, 0x88), _mm256_shuffle_ps(a, b, 0xDD)))
+#define V8_PAIR_ADD(a, b)   V8_PAIRS(_mm256_add_ps(_mm256_shuffle_ps(a, b, 0x88), _mm256_shuffle_ps(a, b, 0xDD)))
+// the shuffles work within 128-bit halves, this puts the 64-bit groups back
+// in order
+#define V8_PAIRS(v)         _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(v), 0xD8))
+// 8 uint8 values widened to floats
+#define V8_LOAD_U8(p)       _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(p))))
+// 8 bf16 values widened to floats, and 8 fp16 values when F16C is there
+#define V8_LOAD_BF16(p)     _mm256_castsi256_ps(_mm256_slli_epi32( \
+                                _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(p))), 16))
+#if defined(__F16C__)
+#define V8_LOAD_F16(p)      _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(p)))
+#endif
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SIMD_HAS_V4 1
+typedef float32x4_t v4f;
+#define V4_LOAD(p)          vld1q_f32(p)
+#define V4_STORE(p, v)      vst1q_f32(p, v)
+#define V4_DUP(x)           vdupq_n_f32(x)
+#if defined(__aarch64__)
+#define V4_FMA(acc, a, b)   vfmaq_f32(acc, a, b)
+#else
+#define V4_FMA(acc, a, b)   vmlaq_f32(acc, a, b)
+#endif
+#define V4_MAX(a, b)        vmaxq_f32(a, b)
+#define V4_MUL(a, b)        vmulq_f32(a, b)
+#define V4_ADD(a, b)        vaddq_f32(a, b)
+// max and sum of adjacent lanes, the 2 pairs of a then the 2 pairs of b
+#define V4_PAIR_MAX(a, b)   vmaxq_f32(vuzpq_f32(a, b).val[0], vuzpq_f32(a, b).val[1])
+#define V4_PAIR_ADD(a, b)   vaddq_f32(vuzpq_f32(a, b).val[0], vuzpq_f32(a, b).val[1])
+#define V4_LOAD_U8(p)       vcvtq_f32_u32(vmovl_u16(vget_low_u16(vmovl_u8(vreinterpret_u8_u32( \
+                                vdup_n_u32(SimdLoadU32(p)))))))
+#define V4_LOAD_BF16(p)     vreinterpretq_f32_u32(vshll_n_u16(vld1_u16(p), 16))
+#if defined(__aarch64__)
+#define V4_LOAD_F16(p)      vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(p)))
+#endif
+#elif defined(__SSE2__)
+#include <immintrin.h>
+#define SIMD_HAS_V4 1
+typedef __m128 v4f;
+#define V4_LOAD(p)          _mm_loadu_ps(p)
+#define V4_STORE(p, v)      _mm_storeu_ps(p, v)
+#define V4_DUP(x)           _mm_set1_ps(x)
+#if defined(__FMA__)
+#define V4_FMA(acc, a, b)   _mm_fmadd_ps(a, b, acc)
+#else
+#define V4_FMA(acc, a, b)   _mm_add_ps(acc, _mm_mul_ps(a, b))
+#endif
+#define V4_MAX(a, b)        _mm_max_ps(a, b)
+#define V4_MUL(a, b)        _mm_mul_ps(a, b)
+#define V4_ADD(a, b)        _mm_add_ps(a, b)
+#define V4_PAIR_MAX(a, b)   _mm_max_ps(_mm_shuffle_ps(a, b, 0x88), _mm_shuffle_ps(a, b, 0xDD))
+#define V4_PAIR_ADD(a, b)   _mm_add_ps(_mm_shuffle_ps(a, b, 0x88), _mm_shuffle_ps(a, b, 0xDD))
+#define V4_LOAD_U8(p)       _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8( \
+                                _mm_cvtsi32_si128((int)SimdLoadU32(p)), _mm_setzero_si128()), _mm_setzero_si128()))
+#define V4_LOAD_BF16(p)     _mm_castsi128_ps(_mm_unpacklo_epi16(_mm_setzero_si128(), \
+                                _mm_loadl_epi64((const __m128i *)(p))))
+#if defined(__F16C__)
+#define V4_LOAD_F16(p)      _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)(p)))
+#endif
+#endif
+
+#endif  // SIMD_H_
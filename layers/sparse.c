@@ -0,0 +1,179 @@
+#include "sparse.h"
+#include "config.h"
+#include "gemm.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define P GEMM_PANEL
+
+static int BlockZero(const float *weights, const int rows, const int cols, const int panel, const int col)
+{
+    for (int r = panel * P; r < rows && r < (panel + 1) * P; ++r)
+    {
+        if (weights[(size_t)r * cols + col] != 0.0f)
+            return 0;
+    }
+    return 1;
+}
+
+double ZeroBlocks(const float *weights, const int rows, const int cols)
+{
+    const int panels = (rows + P - 1) / P;
+    int zero = 0;
+    for (int p = 0; p < panels; ++p)
+    {
+        for (int col = 0; col < cols; ++col)
+            zero += BlockZero(weights, rows, cols, p, col);
+    }
+    return panels * cols > 0 ? (double)zero / (panels * cols) : 0.0;
+}
+
+typedef struct {
+    float norm;
+    int panel, col;
+} BlockNorm;
+
+static int CompareNorm(const void *a, const void *b)
+{
+    const float x = ((const BlockNorm *)a)->norm, y = ((const BlockNorm *)b)->norm;
+    return x < y ? -1 : x > y;
+}
+
+int PruneBlocks(float *weights, const int rows, const int cols, const double sparsity)
+{
+    // magnitude pruning at the granularity the kernels skip, the smallest
+    // blocks by L2 norm go first
+    const int panels = (rows + P - 1) / P;
+    const int count = panels * (cols - 1);
+    BlockNorm *norms = count > 0 ? malloc(count * sizeof(BlockNorm)) : NULL;
+    if (norms == NULL)
+        return 0;
+    for (int p = 0; p < panels; ++p)
+    {
+        for (int col = 0; col < cols - 1; ++col)
+        {
+            BlockNorm *block = &norms[p * (cols - 1) + col];
+            block->norm = 0.0f;
+            block->panel = p;
+            block->col = col;
+            for (int r = p * P; r < rows && r < (p + 1) * P; ++r)
+                block->norm += weights[(size_t)r * cols + col] * weights[(size_t)r * cols + col];
+        }
+    }
+    qsort(norms, count, sizeof(BlockNorm), CompareNorm);
+    const int pruned = (int)(sparsity * count + 0.5);
+    for (int i = 0; i < pruned && i < count; ++i)
+    {
+        for (int r = norms[i].panel * P; r < rows && r < (norms[i].panel + 1) * P; ++r)
+            weights[(size_t)r * cols + norms[i].col] = 0.0f;
+    }
+    free(norms);
+    return pruned < count ? pruned : count;
+}
+
+static int BuildMatrix(const float *weights, const int rows, const int cols, SparseMatrix *matrix)
+{
+    // the blocks of a panel in column order, so the input is read forward
+    const int panels = (rows + P - 1) / P;
+    int count = 0;
+    for (int p = 0; p < panels; ++p)
+    {
+        for (int col = 0; col < cols; ++col)
+            count += !BlockZero(weights, rows, cols, p, col);
+    }
+    const size_t block_bytes = ((size_t)count * P * sizeof(float) + ALIGN_SIZE - 1) / ALIGN_SIZE * ALIGN_SIZE;
+    const size_t bytes = block_bytes + (panels + 1 + (size_t)count) * sizeof(int);
+    float *storage = aligned_alloc(ALIGN_SIZE, (bytes + ALIGN_SIZE - 1) / ALIGN_SIZE * ALIGN_SIZE);
+    if (storage == NULL)
+        return 0;
+    matrix->rows = rows;
+    matrix->cols = cols;
+    matrix->blocks = storage;
+    matrix->offsets = (int *)((char *)storage + block_bytes);
+    matrix->index = &matrix->offsets[panels + 1];
+    matrix->block_count = count;
+    int j = 0;
+    for (int p = 0; p < panels; ++p)
+    {
+        matrix->offsets[p] = j;
+        for (int col = 0; col < cols; ++col)
+        {
+            if (BlockZero(weights, rows, cols, p, col))
+                continue;
+            float *block = &matrix->blocks[(size_t)j * P];
+            for (int r = 0; r < P; ++r)
+                block[r] = p * P + r < rows ? weights[(size_t)(p * P + r) * cols + col] : 0.0f;
+            matrix->index[j++] = col;
+        }
+    }
+    matrix->offsets[panels] = j;
+    return 1;
+}
+
+int SparsifyLayers(Layer *layers, const int num_layers, SparseModel *model)
+{
+    memset(model, 0, sizeof(SparseModel));
+    int count = 0;
+    for (int i = 0; i < num_layers; ++i)
+    {
+        layers[i].sparse = NULL;
+        count += layers[i].type == LAYER_FC && layers[i].weights != NULL;
+    }
+    if (count == 0)
+        return 1;
+    model->matrices = calloc(count, sizeof(SparseMatrix));
+    if (model->matrices == NULL)
+        return 0;
+    for (int i = 0; i < num_layers; ++i)
+    {
+        Layer *layer = &layers[i];
+        if (layer->type != LAYER_FC || layer->weights == NULL)
+            continue;
+        const int rows = layer->out_feat, cols = layer->weight_count / layer->out_feat;
+        if (ZeroBlocks(layer->weights, rows, cols) < SPARSE_MIN_ZERO)
+            continue;
+        SparseMatrix *matrix = &model->matrices[model->count];
+        if (BuildMatrix(layer->weights, rows, cols, matrix) == 0)
+        {
+            FreeSparseModel(model);
+            return 0;
+        }
+        ++model->count;
+        model->weight_bytes += (size_t)matrix->block_count * (P * sizeof(float) + sizeof(int));
+        model->dense_bytes += (size_t)layer->weight_count * sizeof(float);
+        layer->type = LAYER_FC_SPARSE;
+        layer->sparse = matrix;
+    }
+    return 1;
+}
+
+void FreeSparseModel(SparseModel *model)
+{
+    for (int i = 0; i < model->count; ++i)
+        free(model->matrices[i].blocks);
+    free(model->matrices);
+    memset(model, 0, sizeof(SparseModel));
+}
+
+int SparseFCLayer(
+    const SparseMatrix *Fc1, const float *bottom, float *top,
+    int out_feat, int in_feat
+)
+{
+    (void)in_feat;
+    SparseGemvPanels(Fc1->blocks, Fc1->index, Fc1->offsets, bottom, top, out_feat);
+    return out_feat;
+}
+
+int SparseFCLayerBatch(
+    const SparseMatrix *Fc1, const float *bottom, float *top, const int batch,
+    int out_feat, int in_feat
+)
+{
+    // rows of top get the trailing 1.0f as in FCLayerBatch()
+    const int ldc = out_feat + 1;
+    SparseGemmPanelsT(Fc1->blocks, Fc1->index, Fc1->offsets, bottom, top, batch, out_feat, in_feat, ldc);
+    for (int b = 0; b < batch; ++b)
+        top[b * ldc + out_feat] = 1.0f;
+    return batch * ldc;
+}
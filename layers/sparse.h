@@ -0,0 +1,63 @@
+#ifndef SPARSE_H_
+#define SPARSE_H_
+
+#include <stddef.h>
+#include "layers.h"
+
+// Block-sparse fc weights for pruned models. A block is one column of a GEMM
+// panel, GEMM_PANEL consecutive rows of one input feature, which is what the
+// kernels read with one vector load, so a block that is all zero costs
+// neither its load nor its fma once it is dropped. The bias column is a block
+// like the others. Models stay dense on disk, the zero blocks are found at
+// load time.
+
+// fc layers with at least this fraction of zero blocks run sparse, below it
+// the index gathers cost more than the skipped blocks save
+#define SPARSE_MIN_ZERO     0.5
+
+struct SparseMatrix {
+    int rows, cols;
+    // blocks of panel p are offsets[p] .. offsets[p + 1] - 1
+    int *offsets;
+    // the dense column of every block
+    int *index;
+    // GEMM_PANEL floats per block, the missing rows of the last panel are 0
+    float *blocks;
+    int block_count;
+};
+
+typedef struct {
+    // one per fc layer that was made sparse
+    SparseMatrix *matrices;
+    int count;
+    // bytes of the blocks and indices, and of the dense rows they replace
+    size_t weight_bytes;
+    size_t dense_bytes;
+} SparseModel;
+
+// fraction of the GEMM_PANEL x 1 blocks of a rows x cols matrix that are 0
+double ZeroBlocks(const float *weights, const int rows, const int cols);
+
+// zeroes the sparsity fraction of the blocks with the smallest L2 norm, the
+// bias column is never pruned, returns the number of zeroed blocks
+int PruneBlocks(float *weights, const int rows, const int cols, const double sparsity);
+
+// rewrites every LAYER_FC with enough zero blocks into LAYER_FC_SPARSE and
+// sets layer->sparse, the dense weights stay in place, returns 0 when out of
+// memory
+int SparsifyLayers(Layer *layers, const int num_layers, SparseModel *model);
+
+void FreeSparseModel(SparseModel *model);
+
+// same contracts as FCLayer() and FCLayerBatch()
+int SparseFCLayer(
+    const SparseMatrix *Fc1, const float *bottom, float *top,
+    int out_feat, int in_feat
+);
+
+int SparseFCLayerBatch(
+    const SparseMatrix *Fc1, const float *bottom, float *top, const int batch,
+    int out_feat, int in_feat
+);
+
+#endif  // SPARSE_H_
@@ -0,0 +1,1364 @@
+#include "tinycnn.h"
+#include "config.h"
+#include "layers.h"
+#include "model.h"
+#include "dataset.h"
+#include "import.h"
+#include "jit.h"
+#include "quant.h"
+#include "half.h"
+#include "sparse.h"
+#include "profile.h"
+#include "gemm.h"
+#include "dense.h"
+#include "util.h"
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_RELAX()     _mm_pause()
+#elif defined(__aarch64__)
+#define CPU_RELAX()     __asm__ __volatile__("yield")
+#else
+#define CPU_RELAX()
+#endif
+
+#define CACHE_LINE      64
+// pause rounds a team member spins before it yields the cpu at a barrier or
+// goes to sleep between requests
+#define SPIN_LIMIT      4000
+
+typedef struct {
+    float *blob;
+    float *col;
+    float *image;
+    void *quant;
+    // half-precision conv weights widened for the current layer
+    float *weights;
+#ifdef USE_PROFILE
+    Profile *profile;
+#endif
+} Workspace;
+
+struct tcnn_model {
+    tcnn_options options;
+    // text models are parsed into text and wired up as the demo graph,
+    // binary models are mapped and used in place, ONNX and ncnn models are
+    // imported into text with their layer table in file
+    float *text;
+    ModelFile file;
+    const float *params;
+    size_t param_count;
+    Layer demo_layers[NUM_LAYER];
+    Layer *layers;
+    int num_layers;
+    ModelShape shape;
+    float *input_weights;
+    float *winograd;
+    float *packed;
+    HalfModel half;
+    SparseModel sparse;
+    QuantModel quant;
+    JitModel jit;
+    // floats of every part of a context workspace
+    size_t blob_size, col_size, image_size, quant_size, weights_size;
+    // held by the handle that publishes the model and by every context
+    // bound to it through the handle, the last release frees it
+    atomic_int refs;
+};
+
+struct tcnn_context {
+    const tcnn_model *model;
+    float *arena;
+    size_t arena_bytes;
+    Workspace ws;
+    // set for contexts that follow a handle, version is the one their model
+    // was published at
+    tcnn_handle *handle;
+    uint64_t version;
+};
+
+struct tcnn_handle {
+    // read-copy-update: readers take a reference to current, a reload
+    // publishes the next model, bumps version and drops the handle's
+    // reference to the old one once no reader is between the two steps,
+    // readers are counted by the parity of the version they started at
+    _Atomic(tcnn_model *) current;
+    _Alignas(CACHE_LINE) atomic_uint_fast64_t version;
+    _Alignas(CACHE_LINE) atomic_int readers[2];
+    // one reload at a time
+    pthread_mutex_t lock;
+};
+
+static int LoadModel(tcnn_model *model, const char *filename)
+{
+    if (IsModelFile(filename))
+    {
+        if (LoadModelFile(filename, &model->file) == 0)
+            return 0;
+        model->params = model->file.params;
+        model->param_count = model->file.param_count;
+        model->layers = model->file.layers;
+        model->num_layers = model->file.num_layers;
+        return 1;
+    }
+    if (IsImportedFile(filename))
+    {
+        ImportedModel imported;
+        if (LoadImportedModel(filename, &imported) == 0)
+            return 0;
+        model->text = imported.params;
+        model->params = imported.params;
+        model->param_count = imported.param_count;
+        model->file.layers = imported.layers;
+        model->file.num_layers = imported.num_layers;
+        model->layers = imported.layers;
+        model->num_layers = imported.num_layers;
+        return 1;
+    }
+    model->text = LoadTextFloats(filename, &model->param_count);
+    if (model->text == NULL)
+        return 0;
+    model->params = model->text;
+    model->layers = model->demo_layers;
+    model->num_layers = BuildDemoModel(model->layers, model->params);
+    return 1;
+}
+
+static int BuildModel(tcnn_model *model)
+{
+    // layer dims follow from the input, and the weights of every layer have
+    // to lie inside the loaded params
+    Layer *layers = model->layers;
+    const int in_h = model->options.in_h, in_w = model->options.in_w;
+    if (InferShapes(layers, model->num_layers, 1, in_h, in_w, &model->shape) == 0)
+        return 0;
+    for (int i = 0; i < model->num_layers; ++i)
+    {
+        if (layers[i].weights == NULL)
+            continue;
+        const ptrdiff_t offset = layers[i].weights - model->params;
+        if (offset < 0 || (size_t)offset > model->param_count ||
+            (size_t)layers[i].weight_count > model->param_count - (size_t)offset)
+        {
+            return 0;
+        }
+    }
+
+    // conv -> relu -> maxpool runs as one fused layer
+    model->num_layers = FuseLayers(layers, model->num_layers);
+    if (InferShapes(layers, model->num_layers, 1, in_h, in_w, &model->shape) == 0)
+        return 0;
+
+    // the first layer takes the raw uint8 pixels, so the 1 / 255 normalization
+    // is folded into a copy of its weights, the batched argmax reads fc rows
+    Layer *input = &layers[0];
+    if ((input->type != LAYER_CONV && input->type != LAYER_CONV_RELU_POOL) ||
+        layers[model->num_layers - 1].type != LAYER_FC)
+    {
+        return 0;
+    }
+    model->input_weights = aligned_alloc(ALIGN_SIZE, AlignFloats(input->weight_count) * sizeof(float));
+    if (model->input_weights == NULL)
+        return 0;
+    FoldInputScale(
+        input, input->filters, input->weight_count / input->filters, INPUT_SCALE, model->input_weights
+    );
+
+    // pruned fc layers keep only their nonzero blocks in fp32, the other
+    // precisions convert the dense weights
+    if (model->options.precision == TCNN_FP32 && SparsifyLayers(layers, model->num_layers, &model->sparse) == 0)
+        return 0;
+
+    // 3x3 filters are transformed once here rather than on every call, and
+    // the weights of the GEMM layers go into panels
+    model->winograd = PrepareWinograd(layers, model->num_layers);
+    model->packed = PackLayers(layers, model->num_layers);
+    return layers[model->num_layers - 1].packed != NULL || layers[model->num_layers - 1].sparse != NULL;
+}
+
+static int ConvertHalf(tcnn_model *model, const HalfFormat format)
+{
+    // the fp32 weights are released once narrowed, which is what halves the
+    // resident model
+    Layer *layers = model->layers;
+    if (ConvertHalfModel(layers, model->num_layers, format, &model->half) == 0)
+        return 0;
+    // fc layers read the half rows, only im2col convs keep fp32 panels
+    for (int i = 0; i < model->num_layers; ++i)
+    {
+        if (layers[i].type == LAYER_FC)
+            layers[i].weights = NULL;
+    }
+    free(model->packed);
+    model->packed = PackLayers(layers, model->num_layers);
+    for (int i = 0; i < model->num_layers; ++i)
+        layers[i].weights = NULL;
+    free(model->input_weights);
+    model->input_weights = NULL;
+    free(model->text);
+    model->text = NULL;
+    ReleaseModelParams(&model->file);
+    model->params = NULL;
+    return 1;
+}
+
+static void SizeWorkspace(tcnn_model *model)
+{
+    // blobs, im2col columns and widened pixels are sized for a full batch
+    const ModelShape *shape = &model->shape;
+    const size_t batch = model->options.max_batch;
+    model->blob_size = AlignFloats(batch * shape->blob_size);
+    if (model->jit.forward != NULL && (size_t)model->jit.blob_size > model->blob_size)
+        model->blob_size = AlignFloats(model->jit.blob_size);
+    model->col_size = AlignFloats(batch * shape->col_size);
+    model->image_size = AlignFloats(batch * shape->image_size);
+    model->quant_size = AlignFloats((model->quant.workspace_size + sizeof(float) - 1) / sizeof(float));
+    model->weights_size = AlignFloats(model->half.widen_size);
+}
+
+static tcnn_model *LoadFailed(tcnn_model *model, tcnn_status *status, const tcnn_status reason)
+{
+    if (status != NULL)
+        *status = reason;
+    tcnn_model_free(model);
+    return NULL;
+}
+
+tcnn_options tcnn_default_options(void)
+{
+    tcnn_options options = { TCNN_FP32, BATCH_SIZE, 1, IMG_HEIGHT, IMG_WIDTH };
+    return options;
+}
+
+tcnn_model *tcnn_model_load(const char *filename, const tcnn_options *options, tcnn_status *status)
+{
+    const tcnn_options defaults = tcnn_default_options();
+    if (options == NULL)
+        options = &defaults;
+    tcnn_model *model = calloc(1, sizeof(tcnn_model));
+    if (model == NULL)
+        return LoadFailed(NULL, status, TCNN_ERR_ALLOC);
+    atomic_init(&model->refs, 1);
+    model->options = *options;
+    if (model->options.max_batch < 1)
+        model->options.max_batch = 1;
+    const tcnn_precision precision = options->precision;
+
+    if (LoadModel(model, filename) == 0)
+        return LoadFailed(model, status, TCNN_ERR_LOAD);
+    if (BuildModel(model) == 0)
+        return LoadFailed(model, status, TCNN_ERR_BUILD);
+
+    // the int8 path needs the activation scales written by calibrate
+    if (precision == TCNN_INT8 && QuantizeModel(model->layers, model->num_layers, &model->quant) == 0)
+        return LoadFailed(model, status, TCNN_ERR_QUANT);
+
+    // half-precision weights are widened by the interpreter kernels, the JIT
+    // only reads fp32
+    if ((precision == TCNN_FP16 || precision == TCNN_BF16) &&
+        ConvertHalf(model, precision == TCNN_BF16 ? HALF_BF16 : HALF_FP16) == 0)
+    {
+        return LoadFailed(model, status, TCNN_ERR_HALF);
+    }
+
+#ifdef USE_JIT
+    if (options->use_jit && precision == TCNN_FP32)
+        JitCompile(model->layers, model->num_layers, &model->jit);
+#endif
+
+    SizeWorkspace(model);
+    if (status != NULL)
+        *status = TCNN_OK;
+    return model;
+}
+
+void tcnn_model_free(tcnn_model *model)
+{
+    if (model == NULL)
+        return;
+    JitFree(&model->jit);
+    FreeQuantModel(&model->quant);
+    FreeHalfModel(&model->half);
+    FreeSparseModel(&model->sparse);
+    free(model->input_weights);
+    free(model->winograd);
+    free(model->packed);
+    free(model->text);
+    FreeModelFile(&model->file);
+    free(model);
+}
+
+void tcnn_model_get_info(const tcnn_model *model, tcnn_model_info *info)
+{
+    const tcnn_precision precision = model->options.precision;
+    info->in_h = model->options.in_h;
+    info->in_w = model->options.in_w;
+    info->classes = model->layers[model->num_layers - 1].out_c;
+    info->max_batch = model->options.max_batch;
+    info->param_bytes = model->shape.param_count * sizeof(float);
+    info->weight_bytes = info->param_bytes;
+    if (precision == TCNN_FP16 || precision == TCNN_BF16)
+        info->weight_bytes = model->half.weight_bytes;
+    else if (precision == TCNN_INT8)
+        info->weight_bytes = model->quant.weight_bytes;
+    else if (model->jit.forward != NULL)
+        info->weight_bytes = model->jit.weight_bytes;
+    else
+        info->weight_bytes += model->sparse.weight_bytes - model->sparse.dense_bytes;
+    info->jit_code_size = model->jit.forward != NULL ? model->jit.code_size : 0;
+    info->workspace_bytes = (model->blob_size + model->col_size + model->image_size +
+        model->quant_size + model->weights_size) * sizeof(float);
+}
+
+const char *tcnn_status_string(const tcnn_status status)
+{
+    switch (status)
+    {
+    case TCNN_OK:
+        return "ok";
+    case TCNN_ERR_LOAD:
+        return "failed to load model";
+    case TCNN_ERR_BUILD:
+        return "failed to build model";
+    case TCNN_ERR_QUANT:
+        return "failed to quantize model, is it calibrated?";
+    case TCNN_ERR_HALF:
+        return "failed to convert weights";
+    case TCNN_ERR_ALLOC:
+        return "out of memory";
+    case TCNN_ERR_BUSY:
+        return "queue is full";
+    case TCNN_ERR_DEADLINE:
+        return "deadline passed";
+    case TCNN_ERR_REJECTED:
+        return "model does not fit the handle";
+    }
+    return "unknown status";
+}
+
+static void ReleaseModel(tcnn_model *model)
+{
+    if (atomic_fetch_sub_explicit(&model->refs, 1, memory_order_acq_rel) == 1)
+        tcnn_model_free(model);
+}
+
+static tcnn_model *AcquireModel(tcnn_handle *handle, uint64_t *version)
+{
+    // the reader count of the version's parity keeps a reload from dropping
+    // the model between loading current and taking the reference, a reader
+    // that saw the version move on retries under the new parity
+    for (;;)
+    {
+        const uint64_t start = atomic_load(&handle->version);
+        atomic_int *readers = &handle->readers[start & 1];
+        atomic_fetch_add(readers, 1);
+        if (atomic_load(&handle->version) == start)
+        {
+            tcnn_model *model = atomic_load(&handle->current);
+            atomic_fetch_add_explicit(&model->refs, 1, memory_order_relaxed);
+            atomic_fetch_sub_explicit(readers, 1, memory_order_release);
+            *version = start;
+            return model;
+        }
+        atomic_fetch_sub_explicit(readers, 1, memory_order_release);
+    }
+}
+
+static int BindWorkspace(tcnn_context *ctx, const tcnn_model *model)
+{
+    // one allocation holds every part of the workspace, it is zeroed here so
+    // that its pages are placed on the NUMA node of the calling thread, an
+    // arena that is large enough for the model is kept
+    tcnn_model_info info;
+    tcnn_model_get_info(model, &info);
+    float *arena = ctx->arena;
+    if (info.workspace_bytes > ctx->arena_bytes)
+    {
+        arena = aligned_alloc(ALIGN_SIZE, info.workspace_bytes);
+        if (arena == NULL)
+            return 0;
+    }
+#ifdef USE_PROFILE
+    // the counters follow the calling thread and the layers of the model
+    Profile *profile = ProfileCreate(model->num_layers);
+    if (profile == NULL)
+    {
+        if (arena != ctx->arena)
+            free(arena);
+        return 0;
+    }
+    ProfileFree(ctx->ws.profile);
+    ctx->ws.profile = profile;
+#endif
+    if (arena != ctx->arena)
+    {
+        free(ctx->arena);
+        ctx->arena = arena;
+        ctx->arena_bytes = info.workspace_bytes;
+    }
+    memset(ctx->arena, 0, info.workspace_bytes);
+    ctx->model = model;
+    ctx->ws.blob = ctx->arena;
+    ctx->ws.col = &ctx->ws.blob[model->blob_size];
+    ctx->ws.image = &ctx->ws.col[model->col_size];
+    ctx->ws.quant = &ctx->ws.image[model->image_size];
+    ctx->ws.weights = &ctx->ws.image[model->image_size + model->quant_size];
+    return 1;
+}
+
+tcnn_context *tcnn_context_create(const tcnn_model *model)
+{
+    tcnn_context *ctx = calloc(1, sizeof(tcnn_context));
+    if (ctx == NULL)
+        return NULL;
+    if (BindWorkspace(ctx, model) == 0)
+    {
+        tcnn_context_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+void tcnn_context_free(tcnn_context *ctx)
+{
+    if (ctx == NULL)
+        return;
+#ifdef USE_PROFILE
+    ProfileFree(ctx->ws.profile);
+#endif
+    free(ctx->arena);
+    if (ctx->handle != NULL && ctx->model != NULL)
+        ReleaseModel((tcnn_model *)ctx->model);
+    free(ctx);
+}
+
+static void FollowHandle(tcnn_context *ctx)
+{
+    // a context moves to a newly published model on its next call, the old
+    // one is freed by whichever of its contexts leaves it last, a failed
+    // move keeps the context on the model it has
+    tcnn_handle *handle = ctx->handle;
+    if (atomic_load_explicit(&handle->version, memory_order_acquire) == ctx->version)
+        return;
+    uint64_t version;
+    tcnn_model *model = AcquireModel(handle, &version);
+    tcnn_model *old = (tcnn_model *)ctx->model;
+    if (model != old && BindWorkspace(ctx, model) == 0)
+    {
+        ReleaseModel(model);
+        return;
+    }
+    ctx->version = version;
+    ReleaseModel(old);
+}
+
+static const float *ConvWeights(const tcnn_model *model, const int layer_i, const Workspace *ws)
+{
+    // conv weights are small next to the work on them, so half-precision
+    // banks are widened whole before the float kernel runs
+    const Layer *layer = &model->layers[layer_i];
+    if (model->half.storage == NULL)
+        return layer->weights;
+    WidenHalf(model->half.weights[layer_i], ws->weights, layer->weight_count, model->half.format);
+    return ws->weights;
+}
+
+static int InputLayer(
+    const tcnn_model *model, const uint8_t *images, float *top, const int count, const Workspace *ws
+)
+{
+    // images are [count][in_h * in_w] uint8 pixels, read directly by the kernel
+    const Layer *layer = &model->layers[0];
+    const int kernel_size = layer->kernel_size;
+    const int padding = layer->padding;
+    const int in_c = layer->in_c, in_h = layer->in_h, in_w = layer->in_w;
+    const int out_c = layer->out_c, out_h = layer->out_h, out_w = layer->out_w;
+    const int fused = layer->type == LAYER_CONV_RELU_POOL;
+    const float *weights = ConvWeights(model, 0, ws);
+    int top_size;
+    if (fused)
+    {
+        top_size = ConvReluPoolDirectU8(
+            images, top, count, in_c, in_h, in_w, out_c, out_h, out_w,
+            weights, kernel_size, padding, layer->alpha, layer->pool_size
+        );
+    }
+    else
+    {
+        top_size = ConvDirectLayerU8(
+            images, top, count, in_c, in_h, in_w, out_c, out_h, out_w,
+            weights, kernel_size, padding
+        );
+    }
+    if (top_size > 0)
+        return top_size;
+
+    // no uint8 kernel for this shape, widen the pixels for the float layer
+    float *image_ptr = ws->image;
+    for (int i = 0; i < count * model->shape.in_size; ++i)
+        image_ptr[i] = images[i];
+    if (fused)
+    {
+        return ConvReluPoolLayer(
+            image_ptr, top, count, in_c, in_h, in_w, out_c, out_h, out_w,
+            weights, layer->packed, layer->winograd, kernel_size, padding, layer->alpha, layer->pool_size, ws->col
+        );
+    }
+    return ConvLayerBatch(
+        image_ptr, top, count, in_c, in_h, in_w, out_c, out_h, out_w,
+        weights, layer->packed, layer->winograd, kernel_size, padding, ws->col
+    );
+}
+
+static const float *Reco(const tcnn_model *model, const uint8_t *image, const Workspace *ws)
+{
+    int top_size = 0;
+    float *bottom = NULL;
+    float *top = &ws->blob[model->layers[0].top_offset];
+    int in_c, in_h, in_w, out_c, out_h, out_w;
+    const Layer *layers_ptr = model->layers;
+    const HalfModel *half = &model->half;
+
+    // input layer
+    PROFILE_BEGIN(ws->profile);
+    top_size = InputLayer(model, image, top, 1, ws);
+    PROFILE_END(ws->profile, 0, 1);
+
+    for (int layer_i = 1; layer_i < model->num_layers; ++layer_i)
+    {
+        // get new layer config
+        PROFILE_BEGIN(ws->profile);
+        ++layers_ptr;
+        in_c = layers_ptr->in_c, in_h = layers_ptr->in_h, in_w = layers_ptr->in_w;
+        out_c = layers_ptr->out_c, out_h = layers_ptr->out_h, out_w = layers_ptr->out_w;
+        // forward propagation
+        if (layers_ptr->type == LAYER_CONV)
+        {
+            bottom = top;
+            top = &ws->blob[layers_ptr->top_offset];
+            top_size = ConvLayer(
+                bottom, top, in_c, in_h, in_w, out_c, out_h, out_w,
+                ConvWeights(model, layer_i, ws), layers_ptr->packed, layers_ptr->winograd, layers_ptr->kernel_size, layers_ptr->padding, ws->col
+            );
+        }
+        else if (layers_ptr->type == LAYER_CONV_RELU_POOL)
+        {
+            bottom = top;
+            top = &ws->blob[layers_ptr->top_offset];
+            top_size = ConvReluPoolLayer(
+                bottom, top, 1, in_c, in_h, in_w, out_c, out_h, out_w,
+                ConvWeights(model, layer_i, ws), layers_ptr->packed, layers_ptr->winograd, layers_ptr->kernel_size, layers_ptr->padding,
+                layers_ptr->alpha, layers_ptr->pool_size, ws->col
+            );
+        }
+        else if (layers_ptr->type == LAYER_RELU)
+        {
+            ReLU(top, top_size, layers_ptr->alpha);
+        }
+        else if (layers_ptr->type == LAYER_MAXPOOL || layers_ptr->type == LAYER_AVGPOOL)
+        {
+            bottom = top;
+            top = &ws->blob[layers_ptr->top_offset];
+            top_size = PoolingLayer(
+                bottom, top, in_c, in_h, in_w, out_h, out_w, layers_ptr->kernel_size,
+                layers_ptr->stride, layers_ptr->padding, layers_ptr->type == LAYER_AVGPOOL
+            );
+        }
+        else if (layers_ptr->type == LAYER_FC || layers_ptr->type == LAYER_FC_SPARSE)
+        {
+            // the first fc layer gets its input with a trailing 1.0f from
+            // flatten, later ones find the slot after the previous output
+            bottom = top;
+            if (layers_ptr->flat_offset >= 0)
+            {
+                bottom = &ws->blob[layers_ptr->flat_offset];
+                FlattenBatch(top, bottom, 1, in_c, in_h * in_w);
+            }
+            else
+            {
+                bottom[top_size] = 1.0f;
+            }
+            top = &ws->blob[layers_ptr->top_offset];
+            if (layers_ptr->sparse != NULL)
+            {
+                top_size = SparseFCLayer(layers_ptr->sparse, bottom, top, out_c, layers_ptr->in_feat + 1);
+            }
+            else if (half->storage != NULL)
+            {
+                top_size = HalfFCLayer(
+                    half->weights[layer_i], half->format, bottom, top, out_c, layers_ptr->in_feat + 1
+                );
+            }
+            else
+            {
+                top_size = FCLayer(layers_ptr->packed, bottom, top, out_c, layers_ptr->in_feat + 1);
+            }
+        }
+        else
+        {
+            printf("Error: unknown layer\n");
+            break;
+        }
+        PROFILE_END(ws->profile, layer_i, 1);
+    }
+    return top;
+}
+
+static const float *RecoBatch(const tcnn_model *model, const uint8_t *images, const int count, const Workspace *ws)
+{
+    // images are [count][in_h * in_w], which is the [c][batch][h * w] layout
+    // of a single channel, so every layer runs once for the whole batch, the
+    // logits come back as rows of out_c + 1
+    int top_size = 0;
+    float *bottom = NULL;
+    float *top = &ws->blob[model->layers[0].top_offset * count];
+    int in_c, in_h, in_w, out_c, out_h, out_w;
+    const Layer *layers_ptr = model->layers;
+    const HalfModel *half = &model->half;
+
+    // input layer
+    PROFILE_BEGIN(ws->profile);
+    top_size = InputLayer(model, images, top, count, ws);
+    PROFILE_END(ws->profile, 0, count);
+
+    for (int layer_i = 1; layer_i < model->num_layers; ++layer_i)
+    {
+        // get new layer config
+        PROFILE_BEGIN(ws->profile);
+        ++layers_ptr;
+        in_c = layers_ptr->in_c, in_h = layers_ptr->in_h, in_w = layers_ptr->in_w;
+        out_c = layers_ptr->out_c, out_h = layers_ptr->out_h, out_w = layers_ptr->out_w;
+        // forward propagation
+        if (layers_ptr->type == LAYER_CONV)
+        {
+            bottom = top;
+            top = &ws->blob[layers_ptr->top_offset * count];
+            top_size = ConvLayerBatch(
+                bottom, top, count, in_c, in_h, in_w, out_c, out_h, out_w,
+                ConvWeights(model, layer_i, ws), layers_ptr->packed, layers_ptr->winograd, layers_ptr->kernel_size, layers_ptr->padding, ws->col
+            );
+        }
+        else if (layers_ptr->type == LAYER_CONV_RELU_POOL)
+        {
+            bottom = top;
+            top = &ws->blob[layers_ptr->top_offset * count];
+            top_size = ConvReluPoolLayer(
+                bottom, top, count, in_c, in_h, in_w, out_c, out_h, out_w,
+                ConvWeights(model, layer_i, ws), layers_ptr->packed, layers_ptr->winograd, layers_ptr->kernel_size, layers_ptr->padding,
+                layers_ptr->alpha, layers_ptr->pool_size, ws->col
+            );
+        }
+        else if (layers_ptr->type == LAYER_RELU)
+        {
+            ReLU(top, top_size, layers_ptr->alpha);
+        }
+        else if (layers_ptr->type == LAYER_MAXPOOL || layers_ptr->type == LAYER_AVGPOOL)
+        {
+            // every (channel, image) plane is pooled independently
+            bottom = top;
+            top = &ws->blob[layers_ptr->top_offset * count];
+            top_size = PoolingLayer(
+                bottom, top, in_c * count, in_h, in_w, out_h, out_w, layers_ptr->kernel_size,
+                layers_ptr->stride, layers_ptr->padding, layers_ptr->type == LAYER_AVGPOOL
+            );
+        }
+        else if (layers_ptr->type == LAYER_FC || layers_ptr->type == LAYER_FC_SPARSE)
+        {
+            if (layers_ptr->flat_offset >= 0)
+            {
+                bottom = top;
+                top = &ws->blob[layers_ptr->flat_offset * count];
+                top_size = FlattenBatch(bottom, top, count, in_c, in_h * in_w);
+            }
+            bottom = top;
+            top = &ws->blob[layers_ptr->top_offset * count];
+            if (layers_ptr->sparse != NULL)
+            {
+                top_size = SparseFCLayerBatch(
+                    layers_ptr->sparse, bottom, top, count, out_c, layers_ptr->in_feat + 1
+                );
+            }
+            else if (half->storage != NULL)
+            {
+                top_size = HalfFCLayerBatch(
+                    half->weights[layer_i], half->format, bottom, top, count,
+                    out_c, layers_ptr->in_feat + 1
+                );
+            }
+            else
+            {
+                top_size = FCLayerBatch(
+                    layers_ptr->packed, bottom, top, count, out_c, layers_ptr->in_feat + 1
+                );
+            }
+        }
+        else
+        {
+            printf("Error: unknown layer\n");
+            break;
+        }
+        PROFILE_END(ws->profile, layer_i, count);
+    }
+    return top;
+}
+
+static int Argmax(const float *row, const int classes)
+{
+    int pred = 0;
+    float max_value = row[0];
+    for (int i = 1; i < classes; ++i)
+    {
+        if (row[i] > max_value)
+        {
+            max_value = row[i];
+            pred = i;
+        }
+    }
+    return pred;
+}
+
+static int Infer(tcnn_context *ctx, const uint8_t *image, float *logits)
+{
+    const tcnn_model *model = ctx->model;
+    const int classes = model->layers[model->num_layers - 1].out_c;
+    if (model->quant.layers != NULL)
+    {
+        PROFILE_BEGIN(ctx->ws.profile);
+        const int pred = QuantForward(&model->quant, image, ctx->ws.quant, logits);
+        PROFILE_END(ctx->ws.profile, PROFILE_INT8, 1);
+        return pred;
+    }
+
+    const float *row;
+    if (model->jit.forward != NULL)
+    {
+        // the emitted code runs one image at a time, without layer bounds
+        PROFILE_BEGIN(ctx->ws.profile);
+        model->jit.forward(image, ctx->ws.blob);
+        PROFILE_END(ctx->ws.profile, PROFILE_JIT, 1);
+        row = &ctx->ws.blob[model->jit.out_offset];
+    }
+    else
+    {
+        row = Reco(model, image, &ctx->ws);
+    }
+    if (logits != NULL)
+        memcpy(logits, row, classes * sizeof(float));
+    return Argmax(row, classes);
+}
+
+int tcnn_infer(tcnn_context *ctx, const uint8_t *image, float *logits)
+{
+    if (ctx->handle != NULL)
+        FollowHandle(ctx);
+    return Infer(ctx, image, logits);
+}
+
+void tcnn_infer_batch(tcnn_context *ctx, const uint8_t *images, const int count, int *preds)
+{
+    // a whole call runs on one model
+    if (ctx->handle != NULL)
+        FollowHandle(ctx);
+    const tcnn_model *model = ctx->model;
+    const int classes = model->layers[model->num_layers - 1].out_c;
+    const size_t in_size = model->shape.in_size;
+    const int max_batch = model->options.max_batch;
+    for (int image_i = 0; image_i < count; image_i += max_batch)
+    {
+        const int chunk = count - image_i < max_batch ? count - image_i : max_batch;
+        const uint8_t *chunk_ptr = &images[image_i * in_size];
+        if (chunk == 1 || model->quant.layers != NULL || model->jit.forward != NULL)
+        {
+            for (int b = 0; b < chunk; ++b)
+                preds[image_i + b] = Infer(ctx, &chunk_ptr[b * in_size], NULL);
+            continue;
+        }
+        // argmax, rows of the last fc layer are out_c + 1 wide
+        const float *top = RecoBatch(model, chunk_ptr, chunk, &ctx->ws);
+        for (int b = 0; b < chunk; ++b)
+            preds[image_i + b] = Argmax(&top[b * (classes + 1)], classes);
+    }
+}
+
+int tcnn_profile_report(tcnn_context *const *contexts, const int count, const char *trace_file)
+{
+#ifdef USE_PROFILE
+    if (count <= 0)
+        return 1;
+    Profile **profiles = malloc(count * sizeof(Profile *));
+    if (profiles == NULL)
+        return 0;
+    for (int i = 0; i < count; ++i)
+        profiles[i] = contexts[i]->ws.profile;
+    const Layer *layers = contexts[0]->model->layers;
+    ProfileReport(profiles, count, layers, stdout);
+    const int written = trace_file == NULL || ProfileWriteTrace(profiles, count, layers, trace_file);
+    free(profiles);
+    return written;
+#else
+    (void)contexts;
+    (void)count;
+    (void)trace_file;
+    return 0;
+#endif
+}
+
+// Team of threads sharing one image. The caller is member 0, the others are
+// helpers that spin on the request generation, then sleep. Every member runs
+// the whole layer loop on a slice of each layer's outputs and meets the
+// others at a spin barrier after it, so a layer costs one barrier rather than
+// a fork and a join.
+typedef struct {
+    // arrivals of the current phase, the last one resets it and bumps phase
+    _Alignas(CACHE_LINE) atomic_int count;
+    _Alignas(CACHE_LINE) atomic_int phase;
+    int size;
+} SpinBarrier;
+
+typedef struct {
+    tcnn_team *team;
+    int index;
+    pthread_t thread;
+    tcnn_context *ctx;
+    // the context's workspace on the blob of member 0
+    Workspace ws;
+} TeamMember;
+
+struct tcnn_team {
+    const tcnn_model *model;
+    TeamMember *members;
+    int size;
+    int started;
+    SpinBarrier barrier;
+    // bumped for every request, helpers that found none for a while wait on
+    // wake and count themselves in sleepers
+    _Alignas(CACHE_LINE) atomic_uint generation;
+    atomic_int sleepers;
+    atomic_int stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    const uint8_t *image;
+    // posted by every helper once it has its context
+    sem_t setup;
+};
+
+static void BarrierWait(SpinBarrier *barrier)
+{
+    // sense reversal on a counter, the phase is read before arriving, it can
+    // only move once this member has arrived
+    const int phase = atomic_load_explicit(&barrier->phase, memory_order_relaxed);
+    if (atomic_fetch_add_explicit(&barrier->count, 1, memory_order_acq_rel) == barrier->size - 1)
+    {
+        atomic_store_explicit(&barrier->count, 0, memory_order_relaxed);
+        atomic_store_explicit(&barrier->phase, phase + 1, memory_order_release);
+        return;
+    }
+    for (int spins = 0; atomic_load_explicit(&barrier->phase, memory_order_acquire) == phase; ++spins)
+    {
+        if (spins < SPIN_LIMIT)
+            CPU_RELAX();
+        else
+            sched_yield();
+    }
+}
+
+static int Share(const int total, const int unit, const int size, const int member, int *first)
+{
+    // splits total items into whole units among the members, returns the
+    // count of member's part, which may be 0
+    const int units = (total + unit - 1) / unit;
+    const int begin = units * member / size * unit;
+    const int end = units * (member + 1) / size * unit;
+    *first = begin;
+    return (end < total ? end : total) - begin;
+}
+
+static void ConvShare(
+    const tcnn_model *model, const int layer_i, const uint8_t *pixels, const float *bottom, float *top,
+    const Workspace *ws, const int size, const int member
+)
+{
+    // a share is a range of output channels, whole GEMM panels and Winograd
+    // blocks so that every kernel finds its weights by pointer, the layer's
+    // first layer reads the pixels like InputLayer()
+    const Layer *layer = &model->layers[layer_i];
+    const int kernel_size = layer->kernel_size, padding = layer->padding;
+    const int in_c = layer->in_c, in_h = layer->in_h, in_w = layer->in_w;
+    const int out_c = layer->out_c, out_h = layer->out_h, out_w = layer->out_w;
+    const int fused = layer->type == LAYER_CONV_RELU_POOL;
+    const int k = kernel_size * kernel_size * in_c + 1;
+    int first = 0, count = out_c;
+    // the fused kernels write only their channels, the unfused fallback uses
+    // all of top as scratch, member 0 runs it alone
+    const int fused_winograd = layer->winograd != NULL && layer->pool_size == 2 && layer->alpha >= 0.0f &&
+        WinogradSupported(in_c, in_h, in_w, kernel_size, padding);
+    if (fused && !fused_winograd &&
+        !ConvReluPoolSupported(in_c, in_h, in_w, kernel_size, padding, layer->alpha, layer->pool_size))
+    {
+        count = member == 0 ? out_c : 0;
+    }
+    else
+    {
+        count = Share(out_c, GEMM_PANEL, size, member, &first);
+    }
+    if (count <= 0)
+        return;
+
+    const float *weights = &ConvWeights(model, layer_i, ws)[(size_t)first * k];
+    const float *packed = layer->packed != NULL ? &layer->packed[(size_t)first * k] : NULL;
+    const float *winograd = layer->winograd != NULL ? &layer->winograd[WinogradOffset(in_c, first)] : NULL;
+    top = &top[(size_t)first * out_h * out_w];
+    if (pixels != NULL)
+    {
+        const int top_size = fused ? ConvReluPoolDirectU8(
+            pixels, top, 1, in_c, in_h, in_w, count, out_h, out_w,
+            weights, kernel_size, padding, layer->alpha, layer->pool_size
+        ) : ConvDirectLayerU8(
+            pixels, top, 1, in_c, in_h, in_w, count, out_h, out_w, weights, kernel_size, padding
+        );
+        if (top_size > 0)
+            return;
+        for (int i = 0; i < model->shape.in_size; ++i)
+            ws->image[i] = pixels[i];
+        bottom = ws->image;
+    }
+    if (fused)
+    {
+        ConvReluPoolLayer(
+            bottom, top, 1, in_c, in_h, in_w, count, out_h, out_w,
+            weights, packed, winograd, kernel_size, padding, layer->alpha, layer->pool_size, ws->col
+        );
+        return;
+    }
+    ConvLayer(
+        bottom, top, in_c, in_h, in_w, count, out_h, out_w,
+        weights, packed, winograd, kernel_size, padding, ws->col
+    );
+}
+
+static void FCShare(
+    const tcnn_model *model, const int layer_i, const float *bottom, float *top,
+    const int size, const int member
+)
+{
+    // a share is a range of whole panels of output rows
+    const Layer *layer = &model->layers[layer_i];
+    const int in_feat = layer->in_feat + 1;
+    int first;
+    const int count = Share(layer->out_c, GEMM_PANEL, size, member, &first);
+    if (count <= 0)
+        return;
+    if (layer->sparse != NULL)
+    {
+        const SparseMatrix *matrix = layer->sparse;
+        SparseGemvPanels(
+            matrix->blocks, matrix->index, &matrix->offsets[first / GEMM_PANEL], bottom, &top[first], count
+        );
+    }
+    else if (model->half.storage != NULL)
+    {
+        HalfFCLayer(
+            &model->half.weights[layer_i][(size_t)first * in_feat], model->half.format, bottom, &top[first],
+            count, in_feat
+        );
+    }
+    else
+    {
+        FCLayer(&layer->packed[(size_t)first * in_feat], bottom, &top[first], count, in_feat);
+    }
+}
+
+static const float *RecoTeam(tcnn_team *team, const int member)
+{
+    // the same layer loop as Reco() on every member, each layer on the
+    // member's share and followed by a barrier, the steps that move the
+    // whole blob run on member 0
+    const tcnn_model *model = team->model;
+    const Workspace *ws = &team->members[member].ws;
+    const int size = team->size;
+    int top_size = 0;
+    float *bottom = NULL;
+    float *top = &ws->blob[model->layers[0].top_offset];
+
+    for (int layer_i = 0; layer_i < model->num_layers; ++layer_i)
+    {
+        const Layer *layer = &model->layers[layer_i];
+        const int out_c = layer->out_c, out_size = layer->out_h * layer->out_w;
+        int first, count;
+        PROFILE_BEGIN(ws->profile);
+        if (layer_i == 0)
+        {
+            ConvShare(model, 0, team->image, NULL, top, ws, size, member);
+            top_size = out_c * out_size;
+        }
+        else if (layer->type == LAYER_CONV || layer->type == LAYER_CONV_RELU_POOL)
+        {
+            bottom = top;
+            top = &ws->blob[layer->top_offset];
+            ConvShare(model, layer_i, NULL, bottom, top, ws, size, member);
+            top_size = out_c * out_size;
+        }
+        else if (layer->type == LAYER_RELU)
+        {
+            count = Share(top_size, ALIGN_SIZE / sizeof(float), size, member, &first);
+            if (count > 0)
+                ReLU(&top[first], count, layer->alpha);
+        }
+        else if (layer->type == LAYER_MAXPOOL || layer->type == LAYER_AVGPOOL)
+        {
+            const int in_size = layer->in_h * layer->in_w;
+            bottom = top;
+            top = &ws->blob[layer->top_offset];
+            count = Share(out_c, 1, size, member, &first);
+            if (count > 0)
+            {
+                PoolingLayer(
+                    &bottom[first * in_size], &top[first * out_size], count, layer->in_h, layer->in_w,
+                    layer->out_h, layer->out_w, layer->kernel_size, layer->stride, layer->padding,
+                    layer->type == LAYER_AVGPOOL
+                );
+            }
+            top_size = out_c * out_size;
+        }
+        else if (layer->type == LAYER_FC || layer->type == LAYER_FC_SPARSE)
+        {
+            // the trailing 1.0f of the input goes in before anyone reads it
+            bottom = top;
+            if (layer->flat_offset >= 0)
+                bottom = &ws->blob[layer->flat_offset];
+            if (member == 0 && layer->flat_offset >= 0)
+                FlattenBatch(top, bottom, 1, layer->in_c, layer->in_h * layer->in_w);
+            else if (member == 0)
+                bottom[top_size] = 1.0f;
+            BarrierWait(&team->barrier);
+            top = &ws->blob[layer->top_offset];
+            FCShare(model, layer_i, bottom, top, size, member);
+            top_size = out_c;
+        }
+        PROFILE_END(ws->profile, layer_i, 1);
+        BarrierWait(&team->barrier);
+    }
+    return top;
+}
+
+static void *TeamMain(void *arg)
+{
+    // the context is created here so that its pages are local to the helper
+    TeamMember *member = arg;
+    tcnn_team *team = member->team;
+    member->ctx = tcnn_context_create(team->model);
+    sem_post(&team->setup);
+    unsigned seen = 0;
+    for (;;)
+    {
+        unsigned generation = atomic_load(&team->generation);
+        for (int spins = 0; generation == seen && spins < SPIN_LIMIT; ++spins)
+        {
+            CPU_RELAX();
+            generation = atomic_load(&team->generation);
+        }
+        if (generation == seen)
+        {
+            // sleepers is raised before the generation is read again, and
+            // the caller bumps the generation before it reads sleepers, so
+            // one of the two sees the other
+            pthread_mutex_lock(&team->lock);
+            atomic_fetch_add(&team->sleepers, 1);
+            while ((generation = atomic_load(&team->generation)) == seen)
+                pthread_cond_wait(&team->wake, &team->lock);
+            atomic_fetch_sub(&team->sleepers, 1);
+            pthread_mutex_unlock(&team->lock);
+        }
+        seen = generation;
+        if (atomic_load(&team->stopping))
+            break;
+        RecoTeam(team, member->index);
+    }
+    return NULL;
+}
+
+static void TeamStart(tcnn_team *team)
+{
+    atomic_fetch_add(&team->generation, 1);
+    if (atomic_load(&team->sleepers) > 0)
+    {
+        pthread_mutex_lock(&team->lock);
+        pthread_cond_broadcast(&team->wake);
+        pthread_mutex_unlock(&team->lock);
+    }
+}
+
+tcnn_team *tcnn_team_create(const tcnn_model *model, const int threads)
+{
+    tcnn_team *team = calloc(1, sizeof(tcnn_team));
+    if (team == NULL)
+        return NULL;
+    team->model = model;
+    team->size = threads > 1 ? threads : 1;
+    team->members = calloc(team->size, sizeof(TeamMember));
+    if (team->members == NULL)
+    {
+        free(team);
+        return NULL;
+    }
+    team->barrier.size = team->size;
+    atomic_init(&team->barrier.count, 0);
+    atomic_init(&team->barrier.phase, 0);
+    atomic_init(&team->generation, 0);
+    atomic_init(&team->sleepers, 0);
+    atomic_init(&team->stopping, 0);
+    pthread_mutex_init(&team->lock, NULL);
+    pthread_cond_init(&team->wake, NULL);
+    sem_init(&team->setup, 0, 0);
+
+    int ok = (team->members[0].ctx = tcnn_context_create(model)) != NULL;
+    for (int i = 1; ok && i < team->size; ++i)
+    {
+        TeamMember *member = &team->members[i];
+        member->team = team;
+        member->index = i;
+        if (pthread_create(&member->thread, NULL, TeamMain, member) != 0)
+            break;
+        ++team->started;
+    }
+    for (int i = 0; i < team->started; ++i)
+    {
+        while (sem_wait(&team->setup) != 0)
+            ;
+    }
+    ok = ok && team->started == team->size - 1;
+    for (int i = 0; ok && i < team->size; ++i)
+    {
+        TeamMember *member = &team->members[i];
+        ok = member->ctx != NULL;
+        if (ok)
+        {
+            member->ws = member->ctx->ws;
+            member->ws.blob = team->members[0].ctx->ws.blob;
+        }
+    }
+    if (!ok)
+    {
+        tcnn_team_free(team);
+        return NULL;
+    }
+    return team;
+}
+
+void tcnn_team_free(tcnn_team *team)
+{
+    if (team == NULL)
+        return;
+    atomic_store(&team->stopping, 1);
+    TeamStart(team);
+    for (int i = 1; i <= team->started; ++i)
+        pthread_join(team->members[i].thread, NULL);
+    for (int i = 0; i < team->size; ++i)
+        tcnn_context_free(team->members[i].ctx);
+    sem_destroy(&team->setup);
+    pthread_cond_destroy(&team->wake);
+    pthread_mutex_destroy(&team->lock);
+    free(team->members);
+    free(team);
+}
+
+int tcnn_infer_team(tcnn_team *team, const uint8_t *image, float *logits)
+{
+    // int8 runs on member 0 alone, the team always takes the interpreter as
+    // the JIT code is one sequential function
+    const tcnn_model *model = team->model;
+    const int classes = model->layers[model->num_layers - 1].out_c;
+    if (model->quant.layers != NULL || team->size == 1)
+        return tcnn_infer(team->members[0].ctx, image, logits);
+    team->image = image;
+    TeamStart(team);
+    const float *row = RecoTeam(team, 0);
+    if (logits != NULL)
+        memcpy(logits, row, classes * sizeof(float));
+    return Argmax(row, classes);
+}
+
+struct tcnn_dense {
+    const tcnn_model *model;
+    DenseModel dense;
+    float *arena;
+};
+
+tcnn_dense *tcnn_dense_create(const tcnn_model *model, const int max_h, const int max_w)
+{
+    // int8 models keep their fp32 weights next to the quantized ones, the
+    // dense kernels read those
+    tcnn_dense *dense = calloc(1, sizeof(tcnn_dense));
+    if (dense == NULL)
+        return NULL;
+    dense->model = model;
+    if (PrepareDense(model->layers, model->num_layers, &model->half, max_h, max_w, &dense->dense) == 0)
+    {
+        free(dense);
+        return NULL;
+    }
+    const size_t bytes = DenseWorkspaceSize(&dense->dense) * sizeof(float);
+    dense->arena = aligned_alloc(ALIGN_SIZE, bytes);
+    if (dense->arena == NULL)
+    {
+        tcnn_dense_free(dense);
+        return NULL;
+    }
+    memset(dense->arena, 0, bytes);
+    return dense;
+}
+
+void tcnn_dense_free(tcnn_dense *dense)
+{
+    if (dense == NULL)
+        return;
+    FreeDenseModel(&dense->dense);
+    free(dense->arena);
+    free(dense);
+}
+
+int tcnn_dense_map_size(tcnn_dense *dense, const int height, const int width, int *rows, int *cols)
+{
+    return DenseMapSize(&dense->dense, height, width, rows, cols) ? dense->dense.step : 0;
+}
+
+tcnn_status tcnn_infer_dense(
+    tcnn_dense *dense, const uint8_t *page, const int height, const int width, const size_t stride,
+    int *classes, float *scores
+)
+{
+    if (DenseForward(&dense->dense, page, height, width, stride, dense->arena, classes, scores) == 0)
+        return TCNN_ERR_BUILD;
+    return TCNN_OK;
+}
+
+tcnn_handle *tcnn_handle_create(tcnn_model *model)
+{
+    tcnn_handle *handle = aligned_alloc(CACHE_LINE, (sizeof(tcnn_handle) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
+    if (handle == NULL)
+        return NULL;
+    memset(handle, 0, sizeof(tcnn_handle));
+    atomic_init(&handle->current, model);
+    atomic_init(&handle->version, 0);
+    atomic_init(&handle->readers[0], 0);
+    atomic_init(&handle->readers[1], 0);
+    pthread_mutex_init(&handle->lock, NULL);
+    return handle;
+}
+
+void tcnn_handle_free(tcnn_handle *handle)
+{
+    if (handle == NULL)
+        return;
+    ReleaseModel(atomic_load(&handle->current));
+    pthread_mutex_destroy(&handle->lock);
+    free(handle);
+}
+
+uint64_t tcnn_handle_version(tcnn_handle *handle)
+{
+    return atomic_load(&handle->version);
+}
+
+void tcnn_handle_get_info(tcnn_handle *handle, tcnn_model_info *info)
+{
+    uint64_t version;
+    tcnn_model *model = AcquireModel(handle, &version);
+    tcnn_model_get_info(model, info);
+    ReleaseModel(model);
+}
+
+tcnn_context *tcnn_handle_context_create(tcnn_handle *handle)
+{
+    tcnn_context *ctx = calloc(1, sizeof(tcnn_context));
+    if (ctx == NULL)
+        return NULL;
+    ctx->handle = handle;
+    tcnn_model *model = AcquireModel(handle, &ctx->version);
+    if (BindWorkspace(ctx, model) == 0)
+    {
+        ReleaseModel(model);
+        tcnn_context_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+static tcnn_status ProbeModel(const tcnn_model *model)
+{
+    // a black and a white image through a context of the model, which also
+    // faults in the weights and the generated code before the first request
+    const int classes = model->layers[model->num_layers - 1].out_c;
+    const size_t in_size = model->shape.in_size;
+    tcnn_context *ctx = tcnn_context_create(model);
+    uint8_t *image = malloc(in_size);
+    float *logits = malloc(classes * sizeof(float));
+    tcnn_status status = ctx != NULL && image != NULL && logits != NULL ? TCNN_OK : TCNN_ERR_ALLOC;
+    for (int pass = 0; status == TCNN_OK && pass < 2; ++pass)
+    {
+        memset(image, pass == 0 ? 0 : 255, in_size);
+        Infer(ctx, image, logits);
+        for (int c = 0; c < classes; ++c)
+        {
+            if (!isfinite(logits[c]))
+                status = TCNN_ERR_REJECTED;
+        }
+    }
+    free(logits);
+    free(image);
+    tcnn_context_free(ctx);
+    return status;
+}
+
+static tcnn_status CheckReload(const tcnn_model *model, const tcnn_model *current)
+{
+    // callers size their images, logits and batches by the model they
+    // started with
+    tcnn_model_info info, current_info;
+    tcnn_model_get_info(model, &info);
+    tcnn_model_get_info(current, &current_info);
+    if (info.in_h != current_info.in_h || info.in_w != current_info.in_w ||
+        info.classes != current_info.classes || info.max_batch != current_info.max_batch)
+    {
+        return TCNN_ERR_REJECTED;
+    }
+    return ProbeModel(model);
+}
+
+tcnn_status tcnn_handle_reload(tcnn_handle *handle, const char *filename, const tcnn_options *options)
+{
+    // the new model is loaded, prepared and probed on the calling thread
+    // while the current one keeps serving, then published in one store
+    pthread_mutex_lock(&handle->lock);
+    tcnn_model *current = atomic_load(&handle->current);
+    const tcnn_options current_options = current->options;
+    if (options == NULL)
+        options = &current_options;
+    tcnn_status status;
+    tcnn_model *model = tcnn_model_load(filename, options, &status);
+    if (model != NULL)
+        status = CheckReload(model, current);
+    if (status != TCNN_OK)
+    {
+        tcnn_model_free(model);
+        pthread_mutex_unlock(&handle->lock);
+        return status;
+    }
+
+    // readers that started at the old version may still be about to take a
+    // reference to the old model, the wait is only as long as that step
+    atomic_store(&handle->current, model);
+    const uint64_t old = atomic_fetch_add(&handle->version, 1);
+    while (atomic_load(&handle->readers[old & 1]) != 0)
+        CPU_RELAX();
+    ReleaseModel(current);
+    pthread_mutex_unlock(&handle->lock);
+    return TCNN_OK;
+}
@@ -0,0 +1,235 @@
+#ifndef TINYCNN_H_
+#define TINYCNN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Embeddable inference API. A model is loaded and prepared once and is
+// read-only afterwards, every context owns the workspace of one caller, so
+// any number of threads can run tcnn_infer() without locks as long as each
+// uses its own context. Nothing in the library keeps global state.
+typedef enum {
+    TCNN_FP32,
+    TCNN_FP16,
+    TCNN_BF16,
+    TCNN_INT8
+} tcnn_precision;
+
+typedef enum {
+    TCNN_OK,
+    // the model or its weights could not be read
+    TCNN_ERR_LOAD,
+    // the layers do not form a model this library runs for the input dims
+    TCNN_ERR_BUILD,
+    // int8 needs a model written by calibrate
+    TCNN_ERR_QUANT,
+    TCNN_ERR_HALF,
+    TCNN_ERR_ALLOC,
+    // the engine queue is full, the request was not taken
+    TCNN_ERR_BUSY,
+    // the request was still queued when its deadline passed and did not run
+    TCNN_ERR_DEADLINE,
+    // a reloaded model differs from the current one in its input dims,
+    // classes or max batch, or gave non-finite logits on the probe images
+    TCNN_ERR_REJECTED
+} tcnn_status;
+
+typedef struct {
+    tcnn_precision precision;
+    // images a context runs in one pass, tcnn_infer_batch() splits larger calls
+    int max_batch;
+    // 0 keeps the interpreter where the runtime code generator is built in
+    int use_jit;
+    // dims of the uint8 images the model is run on
+    int in_h, in_w;
+} tcnn_options;
+
+typedef struct {
+    int in_h, in_w;
+    int classes;
+    int max_batch;
+    // resident weights in the form the kernels read them, the generated code
+    // keeps dense panels even for sparse layers, and their fp32 size
+    size_t weight_bytes;
+    size_t param_bytes;
+    // 0 when the model runs in the interpreter
+    size_t jit_code_size;
+    // bytes every context allocates
+    size_t workspace_bytes;
+} tcnn_model_info;
+
+typedef struct tcnn_model tcnn_model;
+typedef struct tcnn_context tcnn_context;
+
+// fp32, BATCH_SIZE images, jit on, IMG_HEIGHT x IMG_WIDTH
+tcnn_options tcnn_default_options(void);
+
+// loads a text, binary, ONNX or ncnn .param model and prepares it for options,
+// or the defaults when options is NULL, returns NULL on failure with the
+// reason in status unless it is NULL
+tcnn_model *tcnn_model_load(const char *filename, const tcnn_options *options, tcnn_status *status);
+
+// every context of the model has to be freed first
+void tcnn_model_free(tcnn_model *model);
+
+void tcnn_model_get_info(const tcnn_model *model, tcnn_model_info *info);
+
+const char *tcnn_status_string(const tcnn_status status);
+
+// the workspace is first touched by the calling thread, so a thread should
+// create the context it runs
+tcnn_context *tcnn_context_create(const tcnn_model *model);
+
+void tcnn_context_free(tcnn_context *ctx);
+
+// runs one in_h x in_w image and returns the predicted class, the logits are
+// written to logits[classes] unless it is NULL
+int tcnn_infer(tcnn_context *ctx, const uint8_t *image, float *logits);
+
+// runs count images stored back to back and writes their classes to preds
+void tcnn_infer_batch(tcnn_context *ctx, const uint8_t *images, const int count, int *preds);
+
+// with the library built with USE_PROFILE, prints the time and perf counters
+// of every layer run on the contexts, which share one model, and of every
+// context to stdout, and writes every step as Chrome trace JSON to
+// trace_file unless it is NULL, returns 0 without USE_PROFILE or when the
+// trace cannot be written
+int tcnn_profile_report(tcnn_context *const *contexts, const int count, const char *trace_file);
+
+// Low-latency mode. A team of threads splits the layers of one image among
+// its members, by output channels of the conv layers and output rows of the
+// fc layers, and syncs at a spin barrier after every layer. The calling
+// thread is the first member. It pays off for single requests on a model
+// whose layers are large next to a barrier, throughput is still best with
+// one context per thread. The team runs the interpreter, int8 models run on
+// the calling thread alone.
+typedef struct tcnn_team tcnn_team;
+
+// threads includes the caller, the model has to outlive the team
+tcnn_team *tcnn_team_create(const tcnn_model *model, const int threads);
+
+void tcnn_team_free(tcnn_team *team);
+
+// same as tcnn_infer(), a team runs one request at a time
+int tcnn_infer_team(tcnn_team *team, const uint8_t *image, float *logits);
+
+// Dense mode for pages larger than one image. The conv and pooling layers run
+// once over the whole page, and the fc layers as convolutions over their
+// output, so overlapping windows share all of that work. Position (y, x) of
+// the map is the in_h x in_w window at (y * step, x * step) of the page. A
+// window next to a padded inner conv sees its neighbours where a cropped
+// image sees zeros, so scores near such borders differ slightly from
+// tcnn_infer() on the crop. The dense pass runs fp32 or half weights on the
+// calling thread, int8 models run it on their fp32 weights.
+typedef struct tcnn_dense tcnn_dense;
+
+// workspace for pages of up to max_h x max_w, NULL when the model has no fc
+// head or the max page is smaller than one image, one per thread as for
+// contexts
+tcnn_dense *tcnn_dense_create(const tcnn_model *model, const int max_h, const int max_w);
+
+void tcnn_dense_free(tcnn_dense *dense);
+
+// map dims of a height x width page, returns the step in pixels between
+// positions or 0 when the page does not fit
+int tcnn_dense_map_size(tcnn_dense *dense, const int height, const int width, int *rows, int *cols);
+
+// page holds height rows of width pixels, stride bytes apart, which are read
+// in place, classes and scores get rows x cols entries row-major, the class
+// of every window and its logit, either may be NULL, TCNN_ERR_BUILD when the
+// page does not fit
+tcnn_status tcnn_infer_dense(
+    tcnn_dense *dense, const uint8_t *page, const int height, const int width, const size_t stride,
+    int *classes, float *scores
+);
+
+// Hot reload. A handle publishes one model at a time to the contexts and
+// engines created from it. tcnn_handle_reload() loads and prepares the next
+// model on the calling thread while the current one keeps serving, runs two
+// probe images through it and publishes it with one atomic store. Calls
+// already running finish on the old model, every context moves to the new
+// one at the start of its next call, keeping its workspace when that is
+// large enough, and the old model is freed when its last context has moved.
+// A context that stays idle holds on to the old model until then.
+typedef struct tcnn_handle tcnn_handle;
+
+// the handle takes over the model and frees it
+tcnn_handle *tcnn_handle_create(tcnn_model *model);
+
+// every context and engine of the handle has to be freed first
+void tcnn_handle_free(tcnn_handle *handle);
+
+// options NULL keeps those of the current model, on failure the current model
+// stays published, reloads on several threads run one after the other
+tcnn_status tcnn_handle_reload(tcnn_handle *handle, const char *filename, const tcnn_options *options);
+
+// number of reloads published so far
+uint64_t tcnn_handle_version(tcnn_handle *handle);
+
+// of the model published now
+void tcnn_handle_get_info(tcnn_handle *handle, tcnn_model_info *info);
+
+// same as tcnn_context_create() for the published model, which the context
+// then follows, teams and dense workspaces stay on the model they got
+tcnn_context *tcnn_handle_context_create(tcnn_handle *handle);
+
+// Asynchronous engine. A fixed pool of workers, each with its own context,
+// takes requests from a lock-free queue. A worker that finds several requests
+// queued runs them as one batch, earliest deadline first, and splits the
+// batch where the earliest deadline would not survive it. Requests whose
+// deadline has passed by then complete with TCNN_ERR_DEADLINE unrun.
+typedef struct {
+    int threads;
+    // requests the queue holds, rounded up to a power of two
+    int queue_size;
+    // pins every worker to its own cpu the process may run on before it
+    // allocates its context, engines in one process take the next cpus after
+    // those of the engines before them, modulo their count
+    int pin;
+} tcnn_engine_options;
+
+typedef struct tcnn_engine tcnn_engine;
+typedef struct tcnn_future tcnn_future;
+
+// runs on the worker thread, pred is -1 unless status is TCNN_OK
+typedef void (*tcnn_callback)(void *user, const int pred, const tcnn_status status);
+
+// one thread per cpu, 1024 requests, pinned
+tcnn_engine_options tcnn_engine_default_options(void);
+
+// the model has to outlive the engine
+tcnn_engine *tcnn_engine_create(const tcnn_model *model, const tcnn_engine_options *options);
+
+// same with the workers on contexts that follow the handle, which has to
+// outlive the engine
+tcnn_engine *tcnn_handle_engine_create(tcnn_handle *handle, const tcnn_engine_options *options);
+
+// runs every queued request, then stops the workers, submits that race with it
+// are rejected with TCNN_ERR_BUSY, none may start once it has returned
+void tcnn_engine_free(tcnn_engine *engine);
+
+// queues one image, which has to stay valid until the callback ran, timeout_us
+// is the deadline from now, 0 for none, returns TCNN_ERR_BUSY when full or
+// stopping
+tcnn_status tcnn_submit(
+    tcnn_engine *engine, const uint8_t *image, const int64_t timeout_us,
+    tcnn_callback callback, void *user
+);
+
+// same as tcnn_submit() with the result picked up by tcnn_future_wait(),
+// NULL when the queue is full or stopping
+tcnn_future *tcnn_submit_future(tcnn_engine *engine, const uint8_t *image, const int64_t timeout_us);
+
+// blocks until the request completed, returns its class or -1 and frees the
+// future
+int tcnn_future_wait(tcnn_future *future, tcnn_status *status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // TINYCNN_H_
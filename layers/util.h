@@ -0,0 +1,27 @@
+#ifndef UTIL_H_
+#define UTIL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "config.h"
+
+// Small helpers shared by the library, the tools and the benchmarks. They
+// are inline so that the tools built without libtinycnn can use them too.
+
+// CLOCK_MONOTONIC in ns
+static inline int64_t NowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// rounds a float count up to whole ALIGN_SIZE blocks
+static inline size_t AlignFloats(const size_t count)
+{
+    const size_t align = ALIGN_SIZE / sizeof(float);
+    return (count + align - 1) / align * align;
+}
+
+#endif  // UTIL_H_
@@ -0,0 +1,415 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "layers.h"
+#include "config.h"
+#include "simd.h"
+
+#define FORCE_INLINE static inline __attribute__((always_inline))
+// 4x4 transformed tile
+#define TILE 16
+// transformed input tiles of one tile row, for all channels, live on the stack
+#define TILE_BUF_SIZE 4096
+// output channels computed together, one per vector lane
+#define OC_BLOCK WINOGRAD_BLOCK
+// largest error against the direct sum, relative to the sum of |w * x|
+#define TOLERANCE 1e-4f
+
+static size_t AlignCount(const size_t count)
+{
+    const size_t align = ALIGN_SIZE / sizeof(float);
+    return (count + align - 1) / align * align;
+}
+
+static size_t WinogradCount(const int in_c, const int out_c)
+{
+    const size_t blocks = (out_c + OC_BLOCK - 1) / OC_BLOCK;
+    return blocks * OC_BLOCK * ((size_t)in_c * TILE + 1);
+}
+
+size_t WinogradOffset(const int in_c, const int oc)
+{
+    return WinogradCount(in_c, oc);
+}
+
+// F(2x2, 3x3): every 2x2 block of outputs comes from a 4x4 input tile as
+// Y = A^T [sum over channels of (G g G^T) * (B^T d B)] A, which takes 16
+// multiplies per channel instead of 36.
+
+static void TransformFilter(const float *g, float *u)
+{
+    // U = G g G^T
+    float t[4][3];
+    for (int c = 0; c < 3; ++c)
+    {
+        t[0][c] = g[c];
+        t[1][c] = 0.5f * (g[c] + g[3 + c] + g[6 + c]);
+        t[2][c] = 0.5f * (g[c] - g[3 + c] + g[6 + c]);
+        t[3][c] = g[6 + c];
+    }
+    for (int r = 0; r < 4; ++r)
+    {
+        u[r * 4 + 0] = t[r][0];
+        u[r * 4 + 1] = 0.5f * (t[r][0] + t[r][1] + t[r][2]);
+        u[r * 4 + 2] = 0.5f * (t[r][0] - t[r][1] + t[r][2]);
+        u[r * 4 + 3] = t[r][2];
+    }
+}
+
+FORCE_INLINE void LoadTile(
+    const float *plane, const int in_h, const int in_w, const int y0, const int x0, float *d
+)
+{
+    if (y0 >= 0 && x0 >= 0 && y0 + 4 <= in_h && x0 + 4 <= in_w)
+    {
+        for (int r = 0; r < 4; ++r)
+        {
+            for (int c = 0; c < 4; ++c)
+                d[r * 4 + c] = plane[(y0 + r) * in_w + x0 + c];
+        }
+        return;
+    }
+    // border tiles read zeros outside the image
+    for (int r = 0; r < 4; ++r)
+    {
+        for (int c = 0; c < 4; ++c)
+        {
+            const int y = y0 + r, x = x0 + c;
+            d[r * 4 + c] = y >= 0 && y < in_h && x >= 0 && x < in_w ? plane[y * in_w + x] : 0.0f;
+        }
+    }
+}
+
+FORCE_INLINE void TransformInput(const float *d, float *v)
+{
+    // V = B^T d B
+    float t[TILE];
+    for (int c = 0; c < 4; ++c)
+    {
+        t[0 * 4 + c] = d[0 * 4 + c] - d[2 * 4 + c];
+        t[1 * 4 + c] = d[1 * 4 + c] + d[2 * 4 + c];
+        t[2 * 4 + c] = d[2 * 4 + c] - d[1 * 4 + c];
+        t[3 * 4 + c] = d[1 * 4 + c] - d[3 * 4 + c];
+    }
+    for (int r = 0; r < 4; ++r)
+    {
+        v[r * 4 + 0] = t[r * 4 + 0] - t[r * 4 + 2];
+        v[r * 4 + 1] = t[r * 4 + 1] + t[r * 4 + 2];
+        v[r * 4 + 2] = t[r * 4 + 2] - t[r * 4 + 1];
+        v[r * 4 + 3] = t[r * 4 + 1] - t[r * 4 + 3];
+    }
+}
+
+FORCE_INLINE void Accumulate(
+    const float *u, const float *v, const int in_c, const int v_stride, float m[TILE][OC_BLOCK]
+)
+{
+    // element-wise products of a block of output channels' filters with one
+    // input tile, summed over the input channels, the lanes are the channels
+#if defined(SIMD_HAS_V8)
+    v8f acc[TILE];
+    for (int i = 0; i < TILE; ++i)
+        acc[i] = V8_DUP(0.0f);
+    for (int c = 0; c < in_c; ++c)
+    {
+        const float *vt = &v[c * v_stride];
+        const float *ut = &u[c * TILE * OC_BLOCK];
+        for (int i = 0; i < TILE; ++i)
+            acc[i] = V8_FMA(acc[i], V8_DUP(vt[i]), V8_LOAD(&ut[i * OC_BLOCK]));
+    }
+    for (int i = 0; i < TILE; ++i)
+        V8_STORE(m[i], acc[i]);
+#elif defined(SIMD_HAS_V4)
+    v4f acc[TILE][2];
+    for (int i = 0; i < TILE; ++i)
+        acc[i][0] = acc[i][1] = V4_DUP(0.0f);
+    for (int c = 0; c < in_c; ++c)
+    {
+        const float *vt = &v[c * v_stride];
+        const float *ut = &u[c * TILE * OC_BLOCK];
+        for (int i = 0; i < TILE; ++i)
+        {
+            acc[i][0] = V4_FMA(acc[i][0], V4_DUP(vt[i]), V4_LOAD(&ut[i * OC_BLOCK]));
+            acc[i][1] = V4_FMA(acc[i][1], V4_DUP(vt[i]), V4_LOAD(&ut[i * OC_BLOCK + 4]));
+        }
+    }
+    for (int i = 0; i < TILE; ++i)
+    {
+        V4_STORE(m[i], acc[i][0]);
+        V4_STORE(&m[i][4], acc[i][1]);
+    }
+#else
+    for (int i = 0; i < TILE; ++i)
+    {
+        for (int l = 0; l < OC_BLOCK; ++l)
+            m[i][l] = 0.0f;
+    }
+    for (int c = 0; c < in_c; ++c)
+    {
+        const float *vt = &v[c * v_stride];
+        const float *ut = &u[c * TILE * OC_BLOCK];
+        for (int i = 0; i < TILE; ++i)
+        {
+            for (int l = 0; l < OC_BLOCK; ++l)
+                m[i][l] += vt[i] * ut[i * OC_BLOCK + l];
+        }
+    }
+#endif
+}
+
+FORCE_INLINE void TransformOutput(float m[TILE][OC_BLOCK], const float *bias, float y[4][OC_BLOCK])
+{
+    // Y = A^T M A, 2x2 per lane
+#if defined(SIMD_HAS_V8)
+    v8f t[2][4];
+    for (int c = 0; c < 4; ++c)
+    {
+        const v8f m1 = V8_LOAD(m[4 + c]), m2 = V8_LOAD(m[8 + c]);
+        t[0][c] = V8_ADD(V8_ADD(V8_LOAD(m[c]), m1), m2);
+        t[1][c] = V8_SUB(V8_SUB(m1, m2), V8_LOAD(m[12 + c]));
+    }
+    const v8f b = V8_LOAD(bias);
+    for (int r = 0; r < 2; ++r)
+    {
+        V8_STORE(y[r * 2 + 0], V8_ADD(V8_ADD(V8_ADD(t[r][0], t[r][1]), t[r][2]), b));
+        V8_STORE(y[r * 2 + 1], V8_ADD(V8_SUB(V8_SUB(t[r][1], t[r][2]), t[r][3]), b));
+    }
+#else
+    float t[2][4][OC_BLOCK];
+    for (int c = 0; c < 4; ++c)
+    {
+        for (int l = 0; l < OC_BLOCK; ++l)
+        {
+            t[0][c][l] = m[c][l] + m[4 + c][l] + m[8 + c][l];
+            t[1][c][l] = m[4 + c][l] - m[8 + c][l] - m[12 + c][l];
+        }
+    }
+    for (int r = 0; r < 2; ++r)
+    {
+        for (int l = 0; l < OC_BLOCK; ++l)
+        {
+            y[r * 2 + 0][l] = t[r][0][l] + t[r][1][l] + t[r][2][l] + bias[l];
+            y[r * 2 + 1][l] = t[r][1][l] - t[r][2][l] - t[r][3][l] + bias[l];
+        }
+    }
+#endif
+}
+
+FORCE_INLINE int ConvTiles(
+    const float *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *winograd, const int padding, const float alpha, const int pool
+)
+{
+    // with pool set out_h and out_w are the pooled dims, and every 2x2 output
+    // tile is exactly one pooling window
+    const int conv_h = in_h + 2 * padding - 2;
+    const int conv_w = in_w + 2 * padding - 2;
+    const int tiles_h = pool ? out_h : (conv_h + 1) / 2;
+    const int tiles_w = pool ? out_w : (conv_w + 1) / 2;
+    const int in_size = in_h * in_w;
+    const int out_size = out_h * out_w;
+    const int blocks = (out_c + OC_BLOCK - 1) / OC_BLOCK;
+    float v[TILE_BUF_SIZE] __attribute__((aligned(ALIGN_SIZE)));
+    for (int b = 0; b < batch; ++b)
+    {
+        for (int ty = 0; ty < tiles_h; ++ty)
+        {
+            // v is [in_c][tiles_w][TILE]
+            for (int ch = 0; ch < in_c; ++ch)
+            {
+                const float *plane = &bottom[(ch * batch + b) * in_size];
+                for (int tx = 0; tx < tiles_w; ++tx)
+                {
+                    float d[TILE];
+                    LoadTile(plane, in_h, in_w, 2 * ty - padding, 2 * tx - padding, d);
+                    TransformInput(d, &v[(ch * tiles_w + tx) * TILE]);
+                }
+            }
+            for (int block = 0; block < blocks; ++block)
+            {
+                const float *u = &winograd[(size_t)block * (in_c * TILE + 1) * OC_BLOCK];
+                const float *bias = &u[in_c * TILE * OC_BLOCK];
+                const int lanes = out_c - block * OC_BLOCK < OC_BLOCK ? out_c - block * OC_BLOCK : OC_BLOCK;
+                for (int tx = 0; tx < tiles_w; ++tx)
+                {
+                    float m[TILE][OC_BLOCK] __attribute__((aligned(ALIGN_SIZE)));
+                    float y[4][OC_BLOCK] __attribute__((aligned(ALIGN_SIZE)));
+                    Accumulate(u, &v[tx * TILE], in_c, tiles_w * TILE, m);
+                    TransformOutput(m, bias, y);
+                    for (int l = 0; l < lanes; ++l)
+                    {
+                        float *top_ptr = &top[((block * OC_BLOCK + l) * batch + b) * out_size];
+                        if (pool)
+                        {
+                            float max_value = y[0][l] > y[1][l] ? y[0][l] : y[1][l];
+                            max_value = y[2][l] > max_value ? y[2][l] : max_value;
+                            max_value = y[3][l] > max_value ? y[3][l] : max_value;
+                            top_ptr[ty * out_w + tx] = max_value > 0.0f ? max_value : max_value * alpha;
+                            continue;
+                        }
+                        // the last row and column of tiles may hang over odd dims
+                        for (int r = 0; r < 2 && 2 * ty + r < out_h; ++r)
+                        {
+                            for (int c = 0; c < 2 && 2 * tx + c < out_w; ++c)
+                                top_ptr[(2 * ty + r) * out_w + 2 * tx + c] = y[r * 2 + c][l];
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return out_c * batch * out_size;
+}
+
+int WinogradSupported(
+    const int in_c, const int in_h, const int in_w, const int kernel_size, const int padding
+)
+{
+    const int conv_h = in_h + 2 * padding - 2;
+    const int conv_w = in_w + 2 * padding - 2;
+    return kernel_size == 3 && conv_h > 0 && conv_w > 0 &&
+        in_c * ((conv_w + 1) / 2) * TILE <= TILE_BUF_SIZE;
+}
+
+int ConvWinograd(
+    const float *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *winograd, const int padding
+)
+{
+    if (!WinogradSupported(in_c, in_h, in_w, 3, padding))
+        return 0;
+    return ConvTiles(
+        bottom, top, batch, in_c, in_h, in_w, out_c, out_h, out_w, winograd, padding, 0.0f, 0
+    );
+}
+
+int ConvReluPoolWinograd(
+    const float *bottom, float *top, const int batch,
+    const int in_c, const int in_h, const int in_w,
+    const int out_c, const int out_h, const int out_w,
+    const float *winograd, const int padding, const float alpha, const int pool_size
+)
+{
+    // relu is applied to the max of each window, as in ConvReluPoolDirect()
+    if (!WinogradSupported(in_c, in_h, in_w, 3, padding) || pool_size != 2 || alpha < 0.0f)
+        return 0;
+    return ConvTiles(
+        bottom, top, batch, in_c, in_h, in_w, out_c, out_h, out_w, winograd, padding, alpha, 1
+    );
+}
+
+static int CheckLayer(const Layer *layer, const float *winograd)
+{
+    // runs the transformed filters over a fixed pseudo-random input and
+    // compares every output with the direct sum in double
+    const int in_c = layer->in_c, in_h = layer->in_h, in_w = layer->in_w;
+    const int out_c = layer->filters;
+    const int conv_h = in_h + 2 * layer->padding - 2;
+    const int conv_w = in_w + 2 * layer->padding - 2;
+    const int k = 9 * in_c + 1;
+    float *input = malloc((size_t)in_c * in_h * in_w * sizeof(float));
+    float *output = malloc((size_t)out_c * conv_h * conv_w * sizeof(float));
+    int ok = input != NULL && output != NULL;
+    uint32_t seed = 12345;
+    for (int i = 0; ok && i < in_c * in_h * in_w; ++i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        input[i] = (float)(seed >> 8) / (float)(1 << 23) - 1.0f;
+    }
+    ok = ok && ConvWinograd(
+        input, output, 1, in_c, in_h, in_w, out_c, conv_h, conv_w, winograd, layer->padding
+    ) > 0;
+    for (int oc = 0; ok && oc < out_c; ++oc)
+    {
+        const float *w = &layer->weights[oc * k];
+        for (int oy = 0; ok && oy < conv_h; ++oy)
+        {
+            for (int ox = 0; ox < conv_w; ++ox)
+            {
+                double sum = w[k - 1], mag = fabs(w[k - 1]);
+                for (int ch = 0; ch < in_c; ++ch)
+                {
+                    for (int kh = 0; kh < 3; ++kh)
+                    {
+                        for (int kw = 0; kw < 3; ++kw)
+                        {
+                            const int iy = oy + kh - layer->padding, ix = ox + kw - layer->padding;
+                            if (iy < 0 || iy >= in_h || ix < 0 || ix >= in_w)
+                                continue;
+                            const double p = (double)w[ch * 9 + kh * 3 + kw] * input[(ch * in_h + iy) * in_w + ix];
+                            sum += p;
+                            mag += fabs(p);
+                        }
+                    }
+                }
+                if (fabs(output[(oc * conv_h + oy) * conv_w + ox] - sum) > TOLERANCE * (mag + 1.0))
+                {
+                    ok = 0;
+                    break;
+                }
+            }
+        }
+    }
+    free(output);
+    free(input);
+    return ok;
+}
+
+float *PrepareWinograd(Layer *layers, const int num_layers)
+{
+    size_t count = 0;
+    for (int i = 0; i < num_layers; ++i)
+    {
+        const Layer *layer = &layers[i];
+        layers[i].winograd = NULL;
+        if ((layer->type == LAYER_CONV || layer->type == LAYER_CONV_RELU_POOL) && layer->weights != NULL &&
+            WinogradSupported(layer->in_c, layer->in_h, layer->in_w, layer->kernel_size, layer->padding))
+        {
+            count += AlignCount(WinogradCount(layer->in_c, layer->filters));
+        }
+    }
+    float *storage = count > 0 ? aligned_alloc(ALIGN_SIZE, count * sizeof(float)) : NULL;
+    if (storage == NULL)
+        return NULL;
+
+    // every block of OC_BLOCK output channels is its [in_c][TILE][OC_BLOCK]
+    // transformed filters followed by its OC_BLOCK biases, padded with zeros
+    // to a whole block, so the blocks from some channel on are a pointer
+    size_t used = 0;
+    for (int i = 0; i < num_layers; ++i)
+    {
+        Layer *layer = &layers[i];
+        if ((layer->type != LAYER_CONV && layer->type != LAYER_CONV_RELU_POOL) || layer->weights == NULL ||
+            !WinogradSupported(layer->in_c, layer->in_h, layer->in_w, layer->kernel_size, layer->padding))
+        {
+            continue;
+        }
+        const int in_c = layer->in_c, out_c = layer->filters;
+        const int k = 9 * in_c + 1;
+        float *dst = &storage[used];
+        memset(dst, 0, WinogradCount(in_c, out_c) * sizeof(float));
+        for (int oc = 0; oc < out_c; ++oc)
+        {
+            const int block = oc / OC_BLOCK, l = oc % OC_BLOCK;
+            for (int ch = 0; ch < in_c; ++ch)
+            {
+                float u[TILE];
+                TransformFilter(&layer->weights[oc * k + ch * 9], u);
+                for (int i = 0; i < TILE; ++i)
+                    dst[((size_t)block * (in_c * TILE + 1) + ch * TILE + i) * OC_BLOCK + l] = u[i];
+            }
+            dst[((size_t)block * (in_c * TILE + 1) + in_c * TILE) * OC_BLOCK + l] = layer->weights[oc * k + k - 1];
+        }
+        // layers that fail the check keep the other kernels
+        if (CheckLayer(layer, dst))
+        {
+            layer->winograd = dst;
+            used += AlignCount(WinogradCount(in_c, out_c));
+        }
+    }
+    return storage;
+}
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include "config.h"
+#include "layers.h"
+#include "model.h"
+#include "import.h"
+#include "dataset.h"
+#include "gemm.h"
+#include "sparse.h"
+#include "tinycnn.h"
+#include "util.h"
+
+#define DEFAULT_SPARSITY    0.75
+
+Layer DemoLayers[NUM_LAYER];
+
+int Predict(
+    const char *filename, const uint8_t *pixels, const int count, const int height, const int width,
+    int *preds, tcnn_model_info *info, double *elapsed
+)
+{
+    // the whole dataset through libtinycnn, the way cnn_struct runs it on
+    // one thread
+    tcnn_options options = tcnn_default_options();
+    options.in_h = height;
+    options.in_w = width;
+    tcnn_model *model = tcnn_model_load(filename, &options, NULL);
+    tcnn_context *ctx = model != NULL ? tcnn_context_create(model) : NULL;
+    if (ctx == NULL)
+    {
+        tcnn_model_free(model);
+        return 0;
+    }
+    tcnn_model_get_info(model, info);
+    const int64_t start = NowNs();
+    tcnn_infer_batch(ctx, pixels, count, preds);
+    *elapsed = (NowNs() - start) / 1e6;
+    tcnn_context_free(ctx);
+    tcnn_model_free(model);
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    // get settings
+    if (argc < 4)
+    {
+        printf("Usage: %s model input model_bin [sparsity]\n", argv[0]);
+        return 0;
+    }
+    double sparsity = DEFAULT_SPARSITY;
+    if (argc >= 5)
+        sparsity = atof(argv[4]);
+    if (sparsity < 0.0 || sparsity > 1.0)
+    {
+        printf("Sparsity has to be between 0 and 1\n");
+        return 1;
+    }
+    if (strcmp(argv[1], argv[3]) == 0)
+    {
+        // the input model is mapped while the output is written
+        printf("Output has to differ from the input model\n");
+        return 1;
+    }
+    printf("Model: %s\n", argv[1]);
+    printf("Input: %s\n", argv[2]);
+    printf("Output: %s\n", argv[3]);
+    printf("Sparsity: %.2f\n", sparsity);
+
+    // model, text, binary, ONNX or ncnn
+    ModelFile model_file = { 0, };
+    ImportedModel imported = { 0, };
+    float *model_text = NULL;
+    const float *params = NULL;
+    size_t param_count = 0;
+    Layer *layers = DemoLayers;
+    int num_layers = 0;
+    if (IsModelFile(argv[1]))
+    {
+        if (LoadModelFile(argv[1], &model_file))
+        {
+            params = model_file.params;
+            param_count = model_file.param_count;
+            layers = model_file.layers;
+            num_layers = model_file.num_layers;
+        }
+    }
+    else if (IsImportedFile(argv[1]))
+    {
+        if (LoadImportedModel(argv[1], &imported))
+        {
+            params = imported.params;
+            param_count = imported.param_count;
+            layers = imported.layers;
+            num_layers = imported.num_layers;
+        }
+    }
+    else if ((model_text = LoadTextFloats(argv[1], &param_count)) != NULL)
+    {
+        params = model_text;
+        num_layers = BuildDemoModel(layers, params);
+    }
+
+    // images, packed or text
+    DatasetFile dataset = { 0, };
+    uint8_t *inputs = NULL;
+    const uint8_t *pixels = NULL;
+    int count = 0, height = IMG_HEIGHT, width = IMG_WIDTH;
+    if (IsDatasetFile(argv[2]))
+    {
+        if (LoadDatasetFile(argv[2], &dataset))
+        {
+            pixels = dataset.pixels;
+            count = dataset.count, height = dataset.height, width = dataset.width;
+        }
+    }
+    else
+    {
+        size_t size = 0;
+        inputs = LoadTextPixels(argv[2], &size);
+        pixels = inputs;
+        count = inputs != NULL && size % IMG_SIZE == 0 ? (int)(size / IMG_SIZE) : 0;
+    }
+    if (params == NULL || count == 0)
+    {
+        printf("Failed to load data\n");
+        return 1;
+    }
+
+    ModelShape shape;
+    if (InferShapes(layers, num_layers, 1, height, width, &shape) == 0 ||
+        shape.param_count > param_count || layers[num_layers - 1].type != LAYER_FC)
+    {
+        printf("Failed to build model\n");
+        return 1;
+    }
+
+    // the weights are pruned in a copy, the layers are moved onto it
+    float *pruned = aligned_alloc(ALIGN_SIZE, AlignFloats(param_count) * sizeof(float));
+    int *dense_preds = malloc(count * sizeof(int));
+    int *pruned_preds = malloc(count * sizeof(int));
+    if (pruned == NULL || dense_preds == NULL || pruned_preds == NULL)
+    {
+        printf("Failed to allocate workspace\n");
+        return 1;
+    }
+    memcpy(pruned, params, param_count * sizeof(float));
+    for (int i = 0; i < num_layers; ++i)
+    {
+        if (layers[i].weights != NULL)
+            layers[i].weights = pruned + (layers[i].weights - params);
+    }
+
+    // every fc layer but the classifier, whose few rows hold the logits
+    for (int i = 0; i < num_layers - 1; ++i)
+    {
+        Layer *layer = &layers[i];
+        if (layer->type != LAYER_FC)
+            continue;
+        const int rows = layer->out_feat, cols = layer->weight_count / layer->out_feat;
+        const int blocks = (rows + GEMM_PANEL - 1) / GEMM_PANEL * (cols - 1);
+        const int zeroed = PruneBlocks((float *)layer->weights, rows, cols, sparsity);
+        printf(
+            "Layer %d: %d of %d blocks of %dx1 pruned, %.1f%% of the blocks are zero\n",
+            i, zeroed, blocks, GEMM_PANEL, ZeroBlocks(layer->weights, rows, cols) * 100.0
+        );
+    }
+    // the activation scales of the dense model no longer hold
+    for (int i = 0; i < num_layers; ++i)
+        layers[i].act_scale = 0.0f;
+    if (SaveModelFile(argv[3], layers, num_layers, pruned, param_count) == 0)
+    {
+        printf("Failed to save model\n");
+        return 1;
+    }
+    printf("Saved %d layers, run calibrate on it for int8\n", num_layers);
+
+    // there are no labels, so the drop is measured against the predictions
+    // of the dense model
+    tcnn_model_info dense_info, pruned_info;
+    double dense_time, pruned_time;
+    if (Predict(argv[1], pixels, count, height, width, dense_preds, &dense_info, &dense_time) == 0 ||
+        Predict(argv[3], pixels, count, height, width, pruned_preds, &pruned_info, &pruned_time) == 0)
+    {
+        printf("Failed to run model\n");
+        return 1;
+    }
+    int differ = 0;
+    for (int i = 0; i < count; ++i)
+        differ += pruned_preds[i] != dense_preds[i];
+    printf(
+        "Pruned: %d of %d predictions differ from the dense model, %.1f%% agree\n",
+        differ, count, 100.0 * (count - differ) / count
+    );
+    printf("Weights: %zu bytes pruned, %zu bytes dense\n", pruned_info.weight_bytes, dense_info.weight_bytes);
+    printf("Elapsed time: %.2f ms pruned, %.2f ms dense\n", pruned_time, dense_time);
+
+    free(pruned_preds);
+    free(dense_preds);
+    free(pruned);
+    free(inputs);
+    free(model_text);
+    FreeDatasetFile(&dataset);
+    FreeModelFile(&model_file);
+    FreeImportedModel(&imported);
+    return 0;
+}
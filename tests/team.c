@@ -0,0 +1,151 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "model.h"
+#include "tinycnn.h"
+
+// random conv -> relu -> maxpool stacks, pool sizes other than 2 and leaky
+// slopes of both signs included, run by teams of these sizes
+#define MODELS          150
+#define MAX_TEAM        4
+#define MAX_PARAMS      (1 << 20)
+
+static uint32_t Seed = 1;
+
+static uint32_t Next(void)
+{
+    Seed = Seed * 1664525u + 1013904223u;
+    return Seed >> 8;
+}
+
+static int Pick(const int lo, const int hi)
+{
+    return lo + (int)(Next() % (uint32_t)(hi - lo + 1));
+}
+
+static float Uniform(const float scale)
+{
+    return ((float)(Next() & 0xffff) / 65535.0f - 0.5f) * 2.0f * scale;
+}
+
+static int Block(Layer *layers, int *count, float *params, size_t *used, int *c, int *h, int *w)
+{
+    // appends conv -> relu -> maxpool, returns 0 when the input got too small
+    const int filters = 4 * Pick(1, 4), padding = Pick(0, 1), pool = Pick(1, 3);
+    const float slopes[] = { 0.0f, 0.1f, -0.1f };
+    const int conv_h = *h - 3 + 2 * padding + 1, conv_w = *w - 3 + 2 * padding + 1;
+    if (conv_h < pool || conv_w < pool)
+        return 0;
+    const int k = 9 * *c + 1;
+    Layer *conv = &layers[(*count)++];
+    conv->type = LAYER_CONV;
+    conv->kernel_size = 3;
+    conv->filters = filters;
+    conv->padding = padding;
+    conv->weights = &params[*used];
+    for (int i = 0; i < filters * k; ++i)
+        params[(*used)++] = Uniform(1.0f / sqrtf((float)k));
+    Layer *relu = &layers[(*count)++];
+    relu->type = LAYER_RELU;
+    relu->alpha = slopes[Pick(0, 2)];
+    Layer *max = &layers[(*count)++];
+    max->type = LAYER_MAXPOOL;
+    max->kernel_size = pool;
+    max->stride = pool;
+    *c = filters, *h = conv_h / pool, *w = conv_w / pool;
+    return 1;
+}
+
+static int CheckModel(const int index, float *params)
+{
+    // one or two blocks and an fc classifier, every team has to return the
+    // logits of tcnn_infer()
+    Layer layers[8];
+    memset(layers, 0, sizeof(layers));
+    const int in_h = Pick(6, 20), in_w = Pick(6, 20);
+    int c = 1, h = in_h, w = in_w, count = 0;
+    size_t used = 0;
+    const int blocks = Pick(1, 2);
+    for (int b = 0; b < blocks; ++b)
+    {
+        if (!Block(layers, &count, params, &used, &c, &h, &w))
+            break;
+    }
+    if (count == 0)
+        return 1;
+    const int feat = c * h * w, classes = 10;
+    Layer *fc = &layers[count++];
+    fc->type = LAYER_FC;
+    fc->in_feat = feat;
+    fc->out_feat = classes;
+    fc->weights = &params[used];
+    for (int i = 0; i < classes * (feat + 1); ++i)
+        params[used++] = Uniform(1.0f / sqrtf((float)feat));
+
+    char filename[] = "/tmp/tcnn_team_XXXXXX";
+    const int fd = mkstemp(filename);
+    if (fd < 0)
+        return 0;
+    close(fd);
+    const int saved = SaveModelFile(filename, layers, count, params, used);
+    tcnn_options options = tcnn_default_options();
+    options.in_h = in_h;
+    options.in_w = in_w;
+    tcnn_model *model = saved ? tcnn_model_load(filename, &options, NULL) : NULL;
+    unlink(filename);
+    tcnn_context *ctx = model != NULL ? tcnn_context_create(model) : NULL;
+    if (ctx == NULL)
+    {
+        printf("model %d: failed to load\n", index);
+        tcnn_model_free(model);
+        return 0;
+    }
+
+    uint8_t *image = malloc((size_t)in_h * in_w);
+    for (int i = 0; i < in_h * in_w; ++i)
+        image[i] = (uint8_t)Next();
+    float expected[10], logits[10];
+    tcnn_infer(ctx, image, expected);
+    float scale = 0.0f;
+    for (int i = 0; i < classes; ++i)
+        scale = fabsf(expected[i]) > scale ? fabsf(expected[i]) : scale;
+    int ok = 1;
+    for (int size = 2; ok && size <= MAX_TEAM; ++size)
+    {
+        tcnn_team *team = tcnn_team_create(model, size);
+        ok = team != NULL;
+        if (ok)
+            tcnn_infer_team(team, image, logits);
+        float error = 0.0f;
+        for (int i = 0; ok && i < classes; ++i)
+            error = fabsf(logits[i] - expected[i]) > error ? fabsf(logits[i] - expected[i]) : error;
+        if (!ok || error > 1e-4f * (1.0f + scale))
+        {
+            printf(
+                "model %d: %dx%d, %d blocks, team of %d off by %g on a scale of %g\n",
+                index, in_h, in_w, blocks, size, error, scale
+            );
+            ok = 0;
+        }
+        tcnn_team_free(team);
+    }
+    free(image);
+    tcnn_context_free(ctx);
+    tcnn_model_free(model);
+    return ok;
+}
+
+int main(void)
+{
+    float *params = malloc(MAX_PARAMS * sizeof(float));
+    if (params == NULL)
+        return 1;
+    int failed = 0;
+    for (int i = 0; i < MODELS; ++i)
+        failed += !CheckModel(i, params);
+    printf("Team: %d of %d models agree with tcnn_infer()\n", MODELS - failed, MODELS);
+    free(params);
+    return failed > 0;
+}